@@ -0,0 +1,379 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <new>
+#include <tuple>
+#include <vector>
+
+#include <docopt/docopt.h>
+#if __has_include(<sys/resource.h>)
+#include <sys/resource.h>
+#endif
+#include <spdlog/sinks/stdout_color_sinks.h>
+#include <yaml-cpp/yaml.h>
+
+#include "CoreRegistry.h"
+#include "HandlerManager.h"
+#include "InputStreamManager.h"
+#include "Policies.h"
+#include "Taps.h"
+
+#include "handlers/static_plugins.h"
+#include "inputs/static_plugins.h"
+#include "visor_config.h"
+
+#include "GeoDB.h"
+#include "inputs/pcap/PcapInputStream.h"
+
+static const char USAGE[] =
+    R"(pktvisor-pcap
+    Usage:
+      pktvisor-pcap [options] POLICY PCAP
+      pktvisor-pcap (-h | --help)
+      pktvisor-pcap --version
+
+    Replay benchmark. Replays the PCAP file through the pcap input and the stream handlers of the policy in the POLICY
+    file, in the same way pktvisord would run them, and writes throughput, per handler cost, peak RSS and allocations
+    per packet to stdout in JSON format. Console logs are printed to stderr.
+
+    The policy must use a tap with input_type pcap; its interface settings are ignored and the PCAP file is read instead.
+    Besides the full handler chain, the input is replayed once without handlers and once per handler, and the
+    difference to the input alone is reported as the cost of each handler (for sequence policies, the difference to
+    the previous handlers in the sequence).
+
+    Options:
+      --policy NAME         Policy to benchmark, required if the POLICY file defines more than one
+      --speed N             Replay at N times the recorded speed. 0 replays as fast as possible. [default: 0]
+      --repeat N            Run every replay N times and report the median [default: 3]
+      --no-handler-runs     Only replay the full handler chain, skip the per handler replays
+      -h --help             Show this screen
+      --version             Show version
+      -v                    Verbose log output
+      -H HOSTSPEC           Subnets (comma separated) to consider HOST, in CIDR form. Overrides host_spec from the tap and policy
+      --geo-city FILE       GeoLite2 City database to use for IP to Geo mapping (if enabled)
+      --geo-asn FILE        GeoLite2 ASN database to use for IP to ASN mapping (if enabled)
+)";
+
+// every allocation in the process is counted, the benchmark reports the allocations made per replayed packet
+static std::atomic<uint64_t> alloc_count{0};
+
+void *operator new(std::size_t size)
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept
+{
+    return ::operator new(size, tag);
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+using namespace visor;
+
+// everything needed to build the input and handlers of the benchmarked policy, parsed once from the policy file
+struct BenchPolicy {
+    std::string name;
+    Tap *tap{nullptr};
+    Config input_config;
+    Config input_filter;
+    Config window_config;
+    bool sequence{false};
+    YAML::Node modules;
+    std::vector<std::string> handler_names;
+};
+
+struct RunResult {
+    uint64_t packets{0};
+    uint64_t allocs{0};
+    double wall_ns{0};
+    double cpu_ns{0};
+};
+
+BenchPolicy load_policy(CoreRegistry &registry, const YAML::Node &config, const std::string &policy_name)
+{
+    if (!config.IsMap() || !config["visor"]) {
+        throw ConfigException("invalid schema");
+    }
+    if (config["visor"]["taps"] && config["visor"]["taps"].IsMap()) {
+        registry.tap_manager()->load(config["visor"]["taps"], true);
+    }
+    if (config["visor"]["global_handler_config"] && config["visor"]["global_handler_config"].IsMap()) {
+        registry.handler_manager()->set_default_handler_config(config["visor"]["global_handler_config"]);
+    }
+    auto policies = config["visor"]["policies"];
+    if (!policies || !policies.IsMap() || policies.size() == 0) {
+        throw PolicyException("no policies found in schema");
+    }
+
+    YAML::Node policy_node;
+    BenchPolicy policy;
+    if (policy_name.empty()) {
+        if (policies.size() > 1) {
+            throw PolicyException(fmt::format("{} policies found, select one with --policy", policies.size()));
+        }
+        policy.name = policies.begin()->first.as<std::string>();
+        policy_node = policies.begin()->second;
+    } else {
+        if (!policies[policy_name]) {
+            throw PolicyException(fmt::format("policy '{}' not found", policy_name));
+        }
+        policy.name = policy_name;
+        policy_node = policies[policy_name];
+    }
+
+    auto input_node = policy_node["input"];
+    std::tie(policy.input_config, policy.input_filter) = registry.input_manager()->get_config_and_filter(input_node);
+    auto handler_node = policy_node["handlers"];
+    std::tie(policy.window_config, policy.sequence) = registry.handler_manager()->get_default_configuration(handler_node);
+    policy.modules = handler_node["modules"];
+
+    auto taps_name = registry.tap_manager()->get_input_taps_name(input_node);
+    if (taps_name.size() > 1) {
+        spdlog::get("visor")->warn("policy [{}]: selects {} taps, benchmarking with tap '{}'", policy.name, taps_name.size(), taps_name.front());
+    }
+    auto [tap, tap_lock] = registry.tap_manager()->module_get_locked(taps_name.front());
+    if (tap->input_plugin()->plugin() != "pcap") {
+        throw PolicyException(fmt::format("tap '{}' has input type '{}', only pcap can be replayed", tap->name(), tap->input_plugin()->plugin()));
+    }
+    policy.tap = tap;
+    policy.window_config.config_set<std::string>("_internal_tap_name", tap->name());
+
+    for (YAML::const_iterator h_it = policy.modules.begin(); h_it != policy.modules.end(); ++h_it) {
+        policy.handler_names.push_back(registry.handler_manager()->validate_handler(h_it, policy.name, policy.window_config, policy.sequence).name);
+    }
+    if (policy.handler_names.empty()) {
+        throw PolicyException(fmt::format("policy [{}]: no handler modules", policy.name));
+    }
+
+    return policy;
+}
+
+// replay the pcap once through the policy input and the selected handlers. the input runs on this thread and
+// returns when the whole file has been read
+RunResult replay(CoreRegistry &registry, BenchPolicy &policy, const std::string &pcap, uint64_t speed, const std::string &host_spec, const std::vector<bool> &selected)
+{
+    auto input = policy.tap->instantiate(&policy.input_config, &policy.input_filter, policy.tap->get_input_name(policy.input_config, policy.input_filter));
+    input->config_set("pcap_file", pcap);
+    if (speed) {
+        input->config_set<uint64_t>("pcap_file_speed", speed);
+    }
+    if (!host_spec.empty()) {
+        input->config_set("host_spec", host_spec);
+    }
+    auto pcap_input = dynamic_cast<input::pcap::PcapInputStream *>(input.get());
+    pcap_input->parse_host_spec();
+
+    RunResult result;
+    auto counter_proxy = static_cast<input::pcap::PcapInputEventProxy *>(input->add_event_proxy(Configurable()));
+    counter_proxy->packet_signal.connect([&result](pcpp::Packet &, input::pcap::PacketDirection, pcpp::ProtocolType, pcpp::ProtocolType, timespec) {
+        ++result.packets;
+    });
+    auto input_proxy = input->add_event_proxy(policy.input_filter);
+
+    // same wiring as a policy load
+    std::vector<std::unique_ptr<StreamHandler>> handlers;
+    size_t index{0};
+    for (YAML::const_iterator h_it = policy.modules.begin(); h_it != policy.modules.end(); ++h_it, ++index) {
+        if (!selected[index]) {
+            continue;
+        }
+        auto handler_config = registry.handler_manager()->validate_handler(h_it, policy.name, policy.window_config, policy.sequence);
+        auto handler_plugin = registry.handler_plugins().find(std::make_pair(handler_config.type, handler_config.version));
+        auto handler_name = policy.name + "-" + policy.tap->name() + "-" + handler_config.name;
+        std::unique_ptr<StreamHandler> handler;
+        if (!policy.sequence || handlers.empty()) {
+            handler = handler_plugin->second->instantiate(handler_name, input_proxy, &handler_config.config, &handler_config.filter);
+        } else {
+            handlers.back()->set_event_proxy(input->create_event_proxy(Configurable()));
+            handler = handler_plugin->second->instantiate(handler_name, handlers.back()->get_event_proxy(), &handler_config.config, &handler_config.filter);
+        }
+        handler->set_version(handler_config.version);
+        handlers.push_back(std::move(handler));
+    }
+    for (auto &handler : handlers) {
+        handler->start();
+    }
+
+    auto allocs_start = alloc_count.load();
+    auto cpu_start = std::clock();
+    auto wall_start = std::chrono::steady_clock::now();
+    // blocking
+    input->start();
+    auto wall_end = std::chrono::steady_clock::now();
+    auto cpu_end = std::clock();
+    result.allocs = alloc_count.load() - allocs_start;
+    result.wall_ns = std::chrono::duration<double, std::nano>(wall_end - wall_start).count();
+    result.cpu_ns = 1e9 * static_cast<double>(cpu_end - cpu_start) / CLOCKS_PER_SEC;
+
+    for (auto &handler : handlers) {
+        handler->stop();
+    }
+    handlers.clear();
+    input->stop();
+    return result;
+}
+
+RunResult median(std::vector<RunResult> runs)
+{
+    auto mid = runs.size() / 2;
+    // the run with the median wall time, with the medians of the other measures
+    std::nth_element(runs.begin(), runs.begin() + mid, runs.end(), [](const auto &a, const auto &b) { return a.wall_ns < b.wall_ns; });
+    RunResult result = runs[mid];
+    std::nth_element(runs.begin(), runs.begin() + mid, runs.end(), [](const auto &a, const auto &b) { return a.cpu_ns < b.cpu_ns; });
+    result.cpu_ns = runs[mid].cpu_ns;
+    std::nth_element(runs.begin(), runs.begin() + mid, runs.end(), [](const auto &a, const auto &b) { return a.allocs < b.allocs; });
+    result.allocs = runs[mid].allocs;
+    return result;
+}
+
+double per_packet(double value, uint64_t packets)
+{
+    return packets ? value / static_cast<double>(packets) : 0.0;
+}
+
+int main(int argc, char *argv[])
+{
+    std::map<std::string, docopt::value> args = docopt::docopt(USAGE,
+        {argv + 1, argv + argc},
+        true,           // show help if requested
+        VISOR_VERSION); // version string
+
+    auto logger = spdlog::stderr_color_mt("visor");
+    if (args["-v"].asBool()) {
+        logger->set_level(spdlog::level::debug);
+    } else {
+        // policy and module life cycle messages repeat for every replay
+        logger->set_level(spdlog::level::warn);
+    }
+
+    auto speed = args["--speed"].asLong();
+    auto repeat = args["--repeat"].asLong();
+    if (speed < 0 || repeat < 1) {
+        logger->error("--speed must be 0 or more and --repeat at least 1");
+        return -1;
+    }
+
+    std::string host_spec;
+    if (args["-H"]) {
+        host_spec = args["-H"].asString();
+    }
+
+    try {
+
+        if (args["--geo-city"]) {
+            geo::GeoIP().enable(args["--geo-city"].asString());
+        }
+        if (args["--geo-asn"]) {
+            geo::GeoASN().enable(args["--geo-asn"].asString());
+        }
+
+        CoreRegistry registry;
+        registry.start(nullptr);
+
+        YAML::Node config = YAML::LoadFile(args["POLICY"].asString());
+        auto policy = load_policy(registry, config, args["--policy"] ? args["--policy"].asString() : std::string());
+        auto pcap = args["PCAP"].asString();
+        auto handler_count = policy.handler_names.size();
+
+        auto run = [&](const std::vector<bool> &selected) {
+            std::vector<RunResult> runs;
+            for (long i = 0; i < repeat; ++i) {
+                runs.push_back(replay(registry, policy, pcap, speed, host_spec, selected));
+            }
+            return median(runs);
+        };
+
+        // the full chain goes first, so peak RSS is not inflated by the runs that follow
+        auto full = run(std::vector<bool>(handler_count, true));
+        json result;
+        result["policy"] = policy.name;
+        result["pcap"] = pcap;
+        result["speed"] = speed;
+        result["repeat"] = repeat;
+        result["packets"] = full.packets;
+        result["wall_s"] = full.wall_ns / 1e9;
+        result["packets_per_s"] = full.wall_ns > 0 ? 1e9 * static_cast<double>(full.packets) / full.wall_ns : 0.0;
+        result["cpu_ns_per_packet"] = per_packet(full.cpu_ns, full.packets);
+        result["allocations_per_packet"] = per_packet(static_cast<double>(full.allocs), full.packets);
+#if __has_include(<sys/resource.h>)
+        struct rusage usage {
+        };
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        result["peak_rss_kb"] = usage.ru_maxrss / 1024;
+#else
+        result["peak_rss_kb"] = usage.ru_maxrss;
+#endif
+#endif
+
+        if (!args["--no-handler-runs"].asBool()) {
+            // cpu time is used for the per handler cost, so it holds for paced replays as well
+            auto previous = run(std::vector<bool>(handler_count, false));
+            result["input"]["cpu_ns_per_packet"] = per_packet(previous.cpu_ns, previous.packets);
+            result["input"]["allocations_per_packet"] = per_packet(static_cast<double>(previous.allocs), previous.packets);
+            auto baseline = previous;
+            for (size_t i = 0; i < handler_count; ++i) {
+                // a sequence handler only sees what the handlers before it pass on, so it is measured on top of them
+                std::vector<bool> selected(handler_count, false);
+                for (size_t h = (policy.sequence ? 0 : i); h <= i; ++h) {
+                    selected[h] = true;
+                }
+                auto handler_run = run(selected);
+                auto &reference = policy.sequence ? previous : baseline;
+                auto &j = result["handlers"][policy.handler_names[i]];
+                j["cpu_ns_per_packet"] = per_packet(handler_run.cpu_ns - reference.cpu_ns, handler_run.packets);
+                j["allocations_per_packet"] = per_packet(static_cast<double>(handler_run.allocs) - static_cast<double>(reference.allocs), handler_run.packets);
+                previous = handler_run;
+            }
+        }
+
+        std::cout << result.dump() << std::endl;
+
+    } catch (const std::exception &e) {
+        logger->error("Fatal error: {}", e.what());
+        return -1;
+    }
+
+    return 0;
+}
@@ -2,9 +2,15 @@
  * License, v. 2.0. If a copy of the MPL was not distributed with this
  * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
 
+#include <algorithm>
+#include <atomic>
 #include <csignal>
+#include <filesystem>
 #include <functional>
 #include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #include <docopt/docopt.h>
 
@@ -28,17 +34,20 @@
 static const char USAGE[] =
     R"(pktvisor-reader
     Usage:
-      pktvisor-reader [options] FILE
+      pktvisor-reader [options] FILE...
       pktvisor-reader (-h | --help)
       pktvisor-reader --version
 
-    Summarize a network (pcap, dnstap) file. The result will be written to stdout in JSON format, while console logs will be printed
-    to stderr.
+    Summarize network (pcap, dnstap) files. The result will be written to stdout in JSON format, while console logs will be printed
+    to stderr. FILE may be a directory, in which case all files in it are read (e.g. rotated captures). Results of all files
+    are combined into one summary.
 
     Options:
       -i INPUT              Input type (pcap|dnstap|sflow|netflow). If not set, default is pcap input
       --max-deep-sample N   Never deep sample more than N% of streams (an int between 0 and 100) [default: 100]
       --periods P           Hold this many 60 second time periods of history in memory. Use 1 to summarize all data. [default: 5]
+      --threads N           Process with N worker threads. Several files are spread across workers one file at a time, a single
+                            pcap file is split between workers by flow. [default: 1]
       -h --help             Show this screen
       --version             Show version
       -v                    Verbose log output
@@ -83,6 +92,107 @@ void initialize_geo(const docopt::value &city, const docopt::value &asn)
     }
 }
 
+// one unit of work: a whole file, or one flow shard of a pcap file
+struct ReaderJob {
+    std::string file;
+    uint64_t shard_index{0};
+    uint64_t shard_count{1};
+};
+
+// the input stream and handler set a job runs on
+struct ReaderContext {
+    std::unique_ptr<InputStream> input;
+    std::vector<std::unique_ptr<StreamHandler>> handlers;
+
+    ~ReaderContext()
+    {
+        // handlers are connected to the input's event proxy, so they go first
+        for (auto &handler : handlers) {
+            handler->stop();
+        }
+        handlers.clear();
+        input.reset();
+    }
+};
+
+std::vector<std::string> expand_files(const std::vector<std::string> &args)
+{
+    std::vector<std::string> files;
+    for (const auto &arg : args) {
+        if (std::filesystem::is_directory(arg)) {
+            std::vector<std::string> dir_files;
+            for (const auto &entry : std::filesystem::directory_iterator(arg)) {
+                if (entry.is_regular_file()) {
+                    dir_files.push_back(entry.path().string());
+                }
+            }
+            // rotated captures sort in time order by name
+            std::sort(dir_files.begin(), dir_files.end());
+            files.insert(files.end(), dir_files.begin(), dir_files.end());
+        } else {
+            files.push_back(arg);
+        }
+    }
+    return files;
+}
+
+std::unique_ptr<ReaderContext> make_context(InputType input_type, const ReaderJob &job, const std::string &bpf, const std::string &host_spec, const visor::Config *window_config)
+{
+    auto ctx = std::make_unique<ReaderContext>();
+    std::string input_text("pcap");
+    switch (input_type) {
+    case DNSTAP:
+        input_text = "dnstap";
+        ctx->input = std::make_unique<input::dnstap::DnstapInputStream>(input_text);
+        ctx->input->config_set("dnstap_file", job.file);
+        break;
+    case SFLOW:
+        input_text = "flow";
+        ctx->input = std::make_unique<input::flow::FlowInputStream>(input_text);
+        ctx->input->config_set("flow_type", "sflow");
+        ctx->input->config_set("pcap_file", job.file);
+        break;
+    case NETFLOW:
+        input_text = "flow";
+        ctx->input = std::make_unique<input::flow::FlowInputStream>(input_text);
+        ctx->input->config_set("flow_type", "netflow");
+        ctx->input->config_set("pcap_file", job.file);
+        break;
+    case PCAP:
+    default:
+        ctx->input = std::make_unique<input::pcap::PcapInputStream>(input_text);
+        ctx->input->config_set("pcap_file", job.file);
+        ctx->input->config_set("bpf", bpf);
+        ctx->input->config_set("host_spec", host_spec);
+        if (job.shard_count > 1) {
+            // dns and dhcp pair queries with their replies, so shards must keep whole flows rather than byte ranges
+            ctx->input->config_set<uint64_t>("pcap_file_shards", job.shard_count);
+            ctx->input->config_set<uint64_t>("pcap_file_shard_index", job.shard_index);
+            ctx->input->config_set("pcap_file_shard_by", "flow");
+        }
+        static_cast<input::pcap::PcapInputStream *>(ctx->input.get())->parse_host_spec();
+        break;
+    }
+
+    visor::Config filter;
+    auto input_proxy = ctx->input->add_event_proxy(filter);
+
+    auto add_handler = [&ctx](std::unique_ptr<StreamHandler> handler) {
+        handler->config_set("recorded_stream", true);
+        handler->start();
+        ctx->handlers.push_back(std::move(handler));
+    };
+    add_handler(std::make_unique<handler::net::NetStreamHandler>("net", input_proxy, window_config));
+    if (input_type == PCAP || input_type == DNSTAP) {
+        add_handler(std::make_unique<handler::dns::DnsStreamHandler>("dns", input_proxy, window_config));
+    }
+    if (input_type == PCAP) {
+        add_handler(std::make_unique<handler::dhcp::DhcpStreamHandler>("dhcp", input_proxy, window_config));
+    }
+
+    return ctx;
+}
+
 int main(int argc, char *argv[])
 {
     int result{0};
@@ -122,6 +232,12 @@ int main(int argc, char *argv[])
 
     long periods = args["--periods"].asLong();
 
+    long threads = args["--threads"].asLong();
+    if (threads < 1) {
+        logger->error("--threads must be at least 1");
+        return -1;
+    }
+
     visor::Config window_config;
     window_config.config_set<uint64_t>("num_periods", periods);
     window_config.config_set<uint64_t>("deep_sample_rate", sample_rate);
@@ -142,108 +258,126 @@ int main(int argc, char *argv[])
     try {
 
         initialize_geo(args["--geo-city"], args["--geo-asn"]);
-        std::unique_ptr<InputStream> new_input_stream;
-        std::string input_text("pcap");
-        switch (input_type) {
-        case DNSTAP:
-            input_text = "dnstap";
-            new_input_stream = std::make_unique<input::dnstap::DnstapInputStream>(input_text);
-            new_input_stream->config_set("dnstap_file", args["FILE"].asString());
-            break;
-        case SFLOW:
-            input_text = "flow";
-            new_input_stream = std::make_unique<input::flow::FlowInputStream>(input_text);
-            new_input_stream->config_set("flow_type", "sflow");
-            new_input_stream->config_set("pcap_file", args["FILE"].asString());
-            break;
-        case NETFLOW:
-            input_text = "flow";
-            new_input_stream = std::make_unique<input::flow::FlowInputStream>(input_text);
-            new_input_stream->config_set("flow_type", "netflow");
-            new_input_stream->config_set("pcap_file", args["FILE"].asString());
-            break;
-        case PCAP:
-        default:
-            new_input_stream = std::make_unique<input::pcap::PcapInputStream>(input_text);
-            new_input_stream->config_set("pcap_file", args["FILE"].asString());
-            new_input_stream->config_set("bpf", bpf);
-            new_input_stream->config_set("host_spec", host_spec);
-            static_cast<input::pcap::PcapInputStream *>(new_input_stream.get())->parse_host_spec();
-            break;
-        }
 
-        json j;
-        new_input_stream->info_json(j["info"]);
-        logger->info("{}", j.dump(4));
-
-        registry.input_manager()->module_add(std::move(new_input_stream));
-        auto [input_stream_, stream_mgr_lock] = registry.input_manager()->module_get_locked(input_text);
-        stream_mgr_lock.unlock();
-        auto input_stream = input_stream_;
-        visor::Config filter;
-        auto input_proxy = input_stream->add_event_proxy(filter);
+        auto files = expand_files(args["FILE"].asStringList());
+        if (files.empty()) {
+            logger->error("no input files found");
+            return -1;
+        }
 
+        // several files are processed one per job. a single pcap file is split by flow instead, every job reads
+        // the whole file but only keeps its own shard of flows
+        std::vector<ReaderJob> jobs;
+        if (files.size() == 1 && threads > 1 && input_type == PCAP) {
+            for (long i = 0; i < threads; ++i) {
+                jobs.push_back({files[0], static_cast<uint64_t>(i), static_cast<uint64_t>(threads)});
+            }
+        } else {
+            if (files.size() == 1 && threads > 1) {
+                logger->warn("a single {} file can not be split between threads, using one", args["-i"] ? args["-i"].asString() : "pcap");
+            }
+            for (const auto &file : files) {
+                jobs.push_back({file});
+            }
+        }
+        // shards of one file cover the same time span, so their rates add up. separate files are separate spans
+        auto agg_operator = (jobs.size() > 1 && jobs[0].shard_count > 1) ? Metric::Aggregate::SUM : Metric::Aggregate::DEFAULT;
+
+        // the summary window of every job is merged into these, one per handler, as soon as the job finishes.
+        // the context of the first finished job is kept to render them
+        std::vector<std::unique_ptr<AbstractMetricsBucket>> merged_buckets;
+        std::unique_ptr<ReaderContext> render_ctx;
+        std::mutex merge_mutex;
+
+        std::mutex running_mutex;
+        std::vector<InputStream *> running_inputs;
+        std::atomic<bool> stopping{false};
         shutdown_handler = [&]([[maybe_unused]] int signal) {
-            input_stream->stop();
+            stopping = true;
+            std::unique_lock lock(running_mutex);
+            for (auto input : running_inputs) {
+                input->stop();
+            }
             logger->flush();
         };
 
-        handler::net::NetStreamHandler *net_handler{nullptr};
-        {
-            auto handler_module = std::make_unique<handler::net::NetStreamHandler>("net", input_proxy, &window_config);
-            handler_module->config_set("recorded_stream", true);
-            handler_module->start();
-            registry.handler_manager()->module_add(std::move(handler_module));
-            auto [handler, handler_mgr_lock] = registry.handler_manager()->module_get_locked("net");
-            handler_mgr_lock.unlock();
-            net_handler = dynamic_cast<handler::net::NetStreamHandler *>(handler);
-        }
+        std::atomic<size_t> next_job{0};
+        std::atomic<bool> failed{false};
+        auto worker = [&]() {
+            try {
+                for (auto i = next_job++; i < jobs.size() && !stopping; i = next_job++) {
+                    const auto &job = jobs[i];
+                    auto ctx = make_context(input_type, job, bpf, host_spec, &window_config);
+                    if (job.shard_count > 1) {
+                        logger->info("processing {} (flow shard {}/{})", job.file, job.shard_index + 1, job.shard_count);
+                    } else {
+                        logger->info("processing {}", job.file);
+                    }
+                    if (i == 0) {
+                        json j;
+                        ctx->input->info_json(j["info"]);
+                        logger->info("{}", j.dump(4));
+                    }
+
+                    {
+                        std::unique_lock lock(running_mutex);
+                        running_inputs.push_back(ctx->input.get());
+                    }
+                    // blocking
+                    ctx->input->start();
+                    {
+                        std::unique_lock lock(running_mutex);
+                        running_inputs.erase(std::find(running_inputs.begin(), running_inputs.end(), ctx->input.get()));
+                    }
+
+                    // in summary mode the single period is the summary, otherwise the max time window available
+                    std::vector<std::unique_ptr<AbstractMetricsBucket>> buckets;
+                    for (auto &handler : ctx->handlers) {
+                        buckets.push_back(handler->merge(nullptr, (periods == 1) ? 0 : periods, false, periods != 1));
+                    }
+
+                    std::unique_lock lock(merge_mutex);
+                    if (merged_buckets.empty()) {
+                        merged_buckets = std::move(buckets);
+                    } else {
+                        for (size_t h = 0; h < buckets.size(); ++h) {
+                            merged_buckets[h]->merge(*buckets[h], agg_operator);
+                        }
+                    }
+                    if (!render_ctx) {
+                        render_ctx = std::move(ctx);
+                    }
+                }
+            } catch (const std::exception &e) {
+                logger->error("Fatal error: {}", e.what());
+                failed = true;
+                stopping = true;
+            }
+        };
 
-        handler::dns::DnsStreamHandler *dns_handler{nullptr};
-        if (input_type == PCAP || input_type == DNSTAP) {
-            auto handler_module = std::make_unique<handler::dns::DnsStreamHandler>("dns", input_proxy, &window_config);
-            handler_module->config_set("recorded_stream", true);
-            handler_module->start();
-            registry.handler_manager()->module_add(std::move(handler_module));
-            auto [handler, handler_mgr_lock] = registry.handler_manager()->module_get_locked("dns");
-            handler_mgr_lock.unlock();
-            dns_handler = dynamic_cast<handler::dns::DnsStreamHandler *>(handler);
+        std::vector<std::thread> workers;
+        auto worker_count = std::min(static_cast<size_t>(threads), jobs.size());
+        for (size_t i = 1; i < worker_count; ++i) {
+            workers.emplace_back(worker);
         }
-
-        handler::dhcp::DhcpStreamHandler *dhcp_handler{nullptr};
-        if (input_type == PCAP) {
-            auto handler_module = std::make_unique<handler::dhcp::DhcpStreamHandler>("dhcp", input_proxy, &window_config);
-            handler_module->config_set("recorded_stream", true);
-            handler_module->start();
-            registry.handler_manager()->module_add(std::move(handler_module));
-            auto [handler, handler_mgr_lock] = registry.handler_manager()->module_get_locked("dhcp");
-            handler_mgr_lock.unlock();
-            dhcp_handler = dynamic_cast<handler::dhcp::DhcpStreamHandler *>(handler);
+        worker();
+        for (auto &t : workers) {
+            t.join();
+        }
+        if (failed) {
+            return -1;
         }
-
-        // blocking
-        input_stream->start();
 
         json result;
-        if (periods == 1) {
-            // in summary mode we output a single summary of stats
-            net_handler->window_json(result["1m"], 0, false);
-            if (dns_handler) {
-                dns_handler->window_json(result["1m"], 0, false);
-            }
-            if (dhcp_handler) {
-                dhcp_handler->window_json(result["1m"], 0, false);
-            }
-        } else {
-            // otherwise, merge the max time window available
-            auto key = fmt::format("{}m", periods);
-            net_handler->window_json(result[key], periods, true);
-            if (dns_handler) {
-                dns_handler->window_json(result[key], periods, true);
-            }
-            if (dhcp_handler) {
-                dhcp_handler->window_json(result[key], periods, true);
+        auto key = (periods == 1) ? std::string("1m") : fmt::format("{}m", periods);
+        for (size_t h = 0; h < merged_buckets.size(); ++h) {
+            auto &bucket = merged_buckets[h];
+            // merging adds up period lengths, the summary covers the span from the first to the last packet
+            bucket->set_recorded_stream();
+            if (bucket->end_tstamp().tv_sec) {
+                bucket->set_read_only(bucket->end_tstamp());
             }
+            render_ctx->handlers[h]->window_json(result[key], bucket.get());
         }
         std::cout << result.dump() << std::endl;
 
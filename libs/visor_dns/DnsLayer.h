@@ -455,6 +455,16 @@ struct dnshdr {
 		 */
                 static inline bool isDnsPort(uint16_t port);
 
+                /**
+		 * The ports isDnsPort() accepts
+		 */
+                static constexpr uint16_t DNS_PORTS[] = {53, 5353, 5355, 53000};
+
+                /**
+		 * The ports isDnsPort() accepts, as a BPF expression
+		 */
+                static constexpr const char *DNS_PORTS_BPF = "port 53 or port 5353 or port 5355 or port 53000";
+
             private:
                 bool m_ResourcesParsed{false};
                 bool m_ResourcesParseResult{false};
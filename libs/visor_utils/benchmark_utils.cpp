@@ -0,0 +1,76 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include "utils.h"
+#include <random>
+
+using namespace visor::lib::utils;
+
+static constexpr size_t LOOKUPS = 1024;
+
+// random prefixes between /8 and /32 (/16 and /64 for IPv6), roughly the shape of an anycast and customer host_spec
+static void fill_lists(size_t count, IPv4subnetList &ipv4_list, IPv6subnetList &ipv6_list)
+{
+    std::mt19937 rng(count);
+    for (size_t i = 0; i < count; ++i) {
+        IPv4subnet ipv4{};
+        ipv4.addr.s_addr = rng();
+        ipv4.cidr = static_cast<uint8_t>(8 + rng() % 25);
+        ipv4_list.push_back(ipv4);
+        IPv6subnet ipv6{};
+        for (auto &byte : ipv6.addr.s6_addr) {
+            byte = static_cast<uint8_t>(rng());
+        }
+        ipv6.cidr = static_cast<uint8_t>(16 + rng() % 49);
+        ipv6_list.push_back(ipv6);
+    }
+}
+
+// half of the addresses fall inside one of the prefixes, the other half are random
+static void fill_addresses(const IPv4subnetList &ipv4_list, const IPv6subnetList &ipv6_list, std::vector<uint32_t> &ipv4_addrs, std::vector<std::array<uint8_t, 16>> &ipv6_addrs)
+{
+    std::mt19937 rng(LOOKUPS);
+    for (size_t i = 0; i < LOOKUPS; ++i) {
+        auto &ipv4 = ipv4_list[rng() % ipv4_list.size()];
+        ipv4_addrs.push_back(i % 2 ? ipv4.addr.s_addr : static_cast<uint32_t>(rng()));
+        auto &ipv6 = ipv6_list[rng() % ipv6_list.size()];
+        std::array<uint8_t, 16> bytes;
+        for (size_t b = 0; b < bytes.size(); ++b) {
+            bytes[b] = i % 2 ? ipv6.addr.s6_addr[b] : static_cast<uint8_t>(rng());
+        }
+        ipv6_addrs.push_back(bytes);
+    }
+}
+
+TEST_CASE("Subnet match benchmark")
+{
+    for (size_t count : {10, 100, 1000, 3000}) {
+        IPv4subnetList ipv4_list;
+        IPv6subnetList ipv6_list;
+        fill_lists(count, ipv4_list, ipv6_list);
+        std::vector<uint32_t> ipv4_addrs;
+        std::vector<std::array<uint8_t, 16>> ipv6_addrs;
+        fill_addresses(ipv4_list, ipv6_list, ipv4_addrs, ipv6_addrs);
+
+        BENCHMARK("IPv4 " + std::to_string(LOOKUPS) + " lookups, " + std::to_string(count) + " prefixes")
+        {
+            size_t matches{0};
+            for (auto addr : ipv4_addrs) {
+                matches += match_subnet(ipv4_list, addr).has_value();
+            }
+            return matches;
+        };
+
+        BENCHMARK("IPv6 " + std::to_string(LOOKUPS) + " lookups, " + std::to_string(count) + " prefixes")
+        {
+            size_t matches{0};
+            for (const auto &addr : ipv6_addrs) {
+                matches += match_subnet(ipv6_list, addr.data()).has_value();
+            }
+            return matches;
+        };
+    }
+}
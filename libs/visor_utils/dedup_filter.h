@@ -0,0 +1,102 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace visor::lib::utils {
+
+// remembers digests for a time window in a fixed amount of memory, to tell repeated copies of an item from the first.
+// the table is set associative: a digest can only live in the WAYS slots of its set, and a new one takes the slot of
+// an expired entry, or else of the oldest one there. memory stays at capacity entries, at the price of forgetting some
+// digests early when more than that arrive within one window. not thread safe
+class DedupFilter
+{
+    static constexpr size_t WAYS = 4;
+
+    struct Entry {
+        // 0 marks an empty slot
+        uint64_t digest{0};
+        uint64_t stamp_ns{0};
+    };
+
+    std::vector<Entry> _entries;
+    size_t _set_mask;
+    uint64_t _window_ns;
+
+    static uint64_t _mix(uint64_t v)
+    {
+        v ^= v >> 33;
+        v *= 0xff51afd7ed558ccdULL;
+        v ^= v >> 33;
+        v *= 0xc4ceb9fe1a85ec53ULL;
+        v ^= v >> 33;
+        return v;
+    }
+
+public:
+    // capacity is rounded up to a power of two, of at least WAYS
+    DedupFilter(size_t capacity, uint64_t window_ns)
+        : _window_ns(window_ns)
+    {
+        size_t sets{1};
+        while (sets * WAYS < capacity) {
+            sets <<= 1;
+        }
+        _set_mask = sets - 1;
+        _entries.resize(sets * WAYS);
+    }
+
+    size_t capacity() const
+    {
+        return _entries.size();
+    }
+
+    // 64 bit hash of len bytes, chained through seed to hash several ranges into one digest
+    static uint64_t hash(const uint8_t *data, size_t len, uint64_t seed = 0)
+    {
+        auto h = seed ^ _mix(len + 0x9e3779b97f4a7c15ULL);
+        for (; len >= 8; data += 8, len -= 8) {
+            uint64_t v;
+            std::memcpy(&v, data, 8);
+            h = (h ^ _mix(v)) * 0x9e3779b97f4a7c15ULL;
+        }
+        if (len) {
+            uint64_t v{0};
+            std::memcpy(&v, data, len);
+            h = (h ^ _mix(v)) * 0x9e3779b97f4a7c15ULL;
+        }
+        return _mix(h);
+    }
+
+    // true if digest was seen less than the window before stamp_ns. otherwise it is remembered from stamp_ns on
+    bool seen(uint64_t digest, uint64_t stamp_ns)
+    {
+        digest |= !digest;
+        auto set = &_entries[(digest & _set_mask) * WAYS];
+        Entry *victim = set;
+        for (size_t i = 0; i < WAYS; ++i) {
+            auto &entry = set[i];
+            // time stamps of different capture paths are not strictly ordered, so the window counts both ways
+            auto age = stamp_ns >= entry.stamp_ns ? stamp_ns - entry.stamp_ns : entry.stamp_ns - stamp_ns;
+            if (entry.digest == digest && age < _window_ns) {
+                return true;
+            }
+            if (!entry.digest || age >= _window_ns) {
+                victim = &entry;
+            } else if (victim->digest && entry.stamp_ns < victim->stamp_ns) {
+                victim = &entry;
+            }
+        }
+        victim->digest = digest;
+        victim->stamp_ns = stamp_ns;
+        return false;
+    }
+};
+
+}
@@ -0,0 +1,626 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "mmap_pcap_reader.h"
+#include "utils.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace visor::lib::utils {
+
+static constexpr uint32_t PCAP_MAGIC_USEC = 0xa1b2c3d4;
+static constexpr uint32_t PCAP_MAGIC_USEC_SWAPPED = 0xd4c3b2a1;
+static constexpr uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+static constexpr uint32_t PCAP_MAGIC_NSEC_SWAPPED = 0x4d3cb2a1;
+static constexpr size_t PCAP_HEADER_LEN = 24;
+static constexpr size_t PCAP_RECORD_HEADER_LEN = 16;
+
+static constexpr uint32_t PCAPNG_SECTION_HEADER = 0x0a0d0d0a;
+static constexpr uint32_t PCAPNG_INTERFACE_DESCRIPTION = 1;
+static constexpr uint32_t PCAPNG_PACKET = 2;
+static constexpr uint32_t PCAPNG_SIMPLE_PACKET = 3;
+static constexpr uint32_t PCAPNG_ENHANCED_PACKET = 6;
+static constexpr uint32_t PCAPNG_BYTE_ORDER_MAGIC = 0x1a2b3c4d;
+static constexpr uint32_t PCAPNG_BYTE_ORDER_MAGIC_SWAPPED = 0x4d3c2b1a;
+static constexpr uint16_t PCAPNG_OPT_TSRESOL = 9;
+static constexpr uint16_t PCAPNG_OPT_TSOFFSET = 14;
+static constexpr uint32_t PCAPNG_NAME_RESOLUTION = 4;
+static constexpr uint32_t PCAPNG_INTERFACE_STATISTICS = 5;
+static constexpr uint32_t PCAPNG_DECRYPTION_SECRETS = 10;
+static constexpr uint32_t PCAPNG_CUSTOM = 0x00000bad;
+static constexpr uint32_t PCAPNG_CUSTOM_NO_COPY = 0x40000bad;
+
+// records in a row whose framing must check out before set_range() trusts an offset to start one
+static constexpr int RESYNC_RECORDS = 8;
+// snap length assumed when the file header has none
+static constexpr uint32_t MAX_SNAP_LEN = 262144;
+// consecutive records of a capture are less than a day apart. files merged from several captures jump ahead where
+// they were joined, so one jump is let through, but not right after the record being checked
+static constexpr int64_t MAX_RECORD_GAP = 86400;
+
+// pages ahead of the read position are prefetched, and pages behind it unmapped, one window at a time
+static constexpr size_t ADVISE_WINDOW = 64 * 1024 * 1024;
+
+static uint16_t bswap16(uint16_t v)
+{
+    return static_cast<uint16_t>((v >> 8) | (v << 8));
+}
+
+static uint32_t bswap32(uint32_t v)
+{
+    return ((v & 0xff000000u) >> 24) | ((v & 0x00ff0000u) >> 8) | ((v & 0x0000ff00u) << 8) | ((v & 0x000000ffu) << 24);
+}
+
+MmapPcapReader::MmapPcapReader(std::string file_name)
+    : _file_name(std::move(file_name))
+    , _packet(nullptr, 0, timespec{}, false)
+{
+}
+
+MmapPcapReader::~MmapPcapReader()
+{
+    close();
+}
+
+uint16_t MmapPcapReader::_read16(const uint8_t *p) const
+{
+    uint16_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return _swapped ? bswap16(v) : v;
+}
+
+uint32_t MmapPcapReader::_read32(const uint8_t *p) const
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return _swapped ? bswap32(v) : v;
+}
+
+uint64_t MmapPcapReader::_read64(const uint8_t *p) const
+{
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    if (_swapped) {
+        v = (static_cast<uint64_t>(bswap32(static_cast<uint32_t>(v))) << 32) | bswap32(static_cast<uint32_t>(v >> 32));
+    }
+    return v;
+}
+
+void MmapPcapReader::open()
+{
+    if (_data) {
+        return;
+    }
+
+#ifdef _WIN32
+    auto file = CreateFileA(_file_name.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw UtilsException("unable to open capture file: " + _file_name);
+    }
+    _file_handle = file;
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size)) {
+        close();
+        throw UtilsException("unable to stat capture file: " + _file_name);
+    }
+    _size = static_cast<size_t>(file_size.QuadPart);
+    if (_size == 0) {
+        close();
+        throw UtilsException("capture file is empty: " + _file_name);
+    }
+    _mapping_handle = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (!_mapping_handle) {
+        close();
+        throw UtilsException("unable to map capture file: " + _file_name);
+    }
+    _data = static_cast<const uint8_t *>(MapViewOfFile(_mapping_handle, FILE_MAP_COPY, 0, 0, 0));
+    if (!_data) {
+        close();
+        throw UtilsException("unable to map capture file: " + _file_name);
+    }
+#else
+    _fd = ::open(_file_name.c_str(), O_RDONLY);
+    if (_fd == -1) {
+        throw UtilsException("unable to open capture file: " + _file_name + ": " + std::strerror(errno));
+    }
+    struct stat st {
+    };
+    if (fstat(_fd, &st) == -1) {
+        close();
+        throw UtilsException("unable to stat capture file: " + _file_name + ": " + std::strerror(errno));
+    }
+    _size = static_cast<size_t>(st.st_size);
+    if (_size == 0) {
+        close();
+        throw UtilsException("capture file is empty: " + _file_name);
+    }
+    // writable copy on write mapping: nothing should write to packet data, but if it does it only gets a private page
+    auto map = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_PRIVATE, _fd, 0);
+    if (map == MAP_FAILED) {
+        close();
+        throw UtilsException("unable to map capture file: " + _file_name + ": " + std::strerror(errno));
+    }
+    _data = static_cast<const uint8_t *>(map);
+    // aggressive readahead, and pages may be dropped soon after they were read
+    madvise(map, _size, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    // only honored where the kernel supports huge pages for the page cache, harmless elsewhere
+    madvise(map, _size, MADV_HUGEPAGE);
+#endif
+#endif
+
+    try {
+        _read_pcap_header();
+    } catch (...) {
+        close();
+        throw;
+    }
+}
+
+void MmapPcapReader::close()
+{
+    for (auto &filter : _filters) {
+        pcap_freecode(&filter.program);
+    }
+    _filters.clear();
+#ifdef _WIN32
+    if (_data) {
+        UnmapViewOfFile(_data);
+    }
+    if (_mapping_handle) {
+        CloseHandle(_mapping_handle);
+        _mapping_handle = nullptr;
+    }
+    if (_file_handle) {
+        CloseHandle(_file_handle);
+        _file_handle = nullptr;
+    }
+#else
+    if (_data) {
+        munmap(const_cast<uint8_t *>(_data), _size);
+    }
+    if (_fd != -1) {
+        ::close(_fd);
+        _fd = -1;
+    }
+#endif
+    _data = nullptr;
+    _size = 0;
+    _offset = 0;
+    _end = std::numeric_limits<size_t>::max();
+    _advised = 0;
+    _interfaces.clear();
+}
+
+void MmapPcapReader::_read_pcap_header()
+{
+    if (_size < sizeof(uint32_t)) {
+        throw UtilsException("capture file is too short: " + _file_name);
+    }
+    uint32_t magic;
+    std::memcpy(&magic, _data, sizeof(magic));
+
+    if (magic == PCAPNG_SECTION_HEADER) {
+        _pcapng = true;
+        if (!_read_pcapng_section_header()) {
+            throw UtilsException("invalid pcapng section header: " + _file_name);
+        }
+        return;
+    }
+
+    switch (magic) {
+    case PCAP_MAGIC_USEC:
+        break;
+    case PCAP_MAGIC_USEC_SWAPPED:
+        _swapped = true;
+        break;
+    case PCAP_MAGIC_NSEC:
+        _nanosecond = true;
+        break;
+    case PCAP_MAGIC_NSEC_SWAPPED:
+        _nanosecond = true;
+        _swapped = true;
+        break;
+    default:
+        throw UtilsException("unknown capture file format: " + _file_name);
+    }
+    if (_size < PCAP_HEADER_LEN) {
+        throw UtilsException("capture file is too short: " + _file_name);
+    }
+    // the upper bits of the link type field carry FCS information
+    _snap_len = _read32(_data + 16);
+    _link_type = static_cast<uint16_t>(_read32(_data + 20) & 0x0fffffff);
+    _offset = PCAP_HEADER_LEN;
+    if (_size >= PCAP_HEADER_LEN + PCAP_RECORD_HEADER_LEN) {
+        _first_sec = _read32(_data + PCAP_HEADER_LEN);
+    }
+}
+
+bool MmapPcapReader::_read_pcapng_section_header()
+{
+    // type, length, byte order magic, version, section length
+    if (_offset + 28 > _size) {
+        return false;
+    }
+    auto block = _data + _offset;
+    uint32_t byte_order;
+    std::memcpy(&byte_order, block + 8, sizeof(byte_order));
+    if (byte_order == PCAPNG_BYTE_ORDER_MAGIC) {
+        _swapped = false;
+    } else if (byte_order == PCAPNG_BYTE_ORDER_MAGIC_SWAPPED) {
+        _swapped = true;
+    } else {
+        return false;
+    }
+    auto block_len = _read32(block + 4);
+    if (block_len < 28 || block_len % 4 || _offset + block_len > _size) {
+        return false;
+    }
+    // interface ids are scoped to their section
+    _interfaces.clear();
+    _offset += block_len;
+    return true;
+}
+
+void MmapPcapReader::_read_pcapng_interface(const uint8_t *block, uint32_t block_len)
+{
+    PcapngInterface iface{};
+    if (block_len < 20) {
+        return;
+    }
+    iface.link_type = _read16(block + 8);
+    iface.snap_len = _read32(block + 12);
+    iface.ts_units = 1000000;
+    iface.ts_offset = 0;
+
+    auto opt = block + 16;
+    auto end = block + block_len - 4;
+    while (opt + 4 <= end) {
+        auto code = _read16(opt);
+        auto len = _read16(opt + 2);
+        auto value = opt + 4;
+        if (code == 0 || value + len > end) {
+            break;
+        }
+        if (code == PCAPNG_OPT_TSRESOL && len >= 1) {
+            // the high bit selects a power of two, otherwise the resolution is a power of ten
+            uint8_t resol = value[0];
+            if (resol & 0x80) {
+                iface.ts_units = uint64_t{1} << std::min(resol & 0x7f, 63);
+            } else {
+                iface.ts_units = 1;
+                for (int i = 0; i < std::min<int>(resol, 19); ++i) {
+                    iface.ts_units *= 10;
+                }
+            }
+        } else if (code == PCAPNG_OPT_TSOFFSET && len >= 8) {
+            iface.ts_offset = static_cast<int64_t>(_read64(value));
+        }
+        opt = value + ((len + 3u) & ~3u);
+    }
+    _interfaces.push_back(iface);
+}
+
+bool MmapPcapReader::_is_pcap_record(size_t offset) const
+{
+    auto max_caplen = _snap_len ? _snap_len : MAX_SNAP_LEN;
+    auto max_frac = _nanosecond ? 1000000000u : 1000000u;
+    int64_t last_sec{0};
+    int jumps{0};
+    for (int i = 0; i < RESYNC_RECORDS; ++i) {
+        // a record ending exactly at the end of the file
+        if (offset == _size) {
+            return true;
+        }
+        if (offset + PCAP_RECORD_HEADER_LEN > _size) {
+            return false;
+        }
+        auto record = _data + offset;
+        int64_t sec = _read32(record);
+        auto frac = _read32(record + 4);
+        auto caplen = _read32(record + 8);
+        auto len = _read32(record + 12);
+        if (frac >= max_frac || len == 0 || caplen > len || caplen > max_caplen || caplen > _size - offset - PCAP_RECORD_HEADER_LEN) {
+            return false;
+        }
+        if (sec + MAX_RECORD_GAP < _first_sec) {
+            return false;
+        }
+        if (i > 0 && std::abs(sec - last_sec) > MAX_RECORD_GAP && (i == 1 || ++jumps > 1)) {
+            return false;
+        }
+        last_sec = sec;
+        offset += PCAP_RECORD_HEADER_LEN + caplen;
+    }
+    return true;
+}
+
+bool MmapPcapReader::_is_pcapng_block(size_t offset) const
+{
+    for (int i = 0; i < RESYNC_RECORDS; ++i) {
+        if (offset == _size) {
+            return true;
+        }
+        if (offset + 12 > _size) {
+            return false;
+        }
+        auto block = _data + offset;
+        uint32_t type;
+        std::memcpy(&type, block, sizeof(type));
+        // a new section may change the byte order, so its own header is checked instead of what follows
+        if (type == PCAPNG_SECTION_HEADER) {
+            uint32_t byte_order;
+            std::memcpy(&byte_order, block + 8, sizeof(byte_order));
+            return byte_order == PCAPNG_BYTE_ORDER_MAGIC || byte_order == PCAPNG_BYTE_ORDER_MAGIC_SWAPPED;
+        }
+        type = _read32(block);
+        switch (type) {
+        case PCAPNG_INTERFACE_DESCRIPTION:
+        case PCAPNG_PACKET:
+        case PCAPNG_SIMPLE_PACKET:
+        case PCAPNG_NAME_RESOLUTION:
+        case PCAPNG_INTERFACE_STATISTICS:
+        case PCAPNG_ENHANCED_PACKET:
+        case PCAPNG_DECRYPTION_SECRETS:
+        case PCAPNG_CUSTOM:
+        case PCAPNG_CUSTOM_NO_COPY:
+            break;
+        default:
+            return false;
+        }
+        // the block length is repeated at its end
+        auto block_len = _read32(block + 4);
+        if (block_len < 12 || block_len % 4 || block_len > _size - offset || _read32(block + block_len - 4) != block_len) {
+            return false;
+        }
+        offset += block_len;
+    }
+    return true;
+}
+
+void MmapPcapReader::set_range(size_t begin, size_t end)
+{
+    if (!_data) {
+        return;
+    }
+    _end = std::min(end, _size);
+
+    if (_pcapng) {
+        // interfaces are described ahead of the packets, so read them before skipping ahead. one described after the
+        // first packet is only known to the reader whose range holds it
+        while (_offset + 12 <= _size && _offset < begin) {
+            auto block = _data + _offset;
+            uint32_t type;
+            std::memcpy(&type, block, sizeof(type));
+            if (type == PCAPNG_SECTION_HEADER) {
+                if (!_read_pcapng_section_header()) {
+                    break;
+                }
+                continue;
+            }
+            type = _read32(block);
+            auto block_len = _read32(block + 4);
+            if (type == PCAPNG_PACKET || type == PCAPNG_SIMPLE_PACKET || type == PCAPNG_ENHANCED_PACKET || block_len < 12 || block_len % 4 || block_len > _size - _offset) {
+                break;
+            }
+            if (type == PCAPNG_INTERFACE_DESCRIPTION) {
+                _read_pcapng_interface(block, block_len);
+            }
+            _offset += block_len;
+        }
+    }
+    if (begin <= _offset) {
+        return;
+    }
+
+    // blocks of pcapng files stay 4 byte aligned, pcap records may start anywhere
+    size_t step = _pcapng ? 4 : 1;
+    auto offset = _pcapng ? (begin + 3) & ~size_t{3} : begin;
+    while (offset < _size && !(_pcapng ? _is_pcapng_block(offset) : _is_pcap_record(offset))) {
+        offset += step;
+    }
+    _offset = std::min(offset, _size);
+    _advised = _offset / ADVISE_WINDOW * ADVISE_WINDOW;
+}
+
+bool MmapPcapReader::_next_pcap_record(const uint8_t *&data, uint32_t &caplen, uint32_t &len, timespec &ts, uint16_t &link_type)
+{
+    if (_offset >= _end || _offset + PCAP_RECORD_HEADER_LEN > _size) {
+        return false;
+    }
+    auto record = _data + _offset;
+    caplen = _read32(record + 8);
+    len = _read32(record + 12);
+    // a truncated last record ends the file
+    if (caplen > _size - _offset - PCAP_RECORD_HEADER_LEN) {
+        return false;
+    }
+    ts.tv_sec = static_cast<time_t>(_read32(record));
+    auto frac = _read32(record + 4);
+    ts.tv_nsec = static_cast<long>(_nanosecond ? frac : static_cast<uint64_t>(frac) * 1000);
+    data = record + PCAP_RECORD_HEADER_LEN;
+    link_type = _link_type;
+    _offset += PCAP_RECORD_HEADER_LEN + caplen;
+    return true;
+}
+
+bool MmapPcapReader::_next_pcapng_record(const uint8_t *&data, uint32_t &caplen, uint32_t &len, timespec &ts, uint16_t &link_type)
+{
+    while (_offset < _end && _offset + 12 <= _size) {
+        auto block = _data + _offset;
+        uint32_t type;
+        std::memcpy(&type, block, sizeof(type));
+        if (type == PCAPNG_SECTION_HEADER) {
+            if (!_read_pcapng_section_header()) {
+                return false;
+            }
+            continue;
+        }
+        type = _read32(block);
+        auto block_len = _read32(block + 4);
+        if (block_len < 12 || block_len % 4 || block_len > _size - _offset) {
+            return false;
+        }
+        _offset += block_len;
+
+        uint32_t iface_id{0};
+        uint64_t stamp{0};
+        bool has_stamp{true};
+        switch (type) {
+        case PCAPNG_INTERFACE_DESCRIPTION:
+            _read_pcapng_interface(block, block_len);
+            continue;
+        case PCAPNG_ENHANCED_PACKET:
+        case PCAPNG_PACKET:
+            if (block_len < 32) {
+                continue;
+            }
+            // the obsolete packet block has a 16 bit interface id followed by a drop counter
+            iface_id = (type == PCAPNG_PACKET) ? _read16(block + 8) : _read32(block + 8);
+            stamp = (static_cast<uint64_t>(_read32(block + 12)) << 32) | _read32(block + 16);
+            caplen = _read32(block + 20);
+            len = _read32(block + 24);
+            data = block + 28;
+            if (caplen > block_len - 32) {
+                continue;
+            }
+            break;
+        case PCAPNG_SIMPLE_PACKET:
+            if (block_len < 16) {
+                continue;
+            }
+            // no capture length or time stamp, the packet is cut to the snap length of the first interface
+            len = _read32(block + 8);
+            caplen = std::min(len, block_len - 16);
+            if (!_interfaces.empty() && _interfaces[0].snap_len) {
+                caplen = std::min(caplen, _interfaces[0].snap_len);
+            }
+            data = block + 12;
+            has_stamp = false;
+            break;
+        default:
+            continue;
+        }
+
+        if (iface_id >= _interfaces.size()) {
+            continue;
+        }
+        const auto &iface = _interfaces[iface_id];
+        link_type = iface.link_type;
+        if (has_stamp) {
+            auto frac = stamp % iface.ts_units;
+            ts.tv_sec = static_cast<time_t>(static_cast<int64_t>(stamp / iface.ts_units) + iface.ts_offset);
+            if (iface.ts_units == 1000000) {
+                ts.tv_nsec = static_cast<long>(frac * 1000);
+            } else if (iface.ts_units == 1000000000) {
+                ts.tv_nsec = static_cast<long>(frac);
+            } else {
+                ts.tv_nsec = static_cast<long>(static_cast<long double>(frac) * 1e9L / static_cast<long double>(iface.ts_units));
+            }
+        } else {
+            ts = timespec{};
+        }
+        return true;
+    }
+    return false;
+}
+
+const struct bpf_program &MmapPcapReader::_compile_filter(uint16_t link_type)
+{
+    for (const auto &filter : _filters) {
+        if (filter.link_type == link_type) {
+            return filter.program;
+        }
+    }
+
+    pcap_t *handle = pcap_open_dead(link_type, 262144);
+    if (handle == nullptr) {
+        throw UtilsException("failed to open pcap handle");
+    }
+    Filter filter{link_type, {}};
+    if (pcap_compile(handle, &filter.program, _filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) < 0) {
+        std::string err = pcap_geterr(handle);
+        pcap_close(handle);
+        throw UtilsException("failed to parse bpf filter '" + _filter + "': " + err);
+    }
+    pcap_close(handle);
+    _filters.push_back(filter);
+    return _filters.back().program;
+}
+
+void MmapPcapReader::set_filter(const std::string &filter)
+{
+    for (auto &f : _filters) {
+        pcap_freecode(&f.program);
+    }
+    _filters.clear();
+    _filter = filter;
+    if (_filter.empty()) {
+        return;
+    }
+    // compile once up front so a bad expression is reported here. pcapng files may add link types later
+    _compile_filter(_pcapng ? static_cast<uint16_t>(pcpp::LINKTYPE_ETHERNET) : _link_type);
+}
+
+bool MmapPcapReader::_matches(const uint8_t *data, uint32_t caplen, uint32_t len, uint16_t link_type)
+{
+    const auto &program = _compile_filter(link_type);
+    struct pcap_pkthdr hdr {
+    };
+    hdr.caplen = caplen;
+    hdr.len = len;
+    return pcap_offline_filter(&program, &hdr, data) != 0;
+}
+
+void MmapPcapReader::_advise_window()
+{
+    if (_offset < _advised) {
+        return;
+    }
+#ifndef _WIN32
+    auto base = const_cast<uint8_t *>(_data);
+    madvise(base + _advised, std::min(ADVISE_WINDOW, _size - _advised), MADV_WILLNEED);
+    // the pages stay in the page cache, this only keeps our resident set from growing with the file
+    if (_advised >= 2 * ADVISE_WINDOW) {
+        madvise(base + _advised - 2 * ADVISE_WINDOW, ADVISE_WINDOW, MADV_DONTNEED);
+    }
+#endif
+    _advised += ADVISE_WINDOW;
+}
+
+pcpp::RawPacket *MmapPcapReader::next_packet()
+{
+    if (!_data) {
+        return nullptr;
+    }
+
+    const uint8_t *data{nullptr};
+    uint32_t caplen{0}, len{0};
+    uint16_t link_type{0};
+    timespec ts{};
+    while (_pcapng ? _next_pcapng_record(data, caplen, len, ts, link_type) : _next_pcap_record(data, caplen, len, ts, link_type)) {
+        _advise_window();
+        if (!_filter.empty() && !_matches(data, caplen, len, link_type)) {
+            continue;
+        }
+        _packet.setRawData(data, static_cast<int>(caplen), ts, static_cast<pcpp::LinkLayerType>(link_type), static_cast<int>(len));
+        return &_packet;
+    }
+    return nullptr;
+}
+
+}
@@ -0,0 +1,122 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+#include <pcapplusplus/RawPacket.h>
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+#include <pcap/pcap.h>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace visor::lib::utils {
+
+// reads pcap and pcapng capture files through a read only memory mapping. packets are returned as views into the
+// mapping, so nothing is copied; a returned packet stays valid until the next call to next_packet().
+// the bpf filter, if any, is applied in userspace before a packet is returned.
+class MmapPcapReader
+{
+    struct PcapngInterface {
+        uint16_t link_type;
+        uint32_t snap_len;
+        // time stamp units per second, from if_tsresol
+        uint64_t ts_units;
+        int64_t ts_offset;
+    };
+
+    struct Filter {
+        uint16_t link_type;
+        struct bpf_program program;
+    };
+
+    std::string _file_name;
+    std::string _filter;
+
+    const uint8_t *_data{nullptr};
+    size_t _size{0};
+    size_t _offset{0};
+    // records starting at or past this offset are left to the next range, see set_range()
+    size_t _end{std::numeric_limits<size_t>::max()};
+    size_t _advised{0};
+#ifdef _WIN32
+    void *_file_handle{nullptr};
+    void *_mapping_handle{nullptr};
+#else
+    int _fd{-1};
+#endif
+
+    bool _pcapng{false};
+    bool _swapped{false};
+    bool _nanosecond{false};
+    uint16_t _link_type{0};
+    uint32_t _snap_len{0};
+    // time stamp of the first record of a pcap file
+    int64_t _first_sec{0};
+    std::vector<PcapngInterface> _interfaces;
+    std::vector<Filter> _filters;
+
+    pcpp::RawPacket _packet;
+
+    uint16_t _read16(const uint8_t *p) const;
+    uint32_t _read32(const uint8_t *p) const;
+    uint64_t _read64(const uint8_t *p) const;
+    void _advise_window();
+    void _read_pcap_header();
+    bool _read_pcapng_section_header();
+    void _read_pcapng_interface(const uint8_t *block, uint32_t block_len);
+    bool _is_pcap_record(size_t offset) const;
+    bool _is_pcapng_block(size_t offset) const;
+    bool _next_pcap_record(const uint8_t *&data, uint32_t &caplen, uint32_t &len, timespec &ts, uint16_t &link_type);
+    bool _next_pcapng_record(const uint8_t *&data, uint32_t &caplen, uint32_t &len, timespec &ts, uint16_t &link_type);
+    const struct bpf_program &_compile_filter(uint16_t link_type);
+    bool _matches(const uint8_t *data, uint32_t caplen, uint32_t len, uint16_t link_type);
+
+public:
+    explicit MmapPcapReader(std::string file_name);
+    ~MmapPcapReader();
+
+    MmapPcapReader(const MmapPcapReader &) = delete;
+    MmapPcapReader &operator=(const MmapPcapReader &) = delete;
+
+    // maps the file and parses its header, throws UtilsException on failure
+    void open();
+    void close();
+
+    // tcpdump compatible filter expression, compiled per link type of the file. call after open(), throws
+    // UtilsException if it does not compile
+    void set_filter(const std::string &filter);
+
+    // reads only the records starting in [begin, end) of the file, so readers given adjacent ranges split it between
+    // them. call after open(). there is no index to seek with: the first record at or after begin is the first offset
+    // where the framing of several records in a row checks out
+    void set_range(size_t begin, size_t end);
+
+    // next packet matching the filter, or nullptr at the end of the file or range
+    pcpp::RawPacket *next_packet();
+
+    bool is_pcapng() const
+    {
+        return _pcapng;
+    }
+
+    size_t file_size() const
+    {
+        return _size;
+    }
+
+    size_t bytes_read() const
+    {
+        return _offset;
+    }
+};
+
+}
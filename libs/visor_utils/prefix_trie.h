@@ -0,0 +1,175 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace visor::lib::utils {
+
+// path compressed binary trie over network prefixes of Bytes long addresses (4 for IPv4, 16 for IPv6), in network
+// byte order. every node holds the prefix it stands for, so chains of single children collapse into one node and a
+// lookup visits at most one node per distinct prefix length on its path, however many prefixes are stored.
+// lookup() is the longest prefix match; it does not modify the trie and may run concurrently with other lookups
+template <size_t Bytes>
+class PrefixTrie
+{
+public:
+    static constexpr uint8_t MAX_BITS = Bytes * 8;
+    static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+private:
+    using Key = std::array<uint8_t, Bytes>;
+
+    struct Node {
+        Key key;
+        uint8_t len;
+        uint32_t value;
+        std::array<uint32_t, 2> child;
+    };
+
+    // nodes refer to each other by index, the root is at 0
+    std::vector<Node> _nodes;
+
+    static uint8_t _bit(const uint8_t *key, uint8_t pos)
+    {
+        return (key[pos / 8] >> (7 - pos % 8)) & 1;
+    }
+
+    // number of leading bits a and b have in common, at most limit
+    static uint8_t _common(const uint8_t *a, const uint8_t *b, uint8_t limit)
+    {
+        unsigned bits{0};
+        for (size_t i = 0; i < Bytes && bits < limit; ++i) {
+            auto diff = static_cast<uint8_t>(a[i] ^ b[i]);
+            if (diff) {
+                while (!(diff & 0x80)) {
+                    diff = static_cast<uint8_t>(diff << 1);
+                    ++bits;
+                }
+                break;
+            }
+            bits += 8;
+        }
+        return static_cast<uint8_t>(std::min(bits, static_cast<unsigned>(limit)));
+    }
+
+    // whether the first len bits of addr and key are equal
+    static bool _matches(const uint8_t *addr, const uint8_t *key, uint8_t len)
+    {
+        size_t i{0};
+        for (; i < len / 8u; ++i) {
+            if (addr[i] != key[i]) {
+                return false;
+            }
+        }
+        auto bits = len % 8;
+        return !bits || !((addr[i] ^ key[i]) & (0xff << (8 - bits)));
+    }
+
+    static Key _mask(const uint8_t *addr, uint8_t len)
+    {
+        Key key{};
+        for (size_t i = 0; i < Bytes && i * 8 < len; ++i) {
+            key[i] = addr[i];
+            if (len < (i + 1) * 8) {
+                key[i] &= static_cast<uint8_t>(0xff << (8 - len % 8));
+            }
+        }
+        return key;
+    }
+
+    uint32_t _add(const Key &key, uint8_t len, uint32_t value)
+    {
+        _nodes.push_back({key, len, value, {NONE, NONE}});
+        return static_cast<uint32_t>(_nodes.size() - 1);
+    }
+
+public:
+    // stores value for the first len bits of addr. if the prefix is already present, the value stored first is kept
+    void insert(const uint8_t *addr, uint8_t len, uint32_t value)
+    {
+        len = std::min(len, MAX_BITS);
+        auto key = _mask(addr, len);
+        if (_nodes.empty()) {
+            _add(Key{}, 0, NONE);
+        }
+
+        // every node on the way down is a prefix of key and no longer than it
+        uint32_t cur{0};
+        while (true) {
+            if (_nodes[cur].len == len) {
+                if (_nodes[cur].value == NONE) {
+                    _nodes[cur].value = value;
+                }
+                return;
+            }
+            auto branch = _bit(key.data(), _nodes[cur].len);
+            auto next = _nodes[cur].child[branch];
+            if (next == NONE) {
+                auto leaf = _add(key, len, value);
+                _nodes[cur].child[branch] = leaf;
+                return;
+            }
+            auto next_len = _nodes[next].len;
+            auto common = _common(key.data(), _nodes[next].key.data(), std::min(len, next_len));
+            if (common == next_len) {
+                cur = next;
+                continue;
+            }
+
+            // key stops or diverges inside the child's prefix, so a new node takes the child's place above it
+            uint32_t split;
+            if (common == len) {
+                split = _add(key, len, value);
+            } else {
+                split = _add(_mask(key.data(), common), common, NONE);
+                auto leaf = _add(key, len, value);
+                _nodes[split].child[_bit(key.data(), common)] = leaf;
+            }
+            _nodes[split].child[_bit(_nodes[next].key.data(), common)] = next;
+            _nodes[cur].child[branch] = split;
+            return;
+        }
+    }
+
+    // value of the longest stored prefix of addr, or NONE
+    uint32_t lookup(const uint8_t *addr) const
+    {
+        uint32_t best{NONE};
+        uint32_t cur = _nodes.empty() ? NONE : 0;
+        while (cur != NONE) {
+            // descend on single bits and only compare whole prefixes where there is a value; once one does not
+            // match, nothing below it can
+            const auto &node = _nodes[cur];
+            if (node.value != NONE) {
+                if (!_matches(addr, node.key.data(), node.len)) {
+                    break;
+                }
+                best = node.value;
+            }
+            if (node.len == MAX_BITS) {
+                break;
+            }
+            cur = node.child[_bit(addr, node.len)];
+        }
+        return best;
+    }
+
+    void clear()
+    {
+        _nodes.clear();
+    }
+
+    size_t node_count() const
+    {
+        return _nodes.size();
+    }
+};
+
+}
@@ -0,0 +1,115 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace visor::lib::utils {
+
+// bounded lock free queue (Vyukov), safe for any number of producers and consumers, so it serves both as SPSC and
+// MPSC ring. every slot carries a sequence number telling whose turn it is, which lets producers and the consumer
+// work on different slots without sharing anything but the two cursors. slots are filled and drained in place and
+// never destroyed until the queue is, so a T that owns memory (e.g. a vector) keeps its capacity between uses
+template <typename T>
+class RingQueue
+{
+    struct alignas(64) Slot {
+        std::atomic<size_t> seq;
+        T value;
+    };
+
+    const size_t _mask;
+    std::unique_ptr<Slot[]> _slots;
+    // kept on separate cache lines, producers only write _head and consumers only _tail
+    alignas(64) std::atomic<size_t> _head{0};
+    alignas(64) std::atomic<size_t> _tail{0};
+
+    static size_t _round_up(size_t capacity)
+    {
+        size_t size{2};
+        while (size < capacity) {
+            size <<= 1;
+        }
+        return size;
+    }
+
+public:
+    // capacity is rounded up to a power of two, of at least 2
+    explicit RingQueue(size_t capacity)
+        : _mask(_round_up(capacity) - 1)
+        , _slots(std::make_unique<Slot[]>(_mask + 1))
+    {
+        for (size_t i = 0; i <= _mask; ++i) {
+            _slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    RingQueue(const RingQueue &) = delete;
+    RingQueue &operator=(const RingQueue &) = delete;
+
+    size_t capacity() const
+    {
+        return _mask + 1;
+    }
+
+    // approximate while producers or consumers are running
+    size_t size() const
+    {
+        auto head = _head.load(std::memory_order_relaxed);
+        auto tail = _tail.load(std::memory_order_relaxed);
+        return head > tail ? head - tail : 0;
+    }
+
+    // calls fill(T &) on a free slot and publishes it. returns false, without calling fill, if the queue is full
+    template <typename F>
+    bool try_push(F &&fill)
+    {
+        auto pos = _head.load(std::memory_order_relaxed);
+        while (true) {
+            auto &slot = _slots[pos & _mask];
+            auto seq = slot.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    fill(slot.value);
+                    slot.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // calls consume(T &) on the oldest published slot and frees it. returns false if the queue is empty
+    template <typename F>
+    bool try_pop(F &&consume)
+    {
+        auto pos = _tail.load(std::memory_order_relaxed);
+        while (true) {
+            auto &slot = _slots[pos & _mask];
+            auto seq = slot.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    consume(slot.value);
+                    slot.seq.store(pos + _mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = _tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+};
+
+}
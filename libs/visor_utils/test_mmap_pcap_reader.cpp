@@ -0,0 +1,175 @@
+#include <catch2/catch_test_macros.hpp>
+#include "mmap_pcap_reader.h"
+#include "utils.h"
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+#include <pcapplusplus/Packet.h>
+#include <pcapplusplus/PcapFileDevice.h>
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace visor::lib::utils;
+
+static const std::string fixture_path = "../src/tests/fixtures/";
+
+TEST_CASE("mmap reader matches libpcap reader", "[utils][pcap_reader]")
+{
+    for (const auto &name : {"dns_ipv4_udp.pcap", "dns_ipv6_tcp.pcap", "nf9.pcap", "ipfix.pcap"}) {
+        auto file = fixture_path + name;
+        auto pcpp_reader = pcpp::IFileReaderDevice::getReader(file);
+        REQUIRE(pcpp_reader->open());
+
+        MmapPcapReader reader(file);
+        reader.open();
+        CHECK(!reader.is_pcapng());
+
+        pcpp::RawPacket expected;
+        size_t count{0};
+        while (pcpp_reader->getNextPacket(expected)) {
+            auto packet = reader.next_packet();
+            REQUIRE(packet != nullptr);
+            CHECK(packet->getRawDataLen() == expected.getRawDataLen());
+            CHECK(packet->getFrameLength() == expected.getFrameLength());
+            CHECK(packet->getLinkLayerType() == expected.getLinkLayerType());
+            CHECK(packet->getPacketTimeStamp().tv_sec == expected.getPacketTimeStamp().tv_sec);
+            CHECK(packet->getPacketTimeStamp().tv_nsec == expected.getPacketTimeStamp().tv_nsec);
+            CHECK(std::memcmp(packet->getRawData(), expected.getRawData(), expected.getRawDataLen()) == 0);
+            ++count;
+        }
+        CHECK(reader.next_packet() == nullptr);
+        CHECK(count > 0);
+
+        pcpp_reader->close();
+        delete pcpp_reader;
+    }
+}
+
+TEST_CASE("mmap reader reads pcapng", "[utils][pcap_reader]")
+{
+    auto ng_file = "mmap_pcap_reader_test.pcapng";
+    size_t written{0};
+    {
+        pcpp::PcapFileReaderDevice pcap_reader(fixture_path + "dns_ipv4_udp.pcap");
+        REQUIRE(pcap_reader.open());
+        pcpp::PcapNgFileWriterDevice ng_writer(ng_file);
+        REQUIRE(ng_writer.open());
+        pcpp::RawPacket packet;
+        while (pcap_reader.getNextPacket(packet)) {
+            ng_writer.writePacket(packet);
+            ++written;
+        }
+        ng_writer.close();
+        pcap_reader.close();
+    }
+
+    pcpp::PcapFileReaderDevice pcap_reader(fixture_path + "dns_ipv4_udp.pcap");
+    REQUIRE(pcap_reader.open());
+    MmapPcapReader reader(ng_file);
+    reader.open();
+    CHECK(reader.is_pcapng());
+
+    pcpp::RawPacket expected;
+    size_t count{0};
+    while (auto packet = reader.next_packet()) {
+        REQUIRE(pcap_reader.getNextPacket(expected));
+        CHECK(packet->getRawDataLen() == expected.getRawDataLen());
+        CHECK(packet->getPacketTimeStamp().tv_sec == expected.getPacketTimeStamp().tv_sec);
+        CHECK(packet->getPacketTimeStamp().tv_nsec == expected.getPacketTimeStamp().tv_nsec);
+        ++count;
+    }
+    CHECK(count == written);
+
+    reader.close();
+    pcap_reader.close();
+    std::remove(ng_file);
+}
+
+// every packet of the file, as its bytes and time stamp, read in num_ranges byte ranges one after the other
+static std::vector<std::pair<std::vector<uint8_t>, long>> read_ranges(const std::string &file, size_t num_ranges)
+{
+    std::vector<std::pair<std::vector<uint8_t>, long>> packets;
+    size_t size{0};
+    {
+        MmapPcapReader probe(file);
+        probe.open();
+        size = probe.file_size();
+    }
+    for (size_t i = 0; i < num_ranges; ++i) {
+        MmapPcapReader reader(file);
+        reader.open();
+        reader.set_range(size * i / num_ranges, size * (i + 1) / num_ranges);
+        while (auto packet = reader.next_packet()) {
+            packets.emplace_back(std::vector<uint8_t>(packet->getRawData(), packet->getRawData() + packet->getRawDataLen()), packet->getPacketTimeStamp().tv_nsec);
+        }
+    }
+    return packets;
+}
+
+TEST_CASE("mmap reader splits a file into byte ranges", "[utils][pcap_reader]")
+{
+    auto ng_file = "mmap_pcap_reader_ranges.pcapng";
+    {
+        pcpp::PcapFileReaderDevice pcap_reader(fixture_path + "dns_udp_tcp_random.pcap");
+        REQUIRE(pcap_reader.open());
+        pcpp::PcapNgFileWriterDevice ng_writer(ng_file);
+        REQUIRE(ng_writer.open());
+        pcpp::RawPacket packet;
+        while (pcap_reader.getNextPacket(packet)) {
+            ng_writer.writePacket(packet);
+        }
+        ng_writer.close();
+        pcap_reader.close();
+    }
+
+    // adjacent ranges meet on the same record, so together they read every packet once, in order
+    for (const auto &file : {fixture_path + "dns_ipv4_udp.pcap", fixture_path + "dns_udp_tcp_random.pcap", std::string(ng_file)}) {
+        auto whole = read_ranges(file, 1);
+        REQUIRE(whole.size() > 0);
+        for (size_t num_ranges : {2, 3, 7, 64}) {
+            INFO(file << " in " << num_ranges << " ranges");
+            CHECK(read_ranges(file, num_ranges) == whole);
+        }
+    }
+
+    // a range ending before the first record holds nothing
+    MmapPcapReader empty(fixture_path + "dns_ipv4_udp.pcap");
+    empty.open();
+    empty.set_range(0, 10);
+    CHECK(empty.next_packet() == nullptr);
+
+    std::remove(ng_file);
+}
+
+TEST_CASE("mmap reader applies bpf filter", "[utils][pcap_reader]")
+{
+    MmapPcapReader reader(fixture_path + "dns_udp_tcp_random.pcap");
+    reader.open();
+    reader.set_filter("tcp");
+
+    size_t count{0};
+    while (auto packet = reader.next_packet()) {
+        pcpp::Packet parsed(packet);
+        CHECK(parsed.isPacketOfType(pcpp::TCP));
+        ++count;
+    }
+    CHECK(count > 0);
+
+    MmapPcapReader bad_filter(fixture_path + "dns_udp_tcp_random.pcap");
+    bad_filter.open();
+    CHECK_THROWS_AS(bad_filter.set_filter("not a filter ("), UtilsException);
+}
+
+TEST_CASE("mmap reader rejects bad files", "[utils][pcap_reader]")
+{
+    MmapPcapReader missing(fixture_path + "does_not_exist.pcap");
+    CHECK_THROWS_AS(missing.open(), UtilsException);
+
+    MmapPcapReader not_pcap(fixture_path + "pktvisor-port-service-names.csv");
+    CHECK_THROWS_AS(not_pcap.open(), UtilsException);
+}
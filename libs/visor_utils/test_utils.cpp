@@ -1,5 +1,8 @@
 #include <catch2/catch_test_macros.hpp>
+#include "dedup_filter.h"
+#include "ring_queue.h"
 #include "utils.h"
+#include <thread>
 
 #ifdef _WIN32
 #include <ws2tcpip.h>
@@ -103,3 +106,150 @@ TEST_CASE("parseHostSpec", "[utils]")
     }
 }
 
+
+TEST_CASE("matchSubnet", "[utils]")
+{
+    IPv4subnetList hostIPv4;
+    IPv6subnetList hostIPv6;
+    parse_host_specs(split_str_to_vec_str("10.0.0.0/8,10.1.0.0/16,10.1.2.3/32,192.168.1.1/23,2001:db8::/32,2001:db8:1::/48", ','), hostIPv4, hostIPv6);
+
+    SECTION("IPv4 longest prefix")
+    {
+        CHECK(match_subnet(hostIPv4, pcpp::IPv4Address("10.2.0.1").toInt()).value()->str == "10.0.0.0/8");
+        CHECK(match_subnet(hostIPv4, pcpp::IPv4Address("10.1.200.1").toInt()).value()->str == "10.1.0.0/16");
+        CHECK(match_subnet(hostIPv4, pcpp::IPv4Address("10.1.2.3").toInt()).value()->str == "10.1.2.3/32");
+        CHECK(match_subnet(hostIPv4, pcpp::IPv4Address("192.168.0.200").toInt()).value()->str == "192.168.1.1/23");
+        CHECK_FALSE(match_subnet(hostIPv4, pcpp::IPv4Address("192.168.2.1").toInt()).has_value());
+        CHECK_FALSE(match_subnet(hostIPv4, pcpp::IPv4Address("11.0.0.1").toInt()).has_value());
+    }
+
+    SECTION("IPv6 longest prefix")
+    {
+        CHECK(match_subnet(hostIPv6, pcpp::IPv6Address("2001:db8:2::1").toBytes()).value()->str == "2001:db8::/32");
+        CHECK(match_subnet(hostIPv6, pcpp::IPv6Address("2001:db8:1:ffff::1").toBytes()).value()->str == "2001:db8:1::/48");
+        CHECK_FALSE(match_subnet(hostIPv6, pcpp::IPv6Address("2001:db9::1").toBytes()).has_value());
+        CHECK(match_subnet(hostIPv4, hostIPv6, "2001:db8:1::53"));
+        CHECK_FALSE(match_subnet(hostIPv4, hostIPv6, "::1"));
+    }
+
+    SECTION("wildcard and erase")
+    {
+        parse_host_specs({"0.0.0.0/0"}, hostIPv4, hostIPv6);
+        CHECK(match_subnet(hostIPv4, pcpp::IPv4Address("11.0.0.1").toInt()).value()->str == "0.0.0.0/0");
+        CHECK(match_subnet(hostIPv4, pcpp::IPv4Address("10.1.2.3").toInt()).value()->str == "10.1.2.3/32");
+        hostIPv4.erase(hostIPv4.begin() + 1);
+        CHECK(hostIPv4.size() == 4);
+        CHECK(match_subnet(hostIPv4, pcpp::IPv4Address("10.1.200.1").toInt()).value()->str == "10.0.0.0/8");
+        CHECK(match_subnet(hostIPv4, pcpp::IPv4Address("11.0.0.1").toInt()).value()->str == "0.0.0.0/0");
+        hostIPv4.clear();
+        CHECK_FALSE(match_subnet(hostIPv4, pcpp::IPv4Address("10.1.2.3").toInt()).has_value());
+    }
+
+    SECTION("duplicate prefix keeps the first")
+    {
+        parse_host_specs({"10.1.255.255/16"}, hostIPv4, hostIPv6);
+        CHECK(match_subnet(hostIPv4, pcpp::IPv4Address("10.1.200.1").toInt()).value()->str == "10.1.0.0/16");
+    }
+}
+
+TEST_CASE("RingQueue", "[utils]")
+{
+    SECTION("bounded and in order")
+    {
+        RingQueue<int> queue(3);
+        CHECK(queue.capacity() == 4);
+        for (int i = 0; i < 4; ++i) {
+            CHECK(queue.try_push([i](int &slot) { slot = i; }));
+        }
+        CHECK_FALSE(queue.try_push([](int &slot) { slot = 99; }));
+        CHECK(queue.size() == 4);
+        for (int i = 0; i < 4; ++i) {
+            int value{-1};
+            CHECK(queue.try_pop([&value](int &slot) { value = slot; }));
+            CHECK(value == i);
+        }
+        CHECK_FALSE(queue.try_pop([](int &) {}));
+        CHECK(queue.size() == 0);
+    }
+
+    SECTION("multiple producers")
+    {
+        static constexpr uint64_t PER_PRODUCER = 20000;
+        RingQueue<uint64_t> queue(64);
+        std::vector<std::thread> producers;
+        for (uint64_t p = 0; p < 4; ++p) {
+            producers.emplace_back([&queue, p] {
+                for (uint64_t i = 0; i < PER_PRODUCER; ++i) {
+                    while (!queue.try_push([p, i](uint64_t &slot) { slot = p * PER_PRODUCER + i; })) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+        // each producer's values arrive in the order it pushed them
+        std::vector<uint64_t> next(4, 0);
+        uint64_t popped{0};
+        bool ordered{true};
+        while (popped < 4 * PER_PRODUCER) {
+            auto got = queue.try_pop([&](uint64_t &slot) {
+                auto p = slot / PER_PRODUCER;
+                ordered = ordered && slot % PER_PRODUCER == next[p];
+                ++next[p];
+                ++popped;
+            });
+            if (!got) {
+                std::this_thread::yield();
+            }
+        }
+        for (auto &producer : producers) {
+            producer.join();
+        }
+        CHECK(ordered);
+        CHECK(queue.size() == 0);
+    }
+}
+
+TEST_CASE("DedupFilter", "[utils]")
+{
+    static constexpr uint64_t MS = 1'000'000;
+
+    SECTION("within the window")
+    {
+        DedupFilter filter(1024, 10 * MS);
+        CHECK(filter.capacity() == 1024);
+        CHECK_FALSE(filter.seen(42, 0));
+        CHECK(filter.seen(42, 5 * MS));
+        CHECK_FALSE(filter.seen(43, 5 * MS));
+        // copies can arrive slightly out of order
+        CHECK(filter.seen(43, 1 * MS));
+        // the window counts from the first sighting
+        CHECK_FALSE(filter.seen(42, 11 * MS));
+        CHECK(filter.seen(42, 12 * MS));
+    }
+
+    SECTION("hash")
+    {
+        const uint8_t a[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+        const uint8_t b[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 12};
+        CHECK(DedupFilter::hash(a, sizeof(a)) == DedupFilter::hash(a, sizeof(a)));
+        CHECK(DedupFilter::hash(a, sizeof(a)) != DedupFilter::hash(b, sizeof(b)));
+        CHECK(DedupFilter::hash(a, sizeof(a)) != DedupFilter::hash(a, sizeof(a) - 1));
+        CHECK(DedupFilter::hash(a, sizeof(a), 1) != DedupFilter::hash(a, sizeof(a), 2));
+    }
+
+    SECTION("bounded memory")
+    {
+        // far more digests than entries within one window: the filter forgets some, but never grows
+        DedupFilter filter(64, 1000 * MS);
+        uint64_t remembered{0};
+        for (uint64_t i = 1; i <= 10000; ++i) {
+            filter.seen(DedupFilter::hash(reinterpret_cast<const uint8_t *>(&i), sizeof(i)), i);
+        }
+        for (uint64_t i = 9937; i <= 10000; ++i) {
+            remembered += filter.seen(DedupFilter::hash(reinterpret_cast<const uint8_t *>(&i), sizeof(i)), 10001);
+        }
+        CHECK(filter.capacity() == 64);
+        CHECK(remembered > 0);
+        CHECK(remembered <= 64);
+    }
+}
@@ -23,52 +23,23 @@ static uint8_t reverse_bits(uint8_t n)
     return bit_reverse_masks[n];
 }
 
-std::optional<IPv4subnetList::const_iterator> match_subnet(IPv4subnetList &ipv4_list, uint32_t ipv4_val)
+std::optional<IPv4subnetList::const_iterator> match_subnet(const IPv4subnetList &ipv4_list, uint32_t ipv4_val)
 {
     if (ipv4_val && !ipv4_list.empty()) {
-        in_addr ipv4{};
-        std::memcpy(&ipv4, &ipv4_val, sizeof(in_addr));
-        for (IPv4subnetList::const_iterator it = ipv4_list.begin(); it != ipv4_list.end(); ++it) {
-            uint8_t cidr = it->cidr;
-            if (cidr == 0) {
-                return it;
-            }
-            if (!get_subnet((ipv4.s_addr ^ it->addr.s_addr), cidr)) {
-                return it;
-            }
-        }
+        return ipv4_list.match(reinterpret_cast<const uint8_t *>(&ipv4_val));
     }
     return std::nullopt;
 }
 
-std::optional<IPv6subnetList::const_iterator> match_subnet(IPv6subnetList &ipv6_list, const uint8_t *ipv6_val)
+std::optional<IPv6subnetList::const_iterator> match_subnet(const IPv6subnetList &ipv6_list, const uint8_t *ipv6_val)
 {
     if (ipv6_val && !ipv6_list.empty()) {
-        in6_addr ipv6{};
-        std::memcpy(&ipv6, ipv6_val, sizeof(in6_addr));
-        for (IPv6subnetList::const_iterator it = ipv6_list.begin(); it != ipv6_list.end(); ++it) {
-            uint8_t prefixLength = it->cidr;
-            auto network = it->addr;
-            uint8_t compareByteCount = prefixLength / 8;
-            uint8_t compareBitCount = prefixLength % 8;
-            bool result = false;
-            if (compareByteCount > 0) {
-                result = std::memcmp(&network.s6_addr, &ipv6.s6_addr, compareByteCount) == 0;
-            }
-            if ((result || prefixLength < 8) && compareBitCount > 0) {
-                uint8_t subSubnetByte = network.s6_addr[compareByteCount] >> (8 - compareBitCount);
-                uint8_t subThisByte = ipv6.s6_addr[compareByteCount] >> (8 - compareBitCount);
-                result = subSubnetByte == subThisByte;
-            }
-            if (result) {
-                return it;
-            }
-        }
+        return ipv6_list.match(ipv6_val);
     }
     return std::nullopt;
 }
 
-bool match_subnet(IPv4subnetList &ipv4_list, IPv6subnetList &ipv6_list, const std::string &ip_val)
+bool match_subnet(const IPv4subnetList &ipv4_list, const IPv6subnetList &ipv6_list, const std::string &ip_val)
 {
     pcpp::IPv4Address ipv4;
     pcpp::IPv6Address ipv6;
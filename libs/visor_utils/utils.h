@@ -19,6 +19,7 @@
 #ifdef __GNUC__
 #pragma GCC diagnostic pop
 #endif
+#include "prefix_trie.h"
 #include <array>
 #include <optional>
 #include <stdexcept>
@@ -52,17 +53,102 @@ struct IPv6subnet {
     uint8_t cidr;
     std::string str;
 };
-typedef std::vector<IPv4subnet> IPv4subnetList;
-typedef std::vector<IPv6subnet> IPv6subnetList;
+
+// ordered list of subnets, indexed by a prefix trie for longest prefix match. elements are read only, changes go
+// through push_back, erase and clear so the trie stays in sync
+template <typename Subnet>
+class SubnetList
+{
+    std::vector<Subnet> _subnets;
+    PrefixTrie<sizeof(Subnet::addr)> _trie;
+
+    void _index(size_t i)
+    {
+        _trie.insert(reinterpret_cast<const uint8_t *>(&_subnets[i].addr), _subnets[i].cidr, static_cast<uint32_t>(i));
+    }
+
+public:
+    using value_type = Subnet;
+    using const_iterator = typename std::vector<Subnet>::const_iterator;
+
+    void push_back(const Subnet &subnet)
+    {
+        _subnets.push_back(subnet);
+        _index(_subnets.size() - 1);
+    }
+
+    void push_back(Subnet &&subnet)
+    {
+        _subnets.push_back(std::move(subnet));
+        _index(_subnets.size() - 1);
+    }
+
+    const_iterator erase(const_iterator pos)
+    {
+        auto offset = pos - _subnets.cbegin();
+        _subnets.erase(pos);
+        // indexes past pos have shifted, start over
+        _trie.clear();
+        for (size_t i = 0; i < _subnets.size(); ++i) {
+            _index(i);
+        }
+        return _subnets.cbegin() + offset;
+    }
+
+    void clear()
+    {
+        _subnets.clear();
+        _trie.clear();
+    }
+
+    // longest prefix of addr in the list; of equal prefixes, the one added first
+    std::optional<const_iterator> match(const uint8_t *addr) const
+    {
+        auto i = _trie.lookup(addr);
+        if (i == decltype(_trie)::NONE) {
+            return std::nullopt;
+        }
+        return _subnets.cbegin() + i;
+    }
+
+    const_iterator begin() const
+    {
+        return _subnets.cbegin();
+    }
+
+    const_iterator end() const
+    {
+        return _subnets.cend();
+    }
+
+    const Subnet &operator[](size_t i) const
+    {
+        return _subnets[i];
+    }
+
+    size_t size() const
+    {
+        return _subnets.size();
+    }
+
+    bool empty() const
+    {
+        return _subnets.empty();
+    }
+};
+
+typedef SubnetList<IPv4subnet> IPv4subnetList;
+typedef SubnetList<IPv6subnet> IPv6subnetList;
 
 bool ipv4_to_sockaddr(const pcpp::IPv4Address &ip, struct sockaddr_in *sa);
 bool ipv6_to_sockaddr(const pcpp::IPv6Address &ip, struct sockaddr_in6 *sa);
 
 std::vector<std::string> split_str_to_vec_str(const std::string &spec, const char &delimiter);
 void parse_host_specs(const std::vector<std::string> &host_list, IPv4subnetList &ipv4_list, IPv6subnetList &ipv6_list);
-std::optional<IPv4subnetList::const_iterator> match_subnet(IPv4subnetList &ipv4_list, uint32_t ipv4_val);
-std::optional<IPv6subnetList::const_iterator> match_subnet(IPv6subnetList &ipv6_list, const uint8_t *ipv6_val);
-bool match_subnet(IPv4subnetList &ipv4_list, IPv6subnetList &ipv6_list, const std::string &ip_val);
+// longest prefix match, ipv4_val in network byte order
+std::optional<IPv4subnetList::const_iterator> match_subnet(const IPv4subnetList &ipv4_list, uint32_t ipv4_val);
+std::optional<IPv6subnetList::const_iterator> match_subnet(const IPv6subnetList &ipv6_list, const uint8_t *ipv6_val);
+bool match_subnet(const IPv4subnetList &ipv4_list, const IPv6subnetList &ipv6_list, const std::string &ip_val);
 uint8_t get_cidr(uint32_t mask);
 uint8_t get_cidr(uint8_t *addr, size_t size);
 uint32_t get_subnet(uint32_t addr, uint8_t cidr);
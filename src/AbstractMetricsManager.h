@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <deque>
@@ -181,7 +182,12 @@ public:
             std::unique_lock w_lock(_base_mutex);
             _num_events += other._num_events;
             _num_samples += other._num_samples;
-            _period_length += other.period_length();
+            // SUM adds up what several handlers saw in the same period, DEFAULT consecutive periods of one handler
+            if (agg_operator == Metric::Aggregate::SUM) {
+                _period_length = std::max(_period_length, other.period_length());
+            } else {
+                _period_length += other.period_length();
+            }
             if (other._start_tstamp.tv_sec < _start_tstamp.tv_sec) {
                 _start_tstamp.tv_sec = other._start_tstamp.tv_sec;
             }
@@ -194,6 +200,17 @@ public:
         specialized_merge(other, agg_operator);
     }
 
+    // share of the events in this bucket that were deep sampled, in percent. deep sampled counts scale up to the
+    // whole bucket by this rate, which may have changed during the bucket when the deep sample rate is adaptive
+    double effective_deep_sample_rate() const
+    {
+        std::shared_lock r_lock(_base_mutex);
+        if (!_num_events.value()) {
+            return 100.0;
+        }
+        return 100.0 * static_cast<double>(_num_samples.value()) / static_cast<double>(_num_events.value());
+    }
+
     void new_event(bool deep)
     {
         // note, currently not enforcing _read_only
@@ -243,7 +260,13 @@ private:
      * sampling
      */
     jsf32 _rng;
-    uint32_t _deep_sample_rate{100};
+    // atomic so the event path can read it without a lock while adapt_deep_sample_rate() changes it
+    std::atomic<uint32_t> _deep_sample_rate{100};
+    // the deep sample rate adapts between these bounds, unless they are equal
+    uint32_t _deep_sample_rate_min{100};
+    uint32_t _deep_sample_rate_max{100};
+    // deep_sample_mode: flow, see new_flow_event()
+    bool _flow_sampling{false};
     size_t _topn_count{10};
     uint64_t _topn_percentile_threshold{0};
 
@@ -308,6 +331,11 @@ public:
     static const unsigned int PERIOD_SEC = 60;
     static const unsigned int MERGE_CACHE_TTL_MS = 1000;
 
+    // input load, in percent, above which the adaptive deep sample rate is halved and below which it grows again
+    static const uint32_t DEEP_SAMPLE_LOAD_HIGH = 75;
+    static const uint32_t DEEP_SAMPLE_LOAD_LOW = 25;
+    static const uint32_t DEEP_SAMPLE_RATE_STEP = 5;
+
 protected:
     /**
      * the "base" event method that should be called on every event before specialized event functionality. sampling will be
@@ -318,9 +346,53 @@ protected:
     void new_event(timespec stamp, bool sample = true)
     {
         // CRITICAL EVENT PATH
-        if (sample && _deep_sample_rate != 100) {
-            _deep_sampling_now.store((_rng() % 100U < _deep_sample_rate), std::memory_order_relaxed);
+        if (sample) {
+            auto deep_sample_rate = _deep_sample_rate.load(std::memory_order_relaxed);
+            if (deep_sample_rate != 100) {
+                _deep_sampling_now.store((_rng() % 100U < deep_sample_rate), std::memory_order_relaxed);
+            } else {
+                _deep_sampling_now.store(true, std::memory_order_relaxed);
+            }
+        }
+        _base_event(stamp);
+    }
+
+    /**
+     * like new_event(), but with deep_sample_mode: flow the sampling decision is a hash of flow_key rather than chance.
+     * handlers pass the same key for every event of a transaction or connection, e.g. the flow key mixed with the DNS
+     * transaction id, so it is deep sampled or skipped as a whole. since the decision compares the hash with the rate,
+     * lowering the rate only drops flows from the sample and never swaps them for others
+     *
+     * @param stamp time stamp of the event
+     * @param flow_key identifies the transaction or connection the event belongs to
+     */
+    void new_flow_event(timespec stamp, uint32_t flow_key)
+    {
+        // CRITICAL EVENT PATH
+        auto deep_sample_rate = _deep_sample_rate.load(std::memory_order_relaxed);
+        if (deep_sample_rate == 100) {
+            _deep_sampling_now.store(true, std::memory_order_relaxed);
+        } else if (_flow_sampling) {
+            _deep_sampling_now.store((_flow_hash(flow_key) % 100U < deep_sample_rate), std::memory_order_relaxed);
+        } else {
+            _deep_sampling_now.store((_rng() % 100U < deep_sample_rate), std::memory_order_relaxed);
         }
+        _base_event(stamp);
+    }
+
+    // murmur3 finalizer, flow keys of neighbouring flows may only differ in a few bits
+    static uint32_t _flow_hash(uint32_t key)
+    {
+        key ^= key >> 16;
+        key *= 0x85ebca6b;
+        key ^= key >> 13;
+        key *= 0xc2b2ae35;
+        key ^= key >> 16;
+        return key;
+    }
+
+    void _base_event(timespec stamp)
+    {
         std::shared_lock rlb(_base_mutex);
         bool will_shift = _num_periods > 1 && stamp.tv_sec >= _next_shift_tstamp.tv_sec;
         rlb.unlock();
@@ -355,13 +427,26 @@ public:
         , _next_shift_tstamp{0, 0}
     {
         if (window_config->config_exists("deep_sample_rate")) {
-            _deep_sample_rate = window_config->config_get<uint64_t>("deep_sample_rate");
+            _deep_sample_rate_max = window_config->config_get<uint64_t>("deep_sample_rate");
+        }
+        if (_deep_sample_rate_max > 100) {
+            _deep_sample_rate_max = 100;
+        }
+        if (_deep_sample_rate_max < 1) {
+            _deep_sample_rate_max = 1;
         }
-        if (_deep_sample_rate > 100) {
-            _deep_sample_rate = 100;
+        // with a minimum, deep_sample_rate becomes the upper bound of an adaptive rate
+        _deep_sample_rate_min = _deep_sample_rate_max;
+        if (window_config->config_exists("deep_sample_rate_min")) {
+            _deep_sample_rate_min = std::clamp<uint32_t>(window_config->config_get<uint64_t>("deep_sample_rate_min"), 1, _deep_sample_rate_max);
         }
-        if (_deep_sample_rate < 1) {
-            _deep_sample_rate = 1;
+        _deep_sample_rate = _deep_sample_rate_max;
+        if (window_config->config_exists("deep_sample_mode")) {
+            auto mode = window_config->config_get<std::string>("deep_sample_mode");
+            if (mode != "random" && mode != "flow") {
+                throw ConfigException("invalid deep_sample_mode '" + mode + "', valid modes are: random, flow");
+            }
+            _flow_sampling = (mode == "flow");
         }
 
         if (window_config->config_exists("_internal_tap_name")) {
@@ -404,8 +489,37 @@ public:
 
     unsigned int deep_sample_rate() const
     {
-        std::shared_lock rl(_base_mutex);
-        return _deep_sample_rate;
+        return _deep_sample_rate.load(std::memory_order_relaxed);
+    }
+
+    std::pair<unsigned int, unsigned int> deep_sample_rate_bounds() const
+    {
+        return {_deep_sample_rate_min, _deep_sample_rate_max};
+    }
+
+    bool flow_sampling() const
+    {
+        return _flow_sampling;
+    }
+
+    /**
+     * adapt the deep sample rate to the load of the input, if it has bounds: halve it while the input is close to
+     * losing events, and raise it step by step once there is headroom again
+     *
+     * @param load how close the input is to losing events, in percent
+     */
+    void adapt_deep_sample_rate(uint32_t load)
+    {
+        if (_deep_sample_rate_min == _deep_sample_rate_max) {
+            return;
+        }
+        auto rate = _deep_sample_rate.load(std::memory_order_relaxed);
+        if (load >= DEEP_SAMPLE_LOAD_HIGH) {
+            rate = std::max(rate / 2, _deep_sample_rate_min);
+        } else if (load < DEEP_SAMPLE_LOAD_LOW) {
+            rate = std::min(rate + DEEP_SAMPLE_RATE_STEP, _deep_sample_rate_max);
+        }
+        _deep_sample_rate.store(rate, std::memory_order_relaxed);
     }
 
     auto start_tstamp() const
@@ -499,11 +613,12 @@ public:
 
         j[key]["period"]["start_ts"] = _metric_buckets.at(period)->start_tstamp().tv_sec;
         j[key]["period"]["length"] = _metric_buckets.at(period)->period_length();
+        j[key]["period"]["deep_sample_rate"] = _metric_buckets.at(period)->effective_deep_sample_rate();
 
         _metric_buckets.at(period)->to_json(j[key]);
     }
 
-    void window_single_prometheus(std::stringstream &out, uint64_t period = 0, Metric::LabelMap add_labels = {}) const
+    void window_single_prometheus(std::stringstream &out, uint64_t period = 0, Metric::LabelMap add_labels = {}, const std::string &name_prefix = {}) const
     {
         std::shared_lock rl(_base_mutex);
         std::shared_lock rbl(_bucket_mutex);
@@ -527,10 +642,11 @@ public:
             add_labels["tap"] = _tap_name;
         }
 
+        Metric::NamePrefix prefix(name_prefix);
         _metric_buckets.at(period)->to_prometheus(out, add_labels);
     }
 
-    void window_single_opentelemetry(metrics::v1::ScopeMetrics &scope, uint64_t period = 0, Metric::LabelMap add_labels = {}) const
+    void window_single_opentelemetry(metrics::v1::ScopeMetrics &scope, uint64_t period = 0, Metric::LabelMap add_labels = {}, const std::string &name_prefix = {}) const
     {
         std::shared_lock rl(_base_mutex);
         std::shared_lock rbl(_bucket_mutex);
@@ -559,10 +675,11 @@ public:
         if (!end_ts.tv_sec) {
             timespec_get(&end_ts, TIME_UTC);
         }
+        Metric::NamePrefix prefix(name_prefix);
         bucket->to_opentelemetry(scope, start_ts, end_ts, add_labels);
     }
 
-    void window_external_opentelemetry(metrics::v1::ScopeMetrics &scope, AbstractMetricsBucket *bucket, Metric::LabelMap add_labels = {}) const
+    void window_external_opentelemetry(metrics::v1::ScopeMetrics &scope, AbstractMetricsBucket *bucket, Metric::LabelMap add_labels = {}, const std::string &name_prefix = {}) const
     {
         if (_groups && _groups->none()) {
             return;
@@ -574,15 +691,17 @@ public:
         if (!end_ts.tv_sec) {
             timespec_get(&end_ts, TIME_UTC);
         }
+        Metric::NamePrefix prefix(name_prefix);
         sbucket->to_opentelemetry(scope, start_ts, end_ts, add_labels);
     }
 
-    void window_external_prometheus(std::stringstream &out, AbstractMetricsBucket *bucket, Metric::LabelMap add_labels = {}) const
+    void window_external_prometheus(std::stringstream &out, AbstractMetricsBucket *bucket, Metric::LabelMap add_labels = {}, const std::string &name_prefix = {}) const
     {
         if (_groups && _groups->none()) {
             return;
         }
         // static because caller guarantees only our own bucket type
+        Metric::NamePrefix prefix(name_prefix);
         static_cast<MetricsBucketClass *>(bucket)->to_prometheus(out, add_labels);
     }
 
@@ -595,6 +714,7 @@ public:
         auto custom = static_cast<MetricsBucketClass *>(bucket);
         j[key]["period"]["start_ts"] = custom->start_tstamp().tv_sec;
         j[key]["period"]["length"] = custom->period_length();
+        j[key]["period"]["deep_sample_rate"] = custom->effective_deep_sample_rate();
         custom->to_json(j[key]);
     }
 
@@ -640,6 +760,7 @@ public:
 
         j[key]["period"]["start_ts"] = merged.start_tstamp().tv_sec;
         j[key]["period"]["length"] = merged.period_length();
+        j[key]["period"]["deep_sample_rate"] = merged.effective_deep_sample_rate();
 
         merged.to_json(j[key]);
 
@@ -668,7 +789,15 @@ public:
         }
 
         auto merged = std::make_unique<MetricsBucketClass>();
-        merged->merge(*_metric_buckets[period].get());
+        if (_recorded_stream) {
+            merged->set_recorded_stream();
+        }
+        auto &source = *_metric_buckets[period];
+        merged->merge(source);
+        // a copy of a period that is over keeps its length, rather than counting up to now
+        if (source.read_only()) {
+            merged->set_read_only(source.end_tstamp());
+        }
 
         return merged;
     }
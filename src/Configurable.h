@@ -188,38 +188,46 @@ public:
         }
     }
 
-    const std::string config_hash() const
+    // every key with the type and value it holds, each length prefixed, so two configs only have the same signature
+    // if they hold the same values
+    const std::string config_signature() const
     {
         std::shared_lock lock(_config_mutex);
+        auto field = [](const std::string &s) { return fmt::format("{}:{}", s.size(), s); };
         std::vector<std::string> key_values;
         for (const auto &[key, value] : _config) {
-            std::visit([&key_values, key = key](auto &&arg) {
-                std::string data;
-                data += key;
+            std::string data = field(key) + field(std::to_string(value.index()));
+            std::visit([&data, &field](auto &&arg) {
                 using T = std::decay_t<decltype(arg)>;
                 if constexpr (std::is_same_v<T, StringList>) {
                     auto temp_list = arg;
                     std::sort(temp_list.begin(), temp_list.end());
+                    data += field(std::to_string(temp_list.size()));
                     for (const auto &s : temp_list) {
-                        data += s;
+                        data += field(s);
                     }
                 } else if constexpr (std::is_same_v<T, std::string>) {
-                    data += arg;
+                    data += field(arg);
                 } else if constexpr (std::is_same_v<T, std::shared_ptr<Configurable>>) {
-                    data += arg->config_hash();
+                    data += field(arg->config_signature());
                 } else {
-                    data += std::to_string(arg);
+                    data += field(std::to_string(arg));
                 }
-                key_values.push_back(data);
             },
                 value);
+            key_values.push_back(data);
         }
         std::sort(key_values.begin(), key_values.end());
-        std::string hash;
+        std::string signature;
         for (auto &data : key_values) {
-            hash += data;
+            signature += data;
         }
-        auto h1 = std::hash<std::string>{}(hash);
+        return signature;
+    }
+
+    const std::string config_hash() const
+    {
+        auto h1 = std::hash<std::string>{}(config_signature());
         std::stringstream string_stream;
         string_stream << std::hex << h1;
         return string_stream.str();
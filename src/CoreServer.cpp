@@ -5,6 +5,7 @@
 #include "CoreServer.h"
 #include "HandlerManager.h"
 #include "Metrics.h"
+#include "Numa.h"
 #include "Policies.h"
 #include "Taps.h"
 #include "visor_config.h"
@@ -80,6 +81,17 @@ void CoreServer::_setup_routes(const PrometheusConfig &prom_config)
         try {
             j["app"]["version"] = VISOR_VERSION_NUM;
             j["app"]["up_time_min"] = float(std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() - _start_time).count()) / 60;
+            // where each thread runs, to check capture and handler threads share the NUMA node of their NIC
+            j["app"]["threads"] = json::array();
+            for (const auto &placement : numa::process_placements()) {
+                json thread;
+                thread["tid"] = placement.tid;
+                thread["name"] = placement.name;
+                thread["cpu"] = placement.cpu;
+                thread["numa_node"] = placement.node;
+                thread["cpus_allowed"] = placement.cpus_allowed;
+                j["app"]["threads"].push_back(thread);
+            }
             res.set_content(j.dump(), "text/json");
         } catch (const std::exception &e) {
             res.status = 500;
@@ -351,6 +363,44 @@ void CoreServer::_setup_routes(const PrometheusConfig &prom_config)
             res.set_content(j.dump(), "text/json");
         }
     });
+    // applies a changed policy, keeping what did not change running, see PolicyManager::reload()
+    _svr.Put(fmt::format("/api/v1/policies/({})", AbstractModule::MODULE_ID_REGEX).c_str(), [&](const httplib::Request &req, httplib::Response &res) {
+        json j = json::object();
+        auto name = req.matches[1];
+        if (!_registry->policy_manager()->module_exists(name)) {
+            res.status = 404;
+            j["error"] = "policy does not exists";
+            res.set_content(j.dump(), "text/json");
+            return;
+        }
+        if (!req.has_header("Content-Type")) {
+            res.status = 400;
+            j["error"] = "must include Content-Type header";
+            res.set_content(j.dump(), "text/json");
+            return;
+        }
+        auto content_type = req.get_header_value("Content-Type");
+        if (content_type != "application/x-yaml" && content_type != "application/json") {
+            res.status = 400;
+            j["error"] = "Content-Type not supported";
+            res.set_content(j.dump(), "text/json");
+            return;
+        }
+        try {
+            auto policy = _registry->policy_manager()->reload_from_str(name, req.body);
+            policy->info_json(j[policy->name()]);
+            res.status = 200;
+            res.set_content(j.dump(), "text/json");
+        } catch (const std::invalid_argument &e) {
+            res.status = 422;
+            j["error"] = e.what();
+            res.set_content(j.dump(), "text/json");
+        } catch (const std::exception &e) {
+            res.status = 500;
+            j["error"] = e.what();
+            res.set_content(j.dump(), "text/json");
+        }
+    });
     _svr.Delete(fmt::format("/api/v1/policies/({})", AbstractModule::MODULE_ID_REGEX).c_str(), [&](const httplib::Request &req, httplib::Response &res) {
         json j = json::object();
         auto name = req.matches[1];
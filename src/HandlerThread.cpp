@@ -0,0 +1,106 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "HandlerThread.h"
+#include "ThreadName.h"
+#include <future>
+#include <spdlog/spdlog.h>
+
+namespace visor {
+
+HandlerThread::HandlerThread(const HandlerThreadConfig &config, const std::string &schema, const std::string &input_name)
+    : _config(config)
+{
+    _thread = std::thread([this, schema, input_name] {
+        _run(schema, input_name);
+    });
+}
+
+HandlerThread::~HandlerThread()
+{
+    {
+        std::unique_lock lock(_mutex);
+        _running = false;
+    }
+    _cv.notify_one();
+    _thread.join();
+}
+
+bool HandlerThread::post(Task task, bool droppable)
+{
+    {
+        std::unique_lock lock(_mutex);
+        if (droppable && _queue.size() >= _config.queue_size) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        _queue.emplace_back(std::move(task), clock::now());
+    }
+    _cv.notify_one();
+    return true;
+}
+
+void HandlerThread::call(Task task)
+{
+    if (std::this_thread::get_id() == _thread.get_id()) {
+        task();
+        return;
+    }
+    std::promise<void> done;
+    auto finished = done.get_future();
+    {
+        std::unique_lock lock(_mutex);
+        _queue.emplace_back([&task, &done] {
+            task();
+            done.set_value();
+        },
+            clock::now());
+    }
+    _cv.notify_one();
+    finished.wait();
+}
+
+void HandlerThread::_run(const std::string &schema, const std::string &input_name)
+{
+    thread::change_self_name(schema, input_name);
+    {
+        std::unique_lock lock(_mutex);
+        _pinned = thread::pin_self(_config.cpus);
+    }
+    if (!_config.cpus.empty() && !_pinned) {
+        spdlog::get("visor")->warn("policy [{}]: unable to pin handler thread of input {} to cpu_affinity", _config.name, input_name);
+    }
+
+    // events are taken off the queue in batches, so posting rarely waits for a delivery in progress
+    std::deque<std::pair<Task, clock::time_point>> batch;
+    while (true) {
+        {
+            std::unique_lock lock(_mutex);
+            _cv.wait(lock, [this] { return !_queue.empty() || !_running; });
+            if (_queue.empty()) {
+                break;
+            }
+            batch.swap(_queue);
+        }
+        auto now = clock::now();
+        _lag_us.store(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - batch.front().second).count()), std::memory_order_relaxed);
+        for (auto &entry : batch) {
+            entry.first();
+        }
+        batch.clear();
+    }
+}
+
+void HandlerThread::info_json(json &j) const
+{
+    _config.info_json(j);
+    std::unique_lock lock(_mutex);
+    j["size"] = _config.queue_size;
+    j["depth"] = _queue.size();
+    j["dropped"] = _dropped.load(std::memory_order_relaxed);
+    j["lag_us"] = _lag_us.load(std::memory_order_relaxed);
+    j["pinned"] = _pinned;
+}
+
+}
@@ -0,0 +1,84 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <nlohmann/json.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace visor {
+
+using json = nlohmann::json;
+
+// what a policy asked for with its handler_queue_size and cpu_affinity configs: its handlers run on a thread of their
+// own, fed through a bounded queue, instead of on the thread of the input
+struct HandlerThreadConfig {
+    static constexpr uint64_t DEFAULT_QUEUE_SIZE = 1 << 16;
+    static constexpr uint64_t MAX_QUEUE_SIZE = 1 << 20;
+
+    // the policy
+    std::string name;
+    uint64_t queue_size{DEFAULT_QUEUE_SIZE};
+    // empty means any
+    std::vector<uint32_t> cpus;
+
+    void info_json(json &j) const
+    {
+        j["policy"] = name;
+        j["cpu_affinity"] = cpus;
+    }
+};
+
+// runs the events of one event proxy on a thread of its own. the input posts a copy of every event, which is dropped
+// and counted when the queue is full, so a slow policy loses its own events instead of holding up the input and every
+// other policy on it. inputs with their own queueing (pcap) do not use this
+class HandlerThread
+{
+public:
+    using Task = std::function<void()>;
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    HandlerThreadConfig _config;
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+    std::deque<std::pair<Task, clock::time_point>> _queue;
+    bool _running{true};
+    std::atomic<uint64_t> _dropped{0};
+    // how long the oldest event of the last batch taken off the queue waited in it
+    std::atomic<uint64_t> _lag_us{0};
+    bool _pinned{false};
+    std::thread _thread;
+
+    void _run(const std::string &schema, const std::string &input_name);
+
+public:
+    HandlerThread(const HandlerThreadConfig &config, const std::string &schema, const std::string &input_name);
+    // delivers what is still queued, then joins
+    ~HandlerThread();
+    HandlerThread(const HandlerThread &) = delete;
+    HandlerThread &operator=(const HandlerThread &) = delete;
+
+    // false if the queue is full and the event was dropped. events the handlers can not do without, like heartbeats,
+    // are not droppable and queued regardless
+    bool post(Task task, bool droppable = true);
+
+    // runs the task on the thread, after what is queued, and waits for it. never dropped, for events whose arguments
+    // do not outlive the call
+    void call(Task task);
+
+    void info_json(json &j) const;
+};
+
+}
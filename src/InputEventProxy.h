@@ -5,6 +5,9 @@
 #pragma once
 
 #include "AbstractModule.h"
+#include "HandlerThread.h"
+#include <memory>
+#include <optional>
 #include <sigslot/signal.hpp>
 
 namespace visor {
@@ -20,6 +23,14 @@ protected:
     std::string _input_name;
     std::string _filter_hash;
 
+    // set for the proxy of a policy with a handler thread, see InputStream::add_event_proxy(). inputs that queue
+    // events themselves honour the config on their own, the others start _handler_thread and post events to it
+    std::optional<HandlerThreadConfig> _thread_config;
+    std::unique_ptr<HandlerThread> _handler_thread;
+
+    // set for a proxy that only gets the events of one shard of the input, see InputStream::handler_shards()
+    std::optional<size_t> _shard;
+
 public:
     InputEventProxy(const std::string &name, const Configurable &filter)
         : _input_name(name)
@@ -39,16 +50,83 @@ public:
         return _filter_hash;
     }
 
+    void set_thread_config(const HandlerThreadConfig &config)
+    {
+        _thread_config = config;
+    }
+
+    const std::optional<HandlerThreadConfig> &thread_config() const
+    {
+        return _thread_config;
+    }
+
+    void set_shard(size_t shard)
+    {
+        _shard = shard;
+    }
+
+    const std::optional<size_t> &shard() const
+    {
+        return _shard;
+    }
+
+    void start_handler_thread(const std::string &schema)
+    {
+        if (_thread_config && !_handler_thread) {
+            _handler_thread = std::make_unique<HandlerThread>(*_thread_config, schema, _input_name);
+        }
+    }
+
+    // delivers what is still queued and joins the handler thread. proxies using one call this in their destructor,
+    // since the queued events still need the signals of the derived class
+    void stop_handler_thread()
+    {
+        _handler_thread.reset();
+    }
+
+    const HandlerThread *handler_thread() const
+    {
+        return _handler_thread.get();
+    }
+
+    // with a handler thread, every event reaches the handlers on it, so period shifts never race the events they count.
+    // a removed policy goes right after this returns, so its event is waited for
     void policy_cb(const Policy *policy, Action action)
     {
+        if (_handler_thread) {
+            _handler_thread->call([this, policy, action] { policy_signal(policy, action); });
+            return;
+        }
         policy_signal(policy, action);
     }
 
     void heartbeat_cb(const timespec stamp)
     {
+        if (_handler_thread) {
+            _handler_thread->post([this, stamp] { heartbeat_signal(stamp); }, false);
+            return;
+        }
         heartbeat_signal(stamp);
     }
 
+    // a policy attached a handler to this proxy, see StreamHandler::follow_input_load. detached when the handler goes
+    virtual void handler_attached([[maybe_unused]] const std::string &handler_id)
+    {
+    }
+    virtual void handler_detached([[maybe_unused]] const std::string &handler_id)
+    {
+    }
+
+    // how close the input is to losing events, in percent
+    void load_cb(uint32_t load)
+    {
+        if (_handler_thread) {
+            _handler_thread->post([this, load] { load_signal(load); });
+            return;
+        }
+        load_signal(load);
+    }
+
     virtual size_t consumer_count() const
     {
         return policy_signal.slot_count() + heartbeat_signal.slot_count();
@@ -56,5 +134,7 @@ public:
 
     mutable sigslot::signal<const Policy *, Action> policy_signal;
     mutable sigslot::signal<const timespec> heartbeat_signal;
+    // not counted as a consumer: every handler follows it, whether it consumes any other event or not
+    mutable sigslot::signal<uint32_t> load_signal;
 };
 }
\ No newline at end of file
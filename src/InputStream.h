@@ -32,6 +32,22 @@ protected:
         }
     }
 
+    // called from add_event_proxy() for every new proxy, with _input_mutex held
+    virtual void event_proxy_added([[maybe_unused]] InputEventProxy *proxy)
+    {
+    }
+
+    // called from remove_event_proxy() before the proxy is destroyed, with _input_mutex held
+    virtual void event_proxy_removed([[maybe_unused]] InputEventProxy *proxy)
+    {
+    }
+
+    // whether proxies with a HandlerThreadConfig get their events on a thread of their own
+    virtual bool handler_threads_supported() const
+    {
+        return false;
+    }
+
 public:
     InputStream(const std::string &name)
         : AbstractRunnableModule(name)
@@ -64,6 +80,13 @@ public:
         return _policies.size();
     }
 
+    // how many threads of the input deliver events to handlers side by side. with more than one, policies attach an
+    // instance of each handler to the proxy of every shard, see add_event_proxy(), so no two threads share a handler
+    virtual size_t handler_shards() const
+    {
+        return 1;
+    }
+
     size_t consumer_count() const
     {
         std::shared_lock lock(_input_mutex);
@@ -74,12 +97,17 @@ public:
         return count;
     }
 
-    InputEventProxy *add_event_proxy(const Configurable &filter)
+    // policies with the same filter share a proxy, unless they asked for a handler thread: then the proxy is theirs
+    // alone, and must be removed with the policy. a shard proxy gets the events of that shard only
+    InputEventProxy *add_event_proxy(const Configurable &filter, const std::optional<HandlerThreadConfig> &thread = std::nullopt, std::optional<size_t> shard = std::nullopt)
     {
         std::unique_lock lock(_input_mutex);
+        if (thread && !handler_threads_supported()) {
+            throw ConfigException(fmt::format("input {} does not support handler threads (handler_queue_size, cpu_affinity)", schema_key()));
+        }
         auto hash = filter.config_hash();
         for (auto const &proxy : _event_proxies) {
-            if (proxy->hash() == hash) {
+            if (!thread && !proxy->thread_config() && proxy->hash() == hash && proxy->shard() == shard) {
                 return proxy.get();
             }
         }
@@ -88,9 +116,27 @@ public:
         } catch (ConfigException &e) {
             throw ConfigException(fmt::format("unable to create event proxy due to invalid input filter config: {}", e.what()));
         }
+        if (thread) {
+            _event_proxies.back()->set_thread_config(*thread);
+        }
+        if (shard) {
+            _event_proxies.back()->set_shard(*shard);
+        }
+        event_proxy_added(_event_proxies.back().get());
         return _event_proxies.back().get();
     }
 
+    void remove_event_proxy(InputEventProxy *proxy)
+    {
+        std::unique_lock lock(_input_mutex);
+        auto it = std::find_if(_event_proxies.begin(), _event_proxies.end(), [proxy](const auto &p) { return p.get() == proxy; });
+        if (it == _event_proxies.end()) {
+            return;
+        }
+        event_proxy_removed(proxy);
+        _event_proxies.erase(it);
+    }
+
     virtual std::unique_ptr<InputEventProxy> create_event_proxy(const Configurable &filter) = 0;
 
     void common_info_json(json &j) const
@@ -98,6 +144,14 @@ public:
         AbstractModule::common_info_json(j);
         j["input"]["running"] = running();
         j["input"]["consumers"] = consumer_count();
+        std::shared_lock lock(_input_mutex);
+        for (auto const &proxy : _event_proxies) {
+            if (proxy->handler_thread()) {
+                json thread;
+                proxy->handler_thread()->info_json(thread);
+                j["input"]["handler_threads"].push_back(thread);
+            }
+        }
     }
 };
 
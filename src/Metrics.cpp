@@ -97,6 +97,7 @@ void Cardinality::to_opentelemetry(metrics::v1::ScopeMetrics &scope, timespec &s
 
 // static storage for base labels
 Metric::LabelMap Metric::_static_labels;
+thread_local std::string Metric::_name_prefix;
 
 void Metric::name_json_assign(json &j, const json &val) const
 {
@@ -122,7 +123,7 @@ std::string Metric::base_name_snake() const
     auto snake = [](const std::string &ss, const std::string &s) {
         return ss.empty() ? s : ss + "_" + s;
     };
-    std::string name_text = _schema_key + "_" + std::accumulate(std::begin(_name), std::end(_name), std::string(), snake);
+    std::string name_text = _schema_key + "_" + _name_prefix + std::accumulate(std::begin(_name), std::end(_name), std::string(), snake);
     return name_text;
 }
 
@@ -146,7 +147,7 @@ std::string Metric::name_snake(std::initializer_list<std::string> add_names, Met
     auto snake = [](const std::string &ss, const std::string &s) {
         return ss.empty() ? s : ss + "_" + s;
     };
-    std::string name_text = _schema_key + "_" + std::accumulate(std::begin(_name), std::end(_name), std::string(), snake);
+    std::string name_text = _schema_key + "_" + _name_prefix + std::accumulate(std::begin(_name), std::end(_name), std::string(), snake);
     if (add_names.size()) {
         name_text.push_back('_');
         name_text.append(std::accumulate(std::begin(add_names), std::end(add_names), std::string(), snake));
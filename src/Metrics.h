@@ -28,6 +28,7 @@
 #include <regex>
 #include <set>
 #include <shared_mutex>
+#include <utility>
 #include <vector>
 
 #define HIST_MIN_EXP -9
@@ -79,6 +80,8 @@ private:
      * static labels which will be applied to all metrics
      */
     static LabelMap _static_labels;
+    // see NamePrefix
+    static thread_local std::string _name_prefix;
 
 protected:
     std::vector<std::string> _name;
@@ -124,6 +127,27 @@ public:
         _static_labels.emplace(label, value);
     }
 
+    /**
+     * while one lives, every metric rendered on this thread gets prefix between its schema key and its name,
+     * e.g. dns_partition_wire_packets_total
+     */
+    class NamePrefix
+    {
+        std::string _previous;
+
+    public:
+        explicit NamePrefix(const std::string &prefix)
+            : _previous(std::exchange(_name_prefix, prefix))
+        {
+        }
+        ~NamePrefix()
+        {
+            _name_prefix = std::move(_previous);
+        }
+        NamePrefix(const NamePrefix &) = delete;
+        NamePrefix &operator=(const NamePrefix &) = delete;
+    };
+
     void name_json_assign(json &j, const json &val) const;
     void name_json_assign(json &j, std::initializer_list<std::string> add_names, const json &val) const;
 
@@ -0,0 +1,211 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#ifdef __linux__
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+#include <array>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// NUMA topology from sysfs and memory policy through the raw system calls, so there is no dependency on libnuma.
+// everything here degrades to "unknown" (-1, empty) on machines, or in containers, without NUMA information
+namespace visor::numa {
+
+// the highest node id the kernel supports (CONFIG_NODES_SHIFT is at most 10)
+static constexpr int MAX_NODE = 1023;
+
+// a node mask for the memory policy calls, one bit per node up to MAX_NODE
+using NodeMask = std::array<unsigned long, (MAX_NODE + 1 + sizeof(unsigned long) * CHAR_BIT - 1) / (sizeof(unsigned long) * CHAR_BIT)>;
+// the kernel reads one bit less than the maxnode it is given
+static constexpr unsigned long MASK_MAXNODE = MAX_NODE + 2;
+
+// parses a kernel cpu or node list such as "0-3,8,10-11". anything malformed ends the list
+static inline std::vector<uint32_t> parse_list(const std::string &list)
+{
+    std::vector<uint32_t> ids;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        try {
+            auto dash = range.find('-');
+            auto first = std::stoul(range.substr(0, dash));
+            auto last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+            for (auto id = first; id <= last; ++id) {
+                ids.push_back(static_cast<uint32_t>(id));
+            }
+        } catch (const std::exception &) {
+            break;
+        }
+    }
+    return ids;
+}
+
+static inline std::string _read_line(const std::string &path)
+{
+    std::ifstream file(path);
+    std::string line;
+    std::getline(file, line);
+    return line;
+}
+
+// the node the NIC behind iface is attached to, -1 if unknown (virtual interfaces, single node machines). sysfs is
+// only ever changed by tests
+static inline int interface_node(const std::string &iface, const std::string &sysfs = "/sys")
+{
+    auto line = _read_line(sysfs + "/class/net/" + iface + "/device/numa_node");
+    try {
+        return line.empty() ? -1 : std::stoi(line);
+    } catch (const std::exception &) {
+        return -1;
+    }
+}
+
+static inline std::vector<uint32_t> node_cpus(int node)
+{
+    if (node < 0) {
+        return {};
+    }
+    return parse_list(_read_line("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"));
+}
+
+// the node of a cpu, -1 if unknown
+static inline int cpu_node(uint32_t cpu)
+{
+    for (auto node : parse_list(_read_line("/sys/devices/system/node/online"))) {
+        for (auto node_cpu : node_cpus(static_cast<int>(node))) {
+            if (node_cpu == cpu) {
+                return static_cast<int>(node);
+            }
+        }
+    }
+    return -1;
+}
+
+// new memory of the calling thread comes from node while it has free pages there. false if that is not supported
+static inline bool prefer_node(int node)
+{
+#ifdef __linux__
+    if (node < 0 || node > MAX_NODE) {
+        return false;
+    }
+    NodeMask mask{};
+    constexpr auto bits = sizeof(unsigned long) * CHAR_BIT;
+    mask[static_cast<size_t>(node) / bits] = 1UL << (static_cast<size_t>(node) % bits);
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(), MASK_MAXNODE) == 0;
+#else
+    return false;
+#endif
+}
+
+// prefers node for the memory allocated in its scope, also by the kernel on behalf of this thread (e.g. socket rings),
+// and puts back the policy the thread had before
+class PreferNodeScope
+{
+#ifdef __linux__
+    int _mode{MPOL_DEFAULT};
+    NodeMask _mask{};
+#endif
+    bool _changed{false};
+
+public:
+    explicit PreferNodeScope(int node)
+    {
+#ifdef __linux__
+        if (node >= 0 && syscall(SYS_get_mempolicy, &_mode, _mask.data(), MASK_MAXNODE, nullptr, 0) == 0) {
+            _changed = prefer_node(node);
+        }
+#endif
+    }
+    ~PreferNodeScope()
+    {
+#ifdef __linux__
+        if (_changed) {
+            syscall(SYS_set_mempolicy, _mode, _mode == MPOL_DEFAULT ? nullptr : _mask.data(), _mode == MPOL_DEFAULT ? 0 : MASK_MAXNODE);
+        }
+#endif
+    }
+    PreferNodeScope(const PreferNodeScope &) = delete;
+    PreferNodeScope &operator=(const PreferNodeScope &) = delete;
+
+    bool changed() const
+    {
+        return _changed;
+    }
+};
+
+// where a thread runs: the cpu it last ran on, that cpu's node, and the cpus it may run on
+struct ThreadPlacement {
+    uint64_t tid{0};
+    std::string name;
+    int cpu{-1};
+    int node{-1};
+    std::vector<uint32_t> cpus_allowed;
+};
+
+// the placement of the thread whose /proc directory is task_dir, e.g. /proc/thread-self
+static inline ThreadPlacement thread_placement(const std::string &task_dir)
+{
+    ThreadPlacement placement;
+    placement.name = _read_line(task_dir + "/comm");
+    // the name in stat may contain anything, fields are counted from the parenthesis closing it
+    auto stat = _read_line(task_dir + "/stat");
+    auto close = stat.rfind(')');
+    if (close != std::string::npos) {
+        placement.tid = std::strtoull(stat.c_str(), nullptr, 10);
+        std::stringstream fields(stat.substr(close + 1));
+        std::string field;
+        // processor is field 39, the first after the name is field 3
+        for (int i = 3; i <= 39 && fields >> field; ++i) {
+            if (i == 39) {
+                placement.cpu = std::atoi(field.c_str());
+            }
+        }
+    }
+    if (placement.cpu >= 0) {
+        placement.node = cpu_node(static_cast<uint32_t>(placement.cpu));
+    }
+    std::ifstream status(task_dir + "/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("Cpus_allowed_list:", 0) == 0) {
+            auto list = line.substr(line.find(':') + 1);
+            list.erase(0, list.find_first_not_of(" \t"));
+            placement.cpus_allowed = parse_list(list);
+            break;
+        }
+    }
+    return placement;
+}
+
+// the placement of every thread of this process
+static inline std::vector<ThreadPlacement> process_placements()
+{
+    std::vector<ThreadPlacement> placements;
+#ifdef __linux__
+    auto dir = opendir("/proc/self/task");
+    if (dir == nullptr) {
+        return placements;
+    }
+    while (auto entry = readdir(dir)) {
+        if (entry->d_name[0] != '.') {
+            placements.push_back(thread_placement(std::string("/proc/self/task/") + entry->d_name));
+        }
+    }
+    closedir(dir);
+#endif
+    return placements;
+}
+
+}
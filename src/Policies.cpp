@@ -10,11 +10,46 @@
 #include <algorithm>
 #include <fmt/format.h>
 #include <spdlog/spdlog.h>
+#include <set>
 #include <spdlog/stopwatch.h>
+#include <thread>
 
 namespace visor {
 
-std::vector<Policy *> PolicyManager::load_from_str(const std::string &str)
+// identical handlers on one event proxy have the same signature, see load(). the configs go in whole rather than
+// hashed, so handlers only share when their configs are equal
+static std::string handler_signature(const HandlerManager::HandlerData &handler, const InputEventProxy *proxy)
+{
+    return fmt::format("{}/{}/{}/{}/{}", handler.type, handler.version, handler.config.config_signature(), handler.filter.config_signature(), fmt::ptr(proxy));
+}
+
+// instances of handler for the other shards of input, see InputStream::handler_shards(). each gets the proxy of its
+// shard for the same filter, and handler reports for all of them
+static void add_handler_shards(StreamHandler *handler, HandlerModulePlugin *plugin, const HandlerManager::HandlerData &config, InputStream *input, const Configurable &input_filter)
+{
+    for (size_t shard = 1; shard < input->handler_shards(); ++shard) {
+        auto proxy = input->add_event_proxy(input_filter, std::nullopt, shard);
+        auto instance = plugin->instantiate(handler->name(), proxy, &config.config, &config.filter);
+        instance->set_version(config.version);
+        instance->follow_input_load(proxy);
+        handler->add_shard(std::move(instance));
+    }
+}
+
+// merged handlers are reported from one bucket merged from all of theirs, which has no room for partitions
+static void check_merge_like_handlers(const Policy &policy, const std::vector<AbstractRunnableModule *> &modules)
+{
+    if (!policy.config_exists("merge_like_handlers") || !policy.config_get<bool>("merge_like_handlers")) {
+        return;
+    }
+    for (const auto &mod : modules) {
+        if (mod->config_exists("partition_by")) {
+            throw PolicyException(fmt::format("merge_like_handlers is not supported with partition_by, which handler {} has", policy.module_name(mod)));
+        }
+    }
+}
+
+YAML::Node PolicyManager::_get_policies_node(const std::string &str)
 {
     if (str.empty()) {
         throw PolicyException("empty data");
@@ -31,12 +66,22 @@ std::vector<Policy *> PolicyManager::load_from_str(const std::string &str)
         throw PolicyException("unsupported version");
     }
     if (node["visor"]["policies"] && node["visor"]["policies"].IsMap()) {
-        return load(node["visor"]["policies"], true);
+        return node["visor"]["policies"];
     } else {
         throw PolicyException("no policies found in schema");
     }
 }
 
+std::vector<Policy *> PolicyManager::load_from_str(const std::string &str)
+{
+    return load(_get_policies_node(str), true);
+}
+
+Policy *PolicyManager::reload_from_str(const std::string &name, const std::string &str)
+{
+    return reload(name, _get_policies_node(str));
+}
+
 // needs to be thread safe and transactional: any errors mean resources get cleaned up with no side effects
 std::vector<Policy *> PolicyManager::load(const YAML::Node &policy_yaml, bool single)
 {
@@ -49,137 +94,190 @@ std::vector<Policy *> PolicyManager::load(const YAML::Node &policy_yaml, bool si
 
     std::vector<Policy *> result;
     for (YAML::const_iterator it = policy_yaml.begin(); it != policy_yaml.end(); ++it) {
-
         // serialized policy loads
         std::unique_lock lock(_load_mutex);
+        result.push_back(_load_policy(it));
+    }
 
-        auto policy_name = _get_policy_name(it);
-        // Input Section
-        auto input_node = it->second["input"];
-        auto [input_config, input_filter] = _registry->input_manager()->get_config_and_filter(input_node);
-        // Handler Default Section
-        auto handler_node = it->second["handlers"];
-        auto [window_config, handler_sequence] = _registry->handler_manager()->get_default_configuration(handler_node);
-
-        // tap manager ensures that at least one tap is returned, if not it throws
-        auto taps_name = _registry->tap_manager()->get_input_taps_name(input_node);
-
-        // create policy
-        auto policy = std::make_unique<Policy>(policy_name);
-        auto policy_ptr = policy.get();
-        policy_ptr->set_modules_sequence(handler_sequence);
-
-        if (it->second["config"]) {
-            if (!it->second["config"].IsMap()) {
-                throw PolicyException("policy configuration is not a map");
-            }
-            try {
-                policy_ptr->config_set_yaml(it->second["config"]);
-            } catch (ConfigException &e) {
-                throw HandlerException(fmt::format("invalid policy config for policy '{}': {}", policy_name, e.what()));
-            }
-        }
+    return result;
+}
 
-        std::vector<std::string> added_resources_policies;
-        std::vector<std::string> added_inputs;
-        std::vector<std::string> added_handlers;
+Policy *PolicyManager::_load_policy(YAML::const_iterator it)
+{
+    auto policy_name = _get_policy_name(it);
+    // Input Section
+    auto input_node = it->second["input"];
+    auto [input_config, input_filter] = _registry->input_manager()->get_config_and_filter(input_node);
+    // Handler Default Section
+    auto handler_node = it->second["handlers"];
+    auto [window_config, handler_sequence] = _registry->handler_manager()->get_default_configuration(handler_node);
+
+    // tap manager ensures that at least one tap is returned, if not it throws
+    auto taps_name = _registry->tap_manager()->get_input_taps_name(input_node);
+
+    // create policy
+    auto policy = std::make_unique<Policy>(policy_name);
+    auto policy_ptr = policy.get();
+    policy_ptr->set_modules_sequence(handler_sequence);
+    policy_ptr->set_definition(it->second);
+
+    if (it->second["config"]) {
+        if (!it->second["config"].IsMap()) {
+            throw PolicyException("policy configuration is not a map");
+        }
         try {
-            for (const auto &tap_name : taps_name) {
-                auto [tap, tap_lock] = _registry->tap_manager()->module_get_locked(tap_name);
-                policy_ptr->add_tap(tap);
-                // ensure tap input type matches policy input tap
-                if (input_node["input_type"].as<std::string>() != tap->input_plugin()->plugin()) {
-                    throw PolicyException(fmt::format("input_type for policy specified tap '{}' doesn't match tap's defined input type: {}/{}", tap_name, input_node["input_type"].as<std::string>(), tap->input_plugin()->plugin()));
+            policy_ptr->config_set_yaml(it->second["config"]);
+        } catch (ConfigException &e) {
+            throw HandlerException(fmt::format("invalid policy config for policy '{}': {}", policy_name, e.what()));
+        }
+        if (auto thread_config = _get_thread_config(policy_name, *policy_ptr)) {
+            policy_ptr->set_thread_config(*thread_config);
+        }
+    }
+
+    std::vector<std::string> added_resources_policies;
+    std::vector<std::string> added_inputs;
+    std::vector<std::string> added_handlers;
+    std::vector<std::string> shared_handlers;
+    try {
+        for (const auto &tap_name : taps_name) {
+            auto [tap, tap_lock] = _registry->tap_manager()->module_get_locked(tap_name);
+            policy_ptr->add_tap(tap);
+            // ensure tap input type matches policy input tap
+            if (input_node["input_type"].as<std::string>() != tap->input_plugin()->plugin()) {
+                throw PolicyException(fmt::format("input_type for policy specified tap '{}' doesn't match tap's defined input type: {}/{}", tap_name, input_node["input_type"].as<std::string>(), tap->input_plugin()->plugin()));
+            }
+            // handler internal config
+            window_config.config_set<std::string>("_internal_tap_name", tap_name);
+
+            std::string input_stream_name = tap->get_input_name(input_config, input_filter);
+            if (!_registry->input_manager()->module_exists(input_stream_name)) {
+                try {
+                    spdlog::get("visor")->info("policy [{}]: creating input stream: {}", policy_name, input_stream_name);
+                    _registry->input_manager()->module_add(tap->instantiate(&input_config, &input_filter, input_stream_name));
+                    added_inputs.push_back(input_stream_name);
+                } catch (std::runtime_error &e) {
+                    throw PolicyException(fmt::format("unable to instantiate tap '{}': {}", tap_name, e.what()));
                 }
-                // handler internal config
-                window_config.config_set<std::string>("_internal_tap_name", tap_name);
-
-                std::string input_stream_name = tap->get_input_name(input_config, input_filter);
-                if (!_registry->input_manager()->module_exists(input_stream_name)) {
-                    try {
-                        spdlog::get("visor")->info("policy [{}]: creating input stream: {}", policy_name, input_stream_name);
-                        _registry->input_manager()->module_add(tap->instantiate(&input_config, &input_filter, input_stream_name));
-                        added_inputs.push_back(input_stream_name);
-                    } catch (std::runtime_error &e) {
-                        throw PolicyException(fmt::format("unable to instantiate tap '{}': {}", tap_name, e.what()));
+            } else {
+                spdlog::get("visor")->debug("policy [{}]: input stream already exists. reusing: {}", policy_name, input_stream_name);
+            }
+
+            auto [input_ptr, input_lock] = _registry->input_manager()->module_get_locked(input_stream_name);
+            // sequences chain event proxies of their own, and a handler thread already delivers from one thread
+            auto sharded = !handler_sequence && !policy_ptr->thread_config() && input_ptr->handler_shards() > 1;
+            InputEventProxy *input_event_proxy = input_ptr->add_event_proxy(input_filter, policy_ptr->thread_config(), sharded ? std::optional<size_t>(0) : std::nullopt);
+            if (policy_ptr->thread_config()) {
+                policy_ptr->add_own_proxy(input_ptr, input_event_proxy);
+            }
+            policy_ptr->add_input_stream(input_ptr);
+
+            std::vector<std::unique_ptr<StreamHandler>> handler_modules;
+            std::vector<std::string> signatures;
+            for (YAML::const_iterator h_it = handler_node["modules"].begin(); h_it != handler_node["modules"].end(); ++h_it) {
+                auto handler_config = _registry->handler_manager()->validate_handler(h_it, policy_name, window_config, handler_sequence);
+                std::unique_ptr<StreamHandler> handler_module;
+                auto handler_plugin = _registry->handler_plugins().find(std::make_pair(handler_config.type, handler_config.version));
+                auto handler_name = policy_name + "-" + tap_name + "-" + handler_config.name;
+                // an identical handler on the same event proxy would do the same work and keep the same metrics, so the
+                // policy reads those of the running one instead. sequences chain event proxies of their own, and so do
+                // policies with a handler thread, so neither shares
+                std::string signature;
+                if (!handler_sequence && !policy_ptr->thread_config()) {
+                    signature = handler_signature(handler_config, input_event_proxy);
+                    if (auto shared = _shared_handlers.find(signature); shared != _shared_handlers.end()) {
+                        auto [shared_module, handler_lock] = _registry->handler_manager()->module_get_locked(shared->second.module_name);
+                        spdlog::get("visor")->info("policy [{}]: handler {} is identical to {}, sharing it", policy_name, handler_name, shared_module->name());
+                        policy_ptr->add_module(shared_module, handler_name, signature);
+                        ++shared->second.policies;
+                        shared_handlers.push_back(shared->second.module_name);
+                        continue;
                     }
+                }
+                // the name may still be held by a shared instance, created by a policy since removed
+                auto instance_name = handler_name;
+                for (size_t n = 2; _registry->handler_manager()->module_exists(instance_name); ++n) {
+                    instance_name = fmt::format("{}-{}", handler_name, n);
+                }
+                if (!handler_sequence || handler_modules.empty()) {
+                    handler_module = handler_plugin->second->instantiate(instance_name, input_event_proxy, &handler_config.config, &handler_config.filter);
                 } else {
-                    spdlog::get("visor")->debug("policy [{}]: input stream already exists. reusing: {}", policy_name, input_stream_name);
+                    // for sequence, use only previous handler
+                    handler_modules.back()->set_event_proxy(input_ptr->create_event_proxy(Configurable()));
+                    handler_module = handler_plugin->second->instantiate(instance_name, handler_modules.back()->get_event_proxy(), &handler_config.config, &handler_config.filter);
                 }
-
-                auto [input_ptr, input_lock] = _registry->input_manager()->module_get_locked(input_stream_name);
-                InputEventProxy *input_event_proxy = input_ptr->add_event_proxy(input_filter);
-                policy_ptr->add_input_stream(input_ptr);
-
-                std::vector<std::unique_ptr<StreamHandler>> handler_modules;
-                for (YAML::const_iterator h_it = handler_node["modules"].begin(); h_it != handler_node["modules"].end(); ++h_it) {
-                    auto handler_config = _registry->handler_manager()->validate_handler(h_it, policy_name, window_config, handler_sequence);
-                    std::unique_ptr<StreamHandler> handler_module;
-                    auto handler_plugin = _registry->handler_plugins().find(std::make_pair(handler_config.type, handler_config.version));
-                    auto handler_name = policy_name + "-" + tap_name + "-" + handler_config.name;
-                    if (!handler_sequence || handler_modules.empty()) {
-                        handler_module = handler_plugin->second->instantiate(handler_name, input_event_proxy, &handler_config.config, &handler_config.filter);
-                    } else {
-                        // for sequence, use only previous handler
-                        handler_modules.back()->set_event_proxy(input_ptr->create_event_proxy(Configurable()));
-                        handler_module = handler_plugin->second->instantiate(handler_name, handler_modules.back()->get_event_proxy(), &handler_config.config, &handler_config.filter);
-                    }
-                    handler_module->set_version(handler_config.version);
-                    policy_ptr->add_module(handler_module.get());
-                    handler_modules.emplace_back(std::move(handler_module));
+                handler_module->set_version(handler_config.version);
+                handler_module->follow_input_load(input_event_proxy);
+                if (sharded) {
+                    add_handler_shards(handler_module.get(), handler_plugin->second.get(), handler_config, input_ptr, input_filter);
                 }
+                policy_ptr->add_module(handler_module.get(), handler_name, signature);
+                handler_modules.emplace_back(std::move(handler_module));
+                signatures.push_back(signature);
+            }
 
-                for (auto &m : handler_modules) {
-                    auto hname = m->name();
-                    _registry->handler_manager()->module_add(std::move(m));
-                    added_handlers.push_back(hname);
+            for (size_t i = 0; i < handler_modules.size(); ++i) {
+                auto hname = handler_modules[i]->name();
+                _registry->handler_manager()->module_add(std::move(handler_modules[i]));
+                added_handlers.push_back(hname);
+                // the first of identical handlers in one policy is the one shared
+                if (!signatures[i].empty() && _shared_handlers.emplace(signatures[i], SharedHandler{hname, 1}).second) {
+                    _handler_signatures[hname] = signatures[i];
                 }
-
-                // success
-                input_ptr->add_policy(policy_ptr);
             }
 
-            for (auto &p : added_inputs) {
-                auto [input_ptr, input_lock] = _registry->input_manager()->module_get_locked(p);
-                auto [resource_name, module_name] = create_resources_policy(policy_name, input_ptr, window_config);
-                added_resources_policies.push_back(resource_name);
-                added_handlers.push_back(module_name);
-            }
+            // success
+            input_ptr->add_policy(policy_ptr);
+        }
 
-        } catch (std::runtime_error &e) {
-            // failed to create policy
-            for (auto &p : added_resources_policies) {
-                module_remove(p);
-            }
-            for (auto &m : added_handlers) {
-                _registry->handler_manager()->module_remove(m);
-            }
-            for (auto &p : added_inputs) {
-                _registry->input_manager()->module_remove(p);
-            }
-            throw;
+        for (auto &p : added_inputs) {
+            auto [input_ptr, input_lock] = _registry->input_manager()->module_get_locked(p);
+            auto [resource_name, module_name] = create_resources_policy(policy_name, input_ptr, window_config);
+            added_resources_policies.push_back(resource_name);
+            added_handlers.push_back(module_name);
         }
 
-        try {
-            policy_ptr->start();
-            module_add(std::move(policy));
-        } catch (std::runtime_error &e) {
-            for (auto &p : added_resources_policies) {
-                module_remove(p);
-            }
-            for (auto &m : added_handlers) {
-                _registry->handler_manager()->module_remove(m);
-            }
-            for (auto &p : added_inputs) {
-                _registry->input_manager()->module_remove(p);
-            }
-            throw PolicyException(fmt::format("policy [{}] failed to start: {}", policy_name, e.what()));
+    } catch (std::runtime_error &e) {
+        // failed to create policy
+        for (auto &p : added_resources_policies) {
+            module_remove(p);
+        }
+        for (auto &m : shared_handlers) {
+            _release_handler(m);
         }
+        for (auto &m : added_handlers) {
+            _release_handler(m);
+            _registry->handler_manager()->module_remove(m);
+        }
+        policy_ptr->remove_own_proxies();
+        for (auto &p : added_inputs) {
+            _registry->input_manager()->module_remove(p);
+        }
+        throw;
+    }
 
-        result.push_back(policy_ptr);
+    try {
+        policy_ptr->start();
+        module_add(std::move(policy));
+    } catch (std::runtime_error &e) {
+        for (auto &p : added_resources_policies) {
+            module_remove(p);
+        }
+        for (auto &m : shared_handlers) {
+            _release_handler(m);
+        }
+        for (auto &m : added_handlers) {
+            _release_handler(m);
+            _registry->handler_manager()->module_remove(m);
+        }
+        policy_ptr->remove_own_proxies();
+        for (auto &p : added_inputs) {
+            _registry->input_manager()->module_remove(p);
+        }
+        throw PolicyException(fmt::format("policy [{}] failed to start: {}", policy_name, e.what()));
     }
 
-    return result;
+    return policy_ptr;
 }
 
 std::pair<std::string, std::string> PolicyManager::create_resources_policy(const std::string &policy_name, InputStream *input, const Config &window_config)
@@ -214,7 +312,38 @@ std::pair<std::string, std::string> PolicyManager::create_resources_policy(const
     return std::make_pair(resources_policy_name, module_name);
 }
 
-std::string PolicyManager::_get_policy_name(YAML::const_iterator it)
+std::optional<HandlerThreadConfig> PolicyManager::_get_thread_config(const std::string &policy_name, const Policy &policy)
+{
+    if (!policy.config_exists("handler_queue_size") && !policy.config_exists("cpu_affinity")) {
+        return std::nullopt;
+    }
+    HandlerThreadConfig config;
+    config.name = policy_name;
+    try {
+        if (policy.config_exists("handler_queue_size")) {
+            config.queue_size = policy.config_get<uint64_t>("handler_queue_size");
+        }
+        if (policy.config_exists("cpu_affinity")) {
+            for (const auto &cpu : policy.config_get<Configurable::StringList>("cpu_affinity")) {
+                config.cpus.push_back(static_cast<uint32_t>(std::stoul(cpu)));
+            }
+        }
+    } catch (const std::exception &) {
+        throw PolicyException(fmt::format("invalid handler thread config for policy '{}': handler_queue_size must be a number and cpu_affinity a list of cpu numbers", policy_name));
+    }
+    if (config.queue_size < 2 || config.queue_size > HandlerThreadConfig::MAX_QUEUE_SIZE) {
+        throw PolicyException(fmt::format("invalid handler thread config for policy '{}': handler_queue_size must be between 2 and {}", policy_name, HandlerThreadConfig::MAX_QUEUE_SIZE));
+    }
+    auto cpus = std::thread::hardware_concurrency();
+    for (auto cpu : config.cpus) {
+        if (cpus && cpu >= cpus) {
+            throw PolicyException(fmt::format("invalid handler thread config for policy '{}': cpu {} in cpu_affinity does not exist, there are {} cpus", policy_name, cpu, cpus));
+        }
+    }
+    return config;
+}
+
+std::string PolicyManager::_get_policy_name(YAML::const_iterator it, bool existing)
 {
     // Basic Structure
     if (!it->first.IsScalar()) {
@@ -225,9 +354,11 @@ std::string PolicyManager::_get_policy_name(YAML::const_iterator it)
     if (!it->second.IsMap()) {
         throw PolicyException("expecting policy configuration map");
     }
-    // Ensure policy name isn't already defined
-    if (module_exists(policy_name)) {
+    // Ensure policy name isn't already defined, or is when it is reloaded
+    if (!existing && module_exists(policy_name)) {
         throw PolicyException(fmt::format("policy with name '{}' already defined", policy_name));
+    } else if (existing && !module_exists(policy_name)) {
+        throw PolicyException(fmt::format("policy with name '{}' does not exist", policy_name));
     }
 
     // Policy kind defines schema
@@ -240,7 +371,218 @@ std::string PolicyManager::_get_policy_name(YAML::const_iterator it)
     return policy_name;
 }
 
+bool PolicyManager::_release_handler(const std::string &module_name)
+{
+    auto signature = _handler_signatures.find(module_name);
+    if (signature == _handler_signatures.end()) {
+        return true;
+    }
+    auto shared = _shared_handlers.find(signature->second);
+    if (--shared->second.policies) {
+        return false;
+    }
+    _shared_handlers.erase(shared);
+    _handler_signatures.erase(signature);
+    return true;
+}
+
+// applies a changed policy. handler changes are made to the running policy: unchanged handlers keep running with
+// their metrics and state, changed and new ones start on the same event proxy before the ones they replace stop, and
+// the input keeps capturing throughout. a change to anything else (input, taps, policy config, handler sequences)
+// removes the policy and applies it again
+Policy *PolicyManager::reload(const std::string &name, const YAML::Node &policy_yaml)
+{
+    assert(policy_yaml.IsMap());
+    assert(spdlog::get("visor"));
+
+    if (policy_yaml.size() != 1) {
+        throw PolicyException(fmt::format("only a single policy expected but got {}", policy_yaml.size()));
+    }
+    auto it = policy_yaml.begin();
+    // one lock for the whole reload, so no other load sees the policy gone or takes its name meanwhile
+    std::unique_lock lock(_load_mutex);
+    auto policy_name = _get_policy_name(it, true);
+    if (policy_name != name) {
+        throw PolicyException(fmt::format("policy '{}' does not match the policy to reload: {}", policy_name, name));
+    }
+    if (auto policy = _reload_handlers(policy_name, it->second)) {
+        return policy;
+    }
+
+    spdlog::get("visor")->info("policy [{}]: more than its handlers changed, applying it again", name);
+    YAML::Node previous;
+    {
+        std::unique_lock map_lock(_map_mutex);
+        previous[name] = YAML::Clone(_map[name]->definition());
+    }
+    _remove_policy(name);
+    try {
+        return _load_policy(it);
+    } catch (std::runtime_error &e) {
+        // the new definition failed, bring the old one back before reporting it
+        try {
+            _load_policy(previous.begin());
+        } catch (std::runtime_error &restore_error) {
+            spdlog::get("visor")->error("policy [{}]: failed to restore the previous definition: {}", name, restore_error.what());
+        }
+        throw;
+    }
+}
+
+Policy *PolicyManager::_reload_handlers(const std::string &policy_name, const YAML::Node &policy_node)
+{
+    auto input_node = policy_node["input"];
+    auto handler_node = policy_node["handlers"];
+    auto [input_config, input_filter] = _registry->input_manager()->get_config_and_filter(input_node);
+    auto [window_config, handler_sequence] = _registry->handler_manager()->get_default_configuration(handler_node);
+    auto taps_name = _registry->tap_manager()->get_input_taps_name(input_node);
+
+    auto [policy, policy_lock] = module_get_locked(policy_name);
+    Policy *policy_ptr = policy;
+    auto same = [](const YAML::Node &a, const YAML::Node &b) {
+        return (!a || !b) ? (!a && !b) : YAML::Dump(a) == YAML::Dump(b);
+    };
+    std::vector<std::string> policy_taps;
+    for (const auto &tap : policy_ptr->taps()) {
+        policy_taps.push_back(tap->name());
+    }
+    // sequences chain event proxies of their own, and so do policies with a handler thread
+    if (handler_sequence || policy_ptr->modules_sequence() || policy_ptr->thread_config() || taps_name != policy_taps
+        || !same(policy_ptr->definition()["input"], input_node) || !same(policy_ptr->definition()["config"], policy_node["config"])) {
+        return nullptr;
+    }
+
+    struct Module {
+        AbstractRunnableModule *module;
+        std::string name;
+        std::string signature;
+    };
+    std::vector<Module> modules;
+    std::vector<std::unique_ptr<StreamHandler>> created;
+    std::vector<std::string> created_signatures;
+    std::vector<std::string> shared_handlers;
+    std::set<const AbstractRunnableModule *> kept;
+    auto old_modules = policy_ptr->modules();
+    try {
+        for (const auto &tap_name : taps_name) {
+            window_config.config_set<std::string>("_internal_tap_name", tap_name);
+            auto [tap, tap_lock] = _registry->tap_manager()->module_get_locked(tap_name);
+            auto [input_ptr, input_lock] = _registry->input_manager()->module_get_locked(tap->get_input_name(input_config, input_filter));
+            auto sharded = input_ptr->handler_shards() > 1;
+            InputEventProxy *input_event_proxy = input_ptr->add_event_proxy(input_filter, std::nullopt, sharded ? std::optional<size_t>(0) : std::nullopt);
+
+            for (YAML::const_iterator h_it = handler_node["modules"].begin(); h_it != handler_node["modules"].end(); ++h_it) {
+                auto handler_config = _registry->handler_manager()->validate_handler(h_it, policy_name, window_config, false);
+                auto handler_name = policy_name + "-" + tap_name + "-" + handler_config.name;
+                auto signature = handler_signature(handler_config, input_event_proxy);
+
+                // an unchanged handler keeps running as it is, preferably the one of the same name
+                auto unchanged = [&](bool same_name) {
+                    return std::find_if(old_modules.begin(), old_modules.end(), [&](const auto &m) {
+                        return !kept.count(m) && policy_ptr->module_signature(m) == signature && (!same_name || policy_ptr->module_name(m) == handler_name);
+                    });
+                };
+                auto old = unchanged(true);
+                if (old == old_modules.end()) {
+                    old = unchanged(false);
+                }
+                if (old != old_modules.end()) {
+                    kept.insert(*old);
+                    modules.push_back({*old, handler_name, signature});
+                    continue;
+                }
+                if (auto shared = _shared_handlers.find(signature); shared != _shared_handlers.end()
+                    && std::none_of(old_modules.begin(), old_modules.end(), [&](const auto &m) { return m->name() == shared->second.module_name; })) {
+                    auto [shared_module, handler_lock] = _registry->handler_manager()->module_get_locked(shared->second.module_name);
+                    spdlog::get("visor")->info("policy [{}]: handler {} is identical to {}, sharing it", policy_name, handler_name, shared_module->name());
+                    modules.push_back({shared_module, handler_name, signature});
+                    ++shared->second.policies;
+                    shared_handlers.push_back(shared->second.module_name);
+                    continue;
+                }
+
+                // the instance it replaces, if any, holds the name until it stops
+                auto taken = [&](const std::string &instance_name) {
+                    return _registry->handler_manager()->module_exists(instance_name)
+                        || std::any_of(created.begin(), created.end(), [&](const auto &m) { return m->name() == instance_name; });
+                };
+                auto instance_name = handler_name;
+                for (size_t n = 2; taken(instance_name); ++n) {
+                    instance_name = fmt::format("{}-{}", handler_name, n);
+                }
+                auto handler_plugin = _registry->handler_plugins().find(std::make_pair(handler_config.type, handler_config.version));
+                auto handler_module = handler_plugin->second->instantiate(instance_name, input_event_proxy, &handler_config.config, &handler_config.filter);
+                handler_module->set_version(handler_config.version);
+                handler_module->follow_input_load(input_event_proxy);
+                if (sharded) {
+                    add_handler_shards(handler_module.get(), handler_plugin->second.get(), handler_config, input_ptr, input_filter);
+                }
+                modules.push_back({handler_module.get(), handler_name, signature});
+                created.emplace_back(std::move(handler_module));
+                created_signatures.push_back(signature);
+            }
+        }
+
+        std::vector<AbstractRunnableModule *> new_modules;
+        for (auto &m : modules) {
+            new_modules.push_back(m.module);
+        }
+        check_merge_like_handlers(*policy_ptr, new_modules);
+        for (auto &m : created) {
+            spdlog::get("visor")->debug("policy [{}]: starting handler instance: {}", policy_name, m->name());
+            m->start();
+            m->start_shards();
+        }
+    } catch (std::runtime_error &e) {
+        for (auto &m : created) {
+            m->stop_shards();
+            if (m->running()) {
+                m->stop();
+            }
+        }
+        for (auto &m : shared_handlers) {
+            _release_handler(m);
+        }
+        throw PolicyException(fmt::format("policy [{}] failed to reload: {}", policy_name, e.what()));
+    }
+
+    auto started = created.size();
+    for (size_t i = 0; i < created.size(); ++i) {
+        auto hname = created[i]->name();
+        _registry->handler_manager()->module_add(std::move(created[i]));
+        if (_shared_handlers.emplace(created_signatures[i], SharedHandler{hname, 1}).second) {
+            _handler_signatures[hname] = created_signatures[i];
+        }
+    }
+    policy_ptr->clear_modules();
+    for (auto &m : modules) {
+        policy_ptr->add_module(m.module, m.name, m.signature);
+    }
+    // the handlers replaced or dropped stop last, unless other policies still use them
+    for (auto &m : old_modules) {
+        if (kept.count(m)) {
+            continue;
+        }
+        auto mod_name = m->name();
+        if (_release_handler(mod_name)) {
+            spdlog::get("visor")->debug("policy [{}]: stopping handler instance: {}", policy_name, mod_name);
+            m->stop();
+            _registry->handler_manager()->module_remove(mod_name);
+        }
+    }
+    policy_ptr->set_definition(policy_node);
+    spdlog::get("visor")->info("policy [{}]: reloaded, {} handlers kept, {} started", policy_name, kept.size(), started);
+    return policy_ptr;
+}
+
 void PolicyManager::remove_policy(const std::string &name)
+{
+    // loads look up shared handlers, which must not go meanwhile
+    std::unique_lock load_lock(_load_mutex);
+    _remove_policy(name);
+}
+
+void PolicyManager::_remove_policy(const std::string &name)
 {
     std::unique_lock lock(_map_mutex);
     if (_map.count(name) == 0) {
@@ -253,11 +595,19 @@ void PolicyManager::remove_policy(const std::string &name)
         input_stream[input->name()] = input;
     }
 
+    // handlers other policies still use keep running, this policy only lets go of them
     std::vector<std::string> module_names;
-    for (const auto &mod : policy->modules()) {
-        module_names.push_back(mod->name());
+    auto modules = policy->modules();
+    for (const auto &mod : modules) {
+        if (_release_handler(mod->name())) {
+            module_names.push_back(mod->name());
+        } else {
+            policy->remove_module(mod);
+        }
     }
     policy->stop();
+    // joins the policy's handler threads, while its handlers still exist
+    policy->remove_own_proxies();
 
     for (const auto &mod_name : module_names) {
         _registry->handler_manager()->module_remove(mod_name);
@@ -282,6 +632,14 @@ void PolicyManager::remove_policy(const std::string &name)
 
     _map.erase(name);
 }
+void Policy::remove_own_proxies()
+{
+    for (auto &[input, proxy] : _own_proxies) {
+        input->remove_event_proxy(proxy);
+    }
+    _own_proxies.clear();
+}
+
 void Policy::info_json(json &j) const
 {
     for (auto &tap : _taps) {
@@ -291,7 +649,7 @@ void Policy::info_json(json &j) const
         input->info_json(j["input"][input->name()]);
     }
     for (auto &mod : _modules) {
-        mod->info_json(j["modules"][mod->name()]);
+        mod->info_json(j["modules"][module_name(mod)]);
     }
 }
 void Policy::start()
@@ -304,10 +662,14 @@ void Policy::start()
 
     // configurations
     _merge_like_handlers = (config_exists("merge_like_handlers") && config_get<bool>("merge_like_handlers"));
+    check_merge_like_handlers(*this, _modules);
 
     for (auto &mod : _modules) {
         spdlog::get("visor")->debug("policy [{}]: starting handler instance: {}", _name, mod->name());
         mod->start();
+        if (auto hmod = dynamic_cast<StreamHandler *>(mod); hmod) {
+            hmod->start_shards();
+        }
     }
     // start input stream _after_ modules, since input stream will create a new thread and we need to catch any startup errors
     // from handlers in the same thread we are starting the policy from
@@ -335,6 +697,9 @@ void Policy::stop()
         input->remove_policy(this);
     }
     for (auto &mod : _modules) {
+        if (auto hmod = dynamic_cast<StreamHandler *>(mod); hmod) {
+            hmod->stop_shards();
+        }
         if (mod->running()) {
             spdlog::get("visor")->debug("policy [{}]: stopping handler instance: {}", _name, mod->name());
             mod->stop();
@@ -365,9 +730,10 @@ void Policy::json_metrics(json &j, uint64_t period, bool merge)
             if (hmod) {
                 try {
                     spdlog::stopwatch sw;
-                    hmod->window_json(j[name()][hmod->name()], period, merge);
-                    if (j[name()][hmod->name()] == nullptr) {
-                        j[name()].erase(hmod->name());
+                    auto &h_name = module_name(hmod);
+                    hmod->window_json(j[name()][h_name], period, merge);
+                    if (j[name()][h_name] == nullptr) {
+                        j[name()].erase(h_name);
                     }
                     spdlog::get("visor")->debug("{} window_json elapsed time: {}", hmod->name(), sw);
                 } catch (const PeriodException &e) {
@@ -391,7 +757,7 @@ void Policy::prometheus_metrics(std::stringstream &out)
             auto hmod = dynamic_cast<StreamHandler *>(mod);
             if (hmod) {
                 spdlog::stopwatch sw;
-                hmod->window_prometheus(out, {{"policy", name()}, {"handler", hmod->name()}});
+                hmod->window_prometheus(out, {{"policy", name()}, {"handler", module_name(hmod)}});
                 spdlog::get("visor")->debug("{} window_prometheus elapsed time: {}", hmod->name(), sw);
             }
         }
@@ -410,7 +776,7 @@ void Policy::opentelemetry_metrics(metrics::v1::ScopeMetrics &scope)
             auto hmod = dynamic_cast<StreamHandler *>(mod);
             if (hmod) {
                 spdlog::stopwatch sw;
-                hmod->window_opentelemetry(scope, {{"policy", name()}, {"handler", hmod->name()}});
+                hmod->window_opentelemetry(scope, {{"policy", name()}, {"handler", module_name(hmod)}});
                 spdlog::get("visor")->debug("{} window_opentelemetry elapsed time: {}", hmod->name(), sw);
             }
         }
@@ -8,10 +8,12 @@
 #include "AbstractModule.h"
 #include "Configurable.h"
 #include "HandlerModulePlugin.h"
+#include "HandlerThread.h"
 #include "InputModulePlugin.h"
 #include "OpenTelemetry.h"
 #include "Taps.h"
 #include <map>
+#include <optional>
 #include <vector>
 #include <yaml-cpp/yaml.h>
 
@@ -39,9 +41,21 @@ private:
 
     std::vector<Tap *> _taps;
     std::vector<InputStream *> _input_streams;
+    // with a handler thread, the policy has event proxies of its own, which go when it does
+    std::optional<HandlerThreadConfig> _thread_config;
+    std::vector<std::pair<InputStream *, InputEventProxy *>> _own_proxies;
     bool _modules_sequence{false};
     bool _merge_like_handlers{false};
     std::vector<AbstractRunnableModule *> _modules;
+    // what this policy knows its handlers by: its own name for them, which differs from the instance name of a handler
+    // shared with other policies, and the signature identical handlers are found by
+    struct ModuleEntry {
+        std::string name;
+        std::string signature;
+    };
+    std::map<const AbstractRunnableModule *, ModuleEntry> _module_entries;
+    // the policy as it was applied, for reload() to tell what changed
+    YAML::Node _definition;
 
     BucketMap _get_merged_buckets(bool prometheus = true, uint64_t period = 0, bool merged = false);
 
@@ -81,16 +95,85 @@ public:
         return _input_streams;
     }
 
+    void set_thread_config(const HandlerThreadConfig &config)
+    {
+        _thread_config = config;
+    }
+
+    const std::optional<HandlerThreadConfig> &thread_config() const
+    {
+        return _thread_config;
+    }
+
+    void add_own_proxy(InputStream *input_stream, InputEventProxy *proxy)
+    {
+        _own_proxies.emplace_back(input_stream, proxy);
+    }
+
+    // removes the event proxies of the policy from their inputs, once its handlers are stopped
+    void remove_own_proxies();
+
     void add_module(AbstractRunnableModule *m)
     {
         _modules.push_back(m);
     }
 
+    void add_module(AbstractRunnableModule *m, const std::string &name, const std::string &signature = std::string())
+    {
+        _modules.push_back(m);
+        _module_entries[m] = ModuleEntry{name, signature};
+    }
+
+    // detaches a handler still in use by other policies, so stopping this policy leaves it running
+    void remove_module(const AbstractRunnableModule *m)
+    {
+        _modules.erase(std::remove(_modules.begin(), _modules.end(), m), _modules.end());
+        _module_entries.erase(m);
+    }
+
+    void clear_modules()
+    {
+        _modules.clear();
+        _module_entries.clear();
+    }
+
     const std::vector<AbstractRunnableModule *> &modules()
     {
         return _modules;
     }
 
+    const std::string &module_name(const AbstractRunnableModule *m) const
+    {
+        auto it = _module_entries.find(m);
+        return it != _module_entries.end() ? it->second.name : m->name();
+    }
+
+    std::string module_signature(const AbstractRunnableModule *m) const
+    {
+        auto it = _module_entries.find(m);
+        return it != _module_entries.end() ? it->second.signature : std::string();
+    }
+
+    bool modules_sequence() const
+    {
+        return _modules_sequence;
+    }
+
+    const std::vector<Tap *> &taps() const
+    {
+        return _taps;
+    }
+
+    void set_definition(const YAML::Node &definition)
+    {
+        _definition = YAML::Clone(definition);
+    }
+
+    const YAML::Node &definition() const
+    {
+        return _definition;
+    }
+
     size_t get_handlers_list_size() const
     {
         if (_modules_sequence) {
@@ -113,10 +196,28 @@ public:
 
 class PolicyManager : public AbstractManager<Policy>
 {
+    // a handler instance run once for all the policies asking for an identical one, see load()
+    struct SharedHandler {
+        std::string module_name;
+        size_t policies{0};
+    };
+
     mutable std::mutex _load_mutex;
     CoreRegistry *_registry;
-
-    std::string _get_policy_name(YAML::const_iterator it);
+    // by handler signature, and the signature of each shared instance by module name
+    std::map<std::string, SharedHandler> _shared_handlers;
+    std::map<std::string, std::string> _handler_signatures;
+
+    YAML::Node _get_policies_node(const std::string &str);
+    std::string _get_policy_name(YAML::const_iterator it, bool existing = false);
+    std::optional<HandlerThreadConfig> _get_thread_config(const std::string &policy_name, const Policy &policy);
+    // the bodies of load() and remove_policy(), for callers holding _load_mutex
+    Policy *_load_policy(YAML::const_iterator it);
+    void _remove_policy(const std::string &name);
+    // nullptr if more than the handlers of the policy changed
+    Policy *_reload_handlers(const std::string &policy_name, const YAML::Node &policy_node);
+    // one policy less uses the handler instance. true if none is left, and it can go
+    bool _release_handler(const std::string &module_name);
 
 public:
     PolicyManager(CoreRegistry *registry)
@@ -130,6 +231,8 @@ public:
 
     std::vector<Policy *> load_from_str(const std::string &str);
     std::vector<Policy *> load(const YAML::Node &tap_yaml, bool single = false);
+    Policy *reload_from_str(const std::string &name, const std::string &str);
+    Policy *reload(const std::string &name, const YAML::Node &policy_yaml);
     std::pair<std::string, std::string> create_resources_policy(const std::string &policy_name, InputStream *input, const Config &window_config);
     void remove_policy(const std::string &name);
 };
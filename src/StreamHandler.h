@@ -8,9 +8,13 @@
 #include "AbstractModule.h"
 #include "CoreRegistry.h"
 #include "InputEventProxy.h"
+#include <array>
+#include <cstring>
 #include <ctime>
 #include <fmt/ostream.h>
+#include <map>
 #include <nlohmann/json.hpp>
+#include <shared_mutex>
 #include <sstream>
 
 namespace visor {
@@ -26,11 +30,38 @@ public:
     }
 };
 
+// the raw value of the partition_by dimension of an event, e.g. a VLAN id or the bytes of an address, so finding the
+// partition of an event builds no string. kind tells apart the types of value of a handler, 0 is the partition "other"
+struct PartitionKey {
+    uint8_t kind{0};
+    std::array<uint8_t, 16> value{};
+
+    PartitionKey() = default;
+    explicit PartitionKey(uint8_t kind, const void *data = nullptr, size_t len = 0)
+        : kind(kind)
+    {
+        if (len) {
+            std::memcpy(value.data(), data, std::min(len, value.size()));
+        }
+    }
+
+    bool operator<(const PartitionKey &other) const
+    {
+        return kind != other.kind ? kind < other.kind : value < other.value;
+    }
+};
+
 class StreamHandler : public AbstractRunnableModule
 {
 protected:
     std::unique_ptr<InputEventProxy> _event_proxy;
     std::string _version{CoreRegistry::DEFAULT_HANDLER_PLUGIN_VERSION};
+    // scoped, since the handler may go away before the input it follows
+    sigslot::scoped_connection _load_connection;
+    InputEventProxy *_followed_proxy{nullptr};
+    // instances of this handler on the other shards of its input, see InputStream::handler_shards(). this one is the
+    // instance policies know: it starts and stops the others, and reports their metrics together with its own
+    std::vector<std::unique_ptr<StreamHandler>> _shards;
 
 public:
     StreamHandler(const std::string &name)
@@ -38,7 +69,18 @@ public:
     {
     }
 
-    virtual ~StreamHandler(){};
+    virtual ~StreamHandler()
+    {
+        for (auto &shard : _shards) {
+            if (shard->running()) {
+                shard->stop();
+            }
+        }
+        // policies remove their handlers before the proxies they attached them to
+        if (_followed_proxy) {
+            _followed_proxy->handler_detached(name());
+        }
+    };
 
     size_t consumer_count() const
     {
@@ -68,6 +110,47 @@ public:
         return _version;
     }
 
+    void add_shard(std::unique_ptr<StreamHandler> shard)
+    {
+        _shards.push_back(std::move(shard));
+    }
+
+    size_t shard_count() const
+    {
+        return _shards.size() + 1;
+    }
+
+    // policies call these next to start() and stop()
+    void start_shards()
+    {
+        for (auto &shard : _shards) {
+            shard->start();
+        }
+    }
+
+    void stop_shards()
+    {
+        for (auto &shard : _shards) {
+            if (shard->running()) {
+                shard->stop();
+            }
+        }
+    }
+
+    // have input_load() called whenever the input behind proxy reports its load. policies call this for every handler
+    // they attach, which the proxy hears as handler_attached()
+    void follow_input_load(InputEventProxy *proxy)
+    {
+        _load_connection = proxy->load_signal.connect([this](uint32_t load) { input_load(load); });
+        proxy->handler_attached(name());
+        _followed_proxy = proxy;
+    }
+
+    // how close the input is to losing events, in percent
+    virtual void input_load([[maybe_unused]] uint32_t load)
+    {
+    }
+
     virtual void window_json(json &j, uint64_t period, bool merged) = 0;
     virtual void window_json(json &j, AbstractMetricsBucket *bucket) = 0;
     virtual void window_prometheus(std::stringstream &out, Metric::LabelMap add_labels = {}) = 0;
@@ -87,6 +170,8 @@ public:
 private:
     static const inline ConfigsDefType _window_config_defs = {
         "deep_sample_rate",
+        "deep_sample_rate_min",
+        "deep_sample_mode",
         "num_periods",
         "topn_count",
         "topn_percentile_threshold"};
@@ -104,10 +189,166 @@ private:
         return it->second;
     }
 
+    // a copy, partitions are created long after the policy config that was passed in is gone
+    Configurable _window_config;
+    size_t _partition_max{DEFAULT_PARTITION_MAX};
+    struct Partition {
+        std::string label;
+        std::unique_ptr<MetricsManagerClass> metrics;
+    };
+    mutable std::shared_mutex _partitions_mutex;
+    std::map<PartitionKey, Partition> _partitions;
+
+    std::unique_ptr<MetricsManagerClass> _new_partition()
+    {
+        auto partition = std::make_unique<MetricsManagerClass>(&_window_config);
+        partition->configure_groups(&_groups);
+        // periods shift together with those of the handler totals
+        partition->set_start_tstamp(_metrics->start_tstamp());
+        configure_partition(*partition);
+        return partition;
+    }
+
+    // partitions are reported as <schema>_partition_<metric>, so summing a metric of the totals does not count every
+    // event once more
+    static inline const std::string PARTITION_NAME_PREFIX = "partition_";
+
+    // what this instance and its shards have for period, summed into one bucket for the totals and one per partition
+    // label. live takes the period each instance reports on its own, see window_prometheus(). a shard, or a partition,
+    // that has not reached the period yet adds nothing to it
+    struct ShardSum {
+        std::unique_ptr<AbstractMetricsBucket> totals;
+        std::map<std::string, std::unique_ptr<AbstractMetricsBucket>> partitions;
+    };
+
+    ShardSum _sum_shards(uint64_t period, bool merged, bool live)
+    {
+        ShardSum sum;
+        auto add = [&](std::unique_ptr<AbstractMetricsBucket> &bucket, MetricsManagerClass &metrics) {
+            auto p = live ? (metrics.current_periods() > 1 ? 1 : 0) : period;
+            auto result = merged ? metrics.multiple_merge(bucket.get(), p) : metrics.simple_merge(bucket.get(), p);
+            if (result) {
+                bucket = std::move(result);
+            }
+        };
+        auto add_partitions = [&](StreamMetricsHandler &handler) {
+            handler.for_each_partition([&](const std::string &label, MetricsManagerClass &partition) {
+                try {
+                    add(sum.partitions[label], partition);
+                } catch (const PeriodException &) {
+                }
+            });
+        };
+        // a period this instance does not have is an error, as without shards
+        add(sum.totals, *_metrics);
+        add_partitions(*this);
+        for (auto &shard : _shards) {
+            // same plugin, so same class
+            auto &handler = static_cast<StreamMetricsHandler &>(*shard);
+            try {
+                add(sum.totals, *handler._metrics);
+            } catch (const PeriodException &) {
+            }
+            add_partitions(handler);
+        }
+        return sum;
+    }
+
+    // the labels window_single_prometheus() and window_single_opentelemetry() add on their own
+    Metric::LabelMap _shard_labels(Metric::LabelMap add_labels) const
+    {
+        if (_window_config.config_exists("_internal_tap_name")) {
+            add_labels.try_emplace("tap", _window_config.config_get<std::string>("_internal_tap_name"));
+        }
+        return add_labels;
+    }
+
 protected:
     std::unique_ptr<MetricsManagerClass> _metrics;
     std::bitset<GROUP_SIZE> _groups;
 
+    // with partition_by, every event also counts in the metrics of its partition, e.g. its VLAN or server address:
+    // one more metrics manager per key, up to partition_max of them, and one for all the keys beyond. one parse of a
+    // packet feeds the totals and its partition, where a policy per dimension would parse it once per policy
+    static constexpr uint64_t DEFAULT_PARTITION_MAX = 64;
+    static constexpr uint64_t MAX_PARTITION_MAX = 4096;
+    static inline const PartitionKey PARTITION_OTHER{};
+    std::string _partition_by;
+
+    void process_partitions(const std::vector<std::string> &dimensions)
+    {
+        if (!config_exists("partition_by")) {
+            if (config_exists("partition_max")) {
+                throw StreamHandlerException("partition_max requires partition_by");
+            }
+            return;
+        }
+        auto partition_by = config_get<std::string>("partition_by");
+        if (std::find(dimensions.begin(), dimensions.end(), partition_by) == dimensions.end()) {
+            throw StreamHandlerException(fmt::format("{} is an invalid/unsupported partition_by. The valid dimensions are: {}", partition_by, fmt::join(dimensions, ", ")));
+        }
+        if (config_exists("partition_max")) {
+            auto partition_max = config_get<uint64_t>("partition_max");
+            if (partition_max < 1 || partition_max > MAX_PARTITION_MAX) {
+                throw StreamHandlerException(fmt::format("partition_max must be between 1 and {}", MAX_PARTITION_MAX));
+            }
+            _partition_max = partition_max;
+        }
+        _partition_by = partition_by;
+    }
+
+    // called on every partition as it is created, to set it up like _metrics
+    virtual void configure_partition([[maybe_unused]] MetricsManagerClass &partition)
+    {
+    }
+
+    // how a key is shown in JSON and in the label of its partition, called once per partition
+    virtual std::string partition_label([[maybe_unused]] const PartitionKey &key) const
+    {
+        return std::to_string(key.kind);
+    }
+
+    // the metrics of the partition of key, created on first use
+    MetricsManagerClass *partition(const PartitionKey &key)
+    {
+        // CRITICAL PATH
+        {
+            std::shared_lock lock(_partitions_mutex);
+            if (auto it = _partitions.find(key); it != _partitions.end()) {
+                return it->second.metrics.get();
+            }
+        }
+        std::unique_lock lock(_partitions_mutex);
+        auto it = _partitions.find(key);
+        if (it == _partitions.end()) {
+            auto full = _partitions.size() - _partitions.count(PARTITION_OTHER) >= _partition_max;
+            const auto &slot_key = full ? PARTITION_OTHER : key;
+            it = _partitions.find(slot_key);
+            if (it == _partitions.end()) {
+                it = _partitions.emplace(slot_key, Partition{slot_key.kind ? partition_label(slot_key) : "other", _new_partition()}).first;
+            }
+        }
+        return it->second.metrics.get();
+    }
+
+    template <typename F>
+    void for_each_partition(F &&cb)
+    {
+        std::shared_lock lock(_partitions_mutex);
+        for (auto &[key, partition] : _partitions) {
+            cb(partition.label, *partition.metrics);
+        }
+    }
+
+    template <typename F>
+    void for_each_partition(F &&cb) const
+    {
+        std::shared_lock lock(_partitions_mutex);
+        for (const auto &[key, partition] : _partitions) {
+            cb(partition.label, static_cast<const MetricsManagerClass &>(*partition.metrics));
+        }
+    }
+
     void process_groups(const GroupDefType &group_defs)
     {
         if (config_exists("disable")) {
@@ -156,6 +397,9 @@ protected:
         AbstractRunnableModule::common_info_json(j);
 
         j["metrics"]["deep_sample_rate"] = _metrics->deep_sample_rate();
+        if (auto [min, max] = _metrics->deep_sample_rate_bounds(); min != max) {
+            j["metrics"]["deep_sample_rate_bounds"] = {min, max};
+        }
         j["metrics"]["periods_configured"] = _metrics->num_periods();
 
         j["metrics"]["periods"] = json::array();
@@ -195,11 +439,19 @@ protected:
             num_samples->to_json(j["metrics"]["periods"][i]["events"]);
             event_rate->to_json(j["metrics"]["periods"][i]["events"]["rates"], !_metrics->bucket(i)->read_only());
         }
+
+        if (!_partition_by.empty()) {
+            j["metrics"]["partitions"]["by"] = _partition_by;
+            j["metrics"]["partitions"]["max"] = _partition_max;
+            std::shared_lock lock(_partitions_mutex);
+            j["metrics"]["partitions"]["count"] = _partitions.size();
+        }
     }
 
 public:
     StreamMetricsHandler(const std::string &name, const Configurable *window_config)
         : StreamHandler(name)
+        , _window_config(*window_config)
     {
         _metrics = std::make_unique<MetricsManagerClass>(window_config);
     }
@@ -211,11 +463,37 @@ public:
 
     void window_json(json &j, uint64_t period, bool merged) override
     {
+        if (!_shards.empty()) {
+            auto sum = _sum_shards(period, merged, false);
+            _metrics->window_external_json(j, schema_key(), sum.totals.get());
+            for (auto &[label, bucket] : sum.partitions) {
+                json pj;
+                if (bucket) {
+                    _metrics->window_external_json(pj, label, bucket.get());
+                }
+                if (pj.contains(label)) {
+                    j[schema_key()]["partitions"][_partition_by][label] = std::move(pj[label]);
+                }
+            }
+            return;
+        }
         if (merged) {
             _metrics->window_merged_json(j, schema_key(), period);
         } else {
             _metrics->window_single_json(j, schema_key(), period);
         }
+        for_each_partition([&](const std::string &key, const MetricsManagerClass &partition) {
+            json pj;
+            try {
+                merged ? partition.window_merged_json(pj, key, period) : partition.window_single_json(pj, key, period);
+            } catch (const PeriodException &) {
+                // the partition was created after that period
+                return;
+            }
+            if (pj.contains(key)) {
+                j[schema_key()]["partitions"][_partition_by][key] = std::move(pj[key]);
+            }
+        });
     }
 
     void window_json(json &j, AbstractMetricsBucket *bucket) override
@@ -225,11 +503,30 @@ public:
 
     void window_prometheus(std::stringstream &out, Metric::LabelMap add_labels = {}) override
     {
+        if (!_shards.empty()) {
+            auto sum = _sum_shards(0, false, true);
+            add_labels = _shard_labels(std::move(add_labels));
+            _metrics->window_external_prometheus(out, sum.totals.get(), add_labels);
+            for (auto &[label, bucket] : sum.partitions) {
+                if (bucket) {
+                    auto labels = add_labels;
+                    labels[_partition_by] = label;
+                    _metrics->window_external_prometheus(out, bucket.get(), labels, PARTITION_NAME_PREFIX);
+                }
+            }
+            return;
+        }
         if (_metrics->current_periods() > 1) {
             _metrics->window_single_prometheus(out, 1, add_labels);
         } else {
             _metrics->window_single_prometheus(out, 0, add_labels);
         }
+        // partitions carry their key in a label named after the dimension, e.g. vlan="100"
+        for_each_partition([&](const std::string &label, const MetricsManagerClass &partition) {
+            auto labels = add_labels;
+            labels[_partition_by] = label;
+            partition.window_single_prometheus(out, partition.current_periods() > 1 ? 1 : 0, labels, PARTITION_NAME_PREFIX);
+        });
     }
 
     void window_prometheus(std::stringstream &out, AbstractMetricsBucket *bucket, Metric::LabelMap add_labels = {}) override
@@ -239,11 +536,29 @@ public:
 
     void window_opentelemetry(metrics::v1::ScopeMetrics &scope, Metric::LabelMap add_labels = {}) override
     {
+        if (!_shards.empty()) {
+            auto sum = _sum_shards(0, false, true);
+            add_labels = _shard_labels(std::move(add_labels));
+            _metrics->window_external_opentelemetry(scope, sum.totals.get(), add_labels);
+            for (auto &[label, bucket] : sum.partitions) {
+                if (bucket) {
+                    auto labels = add_labels;
+                    labels[_partition_by] = label;
+                    _metrics->window_external_opentelemetry(scope, bucket.get(), labels, PARTITION_NAME_PREFIX);
+                }
+            }
+            return;
+        }
         if (_metrics->current_periods() > 1) {
             _metrics->window_single_opentelemetry(scope, 1, add_labels);
         } else {
             _metrics->window_single_opentelemetry(scope, 0, add_labels);
         }
+        for_each_partition([&](const std::string &label, const MetricsManagerClass &partition) {
+            auto labels = add_labels;
+            labels[_partition_by] = label;
+            partition.window_single_opentelemetry(scope, partition.current_periods() > 1 ? 1 : 0, labels, PARTITION_NAME_PREFIX);
+        });
     }
 
     void window_opentelemetry(metrics::v1::ScopeMetrics &scope, AbstractMetricsBucket *bucket, Metric::LabelMap add_labels = {}) override
@@ -254,6 +569,17 @@ public:
     void check_period_shift(timespec stamp)
     {
         _metrics->check_period_shift(stamp);
+        for_each_partition([stamp](const std::string &, MetricsManagerClass &partition) {
+            partition.check_period_shift(stamp);
+        });
+    }
+
+    void input_load(uint32_t load) override
+    {
+        _metrics->adapt_deep_sample_rate(load);
+        for_each_partition([load](const std::string &, MetricsManagerClass &partition) {
+            partition.adapt_deep_sample_rate(load);
+        });
     }
 
     std::unique_ptr<AbstractMetricsBucket> merge(AbstractMetricsBucket *bucket, uint64_t period, bool prometheus, bool merged) override
@@ -262,10 +588,15 @@ public:
             (_metrics->current_periods() > 1) ? period = 1 : period = 0;
             merged = false;
         }
-        if (merged) {
-            return _metrics->multiple_merge(bucket, period);
+        auto result = merged ? _metrics->multiple_merge(bucket, period) : _metrics->simple_merge(bucket, period);
+        // the shards add theirs to what this one returned, or to the bucket it added to
+        for (auto &shard : _shards) {
+            try {
+                shard->merge(result ? result.get() : bucket, period, prometheus, merged);
+            } catch (const PeriodException &) {
+            }
         }
-        return _metrics->simple_merge(bucket, period);
+        return result;
     }
 
     virtual ~StreamMetricsHandler(){};
@@ -9,8 +9,11 @@
 #include <pthread.h>
 #elif __linux__
 #include <pthread.h>
+#include <sched.h>
 #endif
+#include <cstdint>
 #include <string>
+#include <vector>
 
 namespace visor::thread {
 
@@ -25,4 +28,25 @@ static inline void change_self_name(std::string schema, std::string unique_name)
 #endif
 }
 
+// restricts the calling thread to the given CPUs. false if that is not supported or the CPUs are not available
+static inline bool pin_self(const std::vector<uint32_t> &cpus)
+{
+    if (cpus.empty()) {
+        return true;
+    }
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+        if (cpu >= CPU_SETSIZE) {
+            return false;
+        }
+        CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
 }
\ No newline at end of file
@@ -34,6 +34,8 @@ void BgpStreamHandler::start()
         _tcp_start_connection = _pcap_proxy->tcp_connection_start_signal.connect(&BgpStreamHandler::tcp_connection_start_cb, this);
         _tcp_end_connection = _pcap_proxy->tcp_connection_end_signal.connect(&BgpStreamHandler::tcp_connection_end_cb, this);
         _tcp_message_connection = _pcap_proxy->tcp_message_ready_signal.connect(&BgpStreamHandler::tcp_message_ready_cb, this);
+        _pcap_proxy->register_tcp_ports(name(), TcpPortRanges{179});
+        _pcap_proxy->register_bpf(name(), "tcp port 179");
         _start_tstamp_connection = _pcap_proxy->start_tstamp_signal.connect(&BgpStreamHandler::set_start_tstamp, this);
         _end_tstamp_connection = _pcap_proxy->end_tstamp_signal.connect(&BgpStreamHandler::set_end_tstamp, this);
         _heartbeat_connection = _pcap_proxy->heartbeat_signal.connect(&BgpStreamHandler::check_period_shift, this);
@@ -52,6 +54,8 @@ void BgpStreamHandler::stop()
         _tcp_start_connection.disconnect();
         _tcp_end_connection.disconnect();
         _tcp_message_connection.disconnect();
+        _pcap_proxy->unregister_tcp_ports(name());
+        _pcap_proxy->unregister_bpf(name());
         _start_tstamp_connection.disconnect();
         _end_tstamp_connection.disconnect();
         _heartbeat_connection.disconnect();
@@ -60,6 +60,7 @@ void DhcpStreamHandler::start()
 
     if (_pcap_proxy) {
         _pkt_udp_connection = _pcap_proxy->udp_signal.connect(&DhcpStreamHandler::process_udp_packet_cb, this);
+        _pcap_proxy->register_bpf(name(), "udp and (port 67 or port 68 or port 546 or port 547)");
         _start_tstamp_connection = _pcap_proxy->start_tstamp_signal.connect(&DhcpStreamHandler::set_start_tstamp, this);
         _end_tstamp_connection = _pcap_proxy->end_tstamp_signal.connect(&DhcpStreamHandler::set_end_tstamp, this);
         _heartbeat_connection = _pcap_proxy->heartbeat_signal.connect(&DhcpStreamHandler::check_period_shift, this);
@@ -76,6 +77,7 @@ void DhcpStreamHandler::stop()
 
     if (_pcap_proxy) {
         _pkt_udp_connection.disconnect();
+        _pcap_proxy->unregister_bpf(name());
         _start_tstamp_connection.disconnect();
         _end_tstamp_connection.disconnect();
         _heartbeat_connection.disconnect();
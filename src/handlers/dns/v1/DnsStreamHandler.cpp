@@ -25,8 +25,6 @@
 #include <sstream>
 namespace visor::handler::dns {
 
-thread_local DnsStreamHandler::DnsCacheData DnsStreamHandler::_cached_dns_layer;
-
 DnsStreamHandler::DnsStreamHandler(const std::string &name, InputEventProxy *proxy, const Configurable *window_config)
     : visor::StreamMetricsHandler<DnsMetricsManager>(name, window_config)
 {
@@ -80,7 +78,7 @@ void DnsStreamHandler::start()
             } else {
                 throw ConfigException("DnsStreamHandler: only_rcode filter contained an invalid/unsupported rcode");
             }
-            _register_predicate_filter(Filters::OnlyRCode, "only_rcode", std::to_string(want_code));
+            _register_predicate_filter(Filters::OnlyRCode, "only_rcode", want_code);
         } else {
             for (const auto &rcode : rcodes) {
                 if (std::all_of(rcode.begin(), rcode.end(), ::isdigit)) {
@@ -89,7 +87,7 @@ void DnsStreamHandler::start()
                         throw ConfigException(fmt::format("DnsStreamHandler: only_rcode filter contained an invalid/unsupported rcode: {}", value));
                     }
                     _f_rcodes.push_back(value);
-                    _register_predicate_filter(Filters::OnlyRCode, "only_rcode", rcode);
+                    _register_predicate_filter(Filters::OnlyRCode, "only_rcode", value);
                 } else {
                     std::string upper_rcode{rcode};
                     std::transform(upper_rcode.begin(), upper_rcode.end(), upper_rcode.begin(),
@@ -97,7 +95,7 @@ void DnsStreamHandler::start()
                     if (RCodeNumbers.find(upper_rcode) != RCodeNumbers.end()) {
                         auto value = RCodeNumbers[upper_rcode];
                         _f_rcodes.push_back(value);
-                        _register_predicate_filter(Filters::OnlyRCode, "only_rcode", std::to_string(value));
+                        _register_predicate_filter(Filters::OnlyRCode, "only_rcode", value);
                     } else {
                         throw ConfigException(fmt::format("DnsStreamHandler: only_rcode filter contained an invalid/unsupported rcode: {}", rcode));
                     }
@@ -150,7 +148,7 @@ void DnsStreamHandler::start()
             std::transform(qname_ci.begin(), qname_ci.end(), qname_ci.begin(),
                 [](unsigned char c) { return std::tolower(c); });
             _f_qnames.emplace_back(qname_ci);
-            _register_predicate_filter(Filters::OnlyQName, "only_qname", qname_ci);
+            _register_predicate_filter(Filters::OnlyQName, "only_qname", _qname_predicate_value(qname_ci));
         }
     }
     if (config_exists("only_qname_suffix")) {
@@ -216,6 +214,8 @@ void DnsStreamHandler::start()
         _tcp_start_connection = _pcap_proxy->tcp_connection_start_signal.connect(&DnsStreamHandler::tcp_connection_start_cb, this);
         _tcp_end_connection = _pcap_proxy->tcp_connection_end_signal.connect(&DnsStreamHandler::tcp_connection_end_cb, this);
         _tcp_message_connection = _pcap_proxy->tcp_message_ready_signal.connect(&DnsStreamHandler::tcp_message_ready_cb, this);
+        _pcap_proxy->register_tcp_ports(name(), TcpPortRanges(std::begin(DnsLayer::DNS_PORTS), std::end(DnsLayer::DNS_PORTS)));
+        _pcap_proxy->register_bpf(name(), DnsLayer::DNS_PORTS_BPF);
         _heartbeat_connection = _pcap_proxy->heartbeat_signal.connect([this](const timespec stamp) {
             check_period_shift(stamp);
             _event_proxy ? _event_proxy->heartbeat_signal(stamp) : void();
@@ -245,6 +245,8 @@ void DnsStreamHandler::stop()
         _tcp_start_connection.disconnect();
         _tcp_end_connection.disconnect();
         _tcp_message_connection.disconnect();
+        _pcap_proxy->unregister_tcp_ports(name());
+        _pcap_proxy->unregister_bpf(name());
         if (_using_predicate_signals) {
             _pcap_proxy->unregister_udp_predicate_signal(name());
         }
@@ -283,18 +285,14 @@ void DnsStreamHandler::process_udp_packet_cb(pcpp::Packet &payload, PacketDirect
         metric_port = dst_port;
     }
     if (metric_port) {
-        if (flowkey != _cached_dns_layer.flowKey || stamp.tv_sec != _cached_dns_layer.timestamp.tv_sec || stamp.tv_nsec != _cached_dns_layer.timestamp.tv_nsec) {
-            _cached_dns_layer.flowKey = flowkey;
-            _cached_dns_layer.timestamp = stamp;
-            _cached_dns_layer.dnsLayer = std::make_unique<DnsLayer>(udpLayer, &payload);
-        }
-        auto dnsLayer = _cached_dns_layer.dnsLayer.get();
+        // parsed once per packet, whichever handler or policy gets to it first
+        auto dnsLayer = &PacketContext::of(payload).app_layer<DnsLayer>(udpLayer, &payload);
         if (!_filtering(*dnsLayer, dir, l3, pcpp::UDP, metric_port, stamp) && _configs(*dnsLayer)) {
             _metrics->process_dns_layer(*dnsLayer, dir, l3, pcpp::UDP, flowkey, metric_port, _static_suffix_size, stamp);
             _static_suffix_size = 0;
             // signal for chained stream handlers, if we have any
             if (_event_proxy) {
-                static_cast<PcapInputEventProxy *>(_event_proxy.get())->packet_signal(payload, dir, l3, pcpp::UDP, stamp);
+                static_cast<PcapInputEventProxy *>(_event_proxy.get())->process_packet_cb(payload, dir, l3, pcpp::UDP, stamp);
                 static_cast<PcapInputEventProxy *>(_event_proxy.get())->udp_signal(payload, dir, l3, flowkey, stamp);
             }
         }
@@ -317,12 +315,8 @@ void DnsStreamHandler::process_tcp_reassembled_packet_cb(pcpp::Packet &payload,
         metric_port = dst_port;
     }
     if (metric_port) {
-        if (flowkey != _cached_dns_layer.flowKey || stamp.tv_sec != _cached_dns_layer.timestamp.tv_sec || stamp.tv_nsec != _cached_dns_layer.timestamp.tv_nsec) {
-            _cached_dns_layer.flowKey = flowkey;
-            _cached_dns_layer.timestamp = stamp;
-            _cached_dns_layer.dnsLayer = std::make_unique<DnsLayer>(tcpLayer, &payload);
-        }
-        auto dnsLayer = _cached_dns_layer.dnsLayer.get();
+        // parsed once per packet, whichever handler or policy gets to it first
+        auto dnsLayer = &PacketContext::of(payload).app_layer<DnsLayer>(tcpLayer, &payload);
         if (!_filtering(*dnsLayer, dir, l3, pcpp::TCP, metric_port, stamp) && _configs(*dnsLayer)) {
             _metrics->process_dns_layer(*dnsLayer, dir, l3, pcpp::TCP, flowkey, metric_port, _static_suffix_size, stamp);
             _static_suffix_size = 0;
@@ -482,43 +476,83 @@ void DnsStreamHandler::info_json(json &j) const
     j[schema_key()]["predicate"]["enabled"] = _using_predicate_signals;
 }
 
-inline void DnsStreamHandler::_register_predicate_filter(Filters filter, std::string f_key, std::string f_value)
+// FNV-1a, fed byte by byte so both the wire and the decoded form of a name can be hashed in place
+static constexpr uint64_t QNAME_HASH_SEED = 14695981039346656037ULL;
+static constexpr uint64_t QNAME_HASH_PRIME = 1099511628211ULL;
+
+static inline uint64_t qname_hash(uint64_t hash, uint8_t c)
+{
+    return (hash ^ c) * QNAME_HASH_PRIME;
+}
+
+uint64_t DnsStreamHandler::_qname_predicate_value(std::string_view qname)
+{
+    uint64_t hash = QNAME_HASH_SEED;
+    for (auto c : qname) {
+        hash = qname_hash(hash, static_cast<uint8_t>(c));
+    }
+    return hash;
+}
+
+uint64_t DnsStreamHandler::_qname_predicate_value(DnsLayer &payload)
+{
+    auto data = payload.getData();
+    auto len = payload.getDataLen();
+    if (len <= sizeof(dnshdr) || payload.getDnsHeader()->numberOfQuestions == 0) {
+        return PcapInputEventProxy::NO_PREDICATE_VALUE;
+    }
+    // labels of the first question, joined with dots and lowercased like IDnsResource::decodeName() and getNameLower()
+    uint64_t hash = QNAME_HASH_SEED;
+    size_t offset = sizeof(dnshdr);
+    bool first{true};
+    while (offset < len) {
+        uint8_t label_len = data[offset];
+        if (label_len == 0) {
+            return hash;
+        }
+        if ((label_len & 0xc0) != 0 || offset + 1 + label_len > len) {
+            break;
+        }
+        if (!first) {
+            hash = qname_hash(hash, '.');
+        }
+        first = false;
+        for (size_t i = offset + 1; i <= offset + label_len; ++i) {
+            hash = qname_hash(hash, static_cast<uint8_t>(std::tolower(data[i])));
+        }
+        offset += 1 + label_len;
+    }
+    // compressed or truncated, which decoding tolerates in ways not worth repeating here
+    if (!payload.parseResources(true) || payload.getFirstQuery() == nullptr) {
+        return PcapInputEventProxy::NO_PREDICATE_VALUE;
+    }
+    return _qname_predicate_value(payload.getFirstQuery()->getNameLower());
+}
+
+inline void DnsStreamHandler::_register_predicate_filter(Filters filter, std::string f_key, uint64_t f_value)
 {
     PcapInputEventProxy::UdpPredicate predicate;
     if (filter == Filters::OnlyRCode) {
         // all DnsStreamHandler race to install this predicate, which is only installed once per thread and called once per udp event
-        // it's job is to return the predicate "jump key" to call matching signals
-        static thread_local auto udp_rcode_predicate = [&cache = _cached_dns_layer](pcpp::Packet &payload, PacketDirection, pcpp::ProtocolType, uint32_t flowkey, timespec stamp) -> std::string {
+        // it's job is to return the predicate value to call matching signals
+        static thread_local auto udp_rcode_predicate = [](pcpp::Packet &payload, PacketDirection, pcpp::ProtocolType, uint32_t, timespec) -> uint64_t {
             pcpp::UdpLayer *udpLayer = payload.getLayerOfType<pcpp::UdpLayer>();
             assert(udpLayer);
-            if (flowkey != cache.flowKey || stamp.tv_sec != cache.timestamp.tv_sec || stamp.tv_nsec != cache.timestamp.tv_nsec) {
-                cache.flowKey = flowkey;
-                cache.timestamp = stamp;
-                cache.dnsLayer = std::make_unique<DnsLayer>(udpLayer, &payload);
-            }
-            auto dnsLayer = cache.dnsLayer.get();
-            // return the 'jump key' for pcap to make O(1) call to appropriate signals
+            auto dnsLayer = &PacketContext::of(payload).app_layer<DnsLayer>(udpLayer, &payload);
+            // return the rcode for pcap to call appropriate signals
             if (dnsLayer->getDnsHeader()->queryOrResponse != QR::response) {
-                return std::string(DNS_SCHEMA) + "only_rcode255"; // invalid rcode
+                return PcapInputEventProxy::NO_PREDICATE_VALUE;
             }
-            return std::string(DNS_SCHEMA) + "only_rcode" + std::to_string(dnsLayer->getDnsHeader()->responseCode);
+            return dnsLayer->getDnsHeader()->responseCode;
         };
         predicate = udp_rcode_predicate;
     } else if (filter == Filters::OnlyQName) {
-        static thread_local auto udp_qname_predicate = [&cache = _cached_dns_layer](pcpp::Packet &payload, PacketDirection, pcpp::ProtocolType, uint32_t flowkey, timespec stamp) -> std::string {
+        static thread_local auto udp_qname_predicate = [](pcpp::Packet &payload, PacketDirection, pcpp::ProtocolType, uint32_t, timespec) -> uint64_t {
             pcpp::UdpLayer *udpLayer = payload.getLayerOfType<pcpp::UdpLayer>();
             assert(udpLayer);
-            if (flowkey != cache.flowKey || stamp.tv_sec != cache.timestamp.tv_sec || stamp.tv_nsec != cache.timestamp.tv_nsec) {
-                cache.flowKey = flowkey;
-                cache.timestamp = stamp;
-                cache.dnsLayer = std::make_unique<DnsLayer>(udpLayer, &payload);
-            }
-            auto dnsLayer = cache.dnsLayer.get();
-            // return the 'jump key' for pcap to make O(1) call to appropriate signals
-            if (!dnsLayer->parseResources(true) || dnsLayer->getFirstQuery() == nullptr) {
-                return std::string(DNS_SCHEMA) + "only_qname"; // invalid qname
-            }
-            return std::string(DNS_SCHEMA) + "only_qname" + dnsLayer->getFirstQuery()->getNameLower();
+            auto dnsLayer = &PacketContext::of(payload).app_layer<DnsLayer>(udpLayer, &payload);
+            // return the hash of the qname for pcap to call appropriate signals
+            return _qname_predicate_value(*dnsLayer);
         };
         predicate = udp_qname_predicate;
     }
@@ -590,7 +624,8 @@ inline bool DnsStreamHandler::_filtering(DnsLayer &payload, [[maybe_unused]] Pac
             goto will_filter;
         }
     }
-    if (_f_enabled[Filters::OnlyQName] && _predicate_filter_type != Filters::OnlyQName) {
+    // checked even when the predicate let the packet through, since different qnames may share a hash
+    if (_f_enabled[Filters::OnlyQName]) {
         if (!payload.parseResources(true) || payload.getFirstQuery() == nullptr) {
             goto will_filter;
         }
@@ -1349,8 +1384,8 @@ void DnsMetricsBucket::process_filtered()
 // the general metrics manager entry point (both UDP and TCP)
 void DnsMetricsManager::process_dns_layer(DnsLayer &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint32_t flowkey, uint16_t port, size_t suffix_size, timespec stamp)
 {
-    // base event
-    new_event(stamp);
+    // base event. with flow sampling, a query is sampled together with its response, and a TCP session as a whole
+    new_flow_event(stamp, l4 == pcpp::TCP ? flowkey : flowkey ^ (payload.getDnsHeader()->transactionID * 0x9e3779b1U));
     // process in the "live" bucket. this will parse the resources if we are deep sampling
     live_bucket()->process_dns_layer(_deep_sampling_now, payload, l3, static_cast<Protocol>(l4), port, suffix_size);
 
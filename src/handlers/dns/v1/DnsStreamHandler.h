@@ -300,13 +300,6 @@ class DnsStreamHandler final : public visor::StreamMetricsHandler<DnsMetricsMana
 {
     static constexpr size_t DNSTAP_TYPE_SIZE = 15;
 
-    struct DnsCacheData {
-        uint32_t flowKey = 0;
-        timespec timestamp = timespec();
-        std::unique_ptr<DnsLayer> dnsLayer;
-    };
-    static thread_local DnsCacheData _cached_dns_layer;
-
     // the input event proxy we support (only one will be in use at a time)
     PcapInputEventProxy *_pcap_proxy{nullptr};
     MockInputEventProxy *_mock_proxy{nullptr};
@@ -409,7 +402,11 @@ class DnsStreamHandler final : public visor::StreamMetricsHandler<DnsMetricsMana
 
     bool _filtering(DnsLayer &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint16_t port, timespec stamp);
     bool _configs(DnsLayer &payload);
-    void _register_predicate_filter(Filters filter, std::string f_key, std::string f_value);
+    void _register_predicate_filter(Filters filter, std::string f_key, uint64_t f_value);
+    // the predicate value of a lowercase qname is its hash, so no table has to map qnames to values. the packet's is
+    // hashed straight from the wire, the same as its lowercase decoded form would be
+    static uint64_t _qname_predicate_value(std::string_view qname);
+    static uint64_t _qname_predicate_value(DnsLayer &payload);
 
 public:
     DnsStreamHandler(const std::string &name, InputEventProxy *proxy, const Configurable *window_config);
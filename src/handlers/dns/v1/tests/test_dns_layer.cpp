@@ -268,6 +268,50 @@ TEST_CASE("Parse DNS random UDP/TCP tests", "[pcap][dns]")
     CHECK(j["top_qtype"][6]["estimate"] == 620);
 }
 
+TEST_CASE("Parse DNS random UDP/TCP pcap file shards", "[pcap][dns]")
+{
+
+    // shards keep whole flows, also when asked for ranges, since the handler reassembles TCP. every transaction is
+    // matched by exactly one of them
+    for (auto shard_by : {"flow", "range"}) {
+        uint64_t xacts{0};
+        uint64_t events{0};
+        for (uint64_t shard = 0; shard < 3; ++shard) {
+            PcapInputStream stream{"pcap-test"};
+            stream.config_set("pcap_file", "tests/fixtures/dns_udp_tcp_random.pcap");
+            stream.config_set("bpf", "");
+            stream.config_set("host_spec", "192.168.0.0/24");
+            stream.config_set<uint64_t>("pcap_file_shards", 3);
+            stream.config_set<uint64_t>("pcap_file_shard_index", shard);
+            stream.config_set("pcap_file_shard_by", shard_by);
+            stream.parse_host_spec();
+
+            visor::Config c;
+            auto stream_proxy = stream.add_event_proxy(c);
+            c.config_set<uint64_t>("num_periods", 1);
+            DnsStreamHandler dns_handler{"dns-test", stream_proxy, &c};
+
+            dns_handler.start();
+            stream.start();
+            stream.stop();
+            dns_handler.stop();
+
+            auto counters = dns_handler.metrics()->bucket(0)->counters();
+            xacts += counters.xacts_total.value();
+            events += dns_handler.metrics()->bucket(0)->event_data_locked().num_events->value();
+        }
+        INFO(shard_by);
+        CHECK(xacts == 2921);
+        CHECK(events == 5851);
+    }
+
+    PcapInputStream stream{"pcap-test"};
+    stream.config_set("pcap_file", "tests/fixtures/dns_udp_tcp_random.pcap");
+    stream.config_set<uint64_t>("pcap_file_shards", 2);
+    stream.config_set("pcap_file_shard_by", "time");
+    CHECK_THROWS_WITH(stream.start(), "unknown pcap_file_shard_by 'time', valid values are: flow, range");
+}
+
 TEST_CASE("DNS Filters: exclude_noerror", "[pcap][dns]")
 {
 
@@ -460,9 +504,13 @@ TEST_CASE("DNS Filters: only_qname", "[pcap][dns]")
     // notice, case-insensitive
     dns_handler.config_set<visor::Configurable::StringList>("only_qname", {"play.GooGle.com", "nonexistent.google.com"});
     dns_handler.start();
+    auto pcap_proxy = static_cast<PcapInputEventProxy *>(stream_proxy);
+    CHECK(pcap_proxy->udp_predicate_count() == 2);
     stream.start();
     stream.stop();
     dns_handler.stop();
+    // nothing is left behind for qnames no handler filters on any more
+    CHECK(pcap_proxy->udp_predicate_count() == 0);
 
     auto counters = dns_handler.metrics()->bucket(0)->counters();
 
@@ -1000,7 +1048,7 @@ TEST_CASE("DNS invalid config", "[dns][filter][config]")
     c.config_set<uint64_t>("num_periods", 1);
     DnsStreamHandler dns_handler{"dns-test", stream_proxy, &c};
     dns_handler.config_set<bool>("invalid_config", true);
-    REQUIRE_THROWS_WITH(dns_handler.start(), "invalid_config is an invalid/unsupported config or filter. The valid configs/filters are: exclude_noerror, only_rcode, only_queries, only_responses, only_dnssec_response, answer_count, only_qtype, only_qname, only_qname_suffix, geoloc_notfound, asn_notfound, dnstap_msg_type, public_suffix_list, recorded_stream, xact_ttl_secs, xact_ttl_ms, deep_sample_rate, num_periods, topn_count, topn_percentile_threshold");
+    REQUIRE_THROWS_WITH(dns_handler.start(), "invalid_config is an invalid/unsupported config or filter. The valid configs/filters are: exclude_noerror, only_rcode, only_queries, only_responses, only_dnssec_response, answer_count, only_qtype, only_qname, only_qname_suffix, geoloc_notfound, asn_notfound, dnstap_msg_type, public_suffix_list, recorded_stream, xact_ttl_secs, xact_ttl_ms, deep_sample_rate, deep_sample_rate_min, deep_sample_mode, num_periods, topn_count, topn_percentile_threshold");
 }
 
 TEST_CASE("DNS config ttl", "[dns][config]")
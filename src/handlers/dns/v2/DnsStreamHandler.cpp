@@ -17,6 +17,7 @@
 #include <pcapplusplus/IPv4Layer.h>
 #include <pcapplusplus/IPv6Layer.h>
 #include <pcapplusplus/TimespecTimeval.h>
+#include <pcapplusplus/VlanLayer.h>
 #ifdef __GNUC__
 #pragma GCC diagnostic pop
 #endif
@@ -25,8 +26,6 @@
 #include <sstream>
 namespace visor::handler::dns::v2 {
 
-thread_local DnsStreamHandler::DnsCacheData DnsStreamHandler::_cached_dns_layer;
-
 DnsStreamHandler::DnsStreamHandler(const std::string &name, InputEventProxy *proxy, const Configurable *window_config)
     : visor::StreamMetricsHandler<DnsMetricsManager>(name, window_config)
 {
@@ -57,6 +56,18 @@ void DnsStreamHandler::start()
     _groups.set(group::DnsMetrics::TopQtypes);
     process_groups(_group_defs);
 
+    process_partitions({"vlan", "dst_ip", "src_subnet"});
+    if (!_partition_by.empty() && !_pcap_proxy) {
+        throw ConfigException("DnsStreamHandler: partition_by is only supported with pcap input");
+    }
+    if (_partition_by == "vlan") {
+        _partition = Partition::Vlan;
+    } else if (_partition_by == "dst_ip") {
+        _partition = Partition::Server;
+    } else if (_partition_by == "src_subnet") {
+        _partition = Partition::ClientSubnet;
+    }
+
     // Setup Filters
     if (config_exists("exclude_noerror") && config_get<bool>("exclude_noerror")) {
         _f_enabled.set(Filters::ExcludingRCode);
@@ -198,11 +209,12 @@ void DnsStreamHandler::start()
     }
 
     if (config_exists("xact_ttl_ms")) {
-        auto ttl = config_get<uint64_t>("xact_ttl_ms");
-        _metrics->set_xact_ttl(static_cast<uint32_t>(ttl));
+        _xact_ttl_ms = static_cast<uint32_t>(config_get<uint64_t>("xact_ttl_ms"));
     } else if (config_exists("xact_ttl_secs")) {
-        auto ttl = config_get<uint64_t>("xact_ttl_secs");
-        _metrics->set_xact_ttl(static_cast<uint32_t>(ttl) * 1000);
+        _xact_ttl_ms = static_cast<uint32_t>(config_get<uint64_t>("xact_ttl_secs")) * 1000;
+    }
+    if (_xact_ttl_ms) {
+        _metrics->set_xact_ttl(_xact_ttl_ms);
     }
 
     if (_pcap_proxy) {
@@ -219,6 +231,8 @@ void DnsStreamHandler::start()
         _tcp_start_connection = _pcap_proxy->tcp_connection_start_signal.connect(&DnsStreamHandler::tcp_connection_start_cb, this);
         _tcp_end_connection = _pcap_proxy->tcp_connection_end_signal.connect(&DnsStreamHandler::tcp_connection_end_cb, this);
         _tcp_message_connection = _pcap_proxy->tcp_message_ready_signal.connect(&DnsStreamHandler::tcp_message_ready_cb, this);
+        _pcap_proxy->register_tcp_ports(name(), TcpPortRanges(std::begin(DnsLayer::DNS_PORTS), std::end(DnsLayer::DNS_PORTS)));
+        _pcap_proxy->register_bpf(name(), DnsLayer::DNS_PORTS_BPF);
         _heartbeat_connection = _pcap_proxy->heartbeat_signal.connect([this](const timespec stamp) {
             check_period_shift(stamp);
             _event_proxy ? _event_proxy->heartbeat_signal(stamp) : void();
@@ -248,6 +262,8 @@ void DnsStreamHandler::stop()
         _tcp_start_connection.disconnect();
         _tcp_end_connection.disconnect();
         _tcp_message_connection.disconnect();
+        _pcap_proxy->unregister_tcp_ports(name());
+        _pcap_proxy->unregister_bpf(name());
     } else if (_dnstap_proxy) {
         _dnstap_connection.disconnect();
     }
@@ -283,18 +299,17 @@ void DnsStreamHandler::process_udp_packet_cb(pcpp::Packet &payload, PacketDirect
         metric_port = dst_port;
     }
     if (metric_port) {
-        if (flowkey != _cached_dns_layer.flowKey || stamp.tv_sec != _cached_dns_layer.timestamp.tv_sec || stamp.tv_nsec != _cached_dns_layer.timestamp.tv_nsec) {
-            _cached_dns_layer.flowKey = flowkey;
-            _cached_dns_layer.timestamp = stamp;
-            _cached_dns_layer.dnsLayer = std::make_unique<DnsLayer>(udpLayer, &payload);
-        }
-        auto dnsLayer = _cached_dns_layer.dnsLayer.get();
+        // parsed once per packet, whichever handler or policy gets to it first
+        auto dnsLayer = &PacketContext::of(payload).app_layer<DnsLayer>(udpLayer, &payload);
         if (!_filtering(*dnsLayer, dir, flowkey, stamp) && _configs(*dnsLayer)) {
             _metrics->process_dns_layer(*dnsLayer, dir, l3, pcpp::UDP, flowkey, metric_port, _static_suffix_size, stamp);
+            if (_partition != Partition::None) {
+                partition(_partition_key(payload, DnsLayer::isDnsPort(dst_port)))->process_dns_layer(*dnsLayer, dir, l3, pcpp::UDP, flowkey, metric_port, _static_suffix_size, stamp);
+            }
             _static_suffix_size = 0;
             // signal for chained stream handlers, if we have any
             if (_event_proxy) {
-                static_cast<PcapInputEventProxy *>(_event_proxy.get())->packet_signal(payload, dir, l3, pcpp::UDP, stamp);
+                static_cast<PcapInputEventProxy *>(_event_proxy.get())->process_packet_cb(payload, dir, l3, pcpp::UDP, stamp);
                 static_cast<PcapInputEventProxy *>(_event_proxy.get())->udp_signal(payload, dir, l3, flowkey, stamp);
             }
         }
@@ -317,14 +332,13 @@ void DnsStreamHandler::process_tcp_reassembled_packet_cb(pcpp::Packet &payload,
         metric_port = dst_port;
     }
     if (metric_port) {
-        if (flowkey != _cached_dns_layer.flowKey || stamp.tv_sec != _cached_dns_layer.timestamp.tv_sec || stamp.tv_nsec != _cached_dns_layer.timestamp.tv_nsec) {
-            _cached_dns_layer.flowKey = flowkey;
-            _cached_dns_layer.timestamp = stamp;
-            _cached_dns_layer.dnsLayer = std::make_unique<DnsLayer>(tcpLayer, &payload);
-        }
-        auto dnsLayer = _cached_dns_layer.dnsLayer.get();
+        // parsed once per packet, whichever handler or policy gets to it first
+        auto dnsLayer = &PacketContext::of(payload).app_layer<DnsLayer>(tcpLayer, &payload);
         if (!_filtering(*dnsLayer, dir, flowkey, stamp) && _configs(*dnsLayer)) {
             _metrics->process_dns_layer(*dnsLayer, dir, l3, pcpp::TCP, flowkey, metric_port, _static_suffix_size, stamp);
+            if (_partition != Partition::None) {
+                partition(_partition_key(payload, DnsLayer::isDnsPort(dst_port)))->process_dns_layer(*dnsLayer, dir, l3, pcpp::TCP, flowkey, metric_port, _static_suffix_size, stamp);
+            }
             _static_suffix_size = 0;
             // signal for chained stream handlers, if we have any
             if (_event_proxy) {
@@ -411,6 +425,13 @@ void DnsStreamHandler::tcp_message_ready_cb(int8_t side, const pcpp::TcpStreamDa
         dummy_packet.addLayer(dnsLayer, true);
         if (!_filtering(*dnsLayer, dir, l3Type, stamp) && _configs(*dnsLayer)) {
             _metrics->process_dns_layer(*dnsLayer, dir, l3Type, pcpp::TCP, flowKey, port, _static_suffix_size, stamp);
+            if (_partition == Partition::Vlan) {
+                partition(PartitionKey(KeyTcp))->process_dns_layer(*dnsLayer, dir, l3Type, pcpp::TCP, flowKey, port, _static_suffix_size, stamp);
+            } else if (_partition != Partition::None) {
+                auto server_is_dst = DnsLayer::isDnsPort(conn.dstPort);
+                auto key = _partition_key(server_is_dst ? conn.dstIP : conn.srcIP, server_is_dst ? conn.srcIP : conn.dstIP);
+                partition(key)->process_dns_layer(*dnsLayer, dir, l3Type, pcpp::TCP, flowKey, port, _static_suffix_size, stamp);
+            }
             _static_suffix_size = 0;
             // signal for chained stream handlers, if we have any
             if (_event_proxy) {
@@ -470,10 +491,89 @@ void DnsStreamHandler::tcp_connection_end_cb(const pcpp::ConnectionData &connect
 void DnsStreamHandler::set_start_tstamp(timespec stamp)
 {
     _metrics->set_start_tstamp(stamp);
+    for_each_partition([stamp](const std::string &, DnsMetricsManager &partition) {
+        partition.set_start_tstamp(stamp);
+    });
 }
 void DnsStreamHandler::set_end_tstamp(timespec stamp)
 {
     _metrics->set_end_tstamp(stamp);
+    for_each_partition([stamp](const std::string &, DnsMetricsManager &partition) {
+        partition.set_end_tstamp(stamp);
+    });
+}
+void DnsStreamHandler::configure_partition(DnsMetricsManager &partition)
+{
+    if (config_exists("recorded_stream")) {
+        partition.set_recorded_stream();
+    }
+    if (_xact_ttl_ms) {
+        partition.set_xact_ttl(_xact_ttl_ms);
+    }
+}
+PartitionKey DnsStreamHandler::_partition_key(pcpp::Packet &payload, bool server_is_dst)
+{
+    if (_partition == Partition::Vlan) {
+        auto vlan = payload.getLayerOfType<pcpp::VlanLayer>();
+        if (!vlan) {
+            return PartitionKey(KeyUntagged);
+        }
+        auto id = vlan->getVlanID();
+        return PartitionKey(KeyVlan, &id, sizeof(id));
+    }
+    pcpp::IPAddress src;
+    pcpp::IPAddress dst;
+    if (auto ipv4 = payload.getLayerOfType<pcpp::IPv4Layer>(); ipv4) {
+        src = ipv4->getSrcIPv4Address();
+        dst = ipv4->getDstIPv4Address();
+    } else if (auto ipv6 = payload.getLayerOfType<pcpp::IPv6Layer>(); ipv6) {
+        src = ipv6->getSrcIPv6Address();
+        dst = ipv6->getDstIPv6Address();
+    } else {
+        return PARTITION_OTHER;
+    }
+    return server_is_dst ? _partition_key(dst, src) : _partition_key(src, dst);
+}
+PartitionKey DnsStreamHandler::_partition_key(const pcpp::IPAddress &server, const pcpp::IPAddress &client)
+{
+    if (_partition == Partition::Server) {
+        if (server.isIPv4()) {
+            auto addr = server.getIPv4().toInt();
+            return PartitionKey(KeyIPv4, &addr, sizeof(addr));
+        }
+        return PartitionKey(KeyIPv6, server.getIPv6().toBytes(), 16);
+    }
+    if (client.isIPv4()) {
+        auto subnet = lib::utils::get_subnet(client.getIPv4().toInt(), PARTITION_SUBNET_V4);
+        return PartitionKey(KeyIPv4, &subnet, sizeof(subnet));
+    }
+    auto subnet = lib::utils::get_subnet(client.getIPv6().toBytes(), PARTITION_SUBNET_V6);
+    return PartitionKey(KeyIPv6, subnet.data(), subnet.size());
+}
+std::string DnsStreamHandler::partition_label(const PartitionKey &key) const
+{
+    switch (key.kind) {
+    case KeyVlan: {
+        uint16_t id;
+        std::memcpy(&id, key.value.data(), sizeof(id));
+        return std::to_string(id);
+    }
+    case KeyUntagged:
+        return "none";
+    case KeyTcp:
+        return "tcp";
+    case KeyIPv4: {
+        uint32_t addr;
+        std::memcpy(&addr, key.value.data(), sizeof(addr));
+        auto label = pcpp::IPv4Address(addr).toString();
+        return _partition == Partition::ClientSubnet ? label + "/" + std::to_string(PARTITION_SUBNET_V4) : label;
+    }
+    case KeyIPv6: {
+        auto label = pcpp::IPv6Address(key.value.data()).toString();
+        return _partition == Partition::ClientSubnet ? label + "/" + std::to_string(PARTITION_SUBNET_V6) : label;
+    }
+    }
+    return "other";
 }
 void DnsStreamHandler::info_json(json &j) const
 {
@@ -1099,8 +1199,8 @@ void DnsMetricsBucket::process_filtered()
 // the general metrics manager entry point (both UDP and TCP)
 void DnsMetricsManager::process_dns_layer(DnsLayer &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, uint32_t flowkey, uint16_t port, size_t suffix_size, timespec stamp)
 {
-    // base event
-    new_event(stamp);
+    // base event. with flow sampling, a query is sampled together with its response, and a TCP session as a whole
+    new_flow_event(stamp, l4 == pcpp::TCP ? flowkey : flowkey ^ (payload.getDnsHeader()->transactionID * 0x9e3779b1U));
 
     auto xact_dir = TransactionDirection::unknown;
     if (payload.getDnsHeader()->queryOrResponse == QR::response) {
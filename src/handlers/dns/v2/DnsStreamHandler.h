@@ -469,13 +469,6 @@ class DnsStreamHandler final : public visor::StreamMetricsHandler<DnsMetricsMana
 {
     static constexpr size_t DNSTAP_TYPE_SIZE = 15;
 
-    struct DnsCacheData {
-        uint32_t flowKey = 0;
-        timespec timestamp = timespec();
-        std::unique_ptr<DnsLayer> dnsLayer;
-    };
-    static thread_local DnsCacheData _cached_dns_layer;
-
     // the input event proxy we support (only one will be in use at a time)
     PcapInputEventProxy *_pcap_proxy{nullptr};
     MockInputEventProxy *_mock_proxy{nullptr};
@@ -545,6 +538,28 @@ class DnsStreamHandler final : public visor::StreamMetricsHandler<DnsMetricsMana
     std::vector<uint16_t> _f_qtypes;
     size_t _static_suffix_size{0};
     std::bitset<DNSTAP_TYPE_SIZE> _f_dnstap_types;
+    uint32_t _xact_ttl_ms{0};
+
+    // partition_by dimensions. the server is the side on the DNS port and the client the other one, so a query and
+    // its response always land in the same partition
+    enum class Partition {
+        None,
+        Vlan,
+        Server,
+        ClientSubnet
+    };
+    Partition _partition{Partition::None};
+    // kinds of PartitionKey. TCP messages are rebuilt from reassembled streams, which no longer know the VLAN of their
+    // packets, so with vlan they count in a partition of their own
+    enum PartitionKind : uint8_t {
+        KeyVlan = 1,
+        KeyUntagged,
+        KeyTcp,
+        KeyIPv4,
+        KeyIPv6
+    };
+    static constexpr uint8_t PARTITION_SUBNET_V4 = 24;
+    static constexpr uint8_t PARTITION_SUBNET_V6 = 48;
 
     static const inline StreamMetricsHandler::ConfigsDefType _config_defs = {
         "exclude_noerror",
@@ -560,7 +575,9 @@ class DnsStreamHandler final : public visor::StreamMetricsHandler<DnsMetricsMana
         "public_suffix_list",
         "recorded_stream",
         "xact_ttl_secs",
-        "xact_ttl_ms"};
+        "xact_ttl_ms",
+        "partition_by",
+        "partition_max"};
 
     static const inline StreamMetricsHandler::GroupDefType _group_defs = {
         {"cardinality", group::DnsMetrics::Cardinality},
@@ -576,6 +593,12 @@ class DnsStreamHandler final : public visor::StreamMetricsHandler<DnsMetricsMana
 
     bool _filtering(DnsLayer &payload, PacketDirection dir, uint32_t flowkey, timespec stamp);
     bool _configs(DnsLayer &payload);
+    PartitionKey _partition_key(pcpp::Packet &payload, bool server_is_dst);
+    PartitionKey _partition_key(const pcpp::IPAddress &server, const pcpp::IPAddress &client);
+
+protected:
+    void configure_partition(DnsMetricsManager &partition) override;
+    std::string partition_label(const PartitionKey &key) const override;
 
 public:
     DnsStreamHandler(const std::string &name, InputEventProxy *proxy, const Configurable *window_config);
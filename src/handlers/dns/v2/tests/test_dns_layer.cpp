@@ -18,6 +18,8 @@
 #include <pcapplusplus/Packet.h>
 #include <pcapplusplus/PcapFileDevice.h>
 #include <pcapplusplus/ProtocolType.h>
+#include <set>
+#include <sstream>
 #include <pcapplusplus/UdpLayer.h>
 #ifdef __GNUC__
 #pragma GCC diagnostic pop
@@ -96,6 +98,113 @@ TEST_CASE("Parse DNS UDP IPv4 tests", "[pcap][ipv4][udp][dns]")
     CHECK(j["unknown"]["top_qname2_xacts"][0]["estimate"] == 70);
 }
 
+TEST_CASE("Parse DNS UDP IPv4 with partition_by", "[pcap][ipv4][udp][dns]")
+{
+
+    PcapInputStream stream{"pcap-test"};
+    stream.config_set("pcap_file", "tests/fixtures/dns_ipv4_udp.pcap");
+    stream.config_set("bpf", "");
+
+    visor::Config c;
+    auto stream_proxy = stream.add_event_proxy(c);
+    c.config_set<uint64_t>("num_periods", 1);
+    DnsStreamHandler dns_handler{"dns-test", stream_proxy, &c};
+    dns_handler.config_set("partition_by", "dst_ip");
+    dns_handler.config_set<uint64_t>("partition_max", 4);
+
+    dns_handler.start();
+    stream.start();
+    dns_handler.stop();
+    stream.stop();
+
+    json j;
+    dns_handler.window_json(j, 0, false);
+
+    // every query goes to the same server, and its responses count with it
+    REQUIRE(j["dns"]["partitions"]["dst_ip"].size() == 1);
+    auto partition = j["dns"]["partitions"]["dst_ip"].begin().value();
+    CHECK(partition["unknown"]["top_qname2_xacts"][0]["estimate"] == 70);
+    CHECK(j["dns"]["unknown"]["top_qname2_xacts"][0]["estimate"] == 70);
+
+    // partitions are metrics of their own, so a sum over a metric of the totals counts every packet once
+    std::stringstream output;
+    dns_handler.window_prometheus(output);
+    std::set<std::string> types;
+    bool partition_series{false};
+    std::string line;
+    while (std::getline(output, line)) {
+        if (line.rfind("# TYPE ", 0) == 0) {
+            CHECK(types.insert(line).second);
+        } else if (line.find("dst_ip=") != std::string::npos) {
+            CHECK(line.rfind("dns_partition_", 0) == 0);
+            partition_series = true;
+        }
+    }
+    CHECK(partition_series);
+
+    json info;
+    dns_handler.info_json(info);
+    CHECK(info["metrics"]["partitions"]["by"] == "dst_ip");
+    CHECK(info["metrics"]["partitions"]["count"] == 1);
+}
+
+TEST_CASE("DNS handler shards are reported together", "[pcap][ipv4][udp][dns]")
+{
+
+    // two inputs stand in for two capture workers, each with an instance of the handler
+    PcapInputStream stream{"pcap-test"};
+    stream.config_set("pcap_file", "tests/fixtures/dns_ipv4_udp.pcap");
+    stream.config_set("bpf", "");
+    PcapInputStream shard_stream{"pcap-test-shard"};
+    shard_stream.config_set("pcap_file", "tests/fixtures/dns_ipv4_udp.pcap");
+    shard_stream.config_set("bpf", "");
+
+    visor::Config c;
+    c.config_set<uint64_t>("num_periods", 1);
+    DnsStreamHandler dns_handler{"dns-test", stream.add_event_proxy(c), &c};
+    dns_handler.config_set("partition_by", "dst_ip");
+    auto shard = std::make_unique<DnsStreamHandler>("dns-test", shard_stream.add_event_proxy(c), &c);
+    shard->config_set("partition_by", "dst_ip");
+    dns_handler.add_shard(std::move(shard));
+    CHECK(dns_handler.shard_count() == 2);
+
+    dns_handler.start();
+    dns_handler.start_shards();
+    stream.start();
+    shard_stream.start();
+    dns_handler.stop_shards();
+    dns_handler.stop();
+    stream.stop();
+    shard_stream.stop();
+
+    json j;
+    dns_handler.window_json(j, 0, false);
+    CHECK(j["dns"]["unknown"]["top_qname2_xacts"][0]["estimate"] == 140);
+    // both saw the same 6 seconds of traffic
+    CHECK(j["dns"]["period"]["length"] == 6);
+    REQUIRE(j["dns"]["partitions"]["dst_ip"].size() == 1);
+    CHECK(j["dns"]["partitions"]["dst_ip"].begin().value()["unknown"]["top_qname2_xacts"][0]["estimate"] == 140);
+
+    std::stringstream output;
+    dns_handler.window_prometheus(output);
+    CHECK(output.str().find("dns_partition_") != std::string::npos);
+}
+
+TEST_CASE("DNS invalid partition_by", "[pcap][dns]")
+{
+
+    PcapInputStream stream{"pcap-test"};
+    stream.config_set("pcap_file", "tests/fixtures/dns_ipv4_udp.pcap");
+    stream.config_set("bpf", "");
+
+    visor::Config c;
+    auto stream_proxy = stream.add_event_proxy(c);
+    DnsStreamHandler dns_handler{"dns-test", stream_proxy, &c};
+    dns_handler.config_set("partition_by", "qname");
+
+    CHECK_THROWS_WITH(dns_handler.start(), "qname is an invalid/unsupported partition_by. The valid dimensions are: vlan, dst_ip, src_subnet");
+}
+
 TEST_CASE("Parse DNS TCP IPv4 tests", "[pcap][ipv4][tcp][dns]")
 {
     PcapInputStream stream{"pcap-test"};
@@ -972,5 +1081,5 @@ TEST_CASE("DNS invalid config", "[dns][filter][config]")
     c.config_set<uint64_t>("num_periods", 1);
     DnsStreamHandler dns_handler{"dns-test", stream_proxy, &c};
     dns_handler.config_set<bool>("invalid_config", true);
-    REQUIRE_THROWS_WITH(dns_handler.start(), "invalid_config is an invalid/unsupported config or filter. The valid configs/filters are: exclude_noerror, only_rcode, only_dnssec_response, answer_count, only_qtype, only_qname, only_qname_suffix, geoloc_notfound, asn_notfound, dnstap_msg_type, public_suffix_list, recorded_stream, xact_ttl_secs, xact_ttl_ms, deep_sample_rate, num_periods, topn_count, topn_percentile_threshold");
+    REQUIRE_THROWS_WITH(dns_handler.start(), "invalid_config is an invalid/unsupported config or filter. The valid configs/filters are: exclude_noerror, only_rcode, only_dnssec_response, answer_count, only_qtype, only_qname, only_qname_suffix, geoloc_notfound, asn_notfound, dnstap_msg_type, public_suffix_list, recorded_stream, xact_ttl_secs, xact_ttl_ms, partition_by, partition_max, deep_sample_rate, deep_sample_rate_min, deep_sample_mode, num_periods, topn_count, topn_percentile_threshold");
 }
@@ -37,7 +37,9 @@ void InputResourcesStreamHandler::start()
     }
 
     if (_pcap_proxy) {
-        _pkt_connection = _pcap_proxy->packet_signal.connect(&InputResourcesStreamHandler::process_packet_cb, this);
+        _pkt_connection = _pcap_proxy->packet_batch_signal.connect(&InputResourcesStreamHandler::process_packet_batch_cb, this);
+        // only counts what the input captures anyway
+        _pcap_proxy->register_bpf(name(), std::nullopt);
         _policies_connection = _pcap_proxy->policy_signal.connect(&InputResourcesStreamHandler::process_policies_cb, this);
         _heartbeat_connection = _pcap_proxy->heartbeat_signal.connect(&InputResourcesStreamHandler::check_period_shift, this);
     } else if (_dnstap_proxy) {
@@ -65,6 +67,7 @@ void InputResourcesStreamHandler::stop()
 
     if (_pcap_proxy) {
         _pkt_connection.disconnect();
+        _pcap_proxy->unregister_bpf(name());
     } else if (_dnstap_proxy) {
         _dnstap_connection.disconnect();
     } else if (_flow_proxy) {
@@ -120,8 +123,10 @@ void InputResourcesStreamHandler::process_dnstap_cb([[maybe_unused]] const dnsta
     }
 }
 
-void InputResourcesStreamHandler::process_packet_cb([[maybe_unused]] pcpp::Packet &payload, [[maybe_unused]] PacketDirection dir, [[maybe_unused]] pcpp::ProtocolType l3, [[maybe_unused]] pcpp::ProtocolType l4, [[maybe_unused]] timespec stamp)
+void InputResourcesStreamHandler::process_packet_batch_cb(const PacketBatch &batch)
 {
+    // only the most recent time stamp matters here
+    auto stamp = batch.back().stamp;
     if (stamp.tv_sec >= _timestamp.tv_sec + MEASURE_INTERVAL) {
         _timestamp = stamp;
         _metrics->process_resources(_monitor.cpu_percentage(), _monitor.memory_usage());
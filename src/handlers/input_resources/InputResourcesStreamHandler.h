@@ -108,7 +108,7 @@ class InputResourcesStreamHandler final : public visor::StreamMetricsHandler<Inp
     void process_netflow_cb(const std::string &, const NFSample &, size_t);
     void process_dnstap_cb(const dnstap::Dnstap &, size_t);
     void process_policies_cb(const Policy *policy, Action action);
-    void process_packet_cb(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, timespec stamp);
+    void process_packet_batch_cb(const PacketBatch &batch);
 
 public:
     InputResourcesStreamHandler(const std::string &name, InputEventProxy *proxy, const Configurable *window_config);
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include "Numa.h"
 #include <fstream>
 #include <vector>
 
@@ -78,6 +79,22 @@ public:
 #endif
     }
 
+    // where the calling thread runs: cpu, NUMA node and the cpus it may use
+    inline numa::ThreadPlacement placement()
+    {
+#ifdef __linux__
+        return numa::thread_placement("/proc/thread-self");
+#else
+        return {};
+#endif
+    }
+
+    // the same for every thread of the process, e.g. to see capture and handler threads on the node of their NIC
+    static inline std::vector<numa::ThreadPlacement> placements()
+    {
+        return numa::process_placements();
+    }
+
     inline uint64_t memory_usage()
     {
 #ifdef _WIN32
@@ -108,4 +108,20 @@ TEST_CASE("Check resources for sflow input", "[sflow][resources]")
     CHECK(j["memory_bytes"]["p50"] != nullptr);
     CHECK(j["policy_count"] == 0);
     CHECK(j["handler_count"] == 0);
-}
\ No newline at end of file
+}
+
+TEST_CASE("ThreadMonitor placement", "[resources]")
+{
+    visor::ThreadMonitor monitor;
+    auto self = monitor.placement();
+#ifdef __linux__
+    CHECK(self.tid != 0);
+    CHECK(self.cpu >= 0);
+    CHECK(!self.cpus_allowed.empty());
+    bool found{false};
+    for (const auto &placement : visor::ThreadMonitor::placements()) {
+        found = found || placement.tid == self.tid;
+    }
+    CHECK(found);
+#endif
+}
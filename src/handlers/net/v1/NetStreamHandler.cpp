@@ -93,6 +93,7 @@ void NetStreamHandler::start()
 
     if (_pcap_proxy) {
         _pkt_connection = _pcap_proxy->packet_signal.connect(&NetStreamHandler::process_packet_cb, this);
+        _pcap_proxy->register_bpf(name(), "");
         _pkt_tcp_reassembled_connection = _pcap_proxy->tcp_reassembled_signal.connect(&NetStreamHandler::process_tcp_reassembled_packet_cb, this);
         _start_tstamp_connection = _pcap_proxy->start_tstamp_signal.connect(&NetStreamHandler::set_start_tstamp, this);
         _end_tstamp_connection = _pcap_proxy->end_tstamp_signal.connect(&NetStreamHandler::set_end_tstamp, this);
@@ -117,6 +118,7 @@ void NetStreamHandler::start()
                     static_cast<PcapInputEventProxy *>(_event_proxy.get())->tcp_connection_end_signal(connectionData, reason);
                 }
             });
+            _pcap_proxy->forward_tcp_ports(name(), static_cast<PcapInputEventProxy *>(_event_proxy.get()));
         }
     } else if (_dnstap_proxy) {
         _dnstap_connection = _dnstap_proxy->dnstap_signal.connect(&NetStreamHandler::process_dnstap_cb, this);
@@ -137,6 +139,7 @@ void NetStreamHandler::stop()
 
     if (_pcap_proxy) {
         _pkt_connection.disconnect();
+        _pcap_proxy->unregister_bpf(name());
         _start_tstamp_connection.disconnect();
         _end_tstamp_connection.disconnect();
         _pkt_tcp_reassembled_connection.disconnect();
@@ -144,6 +147,7 @@ void NetStreamHandler::stop()
             _tcp_start_connection.disconnect();
             _tcp_message_connection.disconnect();
             _tcp_end_connection.disconnect();
+            _pcap_proxy->unregister_tcp_ports(name());
         }
     } else if (_dnstap_proxy) {
         _dnstap_connection.disconnect();
@@ -803,8 +807,12 @@ void NetworkMetricsManager::process_filtered(timespec stamp)
 // the general metrics manager entry point
 void NetworkMetricsManager::process_packet(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, timespec stamp)
 {
-    // base event
-    new_event(stamp);
+    // base event. with flow sampling, both directions of a flow are sampled together
+    if (flow_sampling()) {
+        new_flow_event(stamp, PacketContext::of(payload).flowkey());
+    } else {
+        new_event(stamp);
+    }
     // process in the "live" bucket
     live_bucket()->process_packet(_deep_sampling_now, payload, dir, l3, l4);
 }
@@ -47,6 +47,40 @@ TEST_CASE("Parse net (dns) UDP IPv4 tests", "[pcap][ipv4][udp][net]")
     CHECK(counters.IPv6.value() == 0);
 }
 
+TEST_CASE("Parse net (dns) UDP IPv4 pcap file shards", "[pcap][ipv4][udp][net]")
+{
+
+    uint64_t total{0};
+    for (uint64_t shard = 0; shard < 3; ++shard) {
+        PcapInputStream stream{"pcap-test"};
+        stream.config_set("pcap_file", "tests/fixtures/dns_ipv4_udp.pcap");
+        stream.config_set("bpf", std::string());
+        stream.config_set<uint64_t>("pcap_file_shards", 3);
+        stream.config_set<uint64_t>("pcap_file_shard_index", shard);
+
+        visor::Config c;
+        auto stream_proxy = stream.add_event_proxy(c);
+        c.config_set<uint64_t>("num_periods", 1);
+        NetStreamHandler net_handler{"net-test", stream_proxy, &c};
+
+        net_handler.start();
+        stream.start();
+        net_handler.stop();
+        stream.stop();
+
+        auto event_data = net_handler.metrics()->bucket(0)->event_data_locked();
+        total += event_data.num_events->value();
+    }
+
+    CHECK(total == 140);
+
+    PcapInputStream stream{"pcap-test"};
+    stream.config_set("pcap_file", "tests/fixtures/dns_ipv4_udp.pcap");
+    stream.config_set<uint64_t>("pcap_file_shards", 2);
+    stream.config_set<uint64_t>("pcap_file_shard_index", 2);
+    CHECK_THROWS_WITH(stream.start(), "pcap_file_shard_index must be less than pcap_file_shards");
+}
+
 TEST_CASE("Parse net (dns) TCP IPv4 tests", "[pcap][ipv4][tcp][net]")
 {
     PcapInputStream stream{"pcap-test"};
@@ -575,5 +609,5 @@ TEST_CASE("Net invalid config", "[net][filter][config]")
     c.config_set<uint64_t>("num_periods", 1);
     NetStreamHandler net_handler{"net-test", stream_proxy, &c};
     net_handler.config_set<bool>("invalid_config", true);
-    REQUIRE_THROWS_WITH(net_handler.start(), "invalid_config is an invalid/unsupported config or filter. The valid configs/filters are: geoloc_notfound, asn_notfound, only_geoloc_prefix, only_asn_number, recorded_stream, deep_sample_rate, num_periods, topn_count, topn_percentile_threshold");
+    REQUIRE_THROWS_WITH(net_handler.start(), "invalid_config is an invalid/unsupported config or filter. The valid configs/filters are: geoloc_notfound, asn_notfound, only_geoloc_prefix, only_asn_number, recorded_stream, deep_sample_rate, deep_sample_rate_min, deep_sample_mode, num_periods, topn_count, topn_percentile_threshold");
 }
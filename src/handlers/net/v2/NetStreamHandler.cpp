@@ -93,7 +93,8 @@ void NetStreamHandler::start()
     }
 
     if (_pcap_proxy) {
-        _pkt_connection = _pcap_proxy->packet_signal.connect(&NetStreamHandler::process_packet_cb, this);
+        _pkt_connection = _pcap_proxy->packet_batch_signal.connect(&NetStreamHandler::process_packet_batch_cb, this);
+        _pcap_proxy->register_bpf(name(), "");
         _pkt_tcp_reassembled_connection = _pcap_proxy->tcp_reassembled_signal.connect(&NetStreamHandler::process_tcp_reassembled_packet_cb, this);
         _start_tstamp_connection = _pcap_proxy->start_tstamp_signal.connect(&NetStreamHandler::set_start_tstamp, this);
         _end_tstamp_connection = _pcap_proxy->end_tstamp_signal.connect(&NetStreamHandler::set_end_tstamp, this);
@@ -118,6 +119,7 @@ void NetStreamHandler::start()
                     static_cast<PcapInputEventProxy *>(_event_proxy.get())->tcp_connection_end_signal(connectionData, reason);
                 }
             });
+            _pcap_proxy->forward_tcp_ports(name(), static_cast<PcapInputEventProxy *>(_event_proxy.get()));
         }
     } else if (_dnstap_proxy) {
         _dnstap_connection = _dnstap_proxy->dnstap_signal.connect(&NetStreamHandler::process_dnstap_cb, this);
@@ -138,6 +140,7 @@ void NetStreamHandler::stop()
 
     if (_pcap_proxy) {
         _pkt_connection.disconnect();
+        _pcap_proxy->unregister_bpf(name());
         _start_tstamp_connection.disconnect();
         _end_tstamp_connection.disconnect();
         _pkt_tcp_reassembled_connection.disconnect();
@@ -145,6 +148,7 @@ void NetStreamHandler::stop()
             _tcp_start_connection.disconnect();
             _tcp_message_connection.disconnect();
             _tcp_end_connection.disconnect();
+            _pcap_proxy->unregister_tcp_ports(name());
         }
     } else if (_dnstap_proxy) {
         _dnstap_connection.disconnect();
@@ -169,6 +173,13 @@ void NetStreamHandler::process_packet_cb(pcpp::Packet &payload, PacketDirection
     }
 }
 
+void NetStreamHandler::process_packet_batch_cb(const PacketBatch &batch)
+{
+    for (const auto &entry : batch) {
+        process_packet_cb(*entry.packet, entry.dir, entry.l3, entry.l4, entry.stamp);
+    }
+}
+
 void NetStreamHandler::process_tcp_reassembled_packet_cb(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, uint32_t flowkey, timespec stamp)
 {
     if (!_filtering(payload, dir, stamp)) {
@@ -226,55 +237,19 @@ bool NetStreamHandler::_filtering(pcpp::Packet &payload, PacketDirection dir, ti
     if (_f_enabled[Filters::GeoLocPrefix] || _f_enabled[Filters::GeoLocNotFound]) {
         if (!HandlerModulePlugin::city->enabled() || dir == PacketDirection::unknown) {
             goto will_filter;
-        } else if (auto IPv4Layer = payload.getLayerOfType<pcpp::IPv4Layer>(); IPv4Layer) {
-            struct sockaddr_in sa4;
-            if (dir == PacketDirection::toHost && lib::utils::ipv4_to_sockaddr(IPv4Layer->getSrcIPv4Address(), &sa4) && std::none_of(_f_geoloc_prefix.begin(), _f_geoloc_prefix.end(), [sa4](const auto &prefix) {
-                    return begins_with(HandlerModulePlugin::city->getGeoLoc(&sa4).location, prefix);
-                })) {
-                goto will_filter;
-            } else if (dir == PacketDirection::fromHost && lib::utils::ipv4_to_sockaddr(IPv4Layer->getDstIPv4Address(), &sa4) && std::none_of(_f_geoloc_prefix.begin(), _f_geoloc_prefix.end(), [sa4](const auto &prefix) {
-                           return begins_with(HandlerModulePlugin::city->getGeoLoc(&sa4).location, prefix);
-                       })) {
-                goto will_filter;
-            }
-        } else if (auto IPv6layer = payload.getLayerOfType<pcpp::IPv6Layer>(); IPv6layer) {
-            struct sockaddr_in6 sa6;
-            if (dir == PacketDirection::toHost && lib::utils::ipv6_to_sockaddr(IPv6layer->getSrcIPv6Address(), &sa6) && std::none_of(_f_geoloc_prefix.begin(), _f_geoloc_prefix.end(), [sa6](const auto &prefix) {
-                    return begins_with(HandlerModulePlugin::city->getGeoLoc(&sa6).location, prefix);
-                })) {
-                goto will_filter;
-            } else if (dir == PacketDirection::fromHost && lib::utils::ipv6_to_sockaddr(IPv6layer->getDstIPv6Address(), &sa6) && std::none_of(_f_geoloc_prefix.begin(), _f_geoloc_prefix.end(), [sa6](const auto &prefix) {
-                           return begins_with(HandlerModulePlugin::city->getGeoLoc(&sa6).location, prefix);
-                       })) {
-                goto will_filter;
-            }
+        } else if (auto city = PacketContext::of(payload).city(*HandlerModulePlugin::city, dir == PacketDirection::toHost); city && std::none_of(_f_geoloc_prefix.begin(), _f_geoloc_prefix.end(), [city](const auto &prefix) {
+                       return begins_with(city->location, prefix);
+                   })) {
+            goto will_filter;
         }
     }
     if (_f_enabled[Filters::AsnNumber] || _f_enabled[Filters::AsnNotFound]) {
         if (!HandlerModulePlugin::asn->enabled() || dir == PacketDirection::unknown) {
             goto will_filter;
-        } else if (auto IPv4Layer = payload.getLayerOfType<pcpp::IPv4Layer>(); IPv4Layer) {
-            struct sockaddr_in sa4;
-            if (dir == PacketDirection::toHost && lib::utils::ipv4_to_sockaddr(IPv4Layer->getSrcIPv4Address(), &sa4) && std::none_of(_f_asn_number.begin(), _f_asn_number.end(), [sa4](const auto &prefix) {
-                    return begins_with(HandlerModulePlugin::asn->getASNString(&sa4), prefix);
-                })) {
-                goto will_filter;
-            } else if (dir == PacketDirection::fromHost && lib::utils::ipv4_to_sockaddr(IPv4Layer->getDstIPv4Address(), &sa4) && std::none_of(_f_asn_number.begin(), _f_asn_number.end(), [sa4](const auto &prefix) {
-                           return begins_with(HandlerModulePlugin::asn->getASNString(&sa4), prefix);
-                       })) {
-                goto will_filter;
-            }
-        } else if (auto IPv6layer = payload.getLayerOfType<pcpp::IPv6Layer>(); IPv6layer) {
-            struct sockaddr_in6 sa6;
-            if (dir == PacketDirection::toHost && lib::utils::ipv6_to_sockaddr(IPv6layer->getSrcIPv6Address(), &sa6) && std::none_of(_f_asn_number.begin(), _f_asn_number.end(), [sa6](const auto &prefix) {
-                    return begins_with(HandlerModulePlugin::asn->getASNString(&sa6), prefix);
-                })) {
-                goto will_filter;
-            } else if (dir == PacketDirection::fromHost && lib::utils::ipv6_to_sockaddr(IPv6layer->getDstIPv6Address(), &sa6) && std::none_of(_f_asn_number.begin(), _f_asn_number.end(), [sa6](const auto &prefix) {
-                           return begins_with(HandlerModulePlugin::asn->getASNString(&sa6), prefix);
-                       })) {
-                goto will_filter;
-            }
+        } else if (auto asn = PacketContext::of(payload).asn(*HandlerModulePlugin::asn, dir == PacketDirection::toHost); asn && std::none_of(_f_asn_number.begin(), _f_asn_number.end(), [asn](const auto &prefix) {
+                       return begins_with(*asn, prefix);
+                   })) {
+            goto will_filter;
         }
     }
     return false;
@@ -507,6 +482,7 @@ void NetworkMetricsBucket::process_packet(bool deep, pcpp::Packet &payload, Pack
     }
 
     NetworkPacket packet(static_cast<NetworkPacketDirection>(dir), l3, l4, payload.getRawPacket()->getRawDataLen(), syn_flag);
+    packet.context = &PacketContext::of(payload);
 
     if (auto IP4layer = payload.getLayerOfType<pcpp::IPv4Layer>(); IP4layer) {
         if (dir == PacketDirection::toHost) {
@@ -697,27 +673,45 @@ void NetworkMetricsBucket::process_net_layer(NetworkPacket &packet)
     if (packet.l3 == pcpp::IPv4 && packet.ipv4_src.isValid()) {
         group_enabled(group::NetMetrics::Cardinality) ? data.ipCard.update(packet.ipv4_src.toInt()) : void();
         group_enabled(group::NetMetrics::TopIps) ? data.topIPv4.update(packet.ipv4_src.toInt()) : void();
-        _process_geo_metrics(data, packet.ipv4_src);
+        _process_geo_metrics(data, packet.ipv4_src, packet.context, true);
     } else if (packet.l3 == pcpp::IPv6 && packet.ipv6_src.isValid()) {
         group_enabled(group::NetMetrics::Cardinality) ? data.ipCard.update(reinterpret_cast<const void *>(packet.ipv6_src.toBytes()), 16) : void();
         group_enabled(group::NetMetrics::TopIps) ? data.topIPv6.update(packet.ipv6_src.toString()) : void();
-        _process_geo_metrics(data, packet.ipv6_src);
+        _process_geo_metrics(data, packet.ipv6_src, packet.context, true);
     }
 
     if (packet.l3 == pcpp::IPv4 && packet.ipv4_dst.isValid()) {
         group_enabled(group::NetMetrics::Cardinality) ? data.ipCard.update(packet.ipv4_dst.toInt()) : void();
         group_enabled(group::NetMetrics::TopIps) ? data.topIPv4.update(packet.ipv4_dst.toInt()) : void();
-        _process_geo_metrics(data, packet.ipv4_dst);
+        _process_geo_metrics(data, packet.ipv4_dst, packet.context, false);
     } else if (packet.l3 == pcpp::IPv6 && packet.ipv6_dst.isValid()) {
         group_enabled(group::NetMetrics::Cardinality) ? data.ipCard.update(reinterpret_cast<const void *>(packet.ipv6_dst.toBytes()), 16) : void();
         group_enabled(group::NetMetrics::TopIps) ? data.topIPv6.update(packet.ipv6_dst.toString()) : void();
-        _process_geo_metrics(data, packet.ipv6_dst);
+        _process_geo_metrics(data, packet.ipv6_dst, packet.context, false);
     }
 }
 
-inline void NetworkMetricsBucket::_process_geo_metrics(NetworkDirection &net, const pcpp::IPv4Address &ipv4)
+inline void NetworkMetricsBucket::_process_geo_metrics(NetworkDirection &net, PacketContext &context, bool src)
+{
+    if (HandlerModulePlugin::city->enabled()) {
+        if (auto city = context.city(*HandlerModulePlugin::city, src); city) {
+            net.topGeoLoc.update(*city);
+        }
+    }
+    if (HandlerModulePlugin::asn->enabled()) {
+        if (auto asn = context.asn(*HandlerModulePlugin::asn, src); asn) {
+            net.topASN.update(*asn);
+        }
+    }
+}
+
+inline void NetworkMetricsBucket::_process_geo_metrics(NetworkDirection &net, const pcpp::IPv4Address &ipv4, PacketContext *context, bool src)
 {
     if ((HandlerModulePlugin::asn->enabled() || HandlerModulePlugin::city->enabled()) && group_enabled(group::NetMetrics::TopGeo)) {
+        if (context) {
+            _process_geo_metrics(net, *context, src);
+            return;
+        }
         sockaddr_in sa4{};
         if (lib::utils::ipv4_to_sockaddr(ipv4, &sa4)) {
             if (HandlerModulePlugin::city->enabled()) {
@@ -730,9 +724,13 @@ inline void NetworkMetricsBucket::_process_geo_metrics(NetworkDirection &net, co
     }
 }
 
-inline void NetworkMetricsBucket::_process_geo_metrics(NetworkDirection &net, const pcpp::IPv6Address &ipv6)
+inline void NetworkMetricsBucket::_process_geo_metrics(NetworkDirection &net, const pcpp::IPv6Address &ipv6, PacketContext *context, bool src)
 {
     if ((HandlerModulePlugin::asn->enabled() || HandlerModulePlugin::city->enabled()) && group_enabled(group::NetMetrics::TopGeo)) {
+        if (context) {
+            _process_geo_metrics(net, *context, src);
+            return;
+        }
         sockaddr_in6 sa6{};
         if (lib::utils::ipv6_to_sockaddr(ipv6, &sa6)) {
             if (HandlerModulePlugin::city->enabled()) {
@@ -755,8 +753,12 @@ void NetworkMetricsManager::process_filtered(timespec stamp)
 // the general metrics manager entry point
 void NetworkMetricsManager::process_packet(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, timespec stamp)
 {
-    // base event
-    new_event(stamp);
+    // base event. with flow sampling, both directions of a flow are sampled together
+    if (flow_sampling()) {
+        new_flow_event(stamp, PacketContext::of(payload).flowkey());
+    } else {
+        new_event(stamp);
+    }
     // process in the "live" bucket
     live_bucket()->process_packet(_deep_sampling_now, payload, dir, l3, l4);
 }
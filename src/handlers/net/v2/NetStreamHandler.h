@@ -47,6 +47,8 @@ struct NetworkPacket {
     pcpp::IPv4Address ipv4_dst;
     pcpp::IPv6Address ipv6_src;
     pcpp::IPv6Address ipv6_dst;
+    // the packet the addresses come from, if any, whose geo lookups are shared with other handlers
+    PacketContext *context{nullptr};
 
     NetworkPacket(NetworkPacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, size_t payload_size, bool syn_flag)
         : dir(dir)
@@ -169,8 +171,10 @@ protected:
     Counter _filtered;
     std::map<NetworkPacketDirection, NetworkDirection> _net;
 
-    void _process_geo_metrics(NetworkDirection &net, const pcpp::IPv4Address &ipv4);
-    void _process_geo_metrics(NetworkDirection &net, const pcpp::IPv6Address &ipv6);
+    // with a context, its addresses are looked up once for every handler the packet is delivered to
+    void _process_geo_metrics(NetworkDirection &net, PacketContext &context, bool src);
+    void _process_geo_metrics(NetworkDirection &net, const pcpp::IPv4Address &ipv4, PacketContext *context, bool src);
+    void _process_geo_metrics(NetworkDirection &net, const pcpp::IPv6Address &ipv6, PacketContext *context, bool src);
 
 public:
     NetworkMetricsBucket()
@@ -266,6 +270,7 @@ class NetStreamHandler final : public visor::StreamMetricsHandler<NetworkMetrics
 
     void process_dnstap_cb(const dnstap::Dnstap &, size_t);
     void process_packet_cb(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, timespec stamp);
+    void process_packet_batch_cb(const PacketBatch &batch);
     void process_tcp_reassembled_packet_cb(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, uint32_t flowkey, timespec stamp);
     void set_start_tstamp(timespec stamp);
     void set_end_tstamp(timespec stamp);
@@ -32,9 +32,12 @@ void PcapStreamHandler::start()
     if (_pcap_proxy) {
         _start_tstamp_connection = _pcap_proxy->start_tstamp_signal.connect(&PcapStreamHandler::set_start_tstamp, this);
         _end_tstamp_connection = _pcap_proxy->end_tstamp_signal.connect(&PcapStreamHandler::set_end_tstamp, this);
+        _pcap_proxy->register_bpf(name(), std::nullopt);
 
         _pcap_tcp_reassembly_errors_connection = _pcap_proxy->tcp_reassembly_error_signal.connect(&PcapStreamHandler::process_pcap_tcp_reassembly_error, this);
         _pcap_stats_connection = _pcap_proxy->pcap_stats_signal.connect(&PcapStreamHandler::process_pcap_stats, this);
+        _ring_stats_connection = _pcap_proxy->ring_stats_signal.connect(&PcapStreamHandler::process_ring_stats, this);
+        _duplicates_connection = _pcap_proxy->duplicates_signal.connect(&PcapStreamHandler::process_duplicates, this);
         _heartbeat_connection = _pcap_proxy->heartbeat_signal.connect(&PcapStreamHandler::check_period_shift, this);
     }
 
@@ -50,8 +53,11 @@ void PcapStreamHandler::stop()
     if (_pcap_proxy) {
         _start_tstamp_connection.disconnect();
         _end_tstamp_connection.disconnect();
+        _pcap_proxy->unregister_bpf(name());
         _pcap_tcp_reassembly_errors_connection.disconnect();
         _pcap_stats_connection.disconnect();
+        _ring_stats_connection.disconnect();
+        _duplicates_connection.disconnect();
     }
     _heartbeat_connection.disconnect();
 
@@ -67,6 +73,14 @@ void PcapStreamHandler::process_pcap_stats(const pcpp::IPcapDevice::PcapStats &s
 {
     _metrics->process_pcap_stats(stats);
 }
+void PcapStreamHandler::process_ring_stats(const RingStats &stats)
+{
+    _metrics->process_ring_stats(stats);
+}
+void PcapStreamHandler::process_duplicates(uint64_t count, timespec stamp)
+{
+    _metrics->process_duplicates(count, stamp);
+}
 void PcapStreamHandler::set_start_tstamp(timespec stamp)
 {
     _metrics->set_start_tstamp(stamp);
@@ -87,6 +101,11 @@ void PcapMetricsBucket::specialized_merge(const AbstractMetricsBucket &o, [[mayb
     _counters.pcap_TCP_reassembly_errors += other._counters.pcap_TCP_reassembly_errors;
     _counters.pcap_os_drop += other._counters.pcap_os_drop;
     _counters.pcap_if_drop += other._counters.pcap_if_drop;
+    _counters.pcap_ring_freezes += other._counters.pcap_ring_freezes;
+    _counters.pcap_duplicates += other._counters.pcap_duplicates;
+
+    _ring_fill_pct.merge(other._ring_fill_pct);
+    _ring_retire_latency_us.merge(other._ring_retire_latency_us);
 }
 
 void PcapMetricsBucket::to_prometheus(std::stringstream &out, Metric::LabelMap add_labels) const
@@ -96,6 +115,11 @@ void PcapMetricsBucket::to_prometheus(std::stringstream &out, Metric::LabelMap a
     _counters.pcap_TCP_reassembly_errors.to_prometheus(out, add_labels);
     _counters.pcap_os_drop.to_prometheus(out, add_labels);
     _counters.pcap_if_drop.to_prometheus(out, add_labels);
+    _counters.pcap_ring_freezes.to_prometheus(out, add_labels);
+    _counters.pcap_duplicates.to_prometheus(out, add_labels);
+
+    _ring_fill_pct.to_prometheus(out, add_labels);
+    _ring_retire_latency_us.to_prometheus(out, add_labels);
 }
 
 void PcapMetricsBucket::to_opentelemetry(metrics::v1::ScopeMetrics &scope, timespec &start_ts, timespec &end_ts, Metric::LabelMap add_labels) const
@@ -105,6 +129,11 @@ void PcapMetricsBucket::to_opentelemetry(metrics::v1::ScopeMetrics &scope, times
     _counters.pcap_TCP_reassembly_errors.to_opentelemetry(scope, start_ts, end_ts, add_labels);
     _counters.pcap_os_drop.to_opentelemetry(scope, start_ts, end_ts, add_labels);
     _counters.pcap_if_drop.to_opentelemetry(scope, start_ts, end_ts, add_labels);
+    _counters.pcap_ring_freezes.to_opentelemetry(scope, start_ts, end_ts, add_labels);
+    _counters.pcap_duplicates.to_opentelemetry(scope, start_ts, end_ts, add_labels);
+
+    _ring_fill_pct.to_opentelemetry(scope, start_ts, end_ts, add_labels);
+    _ring_retire_latency_us.to_opentelemetry(scope, start_ts, end_ts, add_labels);
 }
 
 void PcapMetricsBucket::to_json(json &j) const
@@ -114,6 +143,11 @@ void PcapMetricsBucket::to_json(json &j) const
     _counters.pcap_TCP_reassembly_errors.to_json(j);
     _counters.pcap_os_drop.to_json(j);
     _counters.pcap_if_drop.to_json(j);
+    _counters.pcap_ring_freezes.to_json(j);
+    _counters.pcap_duplicates.to_json(j);
+
+    _ring_fill_pct.to_json(j);
+    _ring_retire_latency_us.to_json(j);
 }
 
 void PcapMetricsBucket::process_pcap_tcp_reassembly_error([[maybe_unused]] bool deep, [[maybe_unused]] pcpp::Packet &payload, [[maybe_unused]] PacketDirection dir, [[maybe_unused]] pcpp::ProtocolType l3)
@@ -142,6 +176,25 @@ void PcapMetricsBucket::process_pcap_stats(const pcpp::IPcapDevice::PcapStats &s
     }
 }
 
+void PcapMetricsBucket::process_ring_stats(const RingStats &stats)
+{
+    std::unique_lock lock(_mutex);
+
+    _counters.pcap_ring_freezes += stats.freezes;
+    for (auto fill : stats.fill_pct) {
+        _ring_fill_pct.update(fill);
+    }
+    for (auto latency : stats.retire_latency_us) {
+        _ring_retire_latency_us.update(latency);
+    }
+}
+
+void PcapMetricsBucket::process_duplicates(uint64_t count)
+{
+    std::unique_lock lock(_mutex);
+    _counters.pcap_duplicates += count;
+}
+
 // the general metrics manager entry point
 void PcapMetricsManager::process_pcap_tcp_reassembly_error(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, timespec stamp)
 {
@@ -160,4 +213,19 @@ void PcapMetricsManager::process_pcap_stats(const pcpp::IPcapDevice::PcapStats &
     live_bucket()->process_pcap_stats(stats);
 }
 
-}
\ No newline at end of file
+void PcapMetricsManager::process_ring_stats(const RingStats &stats)
+{
+    timespec stamp;
+    // use now()
+    std::timespec_get(&stamp, TIME_UTC);
+    new_event(stamp);
+    live_bucket()->process_ring_stats(stats);
+}
+
+void PcapMetricsManager::process_duplicates(uint64_t count, timespec stamp)
+{
+    new_event(stamp);
+    live_bucket()->process_duplicates(count);
+}
+
+}
@@ -34,17 +34,29 @@ protected:
         Counter pcap_if_drop;
         uint64_t pcap_last_if_drop{std::numeric_limits<uint64_t>::max()};
 
+        Counter pcap_ring_freezes;
+
+        Counter pcap_duplicates;
+
         counters()
             : pcap_TCP_reassembly_errors(PCAP_SCHEMA, {"tcp_reassembly_errors"}, "Count of TCP reassembly errors")
             , pcap_os_drop(PCAP_SCHEMA, {"os_drops"}, "Count of packets dropped by the operating system (if supported)")
             , pcap_if_drop(PCAP_SCHEMA, {"if_drops"}, "Count of packets dropped by the interface (if supported)")
+            , pcap_ring_freezes(PCAP_SCHEMA, {"ring_freezes"}, "Count of times the capture ring was full and the kernel froze its queue (af_packet)")
+            , pcap_duplicates(PCAP_SCHEMA, {"duplicates_suppressed"}, "Count of duplicate packets dropped by the input before any handler saw them (dedup_window_ms)")
         {
         }
     };
     counters _counters;
 
+    // af_packet ring pressure, sampled as each ring block is picked up
+    Histogram<uint64_t> _ring_fill_pct;
+    Histogram<uint64_t> _ring_retire_latency_us;
+
 public:
     PcapMetricsBucket()
+        : _ring_fill_pct(PCAP_SCHEMA, {"ring", "fill_histogram_pct"}, "Histogram of the share of capture ring blocks waiting in user space, in percent (af_packet)")
+        , _ring_retire_latency_us(PCAP_SCHEMA, {"ring", "retire_latency_histogram_us"}, "Histogram of the time from the last packet of a capture ring block until it was picked up, in microseconds (af_packet)")
     {
     }
 
@@ -66,6 +78,8 @@ public:
 
     void process_pcap_tcp_reassembly_error(bool deep, pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3);
     void process_pcap_stats(const pcpp::IPcapDevice::PcapStats &stats);
+    void process_ring_stats(const RingStats &stats);
+    void process_duplicates(uint64_t count);
 };
 
 class PcapMetricsManager final : public visor::AbstractMetricsManager<PcapMetricsBucket>
@@ -78,6 +92,8 @@ public:
 
     void process_pcap_tcp_reassembly_error(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, timespec stamp);
     void process_pcap_stats(const pcpp::IPcapDevice::PcapStats &stats);
+    void process_ring_stats(const RingStats &stats);
+    void process_duplicates(uint64_t count, timespec stamp);
 };
 
 class PcapStreamHandler final : public visor::StreamMetricsHandler<PcapMetricsManager>
@@ -90,6 +106,8 @@ class PcapStreamHandler final : public visor::StreamMetricsHandler<PcapMetricsMa
 
     sigslot::connection _pcap_tcp_reassembly_errors_connection;
     sigslot::connection _pcap_stats_connection;
+    sigslot::connection _ring_stats_connection;
+    sigslot::connection _duplicates_connection;
 
     sigslot::connection _heartbeat_connection;
 
@@ -98,6 +116,8 @@ class PcapStreamHandler final : public visor::StreamMetricsHandler<PcapMetricsMa
 
     void process_pcap_tcp_reassembly_error(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, timespec stamp);
     void process_pcap_stats(const pcpp::IPcapDevice::PcapStats &stats);
+    void process_ring_stats(const RingStats &stats);
+    void process_duplicates(uint64_t count, timespec stamp);
 
     void set_start_tstamp(timespec stamp);
     void set_end_tstamp(timespec stamp);
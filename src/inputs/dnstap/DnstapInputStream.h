@@ -75,6 +75,16 @@ class DnstapInputStream : public visor::InputStream
         return false;
     }
 
+protected:
+    bool handler_threads_supported() const override
+    {
+        return true;
+    }
+    void event_proxy_added(InputEventProxy *proxy) override
+    {
+        proxy->start_handler_thread(schema_key());
+    }
+
 public:
     DnstapInputStream(const std::string &name);
     ~DnstapInputStream() = default;
@@ -112,7 +122,10 @@ public:
         }
     }
 
-    ~DnstapInputEventProxy() = default;
+    ~DnstapInputEventProxy()
+    {
+        stop_handler_thread();
+    }
 
     size_t consumer_count() const override
     {
@@ -142,6 +155,10 @@ public:
             }
         }
 
+        if (_handler_thread) {
+            _handler_thread->post([this, dnstap, size] { dnstap_signal(dnstap, size); });
+            return;
+        }
         dnstap_signal(dnstap, size);
     }
 
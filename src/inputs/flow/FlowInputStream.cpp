@@ -5,6 +5,7 @@
 #include "FlowInputStream.h"
 #include "FlowException.h"
 #include "ThreadName.h"
+#include "mmap_pcap_reader.h"
 #ifdef __GNUC__
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wpedantic"
@@ -15,7 +16,6 @@
 #include <pcapplusplus/IPv4Layer.h>
 #include <pcapplusplus/IPv6Layer.h>
 #include <pcapplusplus/Packet.h>
-#include <pcapplusplus/PcapFileDevice.h>
 #include <pcapplusplus/UdpLayer.h>
 #include <uvw/async.h>
 #include <uvw/loop.h>
@@ -74,16 +74,19 @@ void FlowInputStream::start()
 
 void FlowInputStream::_read_from_pcap_file()
 {
-    pcpp::IFileReaderDevice *reader = pcpp::IFileReaderDevice::getReader(config_get<std::string>("pcap_file"));
-    reader->open();
-
-    pcpp::RawPacket rawPacket;
+    // packets are views into the mapped file, nothing is copied
+    lib::utils::MmapPcapReader reader(config_get<std::string>("pcap_file"));
+    try {
+        reader.open();
+    } catch (const lib::utils::UtilsException &e) {
+        throw FlowException(e.what());
+    }
 
     datasketches::frequent_items_sketch<uint16_t> sketch(3);
 
-    while (reader->getNextPacket(rawPacket)) {
+    while (auto rawPacket = reader.next_packet()) {
         if (_flow_type == Type::SFLOW) {
-            pcpp::Packet sflow_pkt(&rawPacket);
+            pcpp::Packet sflow_pkt(rawPacket);
             if (sflow_pkt.isPacketOfType(pcpp::UDP)) {
                 pcpp::UdpLayer *udpLayer = sflow_pkt.getLayerOfType<pcpp::UdpLayer>();
                 SFSample sample;
@@ -93,14 +96,14 @@ void FlowInputStream::_read_from_pcap_file()
                     read_sflow_datagram(&sample);
                     std::shared_lock lock(_input_mutex);
                     for (auto &proxy : _event_proxies) {
-                        static_cast<FlowInputEventProxy *>(proxy.get())->sflow_cb(sample, rawPacket.getRawDataLen());
+                        static_cast<FlowInputEventProxy *>(proxy.get())->sflow_cb(sample, rawPacket->getRawDataLen());
                     }
                 } catch (const std::exception &e) {
                     _logger->error(e.what());
                 }
             }
         } else if (_flow_type == Type::NETFLOW) {
-            pcpp::Packet netflow_pkt(&rawPacket);
+            pcpp::Packet netflow_pkt(rawPacket);
             if (netflow_pkt.isPacketOfType(pcpp::UDP)) {
                 pcpp::UdpLayer *udpLayer = netflow_pkt.getLayerOfType<pcpp::UdpLayer>();
                 NFSample sample;
@@ -115,7 +118,7 @@ void FlowInputStream::_read_from_pcap_file()
                     }
                     std::shared_lock lock(_input_mutex);
                     for (auto &proxy : _event_proxies) {
-                        static_cast<FlowInputEventProxy *>(proxy.get())->netflow_cb(src_ip, sample, rawPacket.getRawDataLen());
+                        static_cast<FlowInputEventProxy *>(proxy.get())->netflow_cb(src_ip, sample, rawPacket->getRawDataLen());
                     }
                 } else {
                     _logger->error("invalid netflow or ipfix packet");
@@ -124,8 +127,7 @@ void FlowInputStream::_read_from_pcap_file()
         }
     }
 
-    reader->close();
-    delete reader;
+    reader.close();
 }
 
 void FlowInputStream::_create_frame_stream_udp_socket()
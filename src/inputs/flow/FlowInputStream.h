@@ -56,6 +56,16 @@ class FlowInputStream : public visor::InputStream
     void _read_from_pcap_file();
     void _create_frame_stream_udp_socket();
 
+protected:
+    bool handler_threads_supported() const override
+    {
+        return true;
+    }
+    void event_proxy_added(InputEventProxy *proxy) override
+    {
+        proxy->start_handler_thread(schema_key());
+    }
+
 public:
     FlowInputStream(const std::string &name);
     ~FlowInputStream() = default;
@@ -79,20 +89,36 @@ public:
     {
     }
 
-    ~FlowInputEventProxy() = default;
+    ~FlowInputEventProxy()
+    {
+        stop_handler_thread();
+    }
 
     size_t consumer_count() const override
     {
         return policy_signal.slot_count() + heartbeat_signal.slot_count() + sflow_signal.slot_count() + netflow_signal.slot_count();
     }
 
+    // with a handler thread, handlers get a copy of the sample. the datagram it points into is gone by then, so the
+    // copy carries a copy of the datagram too
     void sflow_cb(const SFSample &sflow, std::size_t size)
     {
+        if (_handler_thread) {
+            auto datagram = std::make_shared<std::vector<uint8_t>>(sflow.rawSample, sflow.rawSample + sflow.rawSampleLen);
+            SFSample copy = sflow;
+            relocate_sflow_sample(&copy, datagram->data());
+            _handler_thread->post([this, datagram, copy, size] { sflow_signal(copy, size); });
+            return;
+        }
         sflow_signal(sflow, size);
     }
 
     void netflow_cb(const std::string &srcip, const NFSample &netflow, std::size_t size)
     {
+        if (_handler_thread) {
+            _handler_thread->post([this, srcip, netflow, size] { netflow_signal(srcip, netflow, size); });
+            return;
+        }
         netflow_signal(srcip, netflow, size);
     }
 
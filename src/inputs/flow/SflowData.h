@@ -1090,4 +1090,28 @@ static void read_sflow_datagram(SFSample *sample)
     }
 }
 
+/* point a copy of a decoded sample at its own copy of the datagram: every pointer into the
+ * old datagram moves by the same offset, anything outside of it is cleared */
+static void relocate_sflow_sample(SFSample *sample, uint8_t *raw)
+{
+    uint8_t *old = sample->rawSample;
+    uint32_t len = sample->rawSampleLen;
+    auto relocate = [old, len, raw](auto *ptr) -> decltype(ptr) {
+        auto p = reinterpret_cast<uint8_t *>(ptr);
+        if (!p || p < old || p > old + len) {
+            return nullptr;
+        }
+        return reinterpret_cast<decltype(ptr)>(raw + (p - old));
+    };
+    sample->datap = relocate(sample->datap);
+    sample->endp = relocate(sample->endp);
+    sample->s.header = relocate(sample->s.header);
+    sample->s.dst_as_path = relocate(sample->s.dst_as_path);
+    for (auto &element : sample->elements) {
+        element.header = relocate(element.header);
+        element.dst_as_path = relocate(element.dst_as_path);
+    }
+    sample->rawSample = raw;
+}
+
 }
\ No newline at end of file
@@ -3,6 +3,9 @@
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers.hpp>
 #include <catch2/catch_test_visor.hpp>
+#include <future>
+#include <set>
+#include <thread>
 
 #ifdef __GNUC__
 #pragma GCC diagnostic push
@@ -34,6 +37,98 @@ TEST_CASE("sflow pcap file", "[flow][sflow][file]")
     CHECK(j["module"]["config"]["pcap_file"] == "tests/fixtures/ecmp.pcap");
 }
 
+TEST_CASE("sflow samples outlive their datagram on a handler thread", "[flow][sflow][file]")
+{
+
+    FlowInputStream stream{"sflow-test"};
+    stream.config_set("pcap_file", "tests/fixtures/ecmp.pcap");
+
+    visor::Config filter;
+    visor::HandlerThreadConfig thread;
+    thread.name = "test";
+    auto proxy = static_cast<FlowInputEventProxy *>(stream.add_event_proxy(filter, thread));
+
+    // the handler thread waits until the pcap file is read and unmapped, then decodes every sample again from the
+    // datagram it was handed
+    std::promise<void> file_closed;
+    auto closed = file_closed.get_future().share();
+    std::atomic<uint64_t> samples{0};
+    std::atomic<uint64_t> mismatches{0};
+    auto connection = proxy->sflow_signal.connect([&](const SFSample &sample, std::size_t) {
+        closed.wait();
+        ++samples;
+        SFSample again;
+        again.rawSample = sample.rawSample;
+        again.rawSampleLen = sample.rawSampleLen;
+        read_sflow_datagram(&again);
+        if (again.elements.size() != sample.elements.size()) {
+            ++mismatches;
+            return;
+        }
+        for (size_t i = 0; i < sample.elements.size(); ++i) {
+            if (again.elements[i].header != sample.elements[i].header || again.elements[i].headerLen != sample.elements[i].headerLen) {
+                ++mismatches;
+            }
+        }
+    });
+
+    CHECK_NOTHROW(stream.start());
+    file_closed.set_value();
+    proxy->stop_handler_thread();
+    CHECK_NOTHROW(stream.stop());
+
+    CHECK(samples > 0);
+    CHECK(mismatches == 0);
+}
+
+TEST_CASE("flow handler thread runs heartbeats and policies with the samples", "[flow][sflow]")
+{
+
+    FlowInputStream stream{"sflow-test"};
+    visor::Config filter;
+    visor::HandlerThreadConfig thread;
+    thread.name = "test";
+    auto proxy = static_cast<FlowInputEventProxy *>(stream.add_event_proxy(filter, thread));
+
+    // plain, unsynchronized state, as a handler keeps it: under TSan any event delivered off the handler thread races
+    std::set<std::thread::id> threads;
+    uint64_t samples{0}, heartbeats{0}, policies{0};
+    auto sflow_connection = proxy->sflow_signal.connect([&](const SFSample &, std::size_t) {
+        threads.insert(std::this_thread::get_id());
+        ++samples;
+    });
+    auto heartbeat_connection = proxy->heartbeat_signal.connect([&](const timespec) {
+        threads.insert(std::this_thread::get_id());
+        ++heartbeats;
+    });
+    auto policy_connection = proxy->policy_signal.connect([&](const visor::Policy *, visor::Action) {
+        threads.insert(std::this_thread::get_id());
+        ++policies;
+    });
+
+    // the io loop delivers samples while the timer sends heartbeats and policies come and go
+    std::thread traffic([proxy] {
+        SFSample sample;
+        for (int i = 0; i < 10000; ++i) {
+            proxy->sflow_cb(sample, 100);
+        }
+    });
+    for (int i = 0; i < 100; ++i) {
+        timespec stamp;
+        std::timespec_get(&stamp, TIME_UTC);
+        proxy->heartbeat_cb(stamp);
+        proxy->policy_cb(nullptr, i % 2 ? visor::Action::RemovePolicy : visor::Action::AddPolicy);
+    }
+    traffic.join();
+    proxy->stop_handler_thread();
+
+    CHECK(threads.size() == 1);
+    CHECK(threads.count(std::this_thread::get_id()) == 0);
+    CHECK(samples > 0);
+    CHECK(heartbeats == 100);
+    CHECK(policies == 100);
+}
+
 TEST_CASE("netflow pcap file", "[flow][netflow][file]")
 {
 
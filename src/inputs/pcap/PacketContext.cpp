@@ -0,0 +1,122 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "PacketContext.h"
+#include "utils.h"
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#pragma GCC diagnostic ignored "-Wzero-as-null-pointer-constant"
+#pragma clang diagnostic ignored "-Wc99-extensions"
+#endif
+#include <pcapplusplus/IPv4Layer.h>
+#include <pcapplusplus/IPv6Layer.h>
+#include <pcapplusplus/PacketUtils.h>
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+namespace visor::input::pcap {
+
+thread_local PacketContext::Scoped PacketContext::_scoped;
+thread_local uint64_t PacketContext::_generations{0};
+thread_local std::deque<PacketContext> PacketContext::_contexts;
+thread_local PacketContext PacketContext::_unscoped;
+
+// calls cb with the source or destination address of packet as a sockaddr_in or sockaddr_in6, if it has one
+template <typename F>
+static bool with_sockaddr(pcpp::Packet &packet, bool src, F &&cb)
+{
+    if (auto ipv4 = packet.getLayerOfType<pcpp::IPv4Layer>(); ipv4) {
+        sockaddr_in sa4;
+        if (lib::utils::ipv4_to_sockaddr(src ? ipv4->getSrcIPv4Address() : ipv4->getDstIPv4Address(), &sa4)) {
+            cb(&sa4);
+            return true;
+        }
+    } else if (auto ipv6 = packet.getLayerOfType<pcpp::IPv6Layer>(); ipv6) {
+        sockaddr_in6 sa6;
+        if (lib::utils::ipv6_to_sockaddr(src ? ipv6->getSrcIPv6Address() : ipv6->getDstIPv6Address(), &sa6)) {
+            cb(&sa6);
+            return true;
+        }
+    }
+    return false;
+}
+
+PacketContext::Scope::Scope(pcpp::Packet *packets, size_t count)
+    : _outer(_scoped)
+{
+    _scoped.first = packets;
+    _scoped.count = count;
+    _scoped.offset = _outer.offset + _outer.count;
+    // contexts of earlier scopes go stale without touching them, and are reset on first use
+    _scoped.generation = ++_generations;
+    if (_contexts.size() < _scoped.offset + count) {
+        _contexts.resize(_scoped.offset + count);
+    }
+}
+
+PacketContext::Scope::~Scope()
+{
+    _scoped = _outer;
+}
+
+PacketContext &PacketContext::of(pcpp::Packet &packet)
+{
+    // compared as integers, since packet need not be one of the scoped packets
+    auto addr = reinterpret_cast<uintptr_t>(&packet);
+    auto first = reinterpret_cast<uintptr_t>(_scoped.first);
+    if (_scoped.count && addr >= first && addr < first + _scoped.count * sizeof(pcpp::Packet)) {
+        auto &context = _contexts[_scoped.offset + (addr - first) / sizeof(pcpp::Packet)];
+        if (context._generation != _scoped.generation) {
+            context._reset(packet, _scoped.generation);
+        }
+        return context;
+    }
+    _unscoped._reset(packet, 0);
+    return _unscoped;
+}
+
+void PacketContext::_reset(pcpp::Packet &packet, uint64_t generation)
+{
+    _packet = &packet;
+    _generation = generation;
+    _have_flowkey = false;
+    _app_layer.reset();
+    _app_layer_type = nullptr;
+    _geo = {};
+}
+
+uint32_t PacketContext::flowkey()
+{
+    if (!_have_flowkey) {
+        _flowkey = pcpp::hash5Tuple(_packet);
+        _have_flowkey = true;
+    }
+    return _flowkey;
+}
+
+const geo::City *PacketContext::city(const geo::MaxmindDB &db, bool src)
+{
+    auto &geo = _geo[src ? 0 : 1];
+    if (!geo.city_done) {
+        geo.has_city = with_sockaddr(*_packet, src, [&db, &geo](const auto *sa) { geo.city = db.getGeoLoc(sa); });
+        geo.city_done = true;
+    }
+    return geo.has_city ? &geo.city : nullptr;
+}
+
+const std::string *PacketContext::asn(const geo::MaxmindDB &db, bool src)
+{
+    auto &geo = _geo[src ? 0 : 1];
+    if (!geo.asn_done) {
+        geo.has_asn = with_sockaddr(*_packet, src, [&db, &geo](const auto *sa) { geo.asn = db.getASNString(sa); });
+        geo.asn_done = true;
+    }
+    return geo.has_asn ? &geo.asn : nullptr;
+}
+
+}
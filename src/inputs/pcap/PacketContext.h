@@ -0,0 +1,106 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include "GeoDB.h"
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
+#include <pcapplusplus/Packet.h>
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <typeinfo>
+#include <utility>
+
+namespace visor::input::pcap {
+
+// what more than one handler wants to know about a packet: its flow key, the application layer a handler parsed from
+// it, and the geo location and ASN of its addresses. each is worked out on first use and then shared by every handler
+// and policy the packet is delivered to on this thread, so ten policies on one interface parse it once, not ten times.
+// a context is only valid during the signal that delivered its packet
+class PacketContext
+{
+    // per side, 0 is the source and 1 the destination
+    struct Geo {
+        bool city_done{false};
+        bool asn_done{false};
+        bool has_city{false};
+        bool has_asn{false};
+        geo::City city;
+        std::string asn;
+    };
+
+    pcpp::Packet *_packet{nullptr};
+    uint64_t _generation{0};
+
+    bool _have_flowkey{false};
+    uint32_t _flowkey{0};
+
+    std::unique_ptr<pcpp::Layer> _app_layer;
+    const std::type_info *_app_layer_type{nullptr};
+
+    std::array<Geo, 2> _geo;
+
+    // the packets of the innermost scope open on this thread. a nested scope takes the contexts after those of the
+    // scope it is nested in, and a deque keeps all of them in place while it grows
+    struct Scoped {
+        const pcpp::Packet *first{nullptr};
+        size_t count{0};
+        size_t offset{0};
+        uint64_t generation{0};
+    };
+    static thread_local Scoped _scoped;
+    static thread_local uint64_t _generations;
+    static thread_local std::deque<PacketContext> _contexts;
+    // for packets delivered outside of any scope, e.g. messages rebuilt from reassembled TCP. these are not shared
+    static thread_local PacketContext _unscoped;
+
+    void _reset(pcpp::Packet &packet, uint64_t generation);
+
+public:
+    // marks packets[0..count), which must be contiguous, as being delivered by this thread until the scope ends. the
+    // input opens one around every dispatch, so handlers can find the context of any packet in it
+    class Scope
+    {
+        Scoped _outer;
+
+    public:
+        Scope(pcpp::Packet *packets, size_t count);
+        ~Scope();
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+    };
+
+    // the context of a packet being delivered on this thread
+    static PacketContext &of(pcpp::Packet &packet);
+
+    uint32_t flowkey();
+
+    // the application layer of type L parsed from this packet, e.g. a DnsLayer, constructed from args by the first
+    // handler asking for it
+    template <typename L, typename... Args>
+    L &app_layer(Args &&...args)
+    {
+        if (!_app_layer || _app_layer_type != &typeid(L)) {
+            _app_layer = std::make_unique<L>(std::forward<Args>(args)...);
+            _app_layer_type = &typeid(L);
+        }
+        return static_cast<L &>(*_app_layer);
+    }
+
+    // location and ASN of the source or destination address, or nullptr if the packet has no IP layer
+    const geo::City *city(const geo::MaxmindDB &db, bool src);
+    const std::string *asn(const geo::MaxmindDB &db, bool src);
+};
+
+}
@@ -4,7 +4,9 @@
 
 #include "PcapInputStream.h"
 #include "NetworkInterfaceScan.h"
+#include "Numa.h"
 #include "ThreadName.h"
+#include "mmap_pcap_reader.h"
 #include <pcap.h>
 #include <timer.hpp>
 #ifdef __GNUC__
@@ -15,50 +17,63 @@
 #pragma GCC diagnostic ignored "-Wzero-as-null-pointer-constant"
 #pragma clang diagnostic ignored "-Wc99-extensions"
 #endif
-#include <pcapplusplus/DnsLayer.h> // used only for mock generator
-#include <pcapplusplus/EthLayer.h>
 #include <pcapplusplus/IPv4Layer.h>
 #include <pcapplusplus/IPv6Layer.h>
 #include <pcapplusplus/Logger.h>
 #include <pcapplusplus/PacketUtils.h>
-#include <pcapplusplus/PcapFileDevice.h>
 #include <pcapplusplus/SystemUtils.h>
+#include <pcapplusplus/TcpLayer.h>
 #ifdef __GNUC__
 #pragma GCC diagnostic pop
 #endif
+#include <algorithm>
 #include <assert.h>
 #include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <optional>
 #include <pcapplusplus/IpUtils.h>
 #include <sstream>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 
 using namespace std::chrono;
 
 namespace visor::input::pcap {
 
-// static callbacks for PcapPlusPlus
+// static callbacks for PcapPlusPlus, the cookie is the PcapWorker owning the capture thread
 static void _tcp_message_ready_cb(int8_t side, const pcpp::TcpStreamData &tcpData, void *cookie)
 {
-    auto stream = static_cast<PcapInputStream *>(cookie);
-    stream->tcp_message_ready(side, tcpData);
+    auto worker = static_cast<PcapWorker *>(cookie);
+    worker->stream->tcp_message_ready(*worker, side, tcpData);
 }
 
 static void _tcp_connection_start_cb(const pcpp::ConnectionData &connectionData, void *cookie)
 {
-    auto stream = static_cast<PcapInputStream *>(cookie);
-    stream->tcp_connection_start(connectionData);
+    auto worker = static_cast<PcapWorker *>(cookie);
+    worker->stream->tcp_connection_start(*worker, connectionData);
 }
 
 static void _tcp_connection_end_cb(const pcpp::ConnectionData &connectionData, pcpp::TcpReassembly::ConnectionEndReason reason, void *cookie)
 {
-    auto stream = static_cast<PcapInputStream *>(cookie);
-    stream->tcp_connection_end(connectionData, reason);
+    auto worker = static_cast<PcapWorker *>(cookie);
+    worker->stream->tcp_connection_end(*worker, connectionData, reason);
 }
 
 static void _packet_arrives_cb(pcpp::RawPacket *rawPacket, [[maybe_unused]] pcpp::PcapLiveDevice *dev, void *cookie)
 {
-    auto stream = static_cast<PcapInputStream *>(cookie);
-    stream->process_raw_packet(rawPacket);
+    auto worker = static_cast<PcapWorker *>(cookie);
+    worker->stream->process_raw_packet(*worker, rawPacket);
+}
+
+#ifdef __linux__
+static void _block_arrives_cb(std::vector<pcpp::RawPacket> &rawPackets, void *cookie)
+{
+    auto worker = static_cast<PcapWorker *>(cookie);
+    worker->stream->process_raw_block(*worker, rawPackets);
 }
+#endif
 
 static void _pcap_stats_update(pcpp::IPcapDevice::PcapStats &stats, void *cookie)
 {
@@ -68,21 +83,89 @@ static void _pcap_stats_update(pcpp::IPcapDevice::PcapStats &stats, void *cookie
     stream->process_pcap_stats(stats);
 }
 
-PcapInputStream::PcapInputStream(const std::string &name)
-    : visor::InputStream(name)
-    , _lru_list(std::make_unique<LRUList<uint32_t, timeval>>(DEFAULT_LRULIST_SIZE))
-    , _pcapDevice(nullptr)
-    , _tcp_reassembly(_tcp_message_ready_cb,
+PcapWorker::PcapWorker(PcapInputStream *stream, size_t id, size_t lru_size)
+    : stream(stream)
+    , id(id)
+    , lru_list(std::make_unique<LRUList<uint32_t, timeval>>(lru_size))
+    , tcp_reassembly(_tcp_message_ready_cb,
           this,
           _tcp_connection_start_cb,
           _tcp_connection_end_cb,
           pcpp::TcpReassemblyConfiguration(true, 1, 1000, 50))
+{
+}
+
+template <typename F>
+void PcapInputStream::_for_each_proxy(PcapWorker &worker, F &&cb)
+{
+    if (worker.proxy) {
+        cb(worker.proxy);
+        return;
+    }
+    std::shared_lock lock(_input_mutex);
+    _for_each_inline_proxy(&worker, cb);
+}
+
+template <typename F>
+void PcapInputStream::_for_each_inline_proxy(const PcapWorker *worker, F &&cb)
+{
+    for (auto &proxy : _event_proxies) {
+        auto pcap_proxy = static_cast<PcapInputEventProxy *>(proxy.get());
+        if (pcap_proxy->queued || (worker && pcap_proxy->shard() && *pcap_proxy->shard() != worker->id)) {
+            continue;
+        }
+        auto dispatch = _dispatch_lock(pcap_proxy);
+        cb(pcap_proxy);
+    }
+}
+
+size_t PcapInputStream::handler_shards() const
+{
+    // with handler_queue_size every policy has a thread of its own, and TCP reassembly threads deliver what any capture
+    // worker captured, so neither has a handler per worker
+    if (config_exists("pcap_file") || config_exists("handler_queue_size") || config_exists("tcp_reassembly_threads")) {
+        return 1;
+    }
+    if (config_exists("af_packet_workers")) {
+        return std::clamp<uint64_t>(config_get<uint64_t>("af_packet_workers"), 1, MAX_AF_PACKET_WORKERS);
+    }
+    if (config_exists("af_xdp_queues")) {
+        return std::clamp<uint64_t>(config_get<uint64_t>("af_xdp_queues"), 1, MAX_AF_XDP_QUEUES);
+    }
+    return 1;
+}
+
+std::unique_lock<std::mutex> PcapInputStream::_dispatch_lock(PcapInputEventProxy *proxy)
+{
+    if (_workers.size() > 1 || !_tcp_shards.empty()) {
+        return std::unique_lock(proxy->dispatch_mutex);
+    }
+    return std::unique_lock(proxy->dispatch_mutex, std::defer_lock);
+}
+
+PcapInputStream::PcapInputStream(const std::string &name)
+    : visor::InputStream(name)
+    , _pcapDevice(nullptr)
 {
     pcpp::Logger::getInstance().suppressLogs();
 }
 
 PcapInputStream::~PcapInputStream()
 {
+    // consumers and shards of a start() that failed after creating them
+    _stop_consumers();
+    _stop_tcp_shards();
+}
+
+void PcapInputStream::_create_workers(size_t count)
+{
+    _workers.clear();
+    for (size_t i = 0; i < count; ++i) {
+        _workers.push_back(std::make_unique<PcapWorker>(this, i, _lru_list_size));
+        if (_dedup_window_ms) {
+            _workers.back()->dedup = std::make_unique<lib::utils::DedupFilter>(_dedup_max_entries, _dedup_window_ms * 1'000'000);
+        }
+    }
 }
 
 void PcapInputStream::start()
@@ -95,8 +178,21 @@ void PcapInputStream::start()
     validate_configs(_config_defs);
 
     if (config_exists("tcp_packet_reassembly_cache_limit")) {
-        auto limit = config_get<uint64_t>("tcp_packet_reassembly_cache_limit");
-        _lru_list = std::make_unique<LRUList<uint32_t, timeval>>(limit);
+        _lru_list_size = config_get<uint64_t>("tcp_packet_reassembly_cache_limit");
+    }
+    if (config_exists("dedup_max_entries") && !config_exists("dedup_window_ms")) {
+        throw PcapException("dedup_max_entries needs dedup_window_ms");
+    }
+    _dedup_window_ms = 0;
+    if (config_exists("dedup_window_ms")) {
+        _dedup_window_ms = config_get<uint64_t>("dedup_window_ms");
+        if (_dedup_window_ms < 1 || _dedup_window_ms > MAX_DEDUP_WINDOW_MS) {
+            throw PcapException(fmt::format("dedup_window_ms must be between 1 and {}", MAX_DEDUP_WINDOW_MS));
+        }
+        _dedup_max_entries = config_exists("dedup_max_entries") ? config_get<uint64_t>("dedup_max_entries") : DEFAULT_DEDUP_MAX_ENTRIES;
+        if (_dedup_max_entries < 1024 || _dedup_max_entries > MAX_DEDUP_MAX_ENTRIES) {
+            throw PcapException(fmt::format("dedup_max_entries must be between 1024 and {}", MAX_DEDUP_MAX_ENTRIES));
+        }
     }
     if (config_exists("pcap_file")) {
         // read from pcap file. this is a special case from a command line utility
@@ -104,12 +200,47 @@ void PcapInputStream::start()
             config_set("bpf", "");
         }
         _pcapFile = true;
+        if (config_exists("pcap_file_shards")) {
+            _file_shards = config_get<uint64_t>("pcap_file_shards");
+            _file_shard_index = config_exists("pcap_file_shard_index") ? config_get<uint64_t>("pcap_file_shard_index") : 0;
+            if (_file_shards < 1 || _file_shard_index >= _file_shards) {
+                throw PcapException("pcap_file_shard_index must be less than pcap_file_shards");
+            }
+        }
+        if (config_exists("pcap_file_shard_by")) {
+            auto shard_by = config_get<std::string>("pcap_file_shard_by");
+            if (shard_by != "flow" && shard_by != "range") {
+                throw PcapException(fmt::format("unknown pcap_file_shard_by '{}', valid values are: flow, range", shard_by));
+            }
+            _file_shard_by_range = shard_by == "range";
+        }
+        if (config_exists("pcap_file_speed")) {
+            _file_speed = config_get<uint64_t>("pcap_file_speed");
+        }
+        if (config_exists("handler_queue_size")) {
+            // the reader would have to wait for the slowest handler rather than drop, which is what inline delivery does
+            throw PcapException("handler_queue_size is not supported with pcap_file");
+        }
+        if (config_exists("tcp_reassembly_threads")) {
+            throw PcapException("tcp_reassembly_threads is not supported with pcap_file");
+        }
+        if (config_exists("bpf_pushdown")) {
+            throw PcapException("bpf_pushdown is not supported with pcap_file");
+        }
+        _create_workers(1);
         // note, parse_host_spec should be called manually by now (in CLI)
         _running = true;
         _open_pcap(config_get<std::string>("pcap_file"), config_get<std::string>("bpf"));
         return;
     }
 
+    if (config_exists("pcap_file_shards") || config_exists("pcap_file_shard_index") || config_exists("pcap_file_shard_by")) {
+        throw PcapException("pcap_file_shards is only supported with pcap_file");
+    }
+    if (config_exists("pcap_file_speed")) {
+        throw PcapException("pcap_file_speed is only supported with pcap_file");
+    }
+
     if (config_exists("debug") && config_get<bool>("debug")) {
         pcpp::Logger::getInstance().setAllModulesToLogLevel(pcpp::Logger::LogLevel::Debug);
     }
@@ -125,6 +256,12 @@ void PcapInputStream::start()
             throw PcapException("af_packet is only available on linux");
 #else
             _cur_pcap_source = PcapSource::af_packet;
+#endif
+        } else if (req_source == "af_xdp") {
+#ifndef __linux__
+            throw PcapException("af_xdp is only available on linux");
+#else
+            _cur_pcap_source = PcapSource::af_xdp;
 #endif
         } else if (req_source == "mock") {
             _cur_pcap_source = PcapSource::mock;
@@ -133,12 +270,158 @@ void PcapInputStream::start()
         }
     }
 
-    parse_host_spec();
+    size_t worker_count{1};
+    if (config_exists("af_packet_workers")) {
+        if (_cur_pcap_source != PcapSource::af_packet) {
+            throw PcapException("af_packet_workers is only supported with pcap_source af_packet");
+        }
+        auto workers = config_get<uint64_t>("af_packet_workers");
+#ifdef __linux__
+        if (workers < 1 || workers > MAX_AF_PACKET_WORKERS) {
+            throw PcapException(fmt::format("af_packet_workers must be between 1 and {}", MAX_AF_PACKET_WORKERS));
+        }
+#endif
+        worker_count = workers;
+    }
+    if (config_exists("af_packet_fanout_type")) {
+        if (_cur_pcap_source != PcapSource::af_packet) {
+            throw PcapException("af_packet_fanout_type is only supported with pcap_source af_packet");
+        }
+#ifdef __linux__
+        _af_fanout_type = config_get<std::string>("af_packet_fanout_type");
+        if (_af_fanout_types.find(_af_fanout_type) == _af_fanout_types.end()) {
+            throw PcapException(fmt::format("unknown af_packet_fanout_type '{}', valid types are: hash, cpu, lb", _af_fanout_type));
+        }
+#endif
+    }
+    // copies of a packet are only caught by the worker that saw the first one, and only hash fanout sends them all to
+    // the same worker
+    if (_dedup_window_ms && worker_count > 1 && _af_fanout_type != "hash") {
+        throw PcapException(fmt::format("dedup_window_ms is not supported with af_packet_fanout_type {}, use hash", _af_fanout_type));
+    }
+    if (config_exists("af_packet_timestamp")) {
+        if (_cur_pcap_source != PcapSource::af_packet) {
+            throw PcapException("af_packet_timestamp is only supported with pcap_source af_packet");
+        }
+#ifdef __linux__
+        _af_timestamp = config_get<std::string>("af_packet_timestamp");
+        if (_af_timestamps.find(_af_timestamp) == _af_timestamps.end()) {
+            throw PcapException(fmt::format("unknown af_packet_timestamp '{}', valid types are: ring, software, hardware", _af_timestamp));
+        }
+#endif
+    }
+    if (config_exists("af_xdp_queues")) {
+        if (_cur_pcap_source != PcapSource::af_xdp) {
+            throw PcapException("af_xdp_queues is only supported with pcap_source af_xdp");
+        }
+        auto queues = config_get<uint64_t>("af_xdp_queues");
+#ifdef __linux__
+        if (queues < 1 || queues > MAX_AF_XDP_QUEUES) {
+            throw PcapException(fmt::format("af_xdp_queues must be between 1 and {}", MAX_AF_XDP_QUEUES));
+        }
+#endif
+        worker_count = queues;
+    }
+    if (config_exists("af_xdp_mode")) {
+        if (_cur_pcap_source != PcapSource::af_xdp) {
+            throw PcapException("af_xdp_mode is only supported with pcap_source af_xdp");
+        }
+#ifdef __linux__
+        _xdp_mode = config_get<std::string>("af_xdp_mode");
+        if (_xdp_modes.find(_xdp_mode) == _xdp_modes.end()) {
+            throw PcapException(fmt::format("unknown af_xdp_mode '{}', valid modes are: generic, native", _xdp_mode));
+        }
+#endif
+    }
+    if (config_exists("af_xdp_ip_only")) {
+        if (_cur_pcap_source != PcapSource::af_xdp) {
+            throw PcapException("af_xdp_ip_only is only supported with pcap_source af_xdp");
+        }
+#ifdef __linux__
+        _xdp_ip_only = config_get<bool>("af_xdp_ip_only");
+#endif
+    }
+    if (config_exists("bpf_pushdown")) {
+        if (!_bpf_pushdown_supported()) {
+            throw PcapException("bpf_pushdown is only supported with pcap_source libpcap or af_packet");
+        }
+        _bpf_pushdown = config_get<bool>("bpf_pushdown");
+    }
+
+    for (const auto &key : {"mock_rate", "mock_qnames", "mock_qname_zipf", "mock_clients", "mock_qtypes", "mock_rcodes", "mock_latency_ms", "mock_tcp_pct", "mock_duplicate_pct"}) {
+        if (config_exists(key) && _cur_pcap_source != PcapSource::mock) {
+            throw PcapException(fmt::format("{} is only supported with pcap_source mock", key));
+        }
+    }
+    if (_cur_pcap_source == PcapSource::mock) {
+        _mock_config = MockTrafficConfig();
+        if (config_exists("mock_rate")) {
+            _mock_config.rate = config_get<uint64_t>("mock_rate");
+        }
+        if (config_exists("mock_qnames")) {
+            _mock_config.qnames = config_get<uint64_t>("mock_qnames");
+        }
+        if (config_exists("mock_qname_zipf")) {
+            // yaml gives whole numbers as integers and anything else as a string
+            try {
+                _mock_config.qname_zipf = static_cast<double>(config_get<uint64_t>("mock_qname_zipf"));
+            } catch (const ConfigException &) {
+                try {
+                    _mock_config.qname_zipf = std::stod(config_get<std::string>("mock_qname_zipf"));
+                } catch (const std::exception &) {
+                    throw PcapException("mock_qname_zipf must be a number");
+                }
+            }
+        }
+        if (config_exists("mock_clients")) {
+            _mock_config.clients = config_get<uint64_t>("mock_clients");
+        }
+        for (auto [key, weights] : {std::make_pair("mock_qtypes", &_mock_config.qtypes), std::make_pair("mock_rcodes", &_mock_config.rcodes)}) {
+            if (config_exists(key)) {
+                auto map = config_get<std::shared_ptr<Configurable>>(key);
+                weights->clear();
+                for (const auto &name : map->get_all_keys()) {
+                    (*weights)[name] = map->config_get<uint64_t>(name);
+                }
+            }
+        }
+        if (config_exists("mock_latency_ms")) {
+            _mock_config.latency_ms = config_get<uint64_t>("mock_latency_ms");
+        }
+        if (config_exists("mock_tcp_pct")) {
+            _mock_config.tcp_pct = config_get<uint64_t>("mock_tcp_pct");
+        }
+        if (config_exists("mock_duplicate_pct")) {
+            _mock_config.duplicate_pct = config_get<uint64_t>("mock_duplicate_pct");
+        }
+        // validates the config before the generator thread starts
+        MockTrafficGenerator check(_mock_config);
+    }
+
+    uint64_t handler_queue_size{0};
+    if (config_exists("handler_queue_size")) {
+        handler_queue_size = config_get<uint64_t>("handler_queue_size");
+        if (handler_queue_size < 2 || handler_queue_size > MAX_HANDLER_QUEUE_SIZE) {
+            throw PcapException(fmt::format("handler_queue_size must be between 2 and {}", MAX_HANDLER_QUEUE_SIZE));
+        }
+    }
+
+    uint64_t tcp_reassembly_threads{0};
+    if (config_exists("tcp_reassembly_threads")) {
+        if (handler_queue_size) {
+            // every handler queue reassembles on its own thread already
+            throw PcapException("tcp_reassembly_threads is not supported with handler_queue_size");
+        }
+        tcp_reassembly_threads = config_get<uint64_t>("tcp_reassembly_threads");
+        if (tcp_reassembly_threads < 1 || tcp_reassembly_threads > MAX_TCP_REASSEMBLY_THREADS) {
+            throw PcapException(fmt::format("tcp_reassembly_threads must be between 1 and {}", MAX_TCP_REASSEMBLY_THREADS));
+        }
+    }
 
     std::string TARGET;
     pcpp::IPv4Address interfaceIP4;
     pcpp::IPv6Address interfaceIP6;
-    if (_cur_pcap_source == PcapSource::libpcap || _cur_pcap_source == PcapSource::af_packet) {
+    if (_cur_pcap_source == PcapSource::libpcap || _cur_pcap_source == PcapSource::af_packet || _cur_pcap_source == PcapSource::af_xdp) {
         if (!config_exists("iface")) {
             throw PcapException("no iface was specified for live capture");
         }
@@ -156,6 +439,64 @@ void PcapInputStream::start()
         interfaceIP4 = TARGET;
         interfaceIP6 = TARGET;
     }
+
+    // resolved before any thread of this input starts, so they all start out on the node
+    _numa_node = -1;
+    if (config_exists("numa_node")) {
+        if (TARGET.empty()) {
+            throw PcapException("numa_node is only supported with live capture");
+        }
+        int numa_node{-1};
+        std::optional<uint64_t> node_number;
+        try {
+            node_number = config_get<uint64_t>("numa_node");
+        } catch (const ConfigException &) {
+            if (config_get<std::string>("numa_node") != "auto") {
+                throw PcapException("numa_node must be 'auto' or the number of a NUMA node");
+            }
+        }
+        if (node_number) {
+            if (*node_number > MAX_NUMA_NODE) {
+                throw PcapException(fmt::format("numa_node {} is out of range, the highest NUMA node is {}", *node_number, MAX_NUMA_NODE));
+            }
+            numa_node = static_cast<int>(*node_number);
+        } else {
+            numa_node = numa::interface_node(TARGET);
+            if (numa_node < 0) {
+                spdlog::get("visor")->info("{}: NUMA node of interface {} is unknown, placement left to the kernel", name(), TARGET);
+            }
+        }
+        if (numa_node >= 0 && numa::node_cpus(numa_node).empty()) {
+            throw PcapException(fmt::format("numa_node {} does not exist or has no cpus", numa_node));
+        }
+        _numa_node = numa_node;
+    }
+
+    parse_host_spec();
+    _create_workers(worker_count);
+
+    _stop_tcp_shards();
+    for (size_t i = 0; i < tcp_reassembly_threads; ++i) {
+        auto shard = std::make_unique<PcapConsumer>(nullptr, TCP_SHARD_QUEUE_SIZE);
+        shard->worker = std::make_unique<PcapWorker>(this, i, _lru_list_size);
+        shard->thread = std::make_unique<std::thread>([this, s = shard.get()] {
+            _consume(*s);
+        });
+        _tcp_shards.push_back(std::move(shard));
+    }
+
+    _stop_consumers();
+    {
+        // consumers run before capture starts, proxies added later get theirs in event_proxy_added()
+        std::unique_lock lock(_input_mutex);
+        _handler_queue_size = handler_queue_size;
+        for (auto &proxy : _event_proxies) {
+            if (_handler_queue_size || proxy->thread_config()) {
+                _start_consumer(static_cast<PcapInputEventProxy *>(proxy.get()));
+            }
+        }
+    }
+
     std::string ifNameList = _get_interface_list();
 
     if (_cur_pcap_source == PcapSource::libpcap) {
@@ -180,20 +521,29 @@ void PcapInputStream::start()
         _pcapDevice = std::unique_ptr<pcpp::PcapLiveDevice>(pcapDevice->clone());
 
         _get_hosts_from_libpcap_iface();
-        _open_libpcap_iface(config_get<std::string>("bpf"));
+        _applied_bpf = _capture_bpf();
+        _open_libpcap_iface(_applied_bpf);
     } else if (_cur_pcap_source == PcapSource::af_packet) {
 #ifndef __linux__
         assert(true);
 #else
-        _open_af_packet_iface(TARGET, config_get<std::string>("bpf"));
+        _applied_bpf = _capture_bpf();
+        _open_af_packet_iface(TARGET, _applied_bpf);
+        _running = true;
+        _af_stats_thread = std::make_unique<std::thread>([this, TARGET] {
+            _poll_af_packet_stats(TARGET);
+        });
+#endif
+    } else if (_cur_pcap_source == PcapSource::af_xdp) {
+#ifndef __linux__
+        assert(true);
+#else
+        _open_af_xdp_iface(TARGET, config_get<std::string>("bpf"));
 #endif
     } else if (_cur_pcap_source == PcapSource::mock) {
+        _running = true;
         _mock_generator_thread = std::make_unique<std::thread>([this] {
-            while (_running) {
-                _generate_mock_traffic();
-                // 10 qps. could be configurable in future.
-                std::this_thread::sleep_for(100ms);
-            }
+            _generate_mock_traffic();
         });
     } else {
         assert(true);
@@ -235,13 +585,33 @@ void PcapInputStream::stop()
     }
 
 #ifdef __linux__
-    if (_af_device) {
-        _af_device->stop_capture();
+    if (_af_ring) {
+        _af_ring->unsubscribe(this);
+    }
+    if (_af_stats_thread) {
+        _running = false;
+        _af_stats_thread->join();
+        _af_stats_thread.reset(nullptr);
+    }
+    // the last input to leave closes the sockets. filter updates look at the ring under _bpf_mutex
+    std::shared_ptr<SharedAFPacket> af_ring;
+    {
+        std::unique_lock lock(_bpf_mutex);
+        af_ring = std::move(_af_ring);
     }
+    af_ring.reset();
+    // signal every capture thread before joining any of them, then close the sockets and detach the program
+    for (auto &xdp_device : _xdp_devices) {
+        xdp_device->stop_capture();
+    }
+    _xdp_devices.clear();
+    _xdp_program.reset();
 #endif
 
     // close all connections which are still opened
-    _tcp_reassembly.closeAllConnections();
+    for (auto &worker : _workers) {
+        worker->tcp_reassembly.closeAllConnections();
+    }
 
     _running = false;
 
@@ -249,51 +619,152 @@ void PcapInputStream::stop()
         _mock_generator_thread->join();
         _mock_generator_thread.reset(nullptr);
     }
+
+    _stop_consumers();
+    _stop_tcp_shards();
+
+    std::unique_lock lock(_bpf_mutex);
+    _applied_bpf.clear();
+    _bpf_pending = false;
 }
 
-void PcapInputStream::tcp_message_ready(int8_t side, const pcpp::TcpStreamData &tcpData)
+void PcapInputStream::tcp_message_ready(PcapWorker &worker, int8_t side, const pcpp::TcpStreamData &tcpData)
 {
-    std::shared_lock lock(_input_mutex);
-    for (auto &proxy : _event_proxies) {
-        dynamic_cast<PcapInputEventProxy *>(proxy.get())->tcp_message_ready_cb(side, tcpData, _packet_dir_cache);
+    _for_each_proxy(worker, [&](PcapInputEventProxy *proxy) {
+        proxy->tcp_message_ready_cb(side, tcpData, worker.packet_dir_cache);
+    });
+    if (worker.lru_list->put(tcpData.getConnectionData().flowKey, tcpData.getConnectionData().endTime, &worker.deleted_data)) {
+        worker.lru_overflow.push_back(worker.deleted_data.first);
     }
-    if (_lru_list->put(tcpData.getConnectionData().flowKey, tcpData.getConnectionData().endTime, &_deleted_data)) {
-        _lru_overflow.push_back(_deleted_data.first);
+}
+
+void PcapInputStream::tcp_connection_start(PcapWorker &worker, const pcpp::ConnectionData &connectionData)
+{
+    _for_each_proxy(worker, [&](PcapInputEventProxy *proxy) {
+        proxy->tcp_connection_start_cb(connectionData, worker.packet_dir_cache);
+    });
+    if (worker.lru_list->put(connectionData.flowKey, connectionData.startTime, &worker.deleted_data)) {
+        worker.lru_overflow.push_back(worker.deleted_data.first);
     }
 }
 
-void PcapInputStream::tcp_connection_start(const pcpp::ConnectionData &connectionData)
+void PcapInputStream::tcp_connection_end(PcapWorker &worker, const pcpp::ConnectionData &connectionData, pcpp::TcpReassembly::ConnectionEndReason reason)
 {
-    std::shared_lock lock(_input_mutex);
-    for (auto &proxy : _event_proxies) {
-        dynamic_cast<PcapInputEventProxy *>(proxy.get())->tcp_connection_start_cb(connectionData, _packet_dir_cache);
+    _for_each_proxy(worker, [&](PcapInputEventProxy *proxy) {
+        proxy->tcp_connection_end_cb(connectionData, reason);
+    });
+    worker.lru_list->eraseElement(connectionData.flowKey);
+}
+
+bool PcapInputStream::_bpf_pushdown_supported() const
+{
+    return !_pcapFile && (_cur_pcap_source == PcapSource::libpcap || _cur_pcap_source == PcapSource::af_packet);
+}
+
+std::string PcapInputStream::_capture_bpf() const
+{
+    auto bpf = config_get<std::string>("bpf");
+    if (!_bpf_pushdown || !_bpf_pushdown_supported()) {
+        return bpf;
     }
-    if (_lru_list->put(connectionData.flowKey, connectionData.startTime, &_deleted_data)) {
-        _lru_overflow.push_back(_deleted_data.first);
+    std::set<std::string> expressions;
+    {
+        std::shared_lock lock(_input_mutex);
+        for (auto &proxy : _event_proxies) {
+            if (!static_cast<PcapInputEventProxy *>(proxy.get())->collect_bpf(expressions)) {
+                return bpf;
+            }
+        }
+    }
+    if (expressions.empty()) {
+        // nothing attached consumes packets, the capture statistics still count everything the bpf config lets in
+        return bpf;
     }
+    std::string handlers;
+    for (const auto &expression : expressions) {
+        handlers += fmt::format("{}({})", handlers.empty() ? "" : " or ", expression);
+    }
+    // vlan moves the offsets of everything after it, so tagged frames need the expressions again behind it
+    handlers = fmt::format("{} or (vlan and ({}))", handlers, handlers);
+    return bpf.empty() ? handlers : fmt::format("({}) and ({})", bpf, handlers);
 }
 
-void PcapInputStream::tcp_connection_end(const pcpp::ConnectionData &connectionData, pcpp::TcpReassembly::ConnectionEndReason reason)
+void PcapInputStream::_update_capture_bpf()
 {
-    std::shared_lock lock(_input_mutex);
-    for (auto &proxy : _event_proxies) {
-        static_cast<PcapInputEventProxy *>(proxy.get())->tcp_connection_end_cb(connectionData, reason);
+    if (!_bpf_pushdown || !_bpf_pushdown_supported()) {
+        return;
     }
-    _lru_list->eraseElement(connectionData.flowKey);
+    // computed under the lock, so concurrent updates apply in the order they saw the handlers
+    std::unique_lock lock(_bpf_mutex);
+    if (!_running) {
+        return;
+    }
+    auto bpf = _capture_bpf();
+    if (bpf == _applied_bpf) {
+        return;
+    }
+    // a filter that fails is not retried until the handlers change again
+    _applied_bpf = bpf;
+    if (_cur_pcap_source == PcapSource::libpcap) {
+        _pending_bpf = bpf;
+        _bpf_pending = true;
+        return;
+    }
+#ifdef __linux__
+    if (!_af_ring) {
+        return;
+    }
+    try {
+        _af_ring->set_filter(this, bpf);
+    } catch (const PcapException &e) {
+        spdlog::get("visor")->error("pcap input [{}]: cannot set BPF filter '{}': {}", name(), bpf, e.what());
+    }
+#endif
 }
 
-void PcapInputStream::process_pcap_stats(const pcpp::IPcapDevice::PcapStats &stats)
+void PcapInputStream::process_pcap_stats(const pcpp::IPcapDevice::PcapStats &stats, uint32_t backlog_pct)
 {
+    _update_capture_bpf();
+
+    // load is the backlog waiting in the capture buffer, or full if packets were dropped since the last report
+    auto drops = stats.packetsDrop + stats.packetsDropByInterface;
+    auto load = std::min<uint32_t>(backlog_pct, 100);
+    if (_have_last_drops && drops > _last_drops) {
+        load = 100;
+    }
+    _last_drops = drops;
+    _have_last_drops = true;
+
     std::shared_lock lock(_input_mutex);
     for (auto &proxy : _event_proxies) {
-        static_cast<PcapInputEventProxy *>(proxy.get())->process_pcap_stats(stats);
+        auto pcap_proxy = static_cast<PcapInputEventProxy *>(proxy.get());
+        // the statistics of the whole input, which the handlers of the first shard count for all of them
+        if (pcap_proxy->shard().value_or(0)) {
+            continue;
+        }
+        auto dispatch = _dispatch_lock(pcap_proxy);
+        pcap_proxy->process_pcap_stats(stats);
+    }
+    _for_each_inline_proxy(nullptr, [load](PcapInputEventProxy *proxy) {
+        proxy->load_cb(load);
+    });
+    // a consumer is as loaded as its queue is full, or fully if it dropped packets since the last report
+    for (auto &consumer : _consumers) {
+        auto dropped = consumer->dropped.load(std::memory_order_relaxed);
+        auto queue_pct = static_cast<uint32_t>(consumer->queue.size() * 100 / consumer->queue.capacity());
+        auto consumer_load = dropped > consumer->last_dropped ? 100U : std::min<uint32_t>(queue_pct, 100);
+        consumer->last_dropped = dropped;
+        auto dispatch = _dispatch_lock(consumer->proxy);
+        consumer->proxy->load_cb(std::max(load, consumer_load));
     }
     if (!repeat_counter) {
         // use now()
         timespec stamp;
         std::timespec_get(&stamp, TIME_UTC);
         for (auto &proxy : _event_proxies) {
-            static_cast<PcapInputEventProxy *>(proxy.get())->heartbeat_cb(stamp);
+            auto pcap_proxy = static_cast<PcapInputEventProxy *>(proxy.get());
+            auto dispatch = _dispatch_lock(pcap_proxy);
+            pcap_proxy->heartbeat_cb(stamp);
         }
         repeat_counter++;
     } else if (repeat_counter < HEARTBEAT_INTERVAL) {
@@ -303,168 +774,409 @@ void PcapInputStream::process_pcap_stats(const pcpp::IPcapDevice::PcapStats &sta
     }
 }
 
-void PcapInputStream::_generate_mock_traffic()
+void PcapInputStream::process_ring_stats(const RingStats &stats)
 {
-
-    PacketDirection dir = (std::rand() % 2 == 0) ? PacketDirection::toHost : PacketDirection::fromHost;
-
-    pcpp::MacAddress host_mac("00:50:43:11:22:33");
-    pcpp::IPv4Address host_ip("192.168.0.1");
-
-    pcpp::MacAddress other_mac("aa:bb:cc:dd:" + std::string('a' + std::rand() % 26, 2));
-    pcpp::IPv4Address other_ip("10.0.0." + std::to_string(std::rand() % 255));
-
-    // create a new Ethernet layer
-    pcpp::EthLayer *newEthernetLayer{nullptr};
-    if (dir == PacketDirection::toHost) {
-        newEthernetLayer = new pcpp::EthLayer(other_mac, host_mac);
-    } else {
-        newEthernetLayer = new pcpp::EthLayer(host_mac, other_mac);
-    }
-
-    // create a new IPv4 layer
-    pcpp::IPv4Layer *newIPLayer;
-    if (dir == PacketDirection::toHost) {
-        newIPLayer = new pcpp::IPv4Layer(other_ip, host_ip);
-    } else {
-        newIPLayer = new pcpp::IPv4Layer(host_ip, other_ip);
-    }
-    newIPLayer->getIPv4Header()->ipId = pcpp::hostToNet16(2000);
-    newIPLayer->getIPv4Header()->timeToLive = 64;
-
-    // create a new UDP layer
-    pcpp::UdpLayer *newUdpLayer;
-    if (dir == PacketDirection::toHost) {
-        newUdpLayer = new pcpp::UdpLayer(std::rand() % 65536, 53);
-    } else {
-        newUdpLayer = new pcpp::UdpLayer(53, std::rand() % 65536);
-    }
-
-    // create a new DNS layer
-    std::random_device rd;
-    std::mt19937 g(rd());
-    pcpp::DnsLayer *newDnsLayer = new pcpp::DnsLayer();
-    std::vector<pcpp::DnsType> types{pcpp::DNS_TYPE_A, pcpp::DNS_TYPE_AAAA, pcpp::DNS_TYPE_PTR, pcpp::DNS_TYPE_MX, pcpp::DNS_TYPE_TXT};
-    std::shuffle(types.begin(), types.end(), g);
-    newDnsLayer->addQuery(std::to_string(std::rand() % 20) + ".pktvisor-mock.dev", types[0], pcpp::DNS_CLASS_IN);
-    newDnsLayer->getDnsHeader()->transactionID = std::rand() % 65536; // note this does not work with our transaction tracking
-    if (dir == PacketDirection::fromHost) {
-        // mocking a server
-        newDnsLayer->getDnsHeader()->queryOrResponse = 1;
-        newDnsLayer->getDnsHeader()->responseCode = std::rand() % 6;
-    }
-
-    // create a packet with initial capacity of 100 bytes (will grow automatically if needed)
-    pcpp::Packet newPacket(100);
-
-    // add all the layers we created. newPacket takes ownership and frees them.
-    newPacket.addLayer(newEthernetLayer, true);
-    newPacket.addLayer(newIPLayer, true);
-    newPacket.addLayer(newUdpLayer, true);
-    newPacket.addLayer(newDnsLayer, true);
-    newPacket.computeCalculateFields();
-
-    pcpp::Packet packet(newPacket.getRawPacket());
-    pcpp::ProtocolType l3 = pcpp::IPv4;
-    pcpp::ProtocolType l4 = pcpp::UDP;
-    timespec ts;
-    timespec_get(&ts, TIME_UTC);
     std::shared_lock lock(_input_mutex);
     for (auto &proxy : _event_proxies) {
         auto pcap_proxy = static_cast<PcapInputEventProxy *>(proxy.get());
-        pcap_proxy->process_packet_cb(packet, dir, l3, l4, ts);
-        pcap_proxy->process_udp_packet_cb(packet, dir, l3, pcpp::hash5Tuple(&packet), ts);
+        if (pcap_proxy->shard().value_or(0)) {
+            continue;
+        }
+        auto dispatch = _dispatch_lock(pcap_proxy);
+        pcap_proxy->process_ring_stats(stats);
     }
 }
 
-void PcapInputStream::process_raw_packet(pcpp::RawPacket *rawPacket)
+void PcapInputStream::_generate_mock_traffic()
 {
-    [[maybe_unused]] static thread_local bool name_thread = [this]() {
-        thread::change_self_name(schema_key(), name());
-        return true;
-    }();
-    pcpp::ProtocolType l3(pcpp::UnknownProtocol), l4(pcpp::UnknownProtocol);
-    pcpp::Packet packet(rawPacket, pcpp::TCP | pcpp::UDP);
+    MockTrafficGenerator generator(_mock_config);
+    auto &worker = *_workers.front();
+    std::vector<pcpp::RawPacket> batch;
+
+    // paced per batch: small batches keep low rates smooth, full ones amortize the dispatch at high rates
+    auto rate = _mock_config.rate;
+    auto transactions = rate ? std::clamp<uint64_t>(rate / 1000, 1, MOCK_BATCH_TRANSACTIONS) : MOCK_BATCH_TRANSACTIONS;
+    uint64_t generated{0};
+    auto start = steady_clock::now();
+    while (_running) {
+        timespec now;
+        timespec_get(&now, TIME_UTC);
+        batch.clear();
+        generator.generate(batch, transactions, now);
+        process_raw_block(worker, batch);
+        generated += transactions;
+        if (rate) {
+            std::this_thread::sleep_until(start + duration_cast<nanoseconds>(duration<double>(static_cast<double>(generated) / static_cast<double>(rate))));
+        }
+    }
+}
+
+PacketBatchEntry PcapInputStream::_classify_packet(pcpp::Packet &packet, timespec stamp)
+{
+    PacketBatchEntry entry{&packet, PacketDirection::unknown, pcpp::UnknownProtocol, pcpp::UnknownProtocol, stamp};
     if (packet.isPacketOfType(pcpp::IPv4)) {
-        l3 = pcpp::IPv4;
+        entry.l3 = pcpp::IPv4;
     } else if (packet.isPacketOfType(pcpp::IPv6)) {
-        l3 = pcpp::IPv6;
+        entry.l3 = pcpp::IPv6;
     }
     if (packet.isPacketOfType(pcpp::UDP)) {
-        l4 = pcpp::UDP;
+        entry.l4 = pcpp::UDP;
     } else if (packet.isPacketOfType(pcpp::TCP)) {
-        l4 = pcpp::TCP;
+        entry.l4 = pcpp::TCP;
     }
     // determine packet direction by matching source/dest ips
-    // and cache it to be used on TCP Reassemble
     // note the direction may be indeterminate!
-    _packet_dir_cache = PacketDirection::unknown;
     auto IP4layer = packet.getLayerOfType<pcpp::IPv4Layer>();
     auto IP6layer = packet.getLayerOfType<pcpp::IPv6Layer>();
     if (IP4layer) {
         if (lib::utils::match_subnet(_hostIPv4, IP4layer->getDstIPv4Address().toInt()).has_value()) {
-            _packet_dir_cache = PacketDirection::toHost;
+            entry.dir = PacketDirection::toHost;
         } else if (lib::utils::match_subnet(_hostIPv4, IP4layer->getSrcIPv4Address().toInt()).has_value()) {
-            _packet_dir_cache = PacketDirection::fromHost;
+            entry.dir = PacketDirection::fromHost;
         }
     } else if (IP6layer) {
         if (lib::utils::match_subnet(_hostIPv6, IP6layer->getDstIPv6Address().toBytes()).has_value()) {
-            _packet_dir_cache = PacketDirection::toHost;
+            entry.dir = PacketDirection::toHost;
         } else if (lib::utils::match_subnet(_hostIPv6, IP6layer->getSrcIPv6Address().toBytes()).has_value()) {
-            _packet_dir_cache = PacketDirection::fromHost;
+            entry.dir = PacketDirection::fromHost;
         }
     }
+    return entry;
+}
+
+void PcapInputStream::process_raw_packet(PcapWorker &worker, pcpp::RawPacket *rawPacket)
+{
+    [[maybe_unused]] static thread_local bool name_thread = [this]() {
+        thread::change_self_name(schema_key(), name());
+        return true;
+    }();
+    if (_bpf_pending.load(std::memory_order_relaxed)) {
+        std::unique_lock lock(_bpf_mutex);
+        if (_bpf_pending && !(_pending_bpf.empty() ? _pcapDevice->clearFilter() : _pcapDevice->setFilter(_pending_bpf))) {
+            spdlog::get("visor")->error("pcap input [{}]: cannot set BPF filter '{}'", name(), _pending_bpf);
+        }
+        _bpf_pending = false;
+    }
+    if (worker.dedup) {
+        auto duplicate = _is_duplicate(worker, *rawPacket);
+        _report_duplicates(worker, rawPacket->getPacketTimeStamp());
+        if (duplicate) {
+            return;
+        }
+    }
+    if (_consumer_count.load(std::memory_order_relaxed)) {
+        std::shared_lock lock(_input_mutex);
+        if (_enqueue(*rawPacket)) {
+            return;
+        }
+    }
+    pcpp::Packet packet(rawPacket, pcpp::TCP | pcpp::UDP);
+    // the 5-tuple hash is symmetric, so both directions of a flow (and its transactions) stay in the same shard
+    if (_file_shards > 1 && !_file_shard_by_range && pcpp::hash5Tuple(&packet) % _file_shards != _file_shard_index) {
+        return;
+    }
+    auto entry = _classify_packet(packet, rawPacket->getPacketTimeStamp());
 
-    auto timestamp = rawPacket->getPacketTimeStamp();
     // interface to handlers
     std::shared_lock lock(_input_mutex);
-    for (auto &proxy : _event_proxies) {
-        static_cast<PcapInputEventProxy *>(proxy.get())->process_packet_cb(packet, _packet_dir_cache, l3, l4, timestamp);
+    std::optional<PacketContext::Scope> scope(std::in_place, &packet, 1);
+    auto flowkey = entry.l4 == pcpp::UDP ? PacketContext::of(packet).flowkey() : 0;
+    _for_each_inline_proxy(&worker, [&](PcapInputEventProxy *proxy) {
+        proxy->process_packet_cb(packet, entry.dir, entry.l3, entry.l4, entry.stamp);
+        if (entry.l4 == pcpp::UDP) {
+            proxy->process_udp_packet_cb(packet, entry.dir, entry.l3, flowkey, entry.stamp);
+        }
+    });
+
+    if (entry.l4 == pcpp::TCP) {
+        // reassembly is owned by this worker or a shard, only the handler callbacks it triggers need to be serialized
+        scope.reset();
+        lock.unlock();
+        _reassemble(worker, entry);
     }
+}
 
-    if (l4 == pcpp::UDP) {
-        for (auto &proxy : _event_proxies) {
-            static_cast<PcapInputEventProxy *>(proxy.get())->process_udp_packet_cb(packet, _packet_dir_cache, l3, pcpp::hash5Tuple(&packet), timestamp);
+void PcapInputStream::process_raw_block(PcapWorker &worker, std::vector<pcpp::RawPacket> &block)
+{
+    [[maybe_unused]] static thread_local bool name_thread = [this]() {
+        thread::change_self_name(schema_key(), name());
+        return true;
+    }();
+    auto *packets = &block;
+    if (worker.dedup && !block.empty()) {
+        // the block is only copied, as views without their data, from its first duplicate on
+        worker.dedup_block.clear();
+        bool found{false};
+        for (size_t i = 0; i < block.size(); ++i) {
+            if (_is_duplicate(worker, block[i])) {
+                if (!found) {
+                    found = true;
+                    for (size_t j = 0; j < i; ++j) {
+                        worker.dedup_block.emplace_back(block[j].getRawData(), block[j].getRawDataLen(), block[j].getPacketTimeStamp(), false, block[j].getLinkLayerType());
+                    }
+                }
+            } else if (found) {
+                worker.dedup_block.emplace_back(block[i].getRawData(), block[i].getRawDataLen(), block[i].getPacketTimeStamp(), false, block[i].getLinkLayerType());
+            }
         }
-    } else if (l4 == pcpp::TCP) {
-        lock.unlock();
-        auto result = _tcp_reassembly.reassemblePacket(packet);
-        lock.lock();
-        switch (result) {
-        case pcpp::TcpReassembly::Error_PacketDoesNotMatchFlow:
-        case pcpp::TcpReassembly::NonTcpPacket:
-        case pcpp::TcpReassembly::NonIpPacket:
-            for (auto &proxy : _event_proxies) {
-                static_cast<PcapInputEventProxy *>(proxy.get())->process_pcap_tcp_reassembly_error(packet, _packet_dir_cache, l3, timestamp);
+        _report_duplicates(worker, block.back().getPacketTimeStamp());
+        if (found) {
+            packets = &worker.dedup_block;
+        }
+    }
+    auto &rawPackets = *packets;
+    if (rawPackets.empty()) {
+        return;
+    }
+    if (_consumer_count.load(std::memory_order_relaxed)) {
+        std::shared_lock lock(_input_mutex);
+        bool all_queued{false};
+        for (const auto &rawPacket : rawPackets) {
+            all_queued = _enqueue(rawPacket);
+        }
+        if (all_queued) {
+            return;
+        }
+    }
+    // parse the whole block before taking any lock. reserving guarantees the entries can point into batch_packets
+    worker.batch_packets.clear();
+    worker.batch_entries.clear();
+    worker.batch_packets.reserve(rawPackets.size());
+    worker.batch_entries.reserve(rawPackets.size());
+    for (auto &rawPacket : rawPackets) {
+        auto &packet = worker.batch_packets.emplace_back(&rawPacket, pcpp::TCP | pcpp::UDP);
+        worker.batch_entries.push_back(_classify_packet(packet, rawPacket.getPacketTimeStamp()));
+    }
+    PacketBatch batch(worker.batch_entries.data(), worker.batch_entries.size());
+
+    // interface to handlers: one lock acquisition per proxy and one batch signal per block
+    std::shared_lock lock(_input_mutex);
+    std::optional<PacketContext::Scope> scope(std::in_place, worker.batch_packets.data(), worker.batch_packets.size());
+    _for_each_inline_proxy(&worker, [&batch](PcapInputEventProxy *proxy) {
+        proxy->process_packet_batch_cb(batch);
+        for (const auto &entry : batch) {
+            if (entry.l4 == pcpp::UDP) {
+                proxy->process_udp_packet_cb(*entry.packet, entry.dir, entry.l3, PacketContext::of(*entry.packet).flowkey(), entry.stamp);
             }
-        case pcpp::TcpReassembly::TcpMessageHandled:
-        case pcpp::TcpReassembly::OutOfOrderTcpMessageBuffered:
-        case pcpp::TcpReassembly::FIN_RSTWithNoData:
-        case pcpp::TcpReassembly::Ignore_PacketWithNoData:
-        case pcpp::TcpReassembly::Ignore_PacketOfClosedFlow:
-        case pcpp::TcpReassembly::Ignore_Retransimission:
-            break;
         }
+    });
+    scope.reset();
+    lock.unlock();
+
+    // reassembly triggers its own (locked) callbacks, so it runs after the block has been dispatched
+    for (const auto &entry : batch) {
+        if (entry.l4 == pcpp::TCP) {
+            _reassemble(worker, entry);
+        }
+    }
 
-        for (uint8_t counter = 0; counter < MAX_TCP_CLEANUPS; counter++) {
-            if (_lru_list->getSize() == 0) {
-                break;
+    // the raw packets point into the ring, which is handed back to the kernel after we return
+    worker.batch_entries.clear();
+    worker.batch_packets.clear();
+    worker.dedup_block.clear();
+}
+
+uint64_t PcapInputStream::_packet_digest(const pcpp::RawPacket &rawPacket)
+{
+    auto data = rawPacket.getRawData();
+    size_t len = static_cast<size_t>(std::max(rawPacket.getRawDataLen(), 0));
+    auto be16 = [data](size_t at) {
+        return static_cast<uint16_t>(data[at] << 8 | data[at + 1]);
+    };
+
+    // find the IP header, behind any VLAN tags
+    size_t ip{0};
+    switch (rawPacket.getLinkLayerType()) {
+    case pcpp::LINKTYPE_ETHERNET: {
+        size_t at{12};
+        while (at + 2 <= len && (be16(at) == 0x8100 || be16(at) == 0x88a8)) {
+            at += 4;
+        }
+        if (at + 2 > len || (be16(at) != 0x0800 && be16(at) != 0x86dd)) {
+            return 0;
+        }
+        ip = at + 2;
+        break;
+    }
+    case pcpp::LINKTYPE_LINUX_SLL:
+        if (len < 16 || (be16(14) != 0x0800 && be16(14) != 0x86dd)) {
+            return 0;
+        }
+        ip = 16;
+        break;
+    case pcpp::LINKTYPE_RAW:
+    case pcpp::LINKTYPE_DLT_RAW1:
+    case pcpp::LINKTYPE_DLT_RAW2:
+    case pcpp::LINKTYPE_IPV4:
+    case pcpp::LINKTYPE_IPV6:
+        break;
+    default:
+        return 0;
+    }
+    if (ip >= len) {
+        return 0;
+    }
+
+    // the header fields every copy has in common. TTL, hop limit and the checksum change with every router hop, and
+    // DSCP/traffic class may be remarked on the way, so a packet mirrored before and after a hop still matches
+    uint8_t fields[35];
+    size_t fields_len;
+    size_t header_len;
+    auto version = data[ip] >> 4;
+    if (version == 4 && ip + 20 <= len) {
+        header_len = (data[ip] & 0x0f) * 4u;
+        if (header_len < 20 || ip + header_len > len) {
+            return 0;
+        }
+        // total length, ID, flags and fragment offset, protocol, addresses
+        std::memcpy(fields, data + ip + 2, 6);
+        fields[6] = data[ip + 9];
+        std::memcpy(fields + 7, data + ip + 12, 8);
+        fields_len = 15;
+    } else if (version == 6 && ip + 40 <= len) {
+        header_len = 40;
+        // payload length, next header, addresses
+        std::memcpy(fields, data + ip + 4, 3);
+        std::memcpy(fields + 3, data + ip + 8, 32);
+        fields_len = 35;
+    } else {
+        return 0;
+    }
+
+    // the start of the payload holds the ports and, for TCP, the sequence numbers, which tell retransmissions apart
+    auto payload = ip + header_len;
+    auto digest = lib::utils::DedupFilter::hash(fields, fields_len);
+    return lib::utils::DedupFilter::hash(data + payload, std::min(len - payload, DEDUP_PAYLOAD_BYTES), digest);
+}
+
+bool PcapInputStream::_is_duplicate(PcapWorker &worker, const pcpp::RawPacket &rawPacket)
+{
+    // anything but IP is never suppressed
+    auto digest = _packet_digest(rawPacket);
+    if (!digest) {
+        return false;
+    }
+    auto stamp = rawPacket.getPacketTimeStamp();
+    auto stamp_ns = static_cast<uint64_t>(stamp.tv_sec) * 1'000'000'000 + static_cast<uint64_t>(stamp.tv_nsec);
+    if (!worker.dedup->seen(digest, stamp_ns)) {
+        return false;
+    }
+    ++worker.duplicates;
+    return true;
+}
+
+void PcapInputStream::_report_duplicates(PcapWorker &worker, timespec stamp, bool flush)
+{
+    if (!worker.duplicates || (!flush && stamp.tv_sec == worker.duplicates_reported)) {
+        return;
+    }
+    _for_each_proxy(worker, [&](PcapInputEventProxy *proxy) {
+        proxy->process_duplicates(worker.duplicates, stamp);
+    });
+    if (!worker.proxy) {
+        // queued proxies get the count through their queue, in order with their packets
+        std::shared_lock lock(_input_mutex);
+        for (auto &consumer : _consumers) {
+            if (!consumer->proxy) {
+                continue;
             }
-            auto connection = _lru_list->getLRUElement();
-            if (timestamp.tv_sec < connection.second.tv_sec + TCP_TIMEOUT) {
-                break;
+            auto count = worker.duplicates + consumer->unreported_duplicates.exchange(0, std::memory_order_relaxed);
+            auto pushed = consumer->queue.try_push([&](QueuedPacket &slot) {
+                slot.data.clear();
+                slot.stamp = stamp;
+                slot.duplicates = count;
+            });
+            if (!pushed) {
+                consumer->unreported_duplicates.fetch_add(count, std::memory_order_relaxed);
             }
-            _tcp_reassembly.closeConnection(connection.first);
-            _lru_list->eraseElement(connection.first);
         }
-        if (_lru_overflow.size() > 0) {
-            for (const auto &fKey : _lru_overflow) {
-                _tcp_reassembly.closeConnection(fKey);
-            }
-            _lru_overflow.clear();
+    }
+    worker.duplicates = 0;
+    worker.duplicates_reported = stamp.tv_sec;
+}
+
+bool PcapInputStream::_reassembly_wanted(PcapWorker &worker, const PacketBatchEntry &entry)
+{
+    auto generation = PcapInputEventProxy::tcp_ports_generation();
+    if (generation != worker.tcp_ports_generation) {
+        worker.tcp_ports = TcpPortSet();
+        _for_each_proxy(worker, [&worker](PcapInputEventProxy *proxy) {
+            proxy->collect_tcp_ports(worker.tcp_ports);
+        });
+        worker.tcp_ports_generation = generation;
+    }
+    auto tcpLayer = entry.packet->getLayerOfType<pcpp::TcpLayer>();
+    return !tcpLayer || worker.tcp_ports.wants(tcpLayer->getSrcPort(), tcpLayer->getDstPort());
+}
+
+void PcapInputStream::_reassemble(PcapWorker &worker, const PacketBatchEntry &entry)
+{
+    if (_tcp_shards.empty()) {
+        _process_tcp_packet(worker, entry);
+        return;
+    }
+    if (!_reassembly_wanted(worker, entry)) {
+        return;
+    }
+    // the 5-tuple hash is symmetric, so both directions of a flow land in the same shard
+    auto &shard = *_tcp_shards[pcpp::hash5Tuple(entry.packet) % _tcp_shards.size()];
+    auto rawPacket = entry.packet->getRawPacket();
+    auto pushed = shard.queue.try_push([&](QueuedPacket &slot) {
+        slot.data.assign(rawPacket->getRawData(), rawPacket->getRawData() + rawPacket->getRawDataLen());
+        slot.stamp = entry.stamp;
+        slot.link_type = rawPacket->getLinkLayerType();
+        slot.dir = entry.dir;
+        slot.l3 = entry.l3;
+    });
+    if (!pushed) {
+        shard.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void PcapInputStream::_process_tcp_packet(PcapWorker &worker, const PacketBatchEntry &entry)
+{
+    // flows no handler registered for were already delivered as plain packets, reassembling them would be wasted
+    if (!_reassembly_wanted(worker, entry)) {
+        return;
+    }
+    // cache direction to be used by the TCP reassembly callbacks
+    worker.packet_dir_cache = entry.dir;
+    auto timestamp = entry.stamp;
+    auto result = worker.tcp_reassembly.reassemblePacket(*entry.packet);
+    switch (result) {
+    case pcpp::TcpReassembly::Error_PacketDoesNotMatchFlow:
+    case pcpp::TcpReassembly::NonTcpPacket:
+    case pcpp::TcpReassembly::NonIpPacket:
+        _for_each_proxy(worker, [&](PcapInputEventProxy *proxy) {
+            proxy->process_pcap_tcp_reassembly_error(*entry.packet, entry.dir, entry.l3, timestamp);
+        });
+        [[fallthrough]];
+    case pcpp::TcpReassembly::TcpMessageHandled:
+    case pcpp::TcpReassembly::OutOfOrderTcpMessageBuffered:
+    case pcpp::TcpReassembly::FIN_RSTWithNoData:
+    case pcpp::TcpReassembly::Ignore_PacketWithNoData:
+    case pcpp::TcpReassembly::Ignore_PacketOfClosedFlow:
+    case pcpp::TcpReassembly::Ignore_Retransimission:
+        break;
+    }
+
+    // closing connections triggers tcp_connection_end, which takes the input lock itself
+    for (uint8_t counter = 0; counter < MAX_TCP_CLEANUPS; counter++) {
+        if (worker.lru_list->getSize() == 0) {
+            break;
         }
-    } else {
-        // unsupported layer3 protocol
+        auto connection = worker.lru_list->getLRUElement();
+        if (timestamp.tv_sec < connection.second.tv_sec + TCP_TIMEOUT) {
+            break;
+        }
+        worker.tcp_reassembly.closeConnection(connection.first);
+        worker.lru_list->eraseElement(connection.first);
+    }
+    if (worker.lru_overflow.size() > 0) {
+        for (const auto &fKey : worker.lru_overflow) {
+            worker.tcp_reassembly.closeConnection(fKey);
+        }
+        worker.lru_overflow.clear();
     }
 }
 
@@ -472,31 +1184,48 @@ void PcapInputStream::_open_pcap(const std::string &fileName, const std::string
 {
     assert(_pcapFile);
 
-    // open input file (pcap or pcapng file)
-    // NOTE, we are the owner and must free this
-    auto reader = pcpp::IFileReaderDevice::getReader(fileName.c_str());
-
-    // try to open the file device
-    if (!reader->open()) {
-        throw PcapException("Cannot open pcap/pcapng file");
+    if (_file_shards > 1 && _file_shard_by_range) {
+        // a TCP session or DNS transaction crossing into the next range would be split between two shards
+        std::shared_lock lock(_input_mutex);
+        auto tcp = std::any_of(_event_proxies.begin(), _event_proxies.end(), [](const auto &proxy) {
+            return static_cast<PcapInputEventProxy *>(proxy.get())->reassembles_tcp();
+        });
+        if (tcp) {
+            spdlog::get("visor")->warn("pcap input [{}]: handlers reassemble TCP, sharding {} by flow instead of range", name(), fileName);
+            _file_shard_by_range = false;
+        }
     }
 
-    // set BPF filter if set by the user
-    if (bpfFilter != "") {
-        if (!reader->setFilter(bpfFilter))
-            throw PcapException("Cannot set BPF filter to pcap file");
+    // open input file (pcap or pcapng file). packets are views into the mapped file, nothing is copied
+    lib::utils::MmapPcapReader reader(fileName);
+    try {
+        reader.open();
+        // set BPF filter if set by the user, it is applied in userspace on the mapped packets
+        if (bpfFilter != "") {
+            reader.set_filter(bpfFilter);
+        }
+        // a range shard skips straight to its own slice of the file instead of reading all of it
+        if (_file_shards > 1 && _file_shard_by_range) {
+            auto size = reader.file_size();
+            reader.set_range(size * _file_shard_index / _file_shards, size * (_file_shard_index + 1) / _file_shards);
+        }
+    } catch (const lib::utils::UtilsException &e) {
+        throw PcapException(fmt::format("Cannot open pcap/pcapng file: {}", e.what()));
     }
 
-    pcpp::RawPacket rawPacket;
-    timespec end_tstamp;
+    timespec end_tstamp{};
 
     // setup initial timestamp from first packet to initiate bucketing
-    if (reader->getNextPacket(rawPacket)) {
+    auto &worker = *_workers.front();
+    auto rawPacket = reader.next_packet();
+    if (rawPacket) {
+        end_tstamp = rawPacket->getPacketTimeStamp();
         std::shared_lock lock(_input_mutex);
         for (auto &proxy : _event_proxies) {
-            static_cast<PcapInputEventProxy *>(proxy.get())->start_tstamp_cb(rawPacket.getPacketTimeStamp());
+            static_cast<PcapInputEventProxy *>(proxy.get())->start_tstamp_cb(rawPacket->getPacketTimeStamp());
         }
-        process_raw_packet(&rawPacket);
+        lock.unlock();
+        process_raw_packet(worker, rawPacket);
     }
 
     int packetCount = 1, lastCount = 0;
@@ -505,11 +1234,24 @@ void PcapInputStream::_open_pcap(const std::string &fileName, const std::string
         std::cerr << "processed " << packetCount << " packets (" << lastCount << "/s)\n";
         lastCount = 0;
     });
-    while (_running && reader->getNextPacket(rawPacket)) {
-        process_raw_packet(&rawPacket);
+    auto first_tstamp = end_tstamp;
+    auto replay_start = steady_clock::now();
+    while (_running && (rawPacket = reader.next_packet())) {
+        if (_file_speed) {
+            // hold each packet back until its recorded offset from the first packet, scaled by the speed, has passed
+            auto stamp = rawPacket->getPacketTimeStamp();
+            auto offset = seconds(stamp.tv_sec - first_tstamp.tv_sec) + nanoseconds(stamp.tv_nsec - first_tstamp.tv_nsec);
+            if (offset.count() > 0) {
+                std::this_thread::sleep_until(replay_start + offset / _file_speed);
+            }
+        }
+        process_raw_packet(worker, rawPacket);
         packetCount++;
         lastCount++;
-        end_tstamp = rawPacket.getPacketTimeStamp();
+        end_tstamp = rawPacket->getPacketTimeStamp();
+    }
+    if (worker.dedup) {
+        _report_duplicates(worker, end_tstamp, true);
     }
     std::shared_lock lock(_input_mutex);
     for (auto &proxy : _event_proxies) {
@@ -518,20 +1260,92 @@ void PcapInputStream::_open_pcap(const std::string &fileName, const std::string
     t0->cancel();
     std::cerr << "processed " << packetCount << " packets\n";
 
+    lock.unlock();
     // after all packets have been read - close the connections which are still opened
-    _tcp_reassembly.closeAllConnections();
+    worker.tcp_reassembly.closeAllConnections();
 
-    // close the reader and free its memory
-    reader->close();
-    delete reader;
+    reader.close();
 }
 
 #ifdef __linux__
 void PcapInputStream::_open_af_packet_iface(const std::string &iface, const std::string &bpfFilter)
 {
+    // inputs on the same interface with the same settings share one ring, worker i of each is fed by its socket i
+    _af_ring = SharedAFPacket::open(iface, _workers.size(), _af_fanout_types.at(_af_fanout_type), _af_timestamps.at(_af_timestamp), _numa_node);
+    std::vector<void *> cookies;
+    for (auto &worker : _workers) {
+        cookies.push_back(worker.get());
+    }
+    try {
+        _af_ring->subscribe(this, std::move(cookies), _block_arrives_cb, bpfFilter);
+    } catch (const PcapException &) {
+        _af_ring.reset();
+        throw;
+    }
+}
+
+void PcapInputStream::_poll_af_packet_stats(const std::string &iface)
+{
+    thread::change_self_name(schema_key(), name());
+
+    // libpcap counts interface drops the same way, from the rx_dropped counter of the interface
+    auto read_if_drops = [path = "/sys/class/net/" + iface + "/statistics/rx_dropped"]() {
+        uint64_t drops{0};
+        std::ifstream file(path);
+        file >> drops;
+        return drops;
+    };
+
+    // reported once a second, like the libpcap stats callback, which also drives the heartbeat
+    auto next = steady_clock::now();
+    while (_running) {
+        next += 1s;
+        while (_running && steady_clock::now() < next) {
+            std::this_thread::sleep_for(100ms);
+        }
+        if (!_running) {
+            break;
+        }
+
+        pcpp::IPcapDevice::PcapStats stats{};
+        RingStats ring;
+        // packets are the ones that passed this input's bpf, drops those of the ring it shares
+        auto af_stats = _af_ring->stats(this);
+        stats.packetsRecv = af_stats.packets;
+        stats.packetsDrop = af_stats.drops;
+        auto freezes = af_stats.freeze_q_cnt;
+        ring.fill_pct = std::move(af_stats.fill_pct);
+        ring.retire_latency_us = std::move(af_stats.retire_latency_us);
+        if (iface != "any") {
+            stats.packetsDropByInterface = read_if_drops();
+        }
+        ring.freezes = freezes - _af_last_freezes;
+        _af_last_freezes = freezes;
+
+        // the fullest the ring got since the last report
+        uint64_t backlog_pct{0};
+        if (!ring.fill_pct.empty()) {
+            backlog_pct = *std::max_element(ring.fill_pct.begin(), ring.fill_pct.end());
+        }
+
+        process_pcap_stats(stats, static_cast<uint32_t>(backlog_pct));
+        process_ring_stats(ring);
+    }
+}
 
-    _af_device = std::make_unique<AFPacket>(this, _packet_arrives_cb, bpfFilter, iface);
-    _af_device->start_capture();
+void PcapInputStream::_open_af_xdp_iface(const std::string &iface, const std::string &bpfFilter)
+{
+    // one program per interface, one socket per queue; queue i is served by worker i
+    // the sockets populate their UMEM and rings as they are created, on the node of the NIC with numa_node
+    numa::PreferNodeScope prefer(_numa_node);
+    _xdp_devices.clear();
+    _xdp_program = std::make_shared<XDPProgram>(iface, _xdp_modes.at(_xdp_mode), _xdp_ip_only, static_cast<uint32_t>(_workers.size()));
+    for (size_t i = 0; i < _workers.size(); ++i) {
+        _xdp_devices.push_back(std::make_unique<AFXDP>(_workers[i].get(), _block_arrives_cb, bpfFilter, _xdp_program, static_cast<uint32_t>(i)));
+    }
+    for (auto &xdp_device : _xdp_devices) {
+        xdp_device->start_capture();
+    }
 }
 #endif
 
@@ -569,7 +1383,7 @@ void PcapInputStream::_open_libpcap_iface(const std::string &bpfFilter)
     }
 
     // start capturing packets with stats info
-    if (!_pcapDevice->startCapture(_packet_arrives_cb, this, 1, _pcap_stats_update, this)) {
+    if (!_pcapDevice->startCapture(_packet_arrives_cb, _workers.front().get(), 1, _pcap_stats_update, this)) {
         throw PcapException("Packet capture failed to start");
     }
 }
@@ -635,17 +1449,231 @@ void PcapInputStream::info_json(json &j) const
         break;
     case PcapSource::af_packet:
         info["pcap_source"] = "af_packet";
+#ifdef __linux__
+        info["af_packet"]["workers"] = _workers.size();
+        info["af_packet"]["fanout_type"] = _af_fanout_type;
+        info["af_packet"]["timestamp"] = _af_timestamp;
+        info["af_packet"]["ring_blocks"] = _af_ring ? _af_ring->ring_blocks() : 0;
+        info["af_packet"]["ring_subscribers"] = _af_ring ? _af_ring->subscriber_count() : 0;
+#endif
+        break;
+    case PcapSource::af_xdp:
+        info["pcap_source"] = "af_xdp";
+#ifdef __linux__
+        info["af_xdp"]["queues"] = _workers.size();
+        info["af_xdp"]["mode"] = _xdp_mode;
+        info["af_xdp"]["ip_only"] = _xdp_ip_only;
+        info["af_xdp"]["zero_copy"] = !_xdp_devices.empty() && _xdp_devices.front()->is_zero_copy();
+#endif
         break;
     case PcapSource::mock:
         info["pcap_source"] = "mock";
+        info["mock"]["rate"] = _mock_config.rate;
+        info["mock"]["qnames"] = _mock_config.qnames;
+        info["mock"]["clients"] = _mock_config.clients;
+        info["mock"]["tcp_pct"] = _mock_config.tcp_pct;
         break;
     }
+    if (auto numa_node = _numa_node.load(); numa_node >= 0) {
+        info["numa"]["node"] = numa_node;
+        info["numa"]["cpus"] = numa::node_cpus(numa_node);
+    }
+    if (_dedup_window_ms) {
+        info["dedup"]["window_ms"] = _dedup_window_ms;
+        info["dedup"]["max_entries"] = _dedup_max_entries;
+    }
+    if (_running && _bpf_pushdown_supported()) {
+        std::unique_lock lock(_bpf_mutex);
+        info["bpf_pushdown"] = _bpf_pushdown;
+        info["bpf_applied"] = _applied_bpf;
+    }
+    for (const auto &shard : _tcp_shards) {
+        json queue;
+        queue["size"] = shard->queue.capacity();
+        queue["depth"] = shard->queue.size();
+        queue["dropped"] = shard->dropped.load(std::memory_order_relaxed);
+        info["tcp_reassembly_shards"].push_back(queue);
+    }
+    {
+        std::shared_lock lock(_input_mutex);
+        for (const auto &consumer : _consumers) {
+            json queue;
+            queue["filter_hash"] = consumer->proxy->hash();
+            if (consumer->proxy->thread_config()) {
+                consumer->proxy->thread_config()->info_json(queue);
+            }
+            queue["size"] = consumer->queue.capacity();
+            queue["depth"] = consumer->queue.size();
+            queue["dropped"] = consumer->dropped.load(std::memory_order_relaxed);
+            queue["lag_us"] = consumer->lag_us.load(std::memory_order_relaxed);
+            info["handler_queues"].push_back(queue);
+        }
+    }
     j[schema_key()] = info;
 }
 
 std::unique_ptr<InputEventProxy> PcapInputStream::create_event_proxy(const Configurable &filter)
 {
-    return std::make_unique<PcapInputEventProxy>(_name, filter);
+    auto proxy = std::make_unique<PcapInputEventProxy>(_name, filter);
+    // handlers attaching, leaving or registering what they consume change the capture filter right away
+    proxy->on_bpf_change([this] { _update_capture_bpf(); });
+    return proxy;
+}
+
+void PcapInputStream::event_proxy_added(InputEventProxy *proxy)
+{
+    if (_handler_queue_size || proxy->thread_config()) {
+        _start_consumer(static_cast<PcapInputEventProxy *>(proxy));
+    }
+}
+
+void PcapInputStream::event_proxy_removed(InputEventProxy *proxy)
+{
+    auto it = std::find_if(_consumers.begin(), _consumers.end(), [proxy](const auto &c) { return c->proxy == proxy; });
+    if (it == _consumers.end()) {
+        return;
+    }
+    // capture threads wait for _input_mutex, which we hold, so nothing more is queued for it
+    std::vector<std::unique_ptr<PcapConsumer>> consumer;
+    consumer.push_back(std::move(*it));
+    _consumers.erase(it);
+    _consumer_count = _consumers.size();
+    _join_consumers(consumer);
+}
+
+void PcapInputStream::_start_consumer(PcapInputEventProxy *proxy)
+{
+    // a policy's own queue size wins over the input's
+    auto queue_size = proxy->thread_config() ? proxy->thread_config()->queue_size : _handler_queue_size;
+    auto consumer = std::make_unique<PcapConsumer>(proxy, queue_size);
+    consumer->worker = std::make_unique<PcapWorker>(this, _consumers.size(), _lru_list_size);
+    consumer->worker->proxy = proxy;
+    consumer->thread = std::make_unique<std::thread>([this, c = consumer.get()] {
+        _consume(*c);
+    });
+    proxy->queued = true;
+    _consumers.push_back(std::move(consumer));
+    _consumer_count = _consumers.size();
+}
+
+void PcapInputStream::_join_consumers(std::vector<std::unique_ptr<PcapConsumer>> &consumers)
+{
+    // capture has stopped by now, so each consumer drains what is left in its queue and exits
+    for (auto &consumer : consumers) {
+        consumer->running.store(false, std::memory_order_release);
+    }
+    for (auto &consumer : consumers) {
+        consumer->thread->join();
+    }
+    consumers.clear();
+}
+
+void PcapInputStream::_stop_consumers()
+{
+    std::vector<std::unique_ptr<PcapConsumer>> consumers;
+    {
+        std::unique_lock lock(_input_mutex);
+        consumers.swap(_consumers);
+        _consumer_count = 0;
+        _handler_queue_size = 0;
+        for (auto &consumer : consumers) {
+            consumer->proxy->queued = false;
+        }
+    }
+    _join_consumers(consumers);
+}
+
+void PcapInputStream::_stop_tcp_shards()
+{
+    _join_consumers(_tcp_shards);
+}
+
+bool PcapInputStream::_enqueue(const pcpp::RawPacket &rawPacket)
+{
+    // CRITICAL EVENT PATH: the capture thread only copies the frame, everything else is up to the consumers
+    auto data = rawPacket.getRawData();
+    auto len = static_cast<size_t>(rawPacket.getRawDataLen());
+    for (auto &consumer : _consumers) {
+        auto pushed = consumer->queue.try_push([&](QueuedPacket &slot) {
+            slot.data.assign(data, data + len);
+            slot.stamp = rawPacket.getPacketTimeStamp();
+            slot.link_type = rawPacket.getLinkLayerType();
+            slot.duplicates = 0;
+        });
+        if (!pushed) {
+            consumer->dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    // if every proxy has a consumer, there is nothing left to deliver on the capture thread
+    return _consumers.size() == _event_proxies.size();
+}
+
+void PcapInputStream::_consume(PcapConsumer &consumer)
+{
+    thread::change_self_name(schema_key(), name());
+    if (consumer.proxy && consumer.proxy->thread_config() && !consumer.proxy->thread_config()->cpus.empty()) {
+        // the policy's own cpu_affinity wins over the node of the input
+        if (!thread::pin_self(consumer.proxy->thread_config()->cpus)) {
+            spdlog::get("visor")->warn("policy [{}]: unable to pin handler thread of input {} to cpu_affinity", consumer.proxy->thread_config()->name, name());
+        }
+    } else if (auto numa_node = _numa_node.load(); numa_node >= 0) {
+        // handler state (buckets, sketches) is first touched here, and so allocated on the node as well
+        if (!thread::pin_self(numa::node_cpus(numa_node)) || !numa::prefer_node(numa_node)) {
+            spdlog::get("visor")->warn("{}: unable to place handler thread on numa_node {}", name(), numa_node);
+        }
+    }
+
+    // the consumer is the only thread delivering to its proxy, so nothing here needs the dispatch lock. shards deliver
+    // to every proxy, which takes it
+    auto &worker = *consumer.worker;
+    uint64_t count{0};
+    auto deliver = [this, &consumer, &worker, &count](QueuedPacket &slot) {
+        if (++count % PcapConsumer::LAG_SAMPLE == 0) {
+            // capture time stamps are wall clock, and so is the lag
+            timespec now;
+            std::timespec_get(&now, TIME_UTC);
+            auto lag_us = (now.tv_sec - slot.stamp.tv_sec) * 1'000'000 + (now.tv_nsec - slot.stamp.tv_nsec) / 1000;
+            consumer.lag_us.store(lag_us > 0 ? static_cast<uint64_t>(lag_us) : 0, std::memory_order_relaxed);
+        }
+        if (slot.duplicates) {
+            consumer.proxy->process_duplicates(slot.duplicates, slot.stamp);
+            return;
+        }
+        pcpp::RawPacket rawPacket(slot.data.data(), static_cast<int>(slot.data.size()), slot.stamp, false, slot.link_type);
+        if (!consumer.proxy) {
+            pcpp::Packet packet(&rawPacket, pcpp::TCP);
+            _process_tcp_packet(worker, {&packet, slot.dir, slot.l3, pcpp::TCP, slot.stamp});
+            return;
+        }
+        pcpp::Packet packet(&rawPacket, pcpp::TCP | pcpp::UDP);
+        auto entry = _classify_packet(packet, slot.stamp);
+        {
+            PacketContext::Scope scope(&packet, 1);
+            consumer.proxy->process_packet_cb(packet, entry.dir, entry.l3, entry.l4, entry.stamp);
+            if (entry.l4 == pcpp::UDP) {
+                consumer.proxy->process_udp_packet_cb(packet, entry.dir, entry.l3, PacketContext::of(packet).flowkey(), entry.stamp);
+            }
+        }
+        if (entry.l4 == pcpp::TCP) {
+            _process_tcp_packet(worker, entry);
+        }
+    };
+
+    while (true) {
+        // read before draining, so everything queued before stop() is still delivered
+        auto running = consumer.running.load(std::memory_order_acquire);
+        size_t delivered{0};
+        while (consumer.queue.try_pop(deliver)) {
+            ++delivered;
+        }
+        if (!running) {
+            break;
+        }
+        if (!delivered) {
+            std::this_thread::sleep_for(CONSUMER_IDLE_WAIT);
+        }
+    }
+    worker.tcp_reassembly.closeAllConnections();
 }
 
 void PcapInputStream::parse_host_spec()
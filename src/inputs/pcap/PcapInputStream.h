@@ -25,15 +25,30 @@
 #ifdef __GNUC__
 #pragma GCC diagnostic pop
 #endif
+#include "Numa.h"
+#include "PacketContext.h"
 #include "PcapException.h"
 #include "VisorLRUList.h"
+#include "dedup_filter.h"
+#include "mocktraffic.h"
+#include "ring_queue.h"
 #include "utils.h"
+#include <atomic>
+#include <bitset>
+#include <chrono>
 #include <functional>
+#include <limits>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 #ifdef __linux__
 #include "afpacket.h"
+#include "afxdp.h"
 #endif
 
 namespace visor::input::pcap {
@@ -42,6 +57,7 @@ enum class PcapSource {
     unknown,
     libpcap,
     af_packet,
+    af_xdp,
     mock
 };
 
@@ -51,6 +67,15 @@ enum class PacketDirection {
     unknown
 };
 
+// ring buffer state of capture sources that have one (af_packet), reported about once a second
+struct RingStats {
+    // times the ring was full and the kernel froze the queue, since the previous report
+    uint64_t freezes{0};
+    // samples since the previous report, see AFPacketStats
+    std::vector<uint64_t> fill_pct;
+    std::vector<uint64_t> retire_latency_us;
+};
+
 class TcpSessionData
 {
 public:
@@ -77,6 +102,183 @@ public:
     virtual void receive_tcp_data(const uint8_t *data, size_t len) = 0;
 };
 
+// a packet delivered as part of a batch, with the metadata the input derived for it
+struct PacketBatchEntry {
+    pcpp::Packet *packet;
+    PacketDirection dir;
+    pcpp::ProtocolType l3;
+    pcpp::ProtocolType l4;
+    timespec stamp;
+};
+
+// view over packets delivered together, e.g. all frames of one retired TPACKET_V3 block.
+// neither the view nor the packets it points to may be kept after the signal returns
+class PacketBatch
+{
+    const PacketBatchEntry *_entries;
+    size_t _size;
+
+public:
+    PacketBatch(const PacketBatchEntry *entries, size_t size)
+        : _entries(entries)
+        , _size(size)
+    {
+    }
+
+    const PacketBatchEntry *begin() const
+    {
+        return _entries;
+    }
+
+    const PacketBatchEntry *end() const
+    {
+        return _entries + _size;
+    }
+
+    size_t size() const
+    {
+        return _size;
+    }
+
+    const PacketBatchEntry &back() const
+    {
+        return _entries[_size - 1];
+    }
+};
+
+// an inclusive range of TCP ports, or a single port
+struct TcpPortRange {
+    uint16_t first;
+    uint16_t last;
+
+    TcpPortRange(uint16_t port)
+        : first(port)
+        , last(port)
+    {
+    }
+    TcpPortRange(uint16_t first, uint16_t last)
+        : first(first)
+        , last(last)
+    {
+    }
+};
+typedef std::vector<TcpPortRange> TcpPortRanges;
+
+// the TCP ports handlers need reassembled, compiled from what they registered on event proxies. a flow is reassembled
+// when either of its ports is in the set
+class TcpPortSet
+{
+    bool _all{false};
+    std::bitset<65536> _ports;
+
+public:
+    void add(const TcpPortRanges &ranges)
+    {
+        for (const auto &range : ranges) {
+            for (uint32_t port = range.first; port <= range.last; ++port) {
+                _ports.set(port);
+            }
+        }
+    }
+
+    // for handlers that can only tell a port when they see it: every port is tried once. a null predicate stands for
+    // every port
+    void add(const std::function<bool(uint16_t)> &predicate)
+    {
+        if (!predicate) {
+            _all = true;
+            return;
+        }
+        for (uint32_t port = 0; port < 65536; ++port) {
+            if (predicate(static_cast<uint16_t>(port))) {
+                _ports.set(port);
+            }
+        }
+    }
+
+    void add(const TcpPortSet &other)
+    {
+        _all = _all || other._all;
+        _ports |= other._ports;
+    }
+
+    bool wants(uint16_t src_port, uint16_t dst_port) const
+    {
+        return _all || _ports.test(src_port) || _ports.test(dst_port);
+    }
+};
+
+class PcapInputStream;
+class PcapInputEventProxy;
+
+// state owned by a single capture thread. TCP reassembly and its LRU bookkeeping are not thread safe, so each
+// AF_PACKET fanout worker gets its own instance, while libpcap, file and mock sources use exactly one.
+struct PcapWorker {
+    PcapInputStream *stream;
+    size_t id;
+    std::unique_ptr<LRUList<uint32_t, timeval>> lru_list;
+    std::pair<uint32_t, timeval> deleted_data;
+    std::vector<uint32_t> lru_overflow;
+    PacketDirection packet_dir_cache{PacketDirection::unknown};
+    pcpp::TcpReassembly tcp_reassembly;
+    // parsed packets of the block currently being delivered, reused to avoid allocations
+    std::vector<pcpp::Packet> batch_packets;
+    std::vector<PacketBatchEntry> batch_entries;
+    // set for the worker of a PcapConsumer: its reassembly callbacks go to this proxy only, instead of to all
+    PcapInputEventProxy *proxy{nullptr};
+    // ports to reassemble, recompiled whenever the registrations change
+    TcpPortSet tcp_ports;
+    uint64_t tcp_ports_generation{std::numeric_limits<uint64_t>::max()};
+    // with dedup_window_ms, copies of packets this worker saw within the window are dropped before parsing. a block
+    // with duplicates is delivered from dedup_block, views of the packets that remain
+    std::unique_ptr<lib::utils::DedupFilter> dedup;
+    std::vector<pcpp::RawPacket> dedup_block;
+    // suppressed since the last report, reported at most once per second of packet time
+    uint64_t duplicates{0};
+    time_t duplicates_reported{0};
+
+    PcapWorker(PcapInputStream *stream, size_t id, size_t lru_size);
+};
+
+// copy of a captured frame waiting in a handler queue or reassembly shard
+struct QueuedPacket {
+    std::vector<uint8_t> data;
+    timespec stamp;
+    pcpp::LinkLayerType link_type;
+    // only set for reassembly shards, which get packets the capture thread classified already
+    PacketDirection dir{PacketDirection::unknown};
+    pcpp::ProtocolType l3{pcpp::UnknownProtocol};
+    // a slot with this set carries no packet, only the copies dropped by dedup_window_ms since the last report
+    uint64_t duplicates{0};
+};
+
+// the handlers behind one event proxy, decoupled from capture, see handler_queue_size. capture threads copy each
+// frame into the queue, or count it as dropped when the queue is full, and the consumer thread parses, reassembles
+// and delivers it. a slow policy then loses its own packets instead of holding up capture for every policy.
+// without a proxy, the consumer is a TCP reassembly shard instead, see tcp_reassembly_threads: it only reassembles,
+// and delivers the results to every proxy
+struct PcapConsumer {
+    PcapInputEventProxy *proxy;
+    lib::utils::RingQueue<QueuedPacket> queue;
+    std::unique_ptr<PcapWorker> worker;
+    std::atomic<uint64_t> dropped{0};
+    // drops at the previous stats report, only touched by the stats thread
+    uint64_t last_dropped{0};
+    // age of a recently delivered packet, sampled every LAG_SAMPLE packets
+    static constexpr uint64_t LAG_SAMPLE = 64;
+    std::atomic<uint64_t> lag_us{0};
+    // duplicates that did not fit in the queue, reported with the next ones
+    std::atomic<uint64_t> unreported_duplicates{0};
+    std::atomic_bool running{true};
+    std::unique_ptr<std::thread> thread;
+
+    PcapConsumer(PcapInputEventProxy *proxy, size_t queue_size)
+        : proxy(proxy)
+        , queue(queue_size)
+    {
+    }
+};
+
 struct TcpFlowData {
 
     std::unique_ptr<TcpSessionData> sessionData[2];
@@ -99,39 +301,139 @@ private:
     static constexpr size_t DEFAULT_LRULIST_SIZE = TCP_TIMEOUT * 10000;
 
     static const PcapSource DefaultPcapSource = PcapSource::libpcap;
-    std::unique_ptr<LRUList<uint32_t, timeval>> _lru_list;
-    std::pair<uint32_t, timeval> _deleted_data;
-    std::vector<uint32_t> _lru_overflow;
+    size_t _lru_list_size{DEFAULT_LRULIST_SIZE};
     lib::utils::IPv4subnetList _hostIPv4;
     lib::utils::IPv6subnetList _hostIPv6;
-    PacketDirection _packet_dir_cache{PacketDirection::unknown};
+
+    // one per capture thread, see PcapWorker
+    std::vector<std::unique_ptr<PcapWorker>> _workers;
+
+    // with handler_queue_size, every event proxy is fed by its own PcapConsumer, otherwise only those of policies with
+    // a handler thread. guarded by _input_mutex, _consumer_count lets capture threads skip the lock when there are none
+    static constexpr uint64_t MAX_HANDLER_QUEUE_SIZE = 1 << 20;
+    static constexpr auto CONSUMER_IDLE_WAIT = std::chrono::microseconds(100);
+    uint64_t _handler_queue_size{0};
+    std::vector<std::unique_ptr<PcapConsumer>> _consumers;
+    std::atomic<size_t> _consumer_count{0};
+
+    // with tcp_reassembly_threads, TCP flows are reassembled by these shards, picked by flow hash, instead of on the
+    // capture threads. only changed while capture is stopped
+    static constexpr uint64_t MAX_TCP_REASSEMBLY_THREADS = 64;
+    static constexpr size_t TCP_SHARD_QUEUE_SIZE = 1 << 16;
+    std::vector<std::unique_ptr<PcapConsumer>> _tcp_shards;
 
     PcapSource _cur_pcap_source{PcapSource::unknown};
 
     // libpcap source
     std::unique_ptr<pcpp::PcapLiveDevice> _pcapDevice;
     bool _pcapFile = false;
+    // pcap_file source may be split between several streams. by flow, each reads the whole file and keeps the flows
+    // hashed to it. by range, each reads one byte range of the file only
+    uint64_t _file_shards{1};
+    uint64_t _file_shard_index{0};
+    bool _file_shard_by_range{false};
+    // replay pcap_file at this multiple of its recorded speed, 0 reads as fast as possible
+    uint64_t _file_speed{0};
 
     uint8_t repeat_counter = 0;
 
-    // mock source
+    // mock source, generates batches of this many transactions at a time
+    static constexpr uint64_t MOCK_BATCH_TRANSACTIONS = 64;
     std::unique_ptr<std::thread> _mock_generator_thread;
+    MockTrafficConfig _mock_config;
+
+    // drops at the previous stats report, any new ones mean the input is at full load
+    uint64_t _last_drops{0};
+    bool _have_last_drops{false};
+
+    // with bpf_pushdown, live captures narrow their filter to what the attached handlers consume, see
+    // PcapInputEventProxy::register_bpf. recomputed whenever handlers come or go. libpcap only takes a new filter on
+    // its capture thread, which picks it up from _pending_bpf
+    bool _bpf_pushdown{false};
+    mutable std::mutex _bpf_mutex;
+    std::string _applied_bpf;
+    std::string _pending_bpf;
+    std::atomic_bool _bpf_pending{false};
+
+    // with dedup_window_ms, every capture worker drops the copies of a packet it sees again within the window, see
+    // PcapWorker::dedup
+    static constexpr uint64_t MAX_DEDUP_WINDOW_MS = 10000;
+    static constexpr uint64_t DEFAULT_DEDUP_MAX_ENTRIES = 1 << 20;
+    static constexpr uint64_t MAX_DEDUP_MAX_ENTRIES = 1 << 26;
+    // how much of the IP payload goes into the digest of a packet
+    static constexpr size_t DEDUP_PAYLOAD_BYTES = 128;
+    uint64_t _dedup_window_ms{0};
+    uint64_t _dedup_max_entries{DEFAULT_DEDUP_MAX_ENTRIES};
+
+    // with numa_node, the capture ring and threads and the handler queue threads are kept on the NUMA node of the
+    // NIC (or the one given), so packets and handler state do not cross sockets. -1 leaves placement to the kernel.
+    // atomic as consumer threads read it when they start, which may be while start() sets it
+    static constexpr uint64_t MAX_NUMA_NODE = numa::MAX_NODE;
+    std::atomic<int> _numa_node{-1};
 
 #ifdef __linux__
-    // af_packet source
-    std::unique_ptr<AFPacket> _af_device;
+    // af_packet source, one socket per worker, all joined to the same fanout group when there is more than one. the
+    // sockets are shared with the other inputs capturing from the same interface with the same settings
+    static constexpr uint64_t MAX_AF_PACKET_WORKERS = 64;
+    std::shared_ptr<SharedAFPacket> _af_ring;
+    std::string _af_fanout_type{"hash"};
+    static const inline std::map<std::string, int> _af_fanout_types = {
+        {"hash", PACKET_FANOUT_HASH},
+        {"cpu", PACKET_FANOUT_CPU},
+        {"lb", PACKET_FANOUT_LB}};
+    std::string _af_timestamp{"ring"};
+    static const inline std::map<std::string, AFPacketTimestamp> _af_timestamps = {
+        {"ring", AFPacketTimestamp::ring},
+        {"software", AFPacketTimestamp::software},
+        {"hardware", AFPacketTimestamp::hardware}};
+    // polls the socket and interface counters, see _poll_af_packet_stats()
+    std::unique_ptr<std::thread> _af_stats_thread;
+    uint64_t _af_last_freezes{0};
+
+    // af_xdp source, one socket and worker per NIC queue, all fed by the same XDP program
+    static constexpr uint64_t MAX_AF_XDP_QUEUES = 64;
+    std::shared_ptr<XDPProgram> _xdp_program;
+    std::vector<std::unique_ptr<AFXDP>> _xdp_devices;
+    std::string _xdp_mode{"generic"};
+    bool _xdp_ip_only{false};
+    static const inline std::map<std::string, AFXDPMode> _xdp_modes = {
+        {"generic", AFXDPMode::generic},
+        {"native", AFXDPMode::native}};
 #endif
 
-    pcpp::TcpReassembly _tcp_reassembly;
-
     static const inline ConfigsDefType _config_defs = {
         "iface",
         "bpf",
         "debug",
         "host_spec",
         "pcap_file",
+        "pcap_file_shards",
+        "pcap_file_shard_index",
+        "pcap_file_shard_by",
+        "pcap_file_speed",
         "pcap_source",
-        "tcp_packet_reassembly_cache_limit"};
+        "tcp_packet_reassembly_cache_limit",
+        "handler_queue_size",
+        "tcp_reassembly_threads",
+        "bpf_pushdown",
+        "dedup_window_ms",
+        "dedup_max_entries",
+        "numa_node",
+        "af_packet_workers",
+        "af_packet_fanout_type",
+        "af_packet_timestamp",
+        "af_xdp_mode",
+        "af_xdp_queues",
+        "af_xdp_ip_only",
+        "mock_rate",
+        "mock_qnames",
+        "mock_qname_zipf",
+        "mock_clients",
+        "mock_qtypes",
+        "mock_rcodes",
+        "mock_latency_ms",
+        "mock_tcp_pct",
+        "mock_duplicate_pct"};
 
 protected:
     void _open_pcap(const std::string &fileName, const std::string &bpfFilter);
@@ -139,9 +441,50 @@ protected:
     void _get_hosts_from_libpcap_iface();
     void _generate_mock_traffic();
     std::string _get_interface_list() const;
+    void _create_workers(size_t count);
+    PacketBatchEntry _classify_packet(pcpp::Packet &packet, timespec stamp);
+    void _process_tcp_packet(PcapWorker &worker, const PacketBatchEntry &entry);
+    bool _reassembly_wanted(PcapWorker &worker, const PacketBatchEntry &entry);
+    void _reassemble(PcapWorker &worker, const PacketBatchEntry &entry);
+    void _start_consumer(PcapInputEventProxy *proxy);
+    void _stop_consumers();
+    void _stop_tcp_shards();
+    static void _join_consumers(std::vector<std::unique_ptr<PcapConsumer>> &consumers);
+    void _consume(PcapConsumer &consumer);
+    bool _enqueue(const pcpp::RawPacket &rawPacket);
+    bool _bpf_pushdown_supported() const;
+    std::string _capture_bpf() const;
+    void _update_capture_bpf();
+    static uint64_t _packet_digest(const pcpp::RawPacket &rawPacket);
+    bool _is_duplicate(PcapWorker &worker, const pcpp::RawPacket &rawPacket);
+    void _report_duplicates(PcapWorker &worker, timespec stamp, bool flush = false);
+    void event_proxy_added(InputEventProxy *proxy) override;
+    void event_proxy_removed(InputEventProxy *proxy) override;
+    bool handler_threads_supported() const override
+    {
+        return true;
+    }
+
+    // reassembly callbacks of a consumer's worker go to its own proxy, those of a capture worker to every proxy
+    // without a consumer
+    template <typename F>
+    void _for_each_proxy(PcapWorker &worker, F &&cb);
+    // the proxies capture threads deliver to themselves, i.e. those without a consumer: of a shard proxy, only the one
+    // of worker's shard, or all of them without a worker. needs _input_mutex
+    template <typename F>
+    void _for_each_inline_proxy(const PcapWorker *worker, F &&cb);
+
+    // handlers are not safe for concurrent use, so when more than one thread delivers, each holds the proxy's
+    // dispatch_mutex while it delivers to it. the proxy of a shard, see handler_shards(), only has its capture worker
+    // and the statistics thread to wait for, so workers run their handlers in parallel. a proxy without a shard, of a
+    // handler sequence or with TCP reassembly threads, serializes the threads delivering to it, and handler_queue_size
+    // gives each policy a thread of its own instead
+    std::unique_lock<std::mutex> _dispatch_lock(PcapInputEventProxy *proxy);
 
 #ifdef __linux__
     void _open_af_packet_iface(const std::string &iface, const std::string &bpfFilter);
+    void _poll_af_packet_stats(const std::string &iface);
+    void _open_af_xdp_iface(const std::string &iface, const std::string &bpfFilter);
 #endif
 
 public:
@@ -157,39 +500,87 @@ public:
     void stop() override;
     void info_json(json &j) const override;
     std::unique_ptr<InputEventProxy> create_event_proxy(const Configurable &filter) override;
+    // every capture worker of af_packet_workers or af_xdp_queues delivers to handlers of its own
+    size_t handler_shards() const override;
 
     // utilities
     void parse_host_spec();
 
     // public methods that can be called from a static callback method via cookie, required by PcapPlusPlus
-    void process_raw_packet(pcpp::RawPacket *rawPacket);
-    void process_pcap_stats(const pcpp::IPcapDevice::PcapStats &stats);
-    void tcp_message_ready(int8_t side, const pcpp::TcpStreamData &tcpData);
-    void tcp_connection_start(const pcpp::ConnectionData &connectionData);
-    void tcp_connection_end(const pcpp::ConnectionData &connectionData, pcpp::TcpReassembly::ConnectionEndReason reason);
+    void process_raw_packet(PcapWorker &worker, pcpp::RawPacket *rawPacket);
+    void process_raw_block(PcapWorker &worker, std::vector<pcpp::RawPacket> &rawPackets);
+    void process_pcap_stats(const pcpp::IPcapDevice::PcapStats &stats, uint32_t backlog_pct = 0);
+    void process_ring_stats(const RingStats &stats);
+    void tcp_message_ready(PcapWorker &worker, int8_t side, const pcpp::TcpStreamData &tcpData);
+    void tcp_connection_start(PcapWorker &worker, const pcpp::ConnectionData &connectionData);
+    void tcp_connection_end(PcapWorker &worker, const pcpp::ConnectionData &connectionData, pcpp::TcpReassembly::ConnectionEndReason reason);
 };
 
 class PcapInputEventProxy : public visor::InputEventProxy
 {
 public:
-    // a predicate takes same signature as UdpSignalCB, but returns the value needed for a particular predicate key, i.e. the second half of key in _udp_predicate_signals
-    typedef std::function<std::string(pcpp::Packet &, PacketDirection, pcpp::ProtocolType, uint32_t, timespec)> UdpPredicate;
+    // a predicate takes same signature as UdpSignalCB, but returns the value needed for a particular predicate key as an
+    // integer, e.g. the rcode for only_rcode. signals registered for that value are called
+    typedef std::function<uint64_t(pcpp::Packet &, PacketDirection, pcpp::ProtocolType, uint32_t, timespec)> UdpPredicate;
+    // returned by a predicate when no signal can match
+    static constexpr uint64_t NO_PREDICATE_VALUE = std::numeric_limits<uint64_t>::max();
     // signature for udp callback, should be same as non predicate. Signal needs context.
     typedef std::function<void(pcpp::Packet &, PacketDirection, pcpp::ProtocolType, uint32_t, timespec)> UdpSignalCB;
 
     typedef sigslot::signal<pcpp::Packet &, PacketDirection, pcpp::ProtocolType, uint32_t, timespec> UdpPredicateSignal;
 
+    // whether a handler needs flows with this TCP port reassembled
+    typedef std::function<bool(uint16_t)> TcpPortPredicate;
+
 private:
-    // key example: dnsonly_rcode0
-    std::map<std::string, UdpPredicate> _udp_predicates;
-    // key example: dnsonly_rcode3
-    std::unordered_map<std::string, UdpPredicateSignal> _udp_predicate_signals;
+    // a predicate and its signals, sorted by the value they are registered for
+    struct UdpPredicateEntry {
+        // example: dnsonly_rcode
+        std::string key;
+        UdpPredicate predicate;
+        std::vector<std::pair<uint64_t, std::unique_ptr<UdpPredicateSignal>>> signals;
+
+        UdpPredicateSignal *find(uint64_t value) const
+        {
+            auto it = std::lower_bound(signals.begin(), signals.end(), value, [](const auto &entry, uint64_t v) { return entry.first < v; });
+            return (it != signals.end() && it->first == value) ? it->second.get() : nullptr;
+        }
+    };
+    // compiled at registration time, so a packet only runs each predicate and a binary search over its values
+    std::vector<UdpPredicateEntry> _udp_predicates;
     // key: <handlerid>
     std::map<std::string, std::vector<sigslot::connection>> _udp_predicate_connections;
 
+    // key: <handlerid>. handlers that receive reassembled TCP with the ports they registered, compiled once, and
+    // chained proxies whose handlers do
+    std::map<std::string, TcpPortSet> _tcp_ports;
+    std::map<std::string, const PcapInputEventProxy *> _tcp_port_forwards;
+    // bumped on every change to any proxy's TCP registrations, so inputs know when to recompile their TcpPortSet
+    static inline std::atomic<uint64_t> _tcp_ports_generation{0};
+
+    // key: <handlerid>. the traffic each handler consumes as a BPF expression, see register_bpf
+    std::map<std::string, std::optional<std::string>> _bpf_expressions;
+    // every handler a policy attached, registered or not: one that never says what it consumes may need anything
+    std::set<std::string> _attached_handlers;
+    std::function<void()> _bpf_changed;
+
     mutable std::shared_mutex _pcap_proxy_mutex;
     std::shared_ptr<spdlog::logger> _logger;
 
+    void _notify_bpf_change()
+    {
+        if (_bpf_changed) {
+            _bpf_changed();
+        }
+    }
+
+    void _register_tcp_ports(const std::string &handler_id, TcpPortSet ports)
+    {
+        std::unique_lock lock(_pcap_proxy_mutex);
+        _tcp_ports[handler_id] = std::move(ports);
+        ++_tcp_ports_generation;
+    }
+
 public:
     PcapInputEventProxy(const std::string &name, const Configurable &filter)
         : InputEventProxy(name, filter)
@@ -200,38 +591,208 @@ public:
 
     ~PcapInputEventProxy() = default;
 
+    // set while a PcapConsumer delivers to this proxy, capture threads skip it then. guarded by the input's _input_mutex
+    bool queued{false};
+    // held by whichever input thread delivers to this proxy, see PcapInputStream::_dispatch_lock
+    std::mutex dispatch_mutex;
+
     size_t consumer_count() const override
     {
-        return policy_signal.slot_count() + heartbeat_signal.slot_count() + packet_signal.slot_count() + udp_signal.slot_count() + start_tstamp_signal.slot_count() + tcp_message_ready_signal.slot_count() + tcp_connection_start_signal.slot_count() + tcp_connection_end_signal.slot_count() + tcp_reassembly_error_signal.slot_count() + pcap_stats_signal.slot_count();
+        return policy_signal.slot_count() + heartbeat_signal.slot_count() + packet_signal.slot_count() + packet_batch_signal.slot_count() + udp_signal.slot_count() + start_tstamp_signal.slot_count() + tcp_message_ready_signal.slot_count() + tcp_connection_start_signal.slot_count() + tcp_connection_end_signal.slot_count() + tcp_reassembly_error_signal.slot_count() + pcap_stats_signal.slot_count() + ring_stats_signal.slot_count() + duplicates_signal.slot_count();
     }
 
+    // every packet reaches each handler exactly once, through packet_signal or packet_batch_signal depending on which
+    // one it connected to. a single packet becomes a batch of one, and a batch is unrolled for per packet handlers.
     void process_packet_cb(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, pcpp::ProtocolType l4, timespec stamp)
     {
         packet_signal(payload, dir, l3, l4, stamp);
+        if (packet_batch_signal.slot_count()) {
+            PacketBatchEntry entry{&payload, dir, l3, l4, stamp};
+            packet_batch_signal(PacketBatch(&entry, 1));
+        }
+    }
+
+    void process_packet_batch_cb(const PacketBatch &batch)
+    {
+        packet_batch_signal(batch);
+        if (packet_signal.slot_count()) {
+            for (const auto &entry : batch) {
+                packet_signal(*entry.packet, entry.dir, entry.l3, entry.l4, entry.stamp);
+            }
+        }
     }
 
-    void register_udp_predicate_signal(const std::string &schema_key, const std::string &handler_id, const std::string &predicate_key, const std::string &conditional_value, UdpPredicate predicate, UdpSignalCB callback)
+    void register_udp_predicate_signal(const std::string &schema_key, const std::string &handler_id, const std::string &predicate_key, uint64_t conditional_value, UdpPredicate predicate, UdpSignalCB callback)
     {
         std::unique_lock lock(_pcap_proxy_mutex);
         // if predicate has not been installed yet, install it now
         // note that it is namespaced to each handler so that different handlers can have the same predicate_key
         auto full_predicate_key = schema_key + predicate_key;
-        auto predicate_jump_key = full_predicate_key + conditional_value;
-        if (_udp_predicates.find(full_predicate_key) == _udp_predicates.end()) {
-            _udp_predicates[full_predicate_key] = predicate;
+        auto entry = std::find_if(_udp_predicates.begin(), _udp_predicates.end(), [&full_predicate_key](const auto &e) { return e.key == full_predicate_key; });
+        if (entry == _udp_predicates.end()) {
+            entry = _udp_predicates.insert(_udp_predicates.end(), UdpPredicateEntry{full_predicate_key, std::move(predicate), {}});
+        }
+        // now install the given conditional signal based on the value, keeping the values sorted
+        auto &signals = entry->signals;
+        auto it = std::lower_bound(signals.begin(), signals.end(), conditional_value, [](const auto &e, uint64_t v) { return e.first < v; });
+        if (it == signals.end() || it->first != conditional_value) {
+            it = signals.emplace(it, conditional_value, std::make_unique<UdpPredicateSignal>());
         }
-        // now install the given conditional signal based on the jump key
         // record the connection so we can remove it later when the handler disconnects
-        _udp_predicate_connections[handler_id].push_back(_udp_predicate_signals[predicate_jump_key].connect(callback));
+        _udp_predicate_connections[handler_id].push_back(it->second->connect(std::move(callback)));
     }
 
     void unregister_udp_predicate_signal(const std::string &handler_id)
     {
         assert(_udp_predicate_connections.find(handler_id) != _udp_predicate_connections.end());
-        std::shared_lock lock(_pcap_proxy_mutex);
+        std::unique_lock lock(_pcap_proxy_mutex);
         for (auto &connection : _udp_predicate_connections[handler_id]) {
             connection.disconnect();
         }
+        _udp_predicate_connections.erase(handler_id);
+        // values and predicates no handler listens to any more go, so they do not pile up as policies come and go
+        for (auto &entry : _udp_predicates) {
+            entry.signals.erase(std::remove_if(entry.signals.begin(), entry.signals.end(), [](const auto &signal) { return signal.second->slot_count() == 0; }), entry.signals.end());
+        }
+        _udp_predicates.erase(std::remove_if(_udp_predicates.begin(), _udp_predicates.end(), [](const auto &entry) { return entry.signals.empty(); }), _udp_predicates.end());
+    }
+
+    size_t udp_predicate_count() const
+    {
+        std::shared_lock lock(_pcap_proxy_mutex);
+        size_t count{0};
+        for (const auto &entry : _udp_predicates) {
+            count += entry.signals.size();
+        }
+        return count;
+    }
+
+    // TCP is only reassembled for flows some handler registered for: handlers connecting to tcp_message_ready_signal
+    // and friends must call this with the ports they need
+    void register_tcp_ports(const std::string &handler_id, const TcpPortRanges &ranges)
+    {
+        TcpPortSet ports;
+        ports.add(ranges);
+        _register_tcp_ports(handler_id, std::move(ports));
+    }
+
+    // for handlers that do not know their ports up front, a predicate that is asked about every port once, or a null
+    // predicate for all of them
+    void register_tcp_ports(const std::string &handler_id, const TcpPortPredicate &predicate)
+    {
+        TcpPortSet ports;
+        ports.add(predicate);
+        _register_tcp_ports(handler_id, std::move(ports));
+    }
+
+    // for handlers that pass reassembled TCP on to chained handlers: whatever those register on their proxy counts as
+    // registered here
+    void forward_tcp_ports(const std::string &handler_id, const PcapInputEventProxy *chained)
+    {
+        std::unique_lock lock(_pcap_proxy_mutex);
+        _tcp_port_forwards[handler_id] = chained;
+        ++_tcp_ports_generation;
+    }
+
+    void unregister_tcp_ports(const std::string &handler_id)
+    {
+        std::unique_lock lock(_pcap_proxy_mutex);
+        _tcp_ports.erase(handler_id);
+        _tcp_port_forwards.erase(handler_id);
+        ++_tcp_ports_generation;
+    }
+
+    void collect_tcp_ports(TcpPortSet &ports) const
+    {
+        std::shared_lock lock(_pcap_proxy_mutex);
+        for (const auto &[handler_id, handler_ports] : _tcp_ports) {
+            ports.add(handler_ports);
+        }
+        for (const auto &[handler_id, chained] : _tcp_port_forwards) {
+            chained->collect_tcp_ports(ports);
+        }
+    }
+
+    // whether any handler, or one chained to it, registered TCP ports
+    bool reassembles_tcp() const
+    {
+        std::shared_lock lock(_pcap_proxy_mutex);
+        if (!_tcp_ports.empty()) {
+            return true;
+        }
+        return std::any_of(_tcp_port_forwards.begin(), _tcp_port_forwards.end(), [](const auto &forward) { return forward.second->reassembles_tcp(); });
+    }
+
+    static uint64_t tcp_ports_generation()
+    {
+        return _tcp_ports_generation.load(std::memory_order_acquire);
+    }
+
+    // the traffic a handler consumes, as a BPF expression. an empty expression stands for all traffic, and handlers
+    // that only follow the input's statistics register std::nullopt. live inputs narrow their capture filter to the
+    // union of these, so what no handler consumes is dropped in the kernel
+    void register_bpf(const std::string &handler_id, std::optional<std::string> expression)
+    {
+        {
+            std::unique_lock lock(_pcap_proxy_mutex);
+            _bpf_expressions[handler_id] = std::move(expression);
+        }
+        _notify_bpf_change();
+    }
+
+    void unregister_bpf(const std::string &handler_id)
+    {
+        {
+            std::unique_lock lock(_pcap_proxy_mutex);
+            _bpf_expressions.erase(handler_id);
+        }
+        _notify_bpf_change();
+    }
+
+    void handler_attached(const std::string &handler_id) override
+    {
+        {
+            std::unique_lock lock(_pcap_proxy_mutex);
+            _attached_handlers.insert(handler_id);
+        }
+        _notify_bpf_change();
+    }
+
+    void handler_detached(const std::string &handler_id) override
+    {
+        {
+            std::unique_lock lock(_pcap_proxy_mutex);
+            _attached_handlers.erase(handler_id);
+        }
+        _notify_bpf_change();
+    }
+
+    // called without the proxy lock whenever collect_bpf may return something else
+    void on_bpf_change(std::function<void()> cb)
+    {
+        _bpf_changed = std::move(cb);
+    }
+
+    // adds the expressions of this proxy's handlers. false if some handler needs all traffic, or never said what it
+    // consumes
+    bool collect_bpf(std::set<std::string> &expressions) const
+    {
+        std::shared_lock lock(_pcap_proxy_mutex);
+        for (const auto &handler_id : _attached_handlers) {
+            if (_bpf_expressions.find(handler_id) == _bpf_expressions.end()) {
+                return false;
+            }
+        }
+        for (const auto &[handler_id, expression] : _bpf_expressions) {
+            if (!expression) {
+                continue;
+            }
+            if (expression->empty()) {
+                return false;
+            }
+            expressions.insert(*expression);
+        }
+        return true;
     }
 
     void process_udp_packet_cb(pcpp::Packet &payload, PacketDirection dir, pcpp::ProtocolType l3, uint32_t flowkey, timespec stamp)
@@ -242,10 +803,13 @@ public:
         // if we have udp predicate signals, run each predicate and conditionally trigger signals that match
         std::shared_lock lock(_pcap_proxy_mutex);
         if (_udp_predicates.size()) {
-            for (const auto &[key, predicate] : _udp_predicates) {
-                auto predicate_jump_key = predicate(payload, dir, l3, flowkey, stamp);
-                if (_udp_predicate_signals.find(predicate_jump_key) != _udp_predicate_signals.end()) {
-                    _udp_predicate_signals[predicate_jump_key](payload, dir, l3, flowkey, stamp);
+            for (const auto &entry : _udp_predicates) {
+                auto value = entry.predicate(payload, dir, l3, flowkey, stamp);
+                if (value == NO_PREDICATE_VALUE) {
+                    continue;
+                }
+                if (auto signal = entry.find(value)) {
+                    (*signal)(payload, dir, l3, flowkey, stamp);
                 }
             }
         }
@@ -281,10 +845,21 @@ public:
         pcap_stats_signal(stats);
     }
 
+    void process_ring_stats(const RingStats &stats)
+    {
+        ring_stats_signal(stats);
+    }
+
+    void process_duplicates(uint64_t count, timespec stamp)
+    {
+        duplicates_signal(count, stamp);
+    }
+
     // handler functionality
     // IF THIS changes, see consumer_count()
     // note: these are mutable because consumer_count() calls slot_count() which is not const (unclear if it could/should be)
     mutable sigslot::signal<pcpp::Packet &, PacketDirection, pcpp::ProtocolType, pcpp::ProtocolType, timespec> packet_signal;
+    mutable sigslot::signal<const PacketBatch &> packet_batch_signal;
     mutable sigslot::signal<pcpp::Packet &, PacketDirection, pcpp::ProtocolType, uint32_t, timespec> udp_signal;
     mutable sigslot::signal<pcpp::Packet &, PacketDirection, pcpp::ProtocolType, uint32_t, timespec> tcp_reassembled_signal;
     mutable sigslot::signal<timespec> start_tstamp_signal;
@@ -294,5 +869,8 @@ public:
     mutable sigslot::signal<const pcpp::ConnectionData &, pcpp::TcpReassembly::ConnectionEndReason> tcp_connection_end_signal;
     mutable sigslot::signal<pcpp::Packet &, PacketDirection, pcpp::ProtocolType, timespec> tcp_reassembly_error_signal;
     mutable sigslot::signal<const pcpp::IPcapDevice::PcapStats &> pcap_stats_signal;
+    mutable sigslot::signal<const RingStats &> ring_stats_signal;
+    // packets suppressed as duplicates, see dedup_window_ms
+    mutable sigslot::signal<uint64_t, timespec> duplicates_signal;
 };
 }
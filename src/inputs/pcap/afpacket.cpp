@@ -5,11 +5,18 @@
 #ifdef __linux__
 #include "afpacket.h"
 
+#include "Numa.h"
+#include "ThreadName.h"
 #include "utils.h"
 #include <pcapplusplus/Packet.h>
+#include <spdlog/spdlog.h>
+#include <algorithm>
 #include <arpa/inet.h>
 #include <cerrno>
 #include <cstring>
+#include <ctime>
+#include <linux/net_tstamp.h>
+#include <linux/sockios.h>
 #include <net/ethernet.h>
 #include <net/if.h>
 #include <poll.h>
@@ -20,12 +27,15 @@
 
 namespace visor::input::pcap {
 
-AFPacket::AFPacket(PcapInputStream *stream, pcpp::OnPacketArrivesCallback cb, std::string filter,
+AFPacket::AFPacket(void *cookie, OnBlockArrivesCallback cb, std::string filter,
     std::string interface_name,
     int fanout_group_id,
+    int fanout_type,
+    AFPacketTimestamp timestamp,
     unsigned int block_size,
     unsigned int frame_size,
-    unsigned int num_blocks)
+    unsigned int num_blocks,
+    int numa_node)
     : fd(-1)
     , block_size(block_size)
     , frame_size(frame_size)
@@ -36,9 +46,12 @@ AFPacket::AFPacket(PcapInputStream *stream, pcpp::OnPacketArrivesCallback cb, st
     , bpf()
     , filter(std::move(filter))
     , fanout_group_id(fanout_group_id)
+    , fanout_type(fanout_type)
+    , timestamp(timestamp)
+    , numa_node(numa_node)
     , map(nullptr)
-    , cb(std::move(cb))
-    , inputStream(stream)
+    , cb(cb)
+    , cookie(cookie)
 {
     fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
 
@@ -62,6 +75,7 @@ AFPacket::~AFPacket()
     if (map != nullptr) {
         munmap(map, static_cast<size_t>(block_size) * num_blocks);
     }
+    free(bpf.filter);
 }
 
 void AFPacket::flush_block(struct block_desc *pbd)
@@ -74,16 +88,73 @@ void AFPacket::walk_block(struct block_desc *pbd)
     int num_pkts = pbd->h1.num_pkts, i;
     struct tpacket3_hdr *ppd;
 
+    // reused between blocks; reserving up front guarantees no reallocation (and so no copy) while filling
+    block_packets.clear();
+    block_packets.reserve(num_pkts);
+
     ppd = reinterpret_cast<struct tpacket3_hdr *>(reinterpret_cast<uint8_t *>(pbd) + pbd->h1.offset_to_first_pkt);
     for (i = 0; i < num_pkts; ++i) {
 
+        // every frame carries its own time stamp, the block header only has the first and last one
         auto data_pointer = reinterpret_cast<uint8_t *>(ppd) + ppd->tp_mac;
-        pcpp::RawPacket packet(data_pointer, ppd->tp_snaplen, timespec{pbd->h1.ts_last_pkt.ts_sec, pbd->h1.ts_last_pkt.ts_nsec},
+        block_packets.emplace_back(data_pointer, ppd->tp_snaplen, timespec{ppd->tp_sec, ppd->tp_nsec},
             false, pcpp::LINKTYPE_ETHERNET);
-        cb(&packet, nullptr, inputStream);
 
         ppd = reinterpret_cast<struct tpacket3_hdr *>(reinterpret_cast<uint8_t *>(ppd) + ppd->tp_next_offset);
     }
+
+    if (!block_packets.empty()) {
+        cb(block_packets, cookie);
+    }
+}
+
+void AFPacket::sample_ring(struct block_desc *pbd)
+{
+    unsigned int user_blocks{0};
+    for (const auto &block : rd) {
+        if (reinterpret_cast<struct block_desc *>(block.iov_base)->h1.block_status & TP_STATUS_USER) {
+            ++user_blocks;
+        }
+    }
+
+    int64_t latency_us{-1};
+    if (timestamp != AFPacketTimestamp::hardware) {
+        timespec now{};
+        clock_gettime(CLOCK_REALTIME, &now);
+        auto ns = (static_cast<int64_t>(now.tv_sec) - pbd->h1.ts_last_pkt.ts_sec) * 1'000'000'000 + now.tv_nsec - pbd->h1.ts_last_pkt.ts_nsec;
+        latency_us = std::max<int64_t>(ns / 1000, 0);
+    }
+
+    std::unique_lock lock(stats_mutex);
+    if (stats_totals.fill_pct.size() < MAX_RING_SAMPLES) {
+        stats_totals.fill_pct.push_back(user_blocks * 100ULL / num_blocks);
+        if (latency_us >= 0) {
+            stats_totals.retire_latency_us.push_back(static_cast<uint64_t>(latency_us));
+        }
+    }
+}
+
+AFPacketStats AFPacket::stats()
+{
+    struct tpacket_stats_v3 kernel_stats {
+    };
+    socklen_t len = sizeof(kernel_stats);
+
+    std::unique_lock lock(stats_mutex);
+    // the kernel resets its counters on every read
+    if (fd != -1 && getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &kernel_stats, &len) == 0) {
+        stats_totals.packets += kernel_stats.tp_packets;
+        stats_totals.drops += kernel_stats.tp_drops;
+        stats_totals.freeze_q_cnt += kernel_stats.tp_freeze_q_cnt;
+    }
+
+    AFPacketStats result;
+    result.packets = stats_totals.packets;
+    result.drops = stats_totals.drops;
+    result.freeze_q_cnt = stats_totals.freeze_q_cnt;
+    result.fill_pct.swap(stats_totals.fill_pct);
+    result.retire_latency_us.swap(stats_totals.retire_latency_us);
+    return result;
 }
 
 void AFPacket::set_interface()
@@ -118,6 +189,51 @@ void AFPacket::set_interface()
     interface_type = ifr.ifr_hwaddr.sa_family;
 }
 
+void AFPacket::set_timestamping()
+{
+    if (timestamp == AFPacketTimestamp::ring) {
+        return;
+    }
+
+    int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    if (timestamp == AFPacketTimestamp::hardware) {
+        if (interface <= 0) {
+            throw PcapException("Hardware time stamps require a specific interface, not 'any'");
+        }
+        // ask the driver to stamp every received frame
+        struct hwtstamp_config hwconfig {
+        };
+        memset(&hwconfig, 0, sizeof(hwconfig));
+        hwconfig.tx_type = HWTSTAMP_TX_OFF;
+        hwconfig.rx_filter = HWTSTAMP_FILTER_ALL;
+
+        struct ifreq ifr {
+        };
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, interface_name.c_str(), sizeof(ifr.ifr_name) - 1);
+        ifr.ifr_data = reinterpret_cast<char *>(&hwconfig);
+
+        if (ioctl(fd, SIOCSHWTSTAMP, &ifr) == -1) {
+            throw PcapException("Failed to enable hardware time stamps on interface '" + interface_name + "': " + std::string(strerror(errno)));
+        }
+        flags |= SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+    }
+
+    // enables software receive time stamps in the network stack for this socket
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == -1) {
+        throw PcapException("Failed to enable SO_TIMESTAMPING on AF_PACKET socket: " + std::string(strerror(errno)));
+    }
+
+    // selects which of those time stamps the kernel writes into tp_sec/tp_nsec of the ring frames
+    int ring_flags = SOF_TIMESTAMPING_SOFTWARE;
+    if (timestamp == AFPacketTimestamp::hardware) {
+        ring_flags |= SOF_TIMESTAMPING_RAW_HARDWARE;
+    }
+    if (setsockopt(fd, SOL_PACKET, PACKET_TIMESTAMP, &ring_flags, sizeof(ring_flags)) == -1) {
+        throw PcapException("Failed to set PACKET_TIMESTAMP on AF_PACKET socket: " + std::string(strerror(errno)));
+    }
+}
+
 void AFPacket::set_socket_opts()
 {
     // Set the packet version to TPACKET_V3
@@ -140,6 +256,8 @@ void AFPacket::set_socket_opts()
         }
     }
 
+    set_timestamping();
+
     if (!filter.empty()) {
         memset(&bpf, 0, sizeof(bpf));
         filter_try_compile(filter, &bpf, interface_type);
@@ -147,7 +265,9 @@ void AFPacket::set_socket_opts()
         if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &bpf, sizeof(bpf)) == -1) {
             throw PcapException("Failed to attach supplied BPF filter to AF_PACKET socket: " + std::string(strerror(errno)));
         }
+    }
 
+    if (!filter.empty() && lock_filter) {
         int lock = 1;
         if (setsockopt(fd, SOL_SOCKET, SO_LOCK_FILTER, &lock, sizeof(lock)) == -1) {
             throw PcapException("Failed to lock supplied BPF filter to AF_PACKET socket: " + std::string(strerror(errno)));
@@ -175,7 +295,12 @@ void AFPacket::set_socket_opts()
 void AFPacket::setup()
 {
     set_interface();
-    set_socket_opts();
+    {
+        // the kernel allocates the ring while enabling PACKET_RX_RING, following the memory policy of this thread.
+        // its pages are not movable afterwards, so binding the mapping (mbind) would be too late
+        numa::PreferNodeScope prefer(numa_node);
+        set_socket_opts();
+    }
 
     // Enable mmap for PACKET_RX_RING.
     map = reinterpret_cast<uint8_t *>(mmap(nullptr, static_cast<size_t>(block_size) * num_blocks, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, fd, 0));
@@ -214,17 +339,36 @@ void AFPacket::setup()
 
     // Setup fanout if enabled.
     if (fanout_group_id != -1) {
+        // PACKET_FANOUT_HASH - by flow hash, which the kernel computes symmetrically so both directions land on the same socket
         // PACKET_FANOUT_LB - round robin
         // PACKET_FANOUT_CPU - send packets to CPU where packet arrived
-        int fanout_type = PACKET_FANOUT_LB;
+        int fanout_mode = fanout_type;
+        if (fanout_type == PACKET_FANOUT_HASH) {
+            // reassemble IP fragments before hashing, so all fragments of a datagram reach the same socket
+            fanout_mode |= PACKET_FANOUT_FLAG_DEFRAG;
+        }
 
-        int fanout_arg = (fanout_group_id | (fanout_type << 16));
+        // group ids are global to the host: a group of another process with the same id and mode would silently take
+        // part of our traffic, so a new group gets an id the kernel knows to be unused
+        auto new_group = fanout_group_id == NEW_FANOUT_GROUP;
+        if (new_group) {
+            fanout_mode |= PACKET_FANOUT_FLAG_UNIQUEID;
+        }
+
+        int fanout_arg = ((new_group ? 0 : fanout_group_id & 0xffff) | (fanout_mode << 16));
 
         if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout_arg,
                 sizeof(fanout_arg))
             < 0) {
             throw PcapException("Failed to configure fanout for AF_PACKET socket: " + std::string(strerror(errno)));
         }
+        if (new_group) {
+            socklen_t len = sizeof(fanout_arg);
+            if (getsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout_arg, &len) < 0) {
+                throw PcapException("Failed to read fanout group of AF_PACKET socket: " + std::string(strerror(errno)));
+            }
+            fanout_group_id = fanout_arg & 0xffff;
+        }
     }
 }
 
@@ -236,6 +380,11 @@ void AFPacket::start_capture()
     running = true;
 
     cap_thread = std::make_unique<std::thread>([this] {
+        if (numa_node >= 0) {
+            // on the node of the ring, and of the NIC writing into it
+            thread::pin_self(numa::node_cpus(numa_node));
+            numa::prefer_node(numa_node);
+        }
         unsigned int current_block_num = 0;
 
         struct pollfd pfd {
@@ -254,6 +403,7 @@ void AFPacket::start_capture()
                 continue;
             }
 
+            sample_ring(pbd);
             walk_block(pbd);
             flush_block(pbd);
             current_block_num = (current_block_num + 1) % num_blocks;
@@ -261,6 +411,295 @@ void AFPacket::start_capture()
     });
 }
 
+bool AFPacket::set_filter(const std::vector<std::string> &filters)
+{
+    auto new_filter = filter_union(filters);
+    if (new_filter == filter) {
+        return true;
+    }
+    if (filters.empty()) {
+        if (setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, nullptr, 0) == -1 && errno != ENOENT) {
+            throw PcapException("Failed to detach BPF filter from AF_PACKET socket: " + std::string(strerror(errno)));
+        }
+    } else {
+        struct sock_fprog new_bpf {
+        };
+        if (!filter_union_compile(filters, &new_bpf, interface_type)) {
+            return false;
+        }
+        // the kernel swaps in its own copy atomically, so capture carries on under one filter or the other
+        if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &new_bpf, sizeof(new_bpf)) == -1) {
+            free(new_bpf.filter);
+            throw PcapException("Failed to attach BPF filter to AF_PACKET socket: " + std::string(strerror(errno)));
+        }
+        free(bpf.filter);
+        bpf = new_bpf;
+    }
+    filter = new_filter;
+    return true;
+}
+
+SharedAFPacket::SharedAFPacket(std::string key, std::string interface_name, size_t workers, int fanout_type, AFPacketTimestamp timestamp, int numa_node)
+    : key(std::move(key))
+    , interface_name(std::move(interface_name))
+    , workers(workers)
+    , fanout_type(fanout_type)
+    , timestamp(timestamp)
+    , numa_node(numa_node)
+{
+    for (size_t i = 0; i < workers; ++i) {
+        lanes.push_back({this, i});
+    }
+}
+
+static std::mutex shared_rings_mutex;
+static std::map<std::string, std::weak_ptr<SharedAFPacket>> shared_rings;
+
+SharedAFPacket::~SharedAFPacket()
+{
+    // the sockets stop and join their threads as they go
+    devices.clear();
+    for (auto &subscriber : subscribers) {
+        if (subscriber->has_program) {
+            pcap_freecode(&subscriber->program);
+        }
+    }
+    std::unique_lock lock(shared_rings_mutex);
+    auto it = shared_rings.find(key);
+    if (it != shared_rings.end() && it->second.expired()) {
+        shared_rings.erase(it);
+    }
+}
+
+std::shared_ptr<SharedAFPacket> SharedAFPacket::open(const std::string &interface_name, size_t workers, int fanout_type, AFPacketTimestamp timestamp, int numa_node)
+{
+    // inputs asking for different nodes get rings of their own, each placed where it was asked to be
+    auto key = interface_name + "/" + std::to_string(workers) + "/" + std::to_string(fanout_type) + "/" + std::to_string(static_cast<int>(timestamp)) + "/" + std::to_string(numa_node);
+    std::unique_lock lock(shared_rings_mutex);
+    auto &slot = shared_rings[key];
+    auto ring = slot.lock();
+    if (!ring) {
+        ring = std::shared_ptr<SharedAFPacket>(new SharedAFPacket(key, interface_name, workers, fanout_type, timestamp, numa_node));
+        slot = ring;
+    }
+    return ring;
+}
+
+void SharedAFPacket::block_arrives(std::vector<pcpp::RawPacket> &packets, void *cookie)
+{
+    auto lane = static_cast<Lane *>(cookie);
+    lane->ring->deliver(lane->worker, packets);
+}
+
+void SharedAFPacket::deliver(size_t worker, std::vector<pcpp::RawPacket> &packets)
+{
+    std::shared_lock lock(subscribers_mutex);
+    for (auto &subscriber : subscribers) {
+        if (!subscriber->has_program) {
+            subscriber->packets.fetch_add(packets.size(), std::memory_order_relaxed);
+            subscriber->cb(packets, subscriber->cookies[worker]);
+            continue;
+        }
+        // the frames stay in the ring, the filtered block only points at them
+        auto &filtered = subscriber->filtered[worker];
+        filtered.clear();
+        filtered.reserve(packets.size());
+        for (auto &packet : packets) {
+            struct pcap_pkthdr hdr {
+            };
+            hdr.caplen = static_cast<bpf_u_int32>(packet.getRawDataLen());
+            hdr.len = hdr.caplen;
+            if (pcap_offline_filter(&subscriber->program, &hdr, packet.getRawData()) != 0) {
+                filtered.emplace_back(packet.getRawData(), packet.getRawDataLen(), packet.getPacketTimeStamp(), false, packet.getLinkLayerType());
+            }
+        }
+        subscriber->packets.fetch_add(filtered.size(), std::memory_order_relaxed);
+        if (!filtered.empty()) {
+            subscriber->cb(filtered, subscriber->cookies[worker]);
+        }
+    }
+}
+
+void SharedAFPacket::compile(Subscriber &subscriber)
+{
+    struct bpf_program program {
+    };
+    bool has_program = !subscriber.filter.empty() && subscriber.filter != socket_filter;
+    if (has_program) {
+        // frames in the ring are always ethernet, see AFPacket::walk_block()
+        pcap_t *handle = pcap_open_dead(DLT_EN10MB, 65535);
+        if (handle == nullptr) {
+            throw PcapException("Failed to open pcap handle");
+        }
+        if (pcap_compile(handle, &program, subscriber.filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) < 0) {
+            pcap_close(handle);
+            throw PcapException("Failed to parse bpf filter: " + subscriber.filter);
+        }
+        pcap_close(handle);
+    }
+    if (subscriber.has_program) {
+        pcap_freecode(&subscriber.program);
+    }
+    subscriber.program = program;
+    subscriber.has_program = has_program;
+}
+
+void SharedAFPacket::update_socket_filter()
+{
+    // the union of the subscriber filters, chained in one socket program. a subscriber without a filter takes
+    // everything, and so do the sockets
+    std::vector<std::string> filters;
+    for (const auto &subscriber : subscribers) {
+        if (subscriber->filter.empty()) {
+            filters.clear();
+            break;
+        }
+        if (std::find(filters.begin(), filters.end(), subscriber->filter) == filters.end()) {
+            filters.push_back(subscriber->filter);
+        }
+    }
+
+    bool chained{true};
+    for (auto &device : devices) {
+        if (!device->set_filter(filters)) {
+            chained = false;
+            break;
+        }
+    }
+    if (!chained) {
+        spdlog::get("visor")->warn("AF_PACKET [{}]: the filters of {} inputs cannot be combined into one socket filter, capturing everything and filtering in userspace", interface_name, filters.size());
+        filters.clear();
+        for (auto &device : devices) {
+            device->set_filter(filters);
+        }
+    }
+
+    // subscribers whose filter matches the sockets' need no userspace filter, and the others need theirs
+    socket_filter = filter_union(filters);
+    for (auto &subscriber : subscribers) {
+        compile(*subscriber);
+    }
+}
+
+void SharedAFPacket::subscribe(const void *id, std::vector<void *> cookies, OnBlockArrivesCallback cb, const std::string &filter)
+{
+    if (cookies.size() != workers) {
+        throw PcapException("AF_PACKET ring subscriber needs one cookie per worker");
+    }
+    auto subscriber = std::make_unique<Subscriber>();
+    subscriber->id = id;
+    subscriber->cookies = std::move(cookies);
+    subscriber->cb = cb;
+    subscriber->filter = filter;
+    subscriber->filtered.resize(workers);
+
+    std::unique_lock lock(subscribers_mutex);
+    subscribers.push_back(std::move(subscriber));
+    if (!devices.empty()) {
+        try {
+            update_socket_filter();
+        } catch (const PcapException &) {
+            subscribers.pop_back();
+            update_socket_filter();
+            throw;
+        }
+        return;
+    }
+
+    // a single socket keeps the plain socket, several share one fanout group. the first socket opens the group, and
+    // the others join it by the id the kernel gave it
+    int fanout_group_id = workers > 1 ? AFPacket::NEW_FANOUT_GROUP : -1;
+    try {
+        socket_filter = filter;
+        for (size_t i = 0; i < workers; ++i) {
+            devices.push_back(std::make_unique<AFPacket>(&lanes[i], block_arrives, filter, interface_name, fanout_group_id, fanout_type, timestamp, 1 << 22, 1 << 11, 64, numa_node));
+            devices.back()->allow_filter_updates();
+            devices.back()->start_capture();
+            fanout_group_id = devices.back()->fanout_group();
+        }
+    } catch (const PcapException &) {
+        subscribers.pop_back();
+        // capture threads of the sockets that did start wait for this lock to deliver, so they are joined without it
+        auto failed = std::move(devices);
+        devices.clear();
+        lock.unlock();
+        failed.clear();
+        throw;
+    }
+}
+
+void SharedAFPacket::unsubscribe(const void *id)
+{
+    std::unique_lock lock(subscribers_mutex);
+    auto it = std::find_if(subscribers.begin(), subscribers.end(), [id](const auto &subscriber) { return subscriber->id == id; });
+    if (it == subscribers.end()) {
+        return;
+    }
+    if ((*it)->has_program) {
+        pcap_freecode(&(*it)->program);
+    }
+    subscribers.erase(it);
+    if (!subscribers.empty()) {
+        try {
+            update_socket_filter();
+        } catch (const PcapException &) {
+            // the sockets keep a filter that lets through at least what the remaining subscribers want
+        }
+    }
+}
+
+void SharedAFPacket::set_filter(const void *id, const std::string &filter)
+{
+    std::unique_lock lock(subscribers_mutex);
+    auto it = std::find_if(subscribers.begin(), subscribers.end(), [id](const auto &subscriber) { return subscriber->id == id; });
+    if (it == subscribers.end() || (*it)->filter == filter) {
+        return;
+    }
+    auto previous = (*it)->filter;
+    (*it)->filter = filter;
+    try {
+        update_socket_filter();
+    } catch (const PcapException &) {
+        (*it)->filter = previous;
+        update_socket_filter();
+        throw;
+    }
+}
+
+AFPacketStats SharedAFPacket::stats(const void *id)
+{
+    std::unique_lock stats_lock(stats_mutex);
+    std::shared_lock lock(subscribers_mutex);
+
+    // every subscriber gets its own copy of the ring samples taken since any of them last asked
+    AFPacketStats result;
+    for (auto &device : devices) {
+        auto device_stats = device->stats();
+        result.drops += device_stats.drops;
+        result.freeze_q_cnt += device_stats.freeze_q_cnt;
+        for (auto &subscriber : subscribers) {
+            auto room = MAX_RING_SAMPLES - std::min(MAX_RING_SAMPLES, subscriber->fill_pct.size());
+            subscriber->fill_pct.insert(subscriber->fill_pct.end(), device_stats.fill_pct.begin(), device_stats.fill_pct.begin() + static_cast<ptrdiff_t>(std::min(room, device_stats.fill_pct.size())));
+            room = MAX_RING_SAMPLES - std::min(MAX_RING_SAMPLES, subscriber->retire_latency_us.size());
+            subscriber->retire_latency_us.insert(subscriber->retire_latency_us.end(), device_stats.retire_latency_us.begin(), device_stats.retire_latency_us.begin() + static_cast<ptrdiff_t>(std::min(room, device_stats.retire_latency_us.size())));
+        }
+    }
+    for (auto &subscriber : subscribers) {
+        if (subscriber->id == id) {
+            result.packets = subscriber->packets.load(std::memory_order_relaxed);
+            result.fill_pct.swap(subscriber->fill_pct);
+            result.retire_latency_us.swap(subscriber->retire_latency_us);
+        }
+    }
+    return result;
+}
+
+size_t SharedAFPacket::subscriber_count()
+{
+    std::shared_lock lock(subscribers_mutex);
+    return subscribers.size();
+}
+
 void filter_try_compile(const std::string &filter, struct sock_fprog *bpf, int link_type)
 {
     int i, ret;
@@ -309,5 +748,61 @@ void filter_try_compile(const std::string &filter, struct sock_fprog *bpf, int l
     pcap_freecode(&prog);
 }
 
+bool filter_union_compile(const std::vector<std::string> &filters, struct sock_fprog *bpf, int link_type)
+{
+    std::vector<struct sock_filter> insns;
+    for (size_t f = 0; f < filters.size(); ++f) {
+        struct sock_fprog prog {
+        };
+        filter_try_compile(filters[f], &prog, link_type);
+        bool last = f + 1 == filters.size();
+        bool chained{true};
+        for (unsigned int i = 0; i < prog.len; ++i) {
+            auto ins = prog.filter[i];
+            if (!last && BPF_CLASS(ins.code) == BPF_RET) {
+                if (BPF_RVAL(ins.code) != BPF_K) {
+                    chained = false;
+                    break;
+                }
+                if (ins.k == 0) {
+                    // a rejection jumps to the first instruction of the next filter
+                    ins.code = BPF_JMP | BPF_JA;
+                    ins.jt = 0;
+                    ins.jf = 0;
+                    ins.k = prog.len - i - 1;
+                }
+            }
+            insns.push_back(ins);
+        }
+        free(prog.filter);
+        if (!chained) {
+            return false;
+        }
+    }
+    if (insns.empty() || insns.size() > BPF_MAXINSNS) {
+        return false;
+    }
+
+    bpf->len = static_cast<unsigned short>(insns.size());
+    bpf->filter = reinterpret_cast<struct sock_filter *>(malloc(insns.size() * sizeof(struct sock_filter)));
+    if (bpf->filter == nullptr) {
+        throw PcapException("Failed to generating bpf filter: Out of memory");
+    }
+    memcpy(bpf->filter, insns.data(), insns.size() * sizeof(struct sock_filter));
+    return true;
+}
+
+std::string filter_union(const std::vector<std::string> &filters)
+{
+    if (filters.size() == 1) {
+        return filters.front();
+    }
+    std::string expression;
+    for (const auto &filter : filters) {
+        expression += (expression.empty() ? "(" : " or (") + filter + ")";
+    }
+    return expression;
+}
+
 }
 #endif
\ No newline at end of file
@@ -19,9 +19,14 @@
 #include <functional>
 #include <linux/filter.h>
 #include <linux/if_packet.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <sys/uio.h>
 #include <thread>
+#include <vector>
 
 namespace visor::input::pcap {
 
@@ -35,7 +40,28 @@ struct block_desc {
     struct tpacket_hdr_v1 h1;
 };
 
-class PcapInputStream;
+// where packet time stamps in the ring come from
+enum class AFPacketTimestamp {
+    ring,     // taken by the kernel when the frame is copied into the ring (kernel default)
+    software, // SO_TIMESTAMPING software receive time stamp, taken earlier in the network stack
+    hardware  // NIC receive time stamp, falls back to software for frames the NIC did not stamp
+};
+
+// counters of one socket. the kernel counters are totals since the capture started, the ring samples are the ones
+// taken since the previous call to AFPacket::stats(), one per block as user space picks it up
+struct AFPacketStats {
+    uint64_t packets{0};
+    uint64_t drops{0};
+    uint64_t freeze_q_cnt{0};
+    // share of the ring blocks owned by user space, in percent
+    std::vector<uint64_t> fill_pct;
+    // from the last packet of a block until user space picked it up, which includes the retire timeout of blocks that
+    // did not fill. not sampled with hardware time stamps, as the NIC clock may differ from the system clock
+    std::vector<uint64_t> retire_latency_us;
+};
+
+// called once per retired ring block with all of its frames. the packets point into the ring and are only valid during the call
+typedef void (*OnBlockArrivesCallback)(std::vector<pcpp::RawPacket> &packets, void *cookie);
 
 class AFPacket final
 {
@@ -51,19 +77,32 @@ class AFPacket final
 
     struct sock_fprog bpf;
     std::string filter;
+    bool lock_filter{true};
 
     int fanout_group_id;
+    int fanout_type;
+    AFPacketTimestamp timestamp;
+    // NUMA node of the ring memory and the capture thread, -1 leaves both to the kernel
+    int numa_node;
 
     std::vector<struct iovec> rd;
     uint8_t *map;
 
-    pcpp::OnPacketArrivesCallback cb;
-    PcapInputStream *inputStream;
+    OnBlockArrivesCallback cb;
+    void *cookie;
+    std::vector<pcpp::RawPacket> block_packets;
+
+    // bounds the ring samples kept between two calls to stats()
+    static constexpr size_t MAX_RING_SAMPLES = 4096;
+    std::mutex stats_mutex;
+    AFPacketStats stats_totals;
 
     void flush_block(struct block_desc *pbd);
     void walk_block(struct block_desc *pbd);
+    void sample_ring(struct block_desc *pbd);
 
     void set_interface();
+    void set_timestamping();
     void set_socket_opts();
     void setup();
 
@@ -71,12 +110,18 @@ class AFPacket final
     std::unique_ptr<std::thread> cap_thread;
 
 public:
-    AFPacket(PcapInputStream *stream, pcpp::OnPacketArrivesCallback cb, std::string filter,
+    // as fanout_group_id, opens a new fanout group with an id the kernel picks unique on the host, see fanout_group()
+    static constexpr int NEW_FANOUT_GROUP = -2;
+
+    AFPacket(void *cookie, OnBlockArrivesCallback cb, std::string filter,
         std::string interface_name,
         int fanout_group_id = -1,
+        int fanout_type = PACKET_FANOUT_HASH,
+        AFPacketTimestamp timestamp = AFPacketTimestamp::ring,
         unsigned int block_size = 1 << 22,
         unsigned int frame_size = 1 << 11,
-        unsigned int num_blocks = 64);
+        unsigned int num_blocks = 64,
+        int numa_node = -1);
     ~AFPacket();
 
     void start_capture();
@@ -84,8 +129,114 @@ public:
     {
         running = false;
     }
+
+    // reads and accumulates the kernel counters, and hands over the ring samples. safe to call from any thread
+    AFPacketStats stats();
+
+    // the filter given at construction is locked to the socket, unless this is called before start_capture()
+    void allow_filter_updates()
+    {
+        lock_filter = false;
+    }
+    // replaces the socket filter of a running capture with the union of filters, none lets everything through. false
+    // if they cannot be chained into one socket program, see filter_union_compile. throws PcapException
+    bool set_filter(const std::vector<std::string> &filters);
+
+    unsigned int ring_blocks() const
+    {
+        return num_blocks;
+    }
+
+    // the fanout group the socket joined, -1 without one. only known after start_capture() for NEW_FANOUT_GROUP
+    int fanout_group() const
+    {
+        return fanout_group_id;
+    }
+};
+
+// the AF_PACKET sockets of one interface, shared by every pcap input capturing from it with the same settings, so a
+// frame is copied out of the kernel and walked once however many taps read it. the socket filter lets through what any
+// subscriber wants, and each subscriber's own filter then runs in userspace on the shared frames
+class SharedAFPacket final
+{
+    struct Subscriber {
+        const void *id;
+        // one per worker, frames captured by socket i are handed over with cookies[i]
+        std::vector<void *> cookies;
+        OnBlockArrivesCallback cb;
+        std::string filter;
+        // only compiled when the socket filter lets through more than this subscriber wants
+        struct bpf_program program {
+        };
+        bool has_program{false};
+        // frames of the current block that passed the filter, one vector per worker
+        std::vector<std::vector<pcpp::RawPacket>> filtered;
+        std::atomic<uint64_t> packets{0};
+        // ring samples taken since this subscriber last asked for stats
+        std::vector<uint64_t> fill_pct;
+        std::vector<uint64_t> retire_latency_us;
+    };
+
+    struct Lane {
+        SharedAFPacket *ring;
+        size_t worker;
+    };
+
+    static constexpr size_t MAX_RING_SAMPLES = 4096;
+
+    std::string key;
+    std::string interface_name;
+    size_t workers;
+    int fanout_type;
+    AFPacketTimestamp timestamp;
+    int numa_node;
+
+    // one socket per worker, opened with the first subscriber
+    std::vector<Lane> lanes;
+    std::vector<std::unique_ptr<AFPacket>> devices;
+    std::string socket_filter;
+
+    // held shared while a block is delivered, exclusively to change subscribers
+    std::shared_mutex subscribers_mutex;
+    std::vector<std::unique_ptr<Subscriber>> subscribers;
+    std::mutex stats_mutex;
+
+    static void block_arrives(std::vector<pcpp::RawPacket> &packets, void *cookie);
+    void deliver(size_t worker, std::vector<pcpp::RawPacket> &packets);
+    void compile(Subscriber &subscriber);
+    void update_socket_filter();
+
+    SharedAFPacket(std::string key, std::string interface_name, size_t workers, int fanout_type, AFPacketTimestamp timestamp, int numa_node);
+
+public:
+    ~SharedAFPacket();
+
+    // the ring of this interface, settings and numa_node, opened if no input holds one yet
+    static std::shared_ptr<SharedAFPacket> open(const std::string &interface_name, size_t workers, int fanout_type, AFPacketTimestamp timestamp, int numa_node = -1);
+
+    // cookies holds one cookie per worker. the first subscriber starts the capture. throws PcapException
+    void subscribe(const void *id, std::vector<void *> cookies, OnBlockArrivesCallback cb, const std::string &filter);
+    void unsubscribe(const void *id);
+    // replaces the filter of a subscriber, an empty filter takes everything. throws PcapException
+    void set_filter(const void *id, const std::string &filter);
+
+    // packets are the ones that passed the subscriber's filter, drops and ring samples are those of the shared sockets
+    AFPacketStats stats(const void *id);
+
+    size_t subscriber_count();
+
+    unsigned int ring_blocks() const
+    {
+        return devices.empty() ? 0 : devices.front()->ring_blocks();
+    }
 };
 
 void filter_try_compile(const std::string &, struct sock_fprog *, int);
+// the union of filters as one socket program. each is compiled on its own and a frame it rejects falls through to the
+// next, so offsets moved by one of them (vlan does) never leak into another. false if the chain would exceed the
+// kernel limit or a filter returns a computed length. throws PcapException
+bool filter_union_compile(const std::vector<std::string> &filters, struct sock_fprog *bpf, int link_type);
+// a filter expression naming the union, for display and comparison
+std::string filter_union(const std::vector<std::string> &filters);
 
 } // namespace visor
@@ -0,0 +1,305 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifdef __linux__
+#include "afxdp.h"
+
+#include <pcapplusplus/Packet.h>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+
+namespace visor::input::pcap {
+
+// the socket does not transmit, but binding a UMEM requires a completion ring
+static constexpr uint32_t COMPLETION_RING_SIZE = 64;
+
+AFXDP::AFXDP(void *cookie, OnBlockArrivesCallback cb, std::string filter,
+    std::shared_ptr<XDPProgram> program,
+    uint32_t queue_id,
+    uint32_t frame_size,
+    uint32_t num_frames)
+    : fd(-1)
+    , queue_id(queue_id)
+    , frame_size(frame_size)
+    , num_frames(num_frames)
+    , program(std::move(program))
+    , filter(std::move(filter))
+    , umem(nullptr)
+    , fill()
+    , rx()
+    , zero_copy(false)
+    , cb(cb)
+    , cookie(cookie)
+{
+    if (num_frames == 0 || (num_frames & (num_frames - 1)) != 0) {
+        throw PcapException("AF_XDP frame count must be a power of two");
+    }
+
+    fd = socket(AF_XDP, SOCK_RAW, 0);
+
+    if (fd == -1) {
+        throw PcapException("Failed to create AF_XDP socket: " + std::string(strerror(errno)));
+    }
+}
+
+AFXDP::~AFXDP()
+{
+    if (running) {
+        stop_capture();
+    }
+    if (cap_thread) {
+        cap_thread->join();
+    }
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+    if (rx.map != nullptr) {
+        munmap(rx.map, rx.map_len);
+    }
+    if (fill.map != nullptr) {
+        munmap(fill.map, fill.map_len);
+    }
+    receiver.reset();
+    if (umem != nullptr) {
+        munmap(umem, static_cast<size_t>(frame_size) * num_frames);
+    }
+}
+
+void AFXDP::map_ring(struct ring &r, uint64_t pgoff, const struct xdp_ring_offset &off, size_t desc_size)
+{
+    r.map_len = off.desc + num_frames * desc_size;
+    r.map = mmap(nullptr, r.map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, static_cast<off_t>(pgoff));
+    if (r.map == MAP_FAILED) {
+        r.map = nullptr;
+        throw PcapException("Failed to mmap AF_XDP ring: " + std::string(strerror(errno)));
+    }
+
+    auto base = static_cast<uint8_t *>(r.map);
+    r.ring.producer = reinterpret_cast<uint32_t *>(base + off.producer);
+    r.ring.consumer = reinterpret_cast<uint32_t *>(base + off.consumer);
+    r.ring.flags = reinterpret_cast<uint32_t *>(base + off.flags);
+    r.ring.descs = base + off.desc;
+    r.ring.mask = num_frames - 1;
+}
+
+void AFXDP::set_umem()
+{
+    size_t umem_size = static_cast<size_t>(frame_size) * num_frames;
+    void *area = mmap(nullptr, umem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (area == MAP_FAILED) {
+        throw PcapException("Failed to allocate AF_XDP UMEM: " + std::string(strerror(errno)));
+    }
+    umem = static_cast<uint8_t *>(area);
+
+    struct xdp_umem_reg mr {
+    };
+    memset(&mr, 0, sizeof(mr));
+    mr.addr = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(umem));
+    mr.len = umem_size;
+    mr.chunk_size = frame_size;
+    mr.headroom = 0;
+
+    if (setsockopt(fd, SOL_XDP, XDP_UMEM_REG, &mr, sizeof(mr)) == -1) {
+        throw PcapException("Failed to register AF_XDP UMEM: " + std::string(strerror(errno)));
+    }
+
+    // fill and rx rings can each hold every frame, so returning frames to the fill ring never has to wait
+    uint32_t ring_size = num_frames;
+    uint32_t completion_size = COMPLETION_RING_SIZE;
+    if (setsockopt(fd, SOL_XDP, XDP_UMEM_FILL_RING, &ring_size, sizeof(ring_size)) == -1
+        || setsockopt(fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &completion_size, sizeof(completion_size)) == -1
+        || setsockopt(fd, SOL_XDP, XDP_RX_RING, &ring_size, sizeof(ring_size)) == -1) {
+        throw PcapException("Failed to size AF_XDP rings: " + std::string(strerror(errno)));
+    }
+
+    struct xdp_mmap_offsets off {
+    };
+    socklen_t optlen = sizeof(off);
+    if (getsockopt(fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) == -1) {
+        throw PcapException("Failed to get AF_XDP ring offsets: " + std::string(strerror(errno)));
+    }
+
+    map_ring(fill, XDP_UMEM_PGOFF_FILL_RING, off.fr, sizeof(uint64_t));
+    map_ring(rx, XDP_PGOFF_RX_RING, off.rx, sizeof(struct xdp_desc));
+}
+
+void AFXDP::bind_socket()
+{
+    struct sockaddr_xdp sxdp {
+    };
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = static_cast<uint32_t>(program->if_index());
+    sxdp.sxdp_queue_id = queue_id;
+
+    // native mode tries zero copy first and falls back to copying if the driver does not support it
+    if (program->xdp_mode() == AFXDPMode::native) {
+        sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_ZEROCOPY;
+        if (bind(fd, reinterpret_cast<struct sockaddr *>(&sxdp), sizeof(sxdp)) == 0) {
+            zero_copy = true;
+            return;
+        }
+    }
+
+    sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_COPY;
+    if (bind(fd, reinterpret_cast<struct sockaddr *>(&sxdp), sizeof(sxdp)) == -1) {
+        throw PcapException("Failed binding the AF_XDP socket to queue " + std::to_string(queue_id) + ": " + std::string(strerror(errno)));
+    }
+}
+
+void AFXDP::setup()
+{
+    set_umem();
+    bind_socket();
+
+    receiver = std::make_unique<XDPReceiver>(umem, frame_size, num_frames, fill.ring, rx.ring, filter, cookie, cb);
+    receiver->fill_all();
+
+    program->register_socket(queue_id, fd);
+}
+
+XDPReceiver::XDPReceiver(uint8_t *umem, uint32_t frame_size, uint32_t num_frames, XDPRing fill, XDPRing rx,
+    const std::string &filter, void *cookie, OnBlockArrivesCallback cb)
+    : umem(umem)
+    , frame_size(frame_size)
+    , num_frames(num_frames)
+    , fill(fill)
+    , rx(rx)
+    , bpf()
+    , has_filter(false)
+    , cb(cb)
+    , cookie(cookie)
+{
+    // AF_XDP sockets take no classic BPF filter, so it runs in userspace on the UMEM frames instead
+    if (!filter.empty()) {
+        pcap_t *handle = pcap_open_dead(DLT_EN10MB, 65535);
+        if (handle == nullptr) {
+            throw PcapException("Failed to open pcap handle");
+        }
+        if (pcap_compile(handle, &bpf, filter.c_str(), 1, PCAP_NETMASK_UNKNOWN) < 0) {
+            pcap_close(handle);
+            throw PcapException("Failed to parse bpf filter: " + filter);
+        }
+        pcap_close(handle);
+        has_filter = true;
+    }
+    batch_frames.reserve(num_frames);
+}
+
+XDPReceiver::~XDPReceiver()
+{
+    if (has_filter) {
+        pcap_freecode(&bpf);
+    }
+}
+
+void XDPReceiver::fill_all()
+{
+    for (uint32_t i = 0; i < num_frames; ++i) {
+        batch_frames.push_back(static_cast<uint64_t>(i) * frame_size);
+    }
+    refill(batch_frames.data(), num_frames);
+    batch_frames.clear();
+}
+
+void XDPReceiver::refill(const uint64_t *addrs, uint32_t count)
+{
+    // every frame is in exactly one place: the fill ring, the rx ring or this batch. the fill ring holds all
+    // of them, so there is always room for the ones coming back
+    uint32_t prod = *fill.producer;
+    auto descs = static_cast<uint64_t *>(fill.descs);
+    for (uint32_t i = 0; i < count; ++i) {
+        descs[(prod + i) & fill.mask] = addrs[i];
+    }
+    __atomic_store_n(fill.producer, prod + count, __ATOMIC_RELEASE);
+}
+
+bool XDPReceiver::receive_batch()
+{
+    uint32_t cons = *rx.consumer;
+    uint32_t count = __atomic_load_n(rx.producer, __ATOMIC_ACQUIRE) - cons;
+    if (count == 0) {
+        return false;
+    }
+
+    // rx descriptors carry no time stamp, so the whole batch is stamped on arrival in userspace
+    timespec now{};
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    batch_packets.clear();
+    batch_packets.reserve(count);
+
+    auto descs = static_cast<const struct xdp_desc *>(rx.descs);
+    for (uint32_t i = 0; i < count; ++i) {
+        const auto &desc = descs[(cons + i) & rx.mask];
+        // the descriptor points past the kernel headroom, the fill ring wants the start of the frame back
+        batch_frames.push_back(desc.addr - (desc.addr % frame_size));
+
+        auto data = umem + desc.addr;
+        if (has_filter) {
+            struct pcap_pkthdr hdr {
+            };
+            hdr.ts.tv_sec = now.tv_sec;
+            hdr.ts.tv_usec = now.tv_nsec / 1000;
+            hdr.caplen = desc.len;
+            hdr.len = desc.len;
+            if (pcap_offline_filter(&bpf, &hdr, data) == 0) {
+                continue;
+            }
+        }
+        batch_packets.emplace_back(data, static_cast<int>(desc.len), now, false, pcpp::LINKTYPE_ETHERNET);
+    }
+
+    if (!batch_packets.empty()) {
+        cb(batch_packets, cookie);
+    }
+
+    __atomic_store_n(rx.consumer, cons + count, __ATOMIC_RELEASE);
+    refill(batch_frames.data(), count);
+    batch_frames.clear();
+
+    return true;
+}
+
+void AFXDP::start_capture()
+{
+    // Configure the xdp socket.
+    setup();
+
+    running = true;
+
+    cap_thread = std::make_unique<std::thread>([this] {
+        struct pollfd pfd {
+        };
+        memset(&pfd, 0, sizeof(pfd));
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        while (running) {
+            if (!receiver->receive_batch()) {
+                // with need_wakeup, poll also kicks the driver to process the fill ring
+                poll(&pfd, 1, 100);
+            }
+        }
+    });
+}
+
+}
+#endif
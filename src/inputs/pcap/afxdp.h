@@ -0,0 +1,121 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include "PcapException.h"
+#include "afpacket.h"
+#include "xdpprogram.h"
+#include <pcap/pcap.h>
+#include <atomic>
+#include <cstdint>
+#include <linux/if_xdp.h>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace visor::input::pcap {
+
+// a ring shared with the kernel: its producer and consumer indices, and the descriptors they index
+struct XDPRing {
+    uint32_t *producer{nullptr};
+    uint32_t *consumer{nullptr};
+    uint32_t *flags{nullptr};
+    void *descs{nullptr};
+    uint32_t mask{0};
+};
+
+// the userspace side of a UMEM: hands the frames the kernel put on the rx ring to the callback, through the BPF
+// filter if there is one, and gives every frame back on the fill ring. it only touches memory laid out the way the
+// kernel lays it out, so it works the same over a plain buffer
+class XDPReceiver final
+{
+    uint8_t *umem;
+    uint32_t frame_size;
+    uint32_t num_frames;
+    XDPRing fill;
+    XDPRing rx;
+
+    struct bpf_program bpf;
+    bool has_filter;
+
+    OnBlockArrivesCallback cb;
+    void *cookie;
+    std::vector<uint64_t> batch_frames;
+    std::vector<pcpp::RawPacket> batch_packets;
+
+public:
+    XDPReceiver(uint8_t *umem, uint32_t frame_size, uint32_t num_frames, XDPRing fill, XDPRing rx,
+        const std::string &filter, void *cookie, OnBlockArrivesCallback cb);
+    ~XDPReceiver();
+    XDPReceiver(const XDPReceiver &) = delete;
+    XDPReceiver &operator=(const XDPReceiver &) = delete;
+
+    // hands every frame of the UMEM to the kernel
+    void fill_all();
+    void refill(const uint64_t *addrs, uint32_t count);
+    // false if the rx ring was empty
+    bool receive_batch();
+};
+
+// a single AF_XDP socket bound to one queue of the interface. frames are handed to the callback straight out
+// of the UMEM, in the same form as AFPacket blocks, and given back to the kernel when the callback returns
+class AFXDP final
+{
+    int fd;
+
+    uint32_t queue_id;
+    uint32_t frame_size;
+    uint32_t num_frames;
+
+    std::shared_ptr<XDPProgram> program;
+
+    std::string filter;
+
+    struct ring {
+        XDPRing ring;
+        void *map;
+        size_t map_len;
+    };
+
+    uint8_t *umem;
+    struct ring fill;
+    struct ring rx;
+    bool zero_copy;
+
+    OnBlockArrivesCallback cb;
+    void *cookie;
+    std::unique_ptr<XDPReceiver> receiver;
+
+    void map_ring(struct ring &r, uint64_t pgoff, const struct xdp_ring_offset &off, size_t desc_size);
+
+    void set_umem();
+    void bind_socket();
+    void setup();
+
+    std::atomic<bool> running{false};
+    std::unique_ptr<std::thread> cap_thread;
+
+public:
+    AFXDP(void *cookie, OnBlockArrivesCallback cb, std::string filter,
+        std::shared_ptr<XDPProgram> program,
+        uint32_t queue_id,
+        uint32_t frame_size = 1 << 12,
+        uint32_t num_frames = 1 << 12);
+    ~AFXDP();
+
+    void start_capture();
+    void stop_capture()
+    {
+        running = false;
+    }
+
+    bool is_zero_copy() const
+    {
+        return zero_copy;
+    }
+};
+
+}
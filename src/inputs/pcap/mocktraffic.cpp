@@ -0,0 +1,249 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#include "mocktraffic.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fmt/format.h>
+
+namespace visor::input::pcap {
+
+static constexpr uint8_t SERVER_MAC[6] = {0x00, 0x50, 0x43, 0x11, 0x22, 0x33};
+static constexpr uint8_t CLIENT_MAC[6] = {0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x01};
+static constexpr uint32_t SERVER_IP = 0xc0a80001; // 192.168.0.1
+static constexpr uint32_t CLIENT_NET = 0x0a000000; // 10.0.0.0/8
+static constexpr uint32_t MAX_CLIENTS = 0xfffffe;
+
+static constexpr uint8_t TCP_RST = 0x04;
+static constexpr uint8_t TCP_PSH = 0x08;
+static constexpr uint8_t TCP_ACK = 0x10;
+
+// offsets into the ethernet frame
+static constexpr size_t IP_OFFSET = 14;
+static constexpr size_t L4_OFFSET = IP_OFFSET + 20;
+
+static const std::map<std::string, uint16_t> QTYPES = {
+    {"A", 1}, {"NS", 2}, {"CNAME", 5}, {"SOA", 6}, {"PTR", 12}, {"MX", 15}, {"TXT", 16}, {"AAAA", 28}, {"SRV", 33}, {"HTTPS", 65}, {"ANY", 255}};
+
+static const std::map<std::string, uint8_t> RCODES = {
+    {"NOERROR", 0}, {"FORMERR", 1}, {"SERVFAIL", 2}, {"NXDOMAIN", 3}, {"NOTIMP", 4}, {"REFUSED", 5}};
+
+static inline void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = static_cast<uint8_t>(v >> 8);
+    p[1] = static_cast<uint8_t>(v);
+}
+
+static inline void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = static_cast<uint8_t>(v >> 24);
+    p[1] = static_cast<uint8_t>(v >> 16);
+    p[2] = static_cast<uint8_t>(v >> 8);
+    p[3] = static_cast<uint8_t>(v);
+}
+
+static uint16_t ipv4_checksum(const uint8_t *header)
+{
+    uint32_t sum{0};
+    for (size_t i = 0; i < 20; i += 2) {
+        sum += static_cast<uint32_t>(header[i] << 8 | header[i + 1]);
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return static_cast<uint16_t>(~sum);
+}
+
+template <typename T>
+static std::vector<double> weights(const std::map<std::string, uint64_t> &config, const std::map<std::string, T> &known, std::vector<T> &values, const std::string &key)
+{
+    std::vector<double> result;
+    for (const auto &[name, weight] : config) {
+        auto it = known.find(name);
+        if (it == known.end()) {
+            throw PcapException(fmt::format("unknown {} '{}'", key, name));
+        }
+        values.push_back(it->second);
+        result.push_back(static_cast<double>(weight));
+    }
+    if (values.empty() || std::all_of(result.begin(), result.end(), [](double w) { return w == 0; })) {
+        throw PcapException(fmt::format("{} needs at least one non zero weight", key));
+    }
+    return result;
+}
+
+MockTrafficGenerator::MockTrafficGenerator(const MockTrafficConfig &config)
+    : _rng(std::random_device{}())
+{
+    if (config.qnames < 1 || config.qnames > 10'000'000) {
+        throw PcapException("mock_qnames must be between 1 and 10000000");
+    }
+    if (config.clients < 1 || config.clients > MAX_CLIENTS) {
+        throw PcapException(fmt::format("mock_clients must be between 1 and {}", MAX_CLIENTS));
+    }
+    if (config.tcp_pct > 100) {
+        throw PcapException("mock_tcp_pct must be between 0 and 100");
+    }
+    if (config.duplicate_pct > 100) {
+        throw PcapException("mock_duplicate_pct must be between 0 and 100");
+    }
+    if (!(config.qname_zipf >= 0)) {
+        throw PcapException("mock_qname_zipf must not be negative");
+    }
+
+    auto qtype_weights = weights(config.qtypes, QTYPES, _qtypes, "mock_qtypes");
+    _qtype_dist = std::discrete_distribution<size_t>(qtype_weights.begin(), qtype_weights.end());
+    auto rcode_weights = weights(config.rcodes, RCODES, _rcodes, "mock_rcodes");
+    _rcode_dist = std::discrete_distribution<size_t>(rcode_weights.begin(), rcode_weights.end());
+
+    // rank k is requested with probability proportional to 1 / k^s
+    std::vector<double> qname_weights(config.qnames);
+    for (size_t k = 0; k < config.qnames; ++k) {
+        qname_weights[k] = 1.0 / std::pow(static_cast<double>(k + 1), config.qname_zipf);
+    }
+    _qname_dist = std::discrete_distribution<size_t>(qname_weights.begin(), qname_weights.end());
+
+    _client_dist = std::uniform_int_distribution<uint32_t>(1, static_cast<uint32_t>(config.clients));
+    if (config.latency_ms) {
+        _latency = true;
+        _latency_dist = std::exponential_distribution<double>(1.0 / static_cast<double>(config.latency_ms));
+    }
+    _tcp_dist = std::bernoulli_distribution(static_cast<double>(config.tcp_pct) / 100.0);
+    _duplicate_dist = std::bernoulli_distribution(static_cast<double>(config.duplicate_pct) / 100.0);
+
+    // q<rank>.z<rank % 100>.pktvisor-mock.dev, so qname2 and qname3 aggregates have some spread as well
+    _qname_index.reserve(config.qnames);
+    for (size_t k = 0; k < config.qnames; ++k) {
+        auto offset = static_cast<uint32_t>(_qname_wire.size());
+        for (const auto &label : {"q" + std::to_string(k), "z" + std::to_string(k % 100), std::string("pktvisor-mock"), std::string("dev")}) {
+            _qname_wire.push_back(static_cast<uint8_t>(label.size()));
+            _qname_wire.insert(_qname_wire.end(), label.begin(), label.end());
+        }
+        _qname_wire.push_back(0);
+        _qname_index.emplace_back(offset, static_cast<uint16_t>(_qname_wire.size() - offset));
+    }
+
+    std::memset(_udp_template, 0, sizeof(_udp_template));
+    std::memset(_tcp_template, 0, sizeof(_tcp_template));
+    for (auto header : {_udp_template, _tcp_template}) {
+        put16(header + 12, 0x0800);
+        auto ip = header + IP_OFFSET;
+        ip[0] = 0x45;
+        put16(ip + 6, 0x4000); // don't fragment
+        ip[8] = 64;
+    }
+    _udp_template[IP_OFFSET + 9] = 17;
+    _tcp_template[IP_OFFSET + 9] = 6;
+    _tcp_template[L4_OFFSET + 12] = 5 << 4;
+    put16(_tcp_template + L4_OFFSET + 14, 0xffff);
+}
+
+size_t MockTrafficGenerator::_write_dns(uint8_t *out, bool query, uint16_t txid, uint8_t rcode, size_t qname, uint16_t qtype) const
+{
+    // header: recursion desired, and for responses also recursion available and the rcode
+    std::memset(out, 0, 12);
+    put16(out, txid);
+    put16(out + 2, query ? 0x0100 : static_cast<uint16_t>(0x8180 | rcode));
+    put16(out + 4, 1);
+
+    // question
+    const auto &[offset, len] = _qname_index[qname];
+    std::memcpy(out + 12, _qname_wire.data() + offset, len);
+    put16(out + 12 + len, qtype);
+    put16(out + 14 + len, 1);
+    return 16 + len;
+}
+
+size_t MockTrafficGenerator::_write_headers(uint8_t *out, bool tcp, bool query, uint32_t client_ip, uint16_t client_port, uint32_t seq, uint32_t ack, uint8_t tcp_flags, size_t payload_len) const
+{
+    auto headers_size = tcp ? TCP_HEADERS_SIZE : UDP_HEADERS_SIZE;
+    std::memcpy(out, tcp ? _tcp_template : _udp_template, headers_size);
+
+    std::memcpy(out, query ? SERVER_MAC : CLIENT_MAC, 6);
+    std::memcpy(out + 6, query ? CLIENT_MAC : SERVER_MAC, 6);
+
+    auto ip = out + IP_OFFSET;
+    put16(ip + 2, static_cast<uint16_t>(headers_size - IP_OFFSET + payload_len));
+    put16(ip + 4, static_cast<uint16_t>(seq));
+    put32(ip + 12, query ? client_ip : SERVER_IP);
+    put32(ip + 16, query ? SERVER_IP : client_ip);
+    put16(ip + 10, ipv4_checksum(ip));
+
+    // transport checksums are left at zero, which means none for UDP; nothing in the pipeline verifies TCP's
+    auto l4 = out + L4_OFFSET;
+    put16(l4, query ? client_port : 53);
+    put16(l4 + 2, query ? 53 : client_port);
+    if (tcp) {
+        put32(l4 + 4, seq);
+        put32(l4 + 8, ack);
+        l4[13] = tcp_flags;
+    } else {
+        put16(l4 + 4, static_cast<uint16_t>(8 + payload_len));
+    }
+    return headers_size + payload_len;
+}
+
+void MockTrafficGenerator::generate(std::vector<pcpp::RawPacket> &batch, size_t transactions, timespec now)
+{
+    // up to three packets per transaction, sized before writing so the buffer never moves under this batch
+    if (_buffer.size() < transactions * 3 * MAX_PACKET_SIZE) {
+        _buffer.resize(transactions * 3 * MAX_PACKET_SIZE);
+    }
+    batch.reserve(batch.size() + transactions * 6);
+
+    auto out = _buffer.data();
+    auto emit = [this, &batch, &out](size_t len, timespec stamp) {
+        batch.emplace_back(out, static_cast<int>(len), stamp, false, pcpp::LINKTYPE_ETHERNET);
+        // a copy is another view of the same bytes
+        if (_duplicate_dist(_rng)) {
+            batch.emplace_back(out, static_cast<int>(len), stamp, false, pcpp::LINKTYPE_ETHERNET);
+        }
+        out += MAX_PACKET_SIZE;
+    };
+
+    for (size_t i = 0; i < transactions; ++i) {
+        auto qname = _qname_dist(_rng);
+        auto qtype = _qtypes[_qtype_dist(_rng)];
+        auto rcode = _rcodes[_rcode_dist(_rng)];
+        auto client_ip = CLIENT_NET | _client_dist(_rng);
+        auto tcp = _tcp_dist(_rng);
+        auto bits = _rng();
+        auto client_port = static_cast<uint16_t>(1024 + (bits & 0xffff) % 64512);
+        auto txid = static_cast<uint16_t>(bits >> 16);
+        auto client_seq = static_cast<uint32_t>(bits >> 32);
+        auto server_seq = static_cast<uint32_t>(_rng());
+
+        auto response_stamp = now;
+        if (_latency) {
+            auto ns = static_cast<uint64_t>(_latency_dist(_rng) * 1e6) + static_cast<uint64_t>(now.tv_nsec);
+            response_stamp.tv_sec += static_cast<time_t>(ns / 1'000'000'000);
+            response_stamp.tv_nsec = static_cast<long>(ns % 1'000'000'000);
+        }
+
+        if (!tcp) {
+            auto dns_len = _write_dns(out + UDP_HEADERS_SIZE, true, txid, 0, qname, qtype);
+            emit(_write_headers(out, false, true, client_ip, client_port, client_seq, 0, 0, dns_len), now);
+            dns_len = _write_dns(out + UDP_HEADERS_SIZE, false, txid, rcode, qname, qtype);
+            emit(_write_headers(out, false, false, client_ip, client_port, server_seq, 0, 0, dns_len), response_stamp);
+            continue;
+        }
+
+        // dns over tcp carries a two byte length prefix
+        auto dns_len = _write_dns(out + TCP_HEADERS_SIZE + 2, true, txid, 0, qname, qtype);
+        put16(out + TCP_HEADERS_SIZE, static_cast<uint16_t>(dns_len));
+        auto query_len = static_cast<uint32_t>(dns_len + 2);
+        emit(_write_headers(out, true, true, client_ip, client_port, client_seq, server_seq, TCP_PSH | TCP_ACK, query_len), now);
+
+        dns_len = _write_dns(out + TCP_HEADERS_SIZE + 2, false, txid, rcode, qname, qtype);
+        put16(out + TCP_HEADERS_SIZE, static_cast<uint16_t>(dns_len));
+        emit(_write_headers(out, true, false, client_ip, client_port, server_seq, client_seq + query_len, TCP_PSH | TCP_ACK, dns_len + 2), response_stamp);
+
+        // the client resets the connection once it has its answer, which releases the reassembly state right away
+        emit(_write_headers(out, true, true, client_ip, client_port, client_seq + query_len, 0, TCP_RST, 0), response_stamp);
+    }
+}
+
+}
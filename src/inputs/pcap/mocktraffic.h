@@ -0,0 +1,91 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include "PcapException.h"
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+#include <pcapplusplus/RawPacket.h>
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace visor::input::pcap {
+
+// shape of the synthetic dns traffic, read from the mock_* configs of the pcap input
+struct MockTrafficConfig {
+    // dns transactions per second, 0 generates as fast as possible
+    uint64_t rate{10};
+    // number of distinct qnames, their popularity follows a Zipf distribution with this exponent
+    uint64_t qnames{1000};
+    double qname_zipf{1.0};
+    // number of distinct client addresses, picked uniformly
+    uint64_t clients{1000};
+    // relative weights
+    std::map<std::string, uint64_t> qtypes{{"A", 50}, {"AAAA", 30}, {"PTR", 10}, {"MX", 5}, {"TXT", 5}};
+    std::map<std::string, uint64_t> rcodes{{"NOERROR", 85}, {"NXDOMAIN", 10}, {"SERVFAIL", 3}, {"REFUSED", 2}};
+    // mean of the exponentially distributed response latency
+    uint64_t latency_ms{20};
+    // share of transactions over TCP, in percent
+    uint64_t tcp_pct{0};
+    // share of packets delivered twice, like an aggregated SPAN port does, in percent
+    uint64_t duplicate_pct{0};
+};
+
+// generates dns transactions between a server at 192.168.0.1 and clients in 10.0.0.0/8. the question section of every
+// qname and the layer 2-4 headers are built once; each packet is a copy of its templates with the per transaction
+// fields (addresses, ports, ids, qtype, rcode, lengths and checksum) patched in place
+class MockTrafficGenerator
+{
+    static constexpr size_t MAX_PACKET_SIZE = 384;
+    static constexpr size_t UDP_HEADERS_SIZE = 14 + 20 + 8;
+    static constexpr size_t TCP_HEADERS_SIZE = 14 + 20 + 20;
+
+    std::mt19937_64 _rng;
+    std::discrete_distribution<size_t> _qname_dist;
+    std::discrete_distribution<size_t> _qtype_dist;
+    std::discrete_distribution<size_t> _rcode_dist;
+    std::uniform_int_distribution<uint32_t> _client_dist;
+    std::exponential_distribution<double> _latency_dist;
+    std::bernoulli_distribution _tcp_dist;
+    std::bernoulli_distribution _duplicate_dist;
+    bool _latency{false};
+
+    std::vector<uint16_t> _qtypes;
+    std::vector<uint8_t> _rcodes;
+
+    // wire format qnames, back to back, with their offset and length
+    std::vector<uint8_t> _qname_wire;
+    std::vector<std::pair<uint32_t, uint16_t>> _qname_index;
+
+    // ethernet, ipv4 and udp/tcp headers of a query, with everything that does not vary filled in
+    uint8_t _udp_template[UDP_HEADERS_SIZE];
+    uint8_t _tcp_template[TCP_HEADERS_SIZE];
+
+    // packets of the last batch point into this buffer
+    std::vector<uint8_t> _buffer;
+
+    size_t _write_dns(uint8_t *out, bool query, uint16_t txid, uint8_t rcode, size_t qname, uint16_t qtype) const;
+    size_t _write_headers(uint8_t *out, bool tcp, bool query, uint32_t client_ip, uint16_t client_port, uint32_t seq, uint32_t ack, uint8_t tcp_flags, size_t payload_len) const;
+
+public:
+    // throws PcapException on an invalid config
+    explicit MockTrafficGenerator(const MockTrafficConfig &config);
+
+    // appends the packets of the given number of transactions to batch: query and response, and for TCP a closing
+    // reset, each possibly followed by a copy of itself. queries are stamped with now, responses with now plus their latency. the packets stay valid until the
+    // next call
+    void generate(std::vector<pcpp::RawPacket> &batch, size_t transactions, timespec now);
+};
+
+}
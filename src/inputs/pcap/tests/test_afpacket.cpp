@@ -0,0 +1,71 @@
+#ifdef __linux__
+#include "afpacket.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstdlib>
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+#include <pcapplusplus/EthLayer.h>
+#include <pcapplusplus/IPv4Layer.h>
+#include <pcapplusplus/Packet.h>
+#include <pcapplusplus/UdpLayer.h>
+#include <pcapplusplus/VlanLayer.h>
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+using namespace visor::input::pcap;
+
+static pcpp::Packet udp_packet(uint16_t dst_port, bool tagged)
+{
+    pcpp::Packet packet(100);
+    packet.addLayer(new pcpp::EthLayer(pcpp::MacAddress("00:00:00:00:00:01"), pcpp::MacAddress("00:00:00:00:00:02"), tagged ? PCPP_ETHERTYPE_VLAN : PCPP_ETHERTYPE_IP), true);
+    if (tagged) {
+        packet.addLayer(new pcpp::VlanLayer(100, false, 0, PCPP_ETHERTYPE_IP), true);
+    }
+    packet.addLayer(new pcpp::IPv4Layer(pcpp::IPv4Address("10.0.0.1"), pcpp::IPv4Address("192.168.0.1")), true);
+    packet.addLayer(new pcpp::UdpLayer(40000, dst_port), true);
+    packet.computeCalculateFields();
+    return packet;
+}
+
+// runs the socket program the way the kernel would, the instruction layouts are the same
+static bool matches(const struct sock_fprog &bpf, const pcpp::Packet &packet)
+{
+    auto raw = packet.getRawPacketReadOnly();
+    auto len = static_cast<u_int>(raw->getRawDataLen());
+    return bpf_filter(reinterpret_cast<const struct bpf_insn *>(bpf.filter), raw->getRawData(), len, len) != 0;
+}
+
+TEST_CASE("AF_PACKET filter union keeps vlan filters apart", "[pcap][afpacket]")
+{
+    // the form bpf_pushdown gives each input
+    std::vector<std::string> filters{
+        "udp port 53 or (vlan and (udp port 53))",
+        "udp port 123 or (vlan and (udp port 123))"};
+
+    struct sock_fprog bpf {
+    };
+    REQUIRE(filter_union_compile(filters, &bpf, DLT_EN10MB));
+
+    CHECK(matches(bpf, udp_packet(53, false)));
+    CHECK(matches(bpf, udp_packet(53, true)));
+    CHECK(matches(bpf, udp_packet(123, false)));
+    CHECK(matches(bpf, udp_packet(123, true)));
+    CHECK_FALSE(matches(bpf, udp_packet(80, false)));
+    CHECK_FALSE(matches(bpf, udp_packet(80, true)));
+    free(bpf.filter);
+
+    CHECK(filter_union(filters) == "(udp port 53 or (vlan and (udp port 53))) or (udp port 123 or (vlan and (udp port 123)))");
+    CHECK(filter_union({"udp"}) == "udp");
+}
+
+TEST_CASE("AF_PACKET filter union rejects bad filters", "[pcap][afpacket]")
+{
+    struct sock_fprog bpf {
+    };
+    CHECK_THROWS_AS(filter_union_compile({"udp", "not a filter"}, &bpf, DLT_EN10MB), PcapException);
+    CHECK_FALSE(filter_union_compile({}, &bpf, DLT_EN10MB));
+}
+#endif
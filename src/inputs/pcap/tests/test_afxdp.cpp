@@ -0,0 +1,179 @@
+#ifdef __linux__
+#include "afxdp.h"
+#include <catch2/catch_test_macros.hpp>
+#include <cstring>
+#include <set>
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+#include <pcapplusplus/EthLayer.h>
+#include <pcapplusplus/IPv4Layer.h>
+#include <pcapplusplus/Packet.h>
+#include <pcapplusplus/UdpLayer.h>
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+using namespace visor::input::pcap;
+
+static constexpr uint32_t FRAME_SIZE = 2048;
+static constexpr uint32_t NUM_FRAMES = 8;
+// the kernel writes packets past a headroom inside the frame
+static constexpr uint64_t HEADROOM = 256;
+
+// plays the kernel side of a UMEM over plain memory
+struct FakeUmem {
+    std::vector<uint8_t> umem = std::vector<uint8_t>(FRAME_SIZE * NUM_FRAMES);
+    uint32_t fill_prod{0}, fill_cons{0}, fill_flags{0};
+    uint32_t rx_prod{0}, rx_cons{0}, rx_flags{0};
+    std::vector<uint64_t> fill_descs = std::vector<uint64_t>(NUM_FRAMES);
+    std::vector<struct xdp_desc> rx_descs = std::vector<struct xdp_desc>(NUM_FRAMES);
+
+    XDPRing fill_ring()
+    {
+        return XDPRing{&fill_prod, &fill_cons, &fill_flags, fill_descs.data(), NUM_FRAMES - 1};
+    }
+
+    XDPRing rx_ring()
+    {
+        return XDPRing{&rx_prod, &rx_cons, &rx_flags, rx_descs.data(), NUM_FRAMES - 1};
+    }
+
+    uint32_t fill_available() const
+    {
+        return fill_prod - fill_cons;
+    }
+
+    // takes a frame off the fill ring, copies the packet into it and posts it on the rx ring
+    uint64_t receive(const pcpp::Packet &packet)
+    {
+        REQUIRE(fill_available() > 0);
+        uint64_t frame = fill_descs[fill_cons++ & (NUM_FRAMES - 1)];
+        auto raw = packet.getRawPacketReadOnly();
+        std::memcpy(umem.data() + frame + HEADROOM, raw->getRawData(), raw->getRawDataLen());
+        rx_descs[rx_prod++ & (NUM_FRAMES - 1)] = xdp_desc{frame + HEADROOM, static_cast<uint32_t>(raw->getRawDataLen()), 0};
+        return frame;
+    }
+};
+
+static pcpp::Packet udp_packet(uint16_t dst_port)
+{
+    pcpp::Packet packet(100);
+    packet.addLayer(new pcpp::EthLayer(pcpp::MacAddress("00:00:00:00:00:01"), pcpp::MacAddress("00:00:00:00:00:02")), true);
+    packet.addLayer(new pcpp::IPv4Layer(pcpp::IPv4Address("10.0.0.1"), pcpp::IPv4Address("192.168.0.1")), true);
+    packet.addLayer(new pcpp::UdpLayer(40000, dst_port), true);
+    packet.computeCalculateFields();
+    return packet;
+}
+
+struct Received {
+    std::vector<std::vector<uint8_t>> packets;
+    size_t batches{0};
+};
+
+static void on_batch(std::vector<pcpp::RawPacket> &batch, void *cookie)
+{
+    auto received = static_cast<Received *>(cookie);
+    ++received->batches;
+    for (auto &packet : batch) {
+        received->packets.emplace_back(packet.getRawData(), packet.getRawData() + packet.getRawDataLen());
+    }
+}
+
+TEST_CASE("AF_XDP receiver hands every frame to the kernel", "[pcap][afxdp]")
+{
+    FakeUmem fake;
+    Received received;
+    XDPReceiver receiver(fake.umem.data(), FRAME_SIZE, NUM_FRAMES, fake.fill_ring(), fake.rx_ring(), "", &received, on_batch);
+
+    receiver.fill_all();
+    CHECK(fake.fill_available() == NUM_FRAMES);
+    std::set<uint64_t> frames(fake.fill_descs.begin(), fake.fill_descs.end());
+    CHECK(frames.size() == NUM_FRAMES);
+    for (auto frame : frames) {
+        CHECK(frame % FRAME_SIZE == 0);
+    }
+
+    CHECK_FALSE(receiver.receive_batch());
+    CHECK(received.batches == 0);
+}
+
+TEST_CASE("AF_XDP receiver delivers a batch and recycles its frames", "[pcap][afxdp]")
+{
+    FakeUmem fake;
+    Received received;
+    XDPReceiver receiver(fake.umem.data(), FRAME_SIZE, NUM_FRAMES, fake.fill_ring(), fake.rx_ring(), "", &received, on_batch);
+    receiver.fill_all();
+
+    auto packet = udp_packet(53);
+    std::set<uint64_t> used;
+    for (int i = 0; i < 3; ++i) {
+        used.insert(fake.receive(packet));
+    }
+    CHECK(fake.fill_available() == NUM_FRAMES - 3);
+
+    CHECK(receiver.receive_batch());
+    CHECK(received.batches == 1);
+    REQUIRE(received.packets.size() == 3);
+    auto raw = packet.getRawPacketReadOnly();
+    CHECK(received.packets[0] == std::vector<uint8_t>(raw->getRawData(), raw->getRawData() + raw->getRawDataLen()));
+
+    // the rx ring is consumed and the frames are back on the fill ring at their start, not past the headroom
+    CHECK(fake.rx_cons == fake.rx_prod);
+    CHECK(fake.fill_available() == NUM_FRAMES);
+    std::set<uint64_t> returned;
+    for (uint32_t i = fake.fill_prod - 3; i != fake.fill_prod; ++i) {
+        returned.insert(fake.fill_descs[i & (NUM_FRAMES - 1)]);
+    }
+    CHECK(returned == used);
+}
+
+TEST_CASE("AF_XDP receiver keeps recycling past the ring size", "[pcap][afxdp]")
+{
+    FakeUmem fake;
+    Received received;
+    XDPReceiver receiver(fake.umem.data(), FRAME_SIZE, NUM_FRAMES, fake.fill_ring(), fake.rx_ring(), "", &received, on_batch);
+    receiver.fill_all();
+
+    auto packet = udp_packet(53);
+    // a full ring per batch, many times over: any frame lost along the way would starve the fill ring
+    for (uint32_t round = 0; round < 4 * NUM_FRAMES; ++round) {
+        for (uint32_t i = 0; i < NUM_FRAMES; ++i) {
+            fake.receive(packet);
+        }
+        CHECK(fake.fill_available() == 0);
+        CHECK(receiver.receive_batch());
+        CHECK(fake.fill_available() == NUM_FRAMES);
+    }
+    CHECK(received.packets.size() == 4 * NUM_FRAMES * NUM_FRAMES);
+}
+
+TEST_CASE("AF_XDP receiver filters in userspace and still recycles dropped frames", "[pcap][afxdp]")
+{
+    FakeUmem fake;
+    Received received;
+    XDPReceiver receiver(fake.umem.data(), FRAME_SIZE, NUM_FRAMES, fake.fill_ring(), fake.rx_ring(), "udp port 53", &received, on_batch);
+    receiver.fill_all();
+
+    fake.receive(udp_packet(53));
+    fake.receive(udp_packet(123));
+    fake.receive(udp_packet(53));
+    CHECK(receiver.receive_batch());
+    CHECK(received.packets.size() == 2);
+    CHECK(fake.fill_available() == NUM_FRAMES);
+
+    // a batch the filter drops entirely is not handed to the callback, but its frames come back
+    fake.receive(udp_packet(123));
+    CHECK(receiver.receive_batch());
+    CHECK(received.batches == 1);
+    CHECK(fake.fill_available() == NUM_FRAMES);
+}
+
+TEST_CASE("AF_XDP receiver rejects a bad filter", "[pcap][afxdp]")
+{
+    FakeUmem fake;
+    Received received;
+    CHECK_THROWS_AS(XDPReceiver(fake.umem.data(), FRAME_SIZE, NUM_FRAMES, fake.fill_ring(), fake.rx_ring(), "not a filter", &received, on_batch), PcapException);
+}
+#endif
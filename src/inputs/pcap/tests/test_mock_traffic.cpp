@@ -1,5 +1,21 @@
+#include "Numa.h"
 #include "PcapInputStream.h"
+#include "mocktraffic.h"
 #include <catch2/catch_test_macros.hpp>
+#include <filesystem>
+#include <fstream>
+#include <unistd.h>
+#include <variant>
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+#include <pcapplusplus/DnsLayer.h>
+#include <pcapplusplus/Packet.h>
+#include <pcapplusplus/TcpLayer.h>
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
 
 using namespace visor::input::pcap;
 using namespace std::chrono;
@@ -18,3 +34,237 @@ TEST_CASE("Test mock traffic generator", "[pcap][mock]")
 
 }
 
+
+TEST_CASE("Test mock traffic with tcp reassembly threads", "[pcap][mock]")
+{
+
+    PcapInputStream stream{"pcap-test"};
+    stream.config_set("host_spec", "192.168.0.0/24");
+    stream.config_set("pcap_source", "mock");
+    stream.config_set<uint64_t>("mock_rate", 1000);
+    stream.config_set<uint64_t>("mock_tcp_pct", 50);
+    stream.config_set<uint64_t>("tcp_reassembly_threads", 2);
+    stream.parse_host_spec();
+
+    visor::Config c;
+    auto proxy = static_cast<PcapInputEventProxy *>(stream.add_event_proxy(c));
+    proxy->register_tcp_ports("test", nullptr);
+
+    // the capture thread delivers UDP and the shards TCP, but never two of them to the same proxy at once
+    std::atomic<uint64_t> udp{0};
+    std::atomic<uint64_t> tcp{0};
+    std::atomic<int> delivering{0};
+    std::atomic<bool> overlapped{false};
+    auto deliver = [&](std::atomic<uint64_t> &count) {
+        if (++delivering > 1) {
+            overlapped = true;
+        }
+        ++count;
+        std::this_thread::sleep_for(10us);
+        --delivering;
+    };
+    auto udp_connection = proxy->udp_signal.connect([&](pcpp::Packet &, PacketDirection, pcpp::ProtocolType, uint32_t, timespec) { deliver(udp); });
+    auto tcp_connection = proxy->tcp_message_ready_signal.connect([&](int8_t, const pcpp::TcpStreamData &, PacketDirection) { deliver(tcp); });
+
+    stream.start();
+    std::this_thread::sleep_for(1s);
+    json j;
+    stream.info_json(j);
+    stream.stop();
+
+    CHECK(j["pcap"]["tcp_reassembly_shards"].size() == 2);
+    CHECK(udp > 0);
+    CHECK(tcp > 0);
+    CHECK_FALSE(overlapped);
+    proxy->unregister_tcp_ports("test");
+}
+
+TEST_CASE("Test mock traffic through handler queues", "[pcap][mock]")
+{
+
+    PcapInputStream stream{"pcap-test"};
+    stream.config_set("host_spec", "192.168.0.0/24");
+    stream.config_set("pcap_source", "mock");
+    stream.config_set<uint64_t>("mock_rate", 1000);
+    stream.config_set<uint64_t>("handler_queue_size", 1024);
+    stream.parse_host_spec();
+
+    visor::Config c;
+    auto proxy = static_cast<PcapInputEventProxy *>(stream.add_event_proxy(c));
+    std::atomic<uint64_t> udp{0};
+    auto udp_connection = proxy->udp_signal.connect([&](pcpp::Packet &, PacketDirection, pcpp::ProtocolType, uint32_t, timespec) { ++udp; });
+
+    stream.start();
+    std::this_thread::sleep_for(1s);
+    json j;
+    stream.info_json(j);
+    stream.stop();
+
+    // every packet went through the queue of the proxy, and none was dropped at this rate
+    CHECK(udp > 0);
+    REQUIRE(j["pcap"]["handler_queues"].size() == 1);
+    CHECK(j["pcap"]["handler_queues"][0]["dropped"] == 0);
+}
+
+TEST_CASE("Test dedup reports to queued proxies", "[pcap][mock]")
+{
+
+    PcapInputStream stream{"pcap-test"};
+    stream.config_set("host_spec", "192.168.0.0/24");
+    stream.config_set("pcap_source", "mock");
+    stream.config_set<uint64_t>("mock_rate", 1000);
+    stream.config_set<uint64_t>("mock_duplicate_pct", 50);
+    stream.config_set<uint64_t>("dedup_window_ms", 100);
+    stream.config_set<uint64_t>("handler_queue_size", 1024);
+    stream.parse_host_spec();
+
+    visor::Config c;
+    auto proxy = static_cast<PcapInputEventProxy *>(stream.add_event_proxy(c));
+    std::atomic<uint64_t> udp{0};
+    std::atomic<uint64_t> duplicates{0};
+    auto udp_connection = proxy->udp_signal.connect([&](pcpp::Packet &, PacketDirection, pcpp::ProtocolType, uint32_t, timespec) { ++udp; });
+    auto duplicates_connection = proxy->duplicates_signal.connect([&](uint64_t count, timespec) { duplicates += count; });
+
+    stream.start();
+    // duplicates are reported once a second
+    std::this_thread::sleep_for(2500ms);
+    stream.stop();
+
+    // the copies never reach the handlers, but their count does
+    CHECK(udp > 0);
+    CHECK(duplicates > 0);
+}
+
+TEST_CASE("Test configs that need another source or config", "[pcap][mock]")
+{
+
+    struct Requirement {
+        const char *source;
+        std::vector<std::pair<const char *, std::variant<std::string, uint64_t>>> configs;
+        const char *error;
+    };
+    const std::vector<Requirement> requirements{
+        {"mock", {{"tcp_reassembly_threads", uint64_t{2}}, {"handler_queue_size", uint64_t{1024}}}, "tcp_reassembly_threads is not supported with handler_queue_size"},
+        {"mock", {{"af_packet_workers", uint64_t{4}}}, "af_packet_workers is only supported with pcap_source af_packet"},
+        {"mock", {{"af_packet_timestamp", std::string{"hardware"}}}, "af_packet_timestamp is only supported with pcap_source af_packet"},
+        {"mock", {{"af_xdp_queues", uint64_t{2}}}, "af_xdp_queues is only supported with pcap_source af_xdp"},
+        {"mock", {{"numa_node", std::string{"auto"}}}, "numa_node is only supported with live capture"},
+        {"libpcap", {{"mock_rate", uint64_t{1000}}}, "mock_rate is only supported with pcap_source mock"},
+#ifdef __linux__
+        {"af_packet", {{"af_packet_workers", uint64_t{2}}, {"af_packet_fanout_type", std::string{"lb"}}, {"dedup_window_ms", uint64_t{100}}}, "dedup_window_ms is not supported with af_packet_fanout_type lb, use hash"},
+        {"af_packet", {{"af_packet_workers", uint64_t{2}}, {"af_packet_fanout_type", std::string{"cpu"}}, {"dedup_window_ms", uint64_t{100}}}, "dedup_window_ms is not supported with af_packet_fanout_type cpu, use hash"},
+#endif
+    };
+
+    for (const auto &requirement : requirements) {
+        PcapInputStream stream{"pcap-test"};
+        stream.config_set("pcap_source", requirement.source);
+        for (const auto &[key, value] : requirement.configs) {
+            std::visit([&stream, key = key](const auto &v) { stream.config_set(key, v); }, value);
+        }
+        INFO(requirement.error);
+        CHECK_THROWS_WITH(stream.start(), requirement.error);
+    }
+}
+
+TEST_CASE("Test handler shards follow the capture workers", "[pcap][afpacket]")
+{
+
+    PcapInputStream stream{"pcap-test"};
+    stream.config_set("pcap_source", "af_packet");
+    CHECK(stream.handler_shards() == 1);
+    stream.config_set<uint64_t>("af_packet_workers", 4);
+    CHECK(stream.handler_shards() == 4);
+
+    // each worker delivers to the proxy of its shard only
+    visor::Config filter;
+    auto first = stream.add_event_proxy(filter, std::nullopt, 0);
+    auto second = stream.add_event_proxy(filter, std::nullopt, 1);
+    CHECK(first != second);
+    CHECK(stream.add_event_proxy(filter, std::nullopt, 1) == second);
+    CHECK(stream.add_event_proxy(filter) != first);
+
+    // TCP reassembly threads deliver for every worker, so the handlers are not split between them
+    stream.config_set<uint64_t>("tcp_reassembly_threads", 2);
+    CHECK(stream.handler_shards() == 1);
+}
+
+TEST_CASE("Test numa_node out of range", "[pcap][numa]")
+{
+
+    PcapInputStream stream{"pcap-test"};
+    stream.config_set("pcap_source", "libpcap");
+    stream.config_set("iface", "lo");
+    stream.config_set<uint64_t>("numa_node", 5000);
+
+    CHECK_THROWS_AS(stream.start(), PcapException);
+    CHECK_THROWS_WITH(stream.start(), "numa_node 5000 is out of range, the highest NUMA node is 1023");
+}
+
+TEST_CASE("Test NUMA cpu and node lists", "[pcap][numa]")
+{
+
+    CHECK(visor::numa::parse_list("0-2,8,10-11") == std::vector<uint32_t>{0, 1, 2, 8, 10, 11});
+    CHECK(visor::numa::parse_list("").empty());
+    // anything malformed ends the list
+    CHECK(visor::numa::parse_list("0-1,x,4") == std::vector<uint32_t>{0, 1});
+}
+
+TEST_CASE("Test numa_node auto follows the NIC", "[pcap][numa]")
+{
+
+    auto sysfs = std::filesystem::temp_directory_path() / fmt::format("pktvisor-numa-{}", getpid());
+    std::filesystem::create_directories(sysfs / "class/net/nic0/device");
+    std::filesystem::create_directories(sysfs / "class/net/nic1/device");
+    std::filesystem::create_directories(sysfs / "class/net/veth0");
+    std::ofstream(sysfs / "class/net/nic0/device/numa_node") << "1\n";
+    // what the kernel reports for a NIC on a machine without NUMA
+    std::ofstream(sysfs / "class/net/nic1/device/numa_node") << "-1\n";
+
+    CHECK(visor::numa::interface_node("nic0", sysfs.string()) == 1);
+    CHECK(visor::numa::interface_node("nic1", sysfs.string()) == -1);
+    // virtual interfaces have no device at all
+    CHECK(visor::numa::interface_node("veth0", sysfs.string()) == -1);
+    CHECK(visor::numa::interface_node("missing0", sysfs.string()) == -1);
+
+    std::filesystem::remove_all(sysfs);
+}
+
+TEST_CASE("Test mock traffic generator templates", "[pcap][mock]")
+{
+
+    MockTrafficConfig config;
+    config.qnames = 10;
+    config.qtypes = {{"AAAA", 1}};
+    config.rcodes = {{"NXDOMAIN", 1}};
+    config.tcp_pct = 100;
+    MockTrafficGenerator generator(config);
+
+    std::vector<pcpp::RawPacket> batch;
+    timespec now{1700000000, 0};
+    generator.generate(batch, 10, now);
+
+    // query, response and reset per transaction
+    REQUIRE(batch.size() == 30);
+    for (size_t i = 0; i < batch.size(); i += 3) {
+        pcpp::Packet query(&batch[i]);
+        pcpp::Packet response(&batch[i + 1]);
+        pcpp::Packet reset(&batch[i + 2]);
+        CHECK(query.isPacketOfType(pcpp::TCP));
+        CHECK(reset.getLayerOfType<pcpp::TcpLayer>()->getTcpHeader()->rstFlag == 1);
+        CHECK(response.getRawPacket()->getPacketTimeStamp().tv_sec >= now.tv_sec);
+
+        auto query_payload = query.getLayerOfType<pcpp::TcpLayer>()->getLayerPayload();
+        auto response_payload = response.getLayerOfType<pcpp::TcpLayer>()->getLayerPayload();
+        // skip the dns over tcp length prefix
+        pcpp::DnsLayer query_dns(query_payload + 2, query.getLayerOfType<pcpp::TcpLayer>()->getLayerPayloadSize() - 2, nullptr, &query);
+        pcpp::DnsLayer response_dns(response_payload + 2, response.getLayerOfType<pcpp::TcpLayer>()->getLayerPayloadSize() - 2, nullptr, &response);
+        CHECK(query_dns.getFirstQuery()->getDnsType() == pcpp::DNS_TYPE_AAAA);
+        CHECK(response_dns.getDnsHeader()->queryOrResponse == 1);
+        CHECK(response_dns.getDnsHeader()->responseCode == 3);
+        CHECK(query_dns.getDnsHeader()->transactionID == response_dns.getDnsHeader()->transactionID);
+    }
+
+    config.qtypes = {{"BOGUS", 1}};
+    CHECK_THROWS_WITH(MockTrafficGenerator(config), "unknown mock_qtypes 'BOGUS'");
+}
@@ -0,0 +1,72 @@
+#include "PcapInputStream.h"
+#include <catch2/catch_test_macros.hpp>
+#ifdef __GNUC__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wold-style-cast"
+#endif
+#include <pcapplusplus/IPv4Layer.h>
+#include <pcapplusplus/PacketUtils.h>
+#include <pcapplusplus/UdpLayer.h>
+#ifdef __GNUC__
+#pragma GCC diagnostic pop
+#endif
+
+using namespace visor::input::pcap;
+
+static void add_udp(pcpp::Packet &packet, const char *src, const char *dst)
+{
+    packet.addLayer(new pcpp::IPv4Layer(pcpp::IPv4Address(src), pcpp::IPv4Address(dst)), true);
+    packet.addLayer(new pcpp::UdpLayer(40000, 53), true);
+    packet.computeCalculateFields();
+}
+
+TEST_CASE("Test packet context is shared within a scope", "[pcap][context]")
+{
+
+    std::vector<pcpp::Packet> packets(2);
+    add_udp(packets[0], "10.0.0.1", "192.168.0.1");
+    add_udp(packets[1], "10.0.0.2", "192.168.0.1");
+
+    PacketContext::Scope scope(packets.data(), packets.size());
+    auto &first = PacketContext::of(packets[0]);
+    CHECK(&PacketContext::of(packets[0]) == &first);
+    CHECK(&PacketContext::of(packets[1]) != &first);
+    CHECK(first.flowkey() == pcpp::hash5Tuple(&packets[0]));
+    CHECK(PacketContext::of(packets[1]).flowkey() == pcpp::hash5Tuple(&packets[1]));
+
+    // a disabled database still resolves every address, to nothing
+    visor::geo::MaxmindDB city(visor::geo::MaxmindDB::Type::Geo);
+    CHECK(first.city(city, true) != nullptr);
+    CHECK(first.city(city, true) == first.city(city, true));
+
+    pcpp::Packet no_ip;
+    CHECK(PacketContext::of(no_ip).city(city, true) == nullptr);
+}
+
+TEST_CASE("Test packet context scopes", "[pcap][context]")
+{
+
+    std::vector<pcpp::Packet> packets(1);
+    add_udp(packets[0], "10.0.0.1", "192.168.0.1");
+
+    PacketContext *outer_context;
+    {
+        PacketContext::Scope outer(packets.data(), packets.size());
+        outer_context = &PacketContext::of(packets[0]);
+
+        // a nested scope does not disturb the contexts of the one it is nested in
+        pcpp::Packet inner_packet;
+        add_udp(inner_packet, "10.0.0.3", "192.168.0.1");
+        {
+            PacketContext::Scope inner(&inner_packet, 1);
+            CHECK(&PacketContext::of(inner_packet) != outer_context);
+        }
+        CHECK(&PacketContext::of(packets[0]) == outer_context);
+    }
+
+    // outside of any scope nothing is shared
+    pcpp::Packet unscoped;
+    add_udp(unscoped, "10.0.0.4", "192.168.0.1");
+    CHECK(&PacketContext::of(packets[0]) != outer_context);
+    CHECK(PacketContext::of(unscoped).flowkey() == pcpp::hash5Tuple(&unscoped));
+}
@@ -0,0 +1,95 @@
+#include "PcapInputStream.h"
+#include <catch2/catch_test_macros.hpp>
+
+using namespace visor::input::pcap;
+
+TEST_CASE("Test TCP port set", "[pcap][tcp]")
+{
+
+    TcpPortSet ports;
+    CHECK_FALSE(ports.wants(40000, 53));
+
+    ports.add(TcpPortRanges{53, {8000, 8080}});
+    CHECK(ports.wants(40000, 53));
+    CHECK(ports.wants(53, 40000));
+    CHECK(ports.wants(40000, 8000));
+    CHECK(ports.wants(8080, 40000));
+    CHECK_FALSE(ports.wants(40000, 443));
+
+    // predicates are the fallback for handlers without a port list
+    ports.add([](uint16_t port) { return port == 443; });
+    CHECK(ports.wants(40000, 443));
+
+    TcpPortSet merged;
+    merged.add(ports);
+    CHECK(merged.wants(40000, 8001));
+    CHECK_FALSE(merged.wants(40000, 8081));
+
+    // a null predicate wants every port
+    merged.add(nullptr);
+    CHECK(merged.wants(40000, 8081));
+}
+
+TEST_CASE("Test TCP port registration through chained proxies", "[pcap][tcp]")
+{
+
+    PcapInputStream stream{"pcap-test"};
+    visor::Config c;
+    auto proxy = static_cast<PcapInputEventProxy *>(stream.add_event_proxy(c));
+    auto chained = stream.create_event_proxy(visor::Config());
+    auto chained_proxy = static_cast<PcapInputEventProxy *>(chained.get());
+
+    auto generation = PcapInputEventProxy::tcp_ports_generation();
+    proxy->forward_tcp_ports("net", chained_proxy);
+    chained_proxy->register_tcp_ports("dns", TcpPortRanges{53});
+    CHECK(PcapInputEventProxy::tcp_ports_generation() != generation);
+
+    TcpPortSet ports;
+    proxy->collect_tcp_ports(ports);
+    CHECK(ports.wants(40000, 53));
+    CHECK_FALSE(ports.wants(40000, 443));
+
+    proxy->unregister_tcp_ports("net");
+    TcpPortSet none;
+    proxy->collect_tcp_ports(none);
+    CHECK_FALSE(none.wants(40000, 53));
+}
+
+TEST_CASE("Test BPF registration", "[pcap][bpf]")
+{
+
+    PcapInputStream stream{"pcap-test"};
+    visor::Config c;
+    auto proxy = static_cast<PcapInputEventProxy *>(stream.add_event_proxy(c));
+
+    size_t changes{0};
+    proxy->on_bpf_change([&changes] { ++changes; });
+
+    // policies attach handlers before they start and register
+    proxy->handler_attached("dns");
+    proxy->handler_attached("stats");
+
+    std::set<std::string> expressions;
+    proxy->register_bpf("dns", "port 53");
+    CHECK_FALSE(proxy->collect_bpf(expressions));
+
+    proxy->register_bpf("stats", std::nullopt);
+    CHECK(proxy->collect_bpf(expressions));
+    CHECK(expressions == std::set<std::string>{"port 53"});
+
+    proxy->handler_attached("net");
+    proxy->register_bpf("net", "");
+    CHECK_FALSE(proxy->collect_bpf(expressions));
+
+    proxy->unregister_bpf("net");
+    proxy->handler_detached("net");
+    CHECK(proxy->collect_bpf(expressions));
+
+    // a handler that never says what it consumes may need anything, until it goes
+    proxy->handler_attached("custom");
+    CHECK_FALSE(proxy->collect_bpf(expressions));
+    proxy->handler_detached("custom");
+    CHECK(proxy->collect_bpf(expressions));
+
+    CHECK(changes == 10);
+}
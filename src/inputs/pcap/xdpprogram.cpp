@@ -0,0 +1,194 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#ifdef __linux__
+#include "xdpprogram.h"
+
+#include "PcapException.h"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+#include <net/if.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace visor::input::pcap {
+
+static int sys_bpf(enum bpf_cmd cmd, union bpf_attr *attr)
+{
+    return static_cast<int>(syscall(__NR_bpf, cmd, attr, sizeof(*attr)));
+}
+
+static struct bpf_insn make_insn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm)
+{
+    struct bpf_insn insn {
+    };
+    insn.code = code;
+    insn.dst_reg = dst;
+    insn.src_reg = src;
+    insn.off = off;
+    insn.imm = imm;
+    return insn;
+}
+
+XDPProgram::XDPProgram(std::string interface_name, AFXDPMode mode, bool ip_only, uint32_t queues)
+    : interface(-1)
+    , interface_name(std::move(interface_name))
+    , mode(mode)
+    , ip_only(ip_only)
+    , queues(queues)
+    , map_fd(-1)
+    , prog_fd(-1)
+    , link_fd(-1)
+{
+    interface = static_cast<int>(if_nametoindex(this->interface_name.c_str()));
+    if (interface == 0) {
+        throw PcapException("Failed to get interface index from name '" + this->interface_name + "': " + std::string(strerror(errno)));
+    }
+
+    // kernels before 5.11 charge BPF maps and the UMEM against RLIMIT_MEMLOCK
+    struct rlimit unlimited = {RLIM_INFINITY, RLIM_INFINITY};
+    setrlimit(RLIMIT_MEMLOCK, &unlimited);
+
+    try {
+        create_map();
+        load_program();
+        attach();
+    } catch (...) {
+        close_fds();
+        throw;
+    }
+}
+
+XDPProgram::~XDPProgram()
+{
+    close_fds();
+}
+
+void XDPProgram::close_fds()
+{
+    // closing the link detaches the program from the interface
+    if (link_fd != -1) {
+        close(link_fd);
+        link_fd = -1;
+    }
+    if (prog_fd != -1) {
+        close(prog_fd);
+        prog_fd = -1;
+    }
+    if (map_fd != -1) {
+        close(map_fd);
+        map_fd = -1;
+    }
+}
+
+void XDPProgram::create_map()
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(uint32_t);
+    attr.value_size = sizeof(int);
+    attr.max_entries = queues;
+    strncpy(attr.map_name, "pktvisor_xsks", BPF_OBJ_NAME_LEN - 1);
+
+    map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    if (map_fd < 0) {
+        throw PcapException("Failed to create XSKMAP for AF_XDP: " + std::string(strerror(errno)));
+    }
+}
+
+void XDPProgram::load_program()
+{
+    // hand assembled so there is no dependency on clang or libbpf. with ip_only, only IPv4, IPv6 and VLAN tagged
+    // frames are redirected, everything else goes on to the kernel stack and never reaches userspace:
+    //
+    //   r6 = ctx
+    //   if (data + ETH_HLEN > data_end) goto pass
+    //   r4 = eth->h_proto
+    //   if (r4 == IP || r4 == IPV6 || r4 == 8021Q || r4 == 8021AD) goto redirect
+    // pass:
+    //   return XDP_PASS
+    // redirect:
+    //   return bpf_redirect_map(&xsks, ctx->rx_queue_index, XDP_PASS)
+    //
+    // the XDP_PASS flag to bpf_redirect_map is the action for queues without a bound socket (kernel 5.3+)
+    std::vector<struct bpf_insn> insns;
+    insns.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0));
+    if (ip_only) {
+        // the h_proto load is in host order, so compare against network order constants
+        insns.push_back(make_insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, data), 0));
+        insns.push_back(make_insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_3, BPF_REG_6, offsetof(struct xdp_md, data_end), 0));
+        insns.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0));
+        insns.push_back(make_insn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, ETH_HLEN));
+        insns.push_back(make_insn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, 5, 0));
+        insns.push_back(make_insn(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_4, BPF_REG_2, offsetof(struct ethhdr, h_proto), 0));
+        insns.push_back(make_insn(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_4, 0, 5, htons(ETH_P_IP)));
+        insns.push_back(make_insn(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_4, 0, 4, htons(ETH_P_IPV6)));
+        insns.push_back(make_insn(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_4, 0, 3, htons(ETH_P_8021Q)));
+        insns.push_back(make_insn(BPF_JMP | BPF_JEQ | BPF_K, BPF_REG_4, 0, 2, htons(ETH_P_8021AD)));
+        insns.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS));
+        insns.push_back(make_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+    }
+    insns.push_back(make_insn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index), 0));
+    // 64 bit immediate load of the map fd, takes two instructions
+    insns.push_back(make_insn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd));
+    insns.push_back(make_insn(0, 0, 0, 0, 0));
+    insns.push_back(make_insn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS));
+    insns.push_back(make_insn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+    insns.push_back(make_insn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+    static const char license[] = "Dual MPL/GPL";
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(insns.data()));
+    attr.insn_cnt = static_cast<uint32_t>(insns.size());
+    attr.license = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(license));
+    strncpy(attr.prog_name, "pktvisor_xsk", BPF_OBJ_NAME_LEN - 1);
+
+    prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+    if (prog_fd < 0) {
+        throw PcapException("Failed to load XDP program for AF_XDP: " + std::string(strerror(errno)));
+    }
+}
+
+void XDPProgram::attach()
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = static_cast<uint32_t>(prog_fd);
+    attr.link_create.target_ifindex = static_cast<uint32_t>(interface);
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = (mode == AFXDPMode::native) ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+
+    link_fd = sys_bpf(BPF_LINK_CREATE, &attr);
+    if (link_fd < 0) {
+        throw PcapException("Failed to attach XDP program to interface '" + interface_name + "': " + std::string(strerror(errno)));
+    }
+}
+
+void XDPProgram::register_socket(uint32_t queue_id, int xsk_fd)
+{
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = static_cast<uint32_t>(map_fd);
+    attr.key = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(&queue_id));
+    attr.value = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(&xsk_fd));
+    attr.flags = BPF_ANY;
+
+    if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0) {
+        throw PcapException("Failed to register AF_XDP socket for queue " + std::to_string(queue_id) + ": " + std::string(strerror(errno)));
+    }
+}
+
+}
+#endif
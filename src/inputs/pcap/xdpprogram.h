@@ -0,0 +1,54 @@
+/* This Source Code Form is subject to the terms of the Mozilla Public
+ * License, v. 2.0. If a copy of the MPL was not distributed with this
+ * file, You can obtain one at https://mozilla.org/MPL/2.0/. */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace visor::input::pcap {
+
+enum class AFXDPMode {
+    generic, // XDP_FLAGS_SKB_MODE, works with any driver (including veth) but copies every frame
+    native   // XDP_FLAGS_DRV_MODE, runs in the driver and uses zero copy when the driver supports it
+};
+
+// the XDP program attached to an interface, redirecting frames of every bound queue into its AF_XDP socket.
+// shared by all AFXDP sockets on the interface and detached when the last of them is gone.
+// kept apart from afxdp.h since linux/bpf.h and pcap/bpf.h can not be included in the same translation unit
+class XDPProgram final
+{
+    int interface;
+    std::string interface_name;
+    AFXDPMode mode;
+    bool ip_only;
+    uint32_t queues;
+
+    int map_fd;
+    int prog_fd;
+    int link_fd;
+
+    void create_map();
+    void load_program();
+    void attach();
+    void close_fds();
+
+public:
+    XDPProgram(std::string interface_name, AFXDPMode mode, bool ip_only, uint32_t queues);
+    ~XDPProgram();
+
+    void register_socket(uint32_t queue_id, int xsk_fd);
+
+    int if_index() const
+    {
+        return interface;
+    }
+
+    AFXDPMode xdp_mode() const
+    {
+        return mode;
+    }
+};
+
+}
@@ -43,7 +43,7 @@ public:
     {
         j["window"] = "single";
     }
-    void window_single_prometheus(std::stringstream &out, uint64_t period, Metric::LabelMap) const
+    void window_single_prometheus(std::stringstream &out, uint64_t period, Metric::LabelMap, const std::string & = {}) const
     {
         if (period) {
             out << "first_window";
@@ -51,7 +51,7 @@ public:
             out << "live_window";
         }
     }
-    void window_single_opentelemetry(metrics::v1::ScopeMetrics &scope, uint64_t period, Metric::LabelMap) const
+    void window_single_opentelemetry(metrics::v1::ScopeMetrics &scope, uint64_t period, Metric::LabelMap, const std::string & = {}) const
     {
         if (period) {
             scope.add_metrics()->set_name("first_window");
@@ -59,11 +59,11 @@ public:
             scope.add_metrics()->set_name("live_window");
         }
     }
-    void window_external_opentelemetry(metrics::v1::ScopeMetrics &scope, AbstractMetricsBucket *, Metric::LabelMap) const
+    void window_external_opentelemetry(metrics::v1::ScopeMetrics &scope, AbstractMetricsBucket *, Metric::LabelMap, const std::string & = {}) const
     {
         scope.add_metrics()->set_name("external_window");
     }
-    void window_external_prometheus(std::stringstream &out, AbstractMetricsBucket *, Metric::LabelMap) const
+    void window_external_prometheus(std::stringstream &out, AbstractMetricsBucket *, Metric::LabelMap, const std::string & = {}) const
     {
         out << "external_window";
     }
@@ -35,6 +35,17 @@ public:
     TestMetricsManager(const Configurable *windowConfig)
         : AbstractMetricsManager(windowConfig){};
     ~TestMetricsManager() = default;
+
+    void process_event(timespec stamp)
+    {
+        new_event(stamp);
+    }
+
+    bool process_flow_event(timespec stamp, uint32_t flow_key)
+    {
+        new_flow_event(stamp, flow_key);
+        return _deep_sampling_now;
+    }
 };
 
 TEST_CASE("Abstract metrics manager", "[metrics][abstract]")
@@ -129,6 +140,73 @@ TEST_CASE("Abstract metrics manager", "[metrics][abstract]")
     }
 }
 
+TEST_CASE("Adaptive deep sample rate", "[metrics][abstract]")
+{
+    json j;
+    visor::Config c;
+    c.config_set<uint64_t>("num_periods", 1);
+    c.config_set<uint64_t>("deep_sample_rate", 80);
+    c.config_set<uint64_t>("deep_sample_rate_min", 10);
+    auto manager = std::make_unique<TestMetricsManager>(&c);
+
+    SECTION("Starts at the maximum")
+    {
+        CHECK(manager->deep_sample_rate() == 80);
+        CHECK(manager->deep_sample_rate_bounds() == std::make_pair(10U, 80U));
+    }
+
+    SECTION("Backs off under load and recovers")
+    {
+        manager->adapt_deep_sample_rate(100);
+        CHECK(manager->deep_sample_rate() == 40);
+        manager->adapt_deep_sample_rate(80);
+        manager->adapt_deep_sample_rate(100);
+        manager->adapt_deep_sample_rate(100);
+        CHECK(manager->deep_sample_rate() == 10);
+        manager->adapt_deep_sample_rate(50);
+        CHECK(manager->deep_sample_rate() == 10);
+        manager->adapt_deep_sample_rate(0);
+        CHECK(manager->deep_sample_rate() == 15);
+        for (int i = 0; i < 100; ++i) {
+            manager->adapt_deep_sample_rate(0);
+        }
+        CHECK(manager->deep_sample_rate() == 80);
+    }
+
+    SECTION("Fixed rate does not adapt")
+    {
+        visor::Config fixed;
+        fixed.config_set<uint64_t>("deep_sample_rate", 50);
+        auto fixed_manager = std::make_unique<TestMetricsManager>(&fixed);
+        fixed_manager->adapt_deep_sample_rate(100);
+        CHECK(fixed_manager->deep_sample_rate() == 50);
+    }
+
+    SECTION("Minimum above maximum")
+    {
+        c.config_set<uint64_t>("deep_sample_rate_min", 90);
+        auto clamped = std::make_unique<TestMetricsManager>(&c);
+        CHECK(clamped->deep_sample_rate_bounds() == std::make_pair(80U, 80U));
+    }
+
+    SECTION("Effective rate in window")
+    {
+        manager->window_single_json(j, "metrics");
+        CHECK(j["metrics"]["period"]["deep_sample_rate"] == 100.0);
+
+        manager->adapt_deep_sample_rate(100);
+        manager->adapt_deep_sample_rate(100);
+        manager->adapt_deep_sample_rate(100);
+        timespec stamp{0, 0};
+        for (int i = 0; i < 10000; ++i) {
+            manager->process_event(stamp);
+        }
+        manager->window_single_json(j, "metrics");
+        CHECK(j["metrics"]["period"]["deep_sample_rate"] > 5.0);
+        CHECK(j["metrics"]["period"]["deep_sample_rate"] < 15.0);
+    }
+}
+
 TEST_CASE("Counter metrics", "[metrics][counter]")
 {
     Metric::add_static_label("instance", "test instance");
@@ -169,6 +247,22 @@ TEST_CASE("Counter metrics", "[metrics][counter]")
         CHECK(line == R"(root_test_metric{instance="test instance",policy="default"} 1)");
     }
 
+    SECTION("Counter prometheus with name prefix")
+    {
+        ++c;
+        {
+            Metric::NamePrefix prefix("partition_");
+            c.to_prometheus(output, {{"policy", "default"}});
+        }
+        std::getline(output, line);
+        CHECK(line == "# HELP root_partition_test_metric A counter test metric");
+        std::getline(output, line);
+        CHECK(line == "# TYPE root_partition_test_metric gauge");
+        std::getline(output, line);
+        CHECK(line == R"(root_partition_test_metric{instance="test instance",policy="default"} 1)");
+        CHECK(c.base_name_snake() == "root_test_metric");
+    }
+
     SECTION("Counter opentelemetry")
     {
         ++c;
@@ -584,3 +678,44 @@ TEST_CASE("Rate metrics", "[metrics][rate]")
         r.to_opentelemetry(scope, stamp, stamp, {{"policy", "default"}});
     }
 }
+
+TEST_CASE("Flow consistent deep sampling", "[metrics][abstract]")
+{
+    visor::Config c;
+    c.config_set<uint64_t>("num_periods", 1);
+    c.config_set<uint64_t>("deep_sample_rate", 10);
+    c.config_set("deep_sample_mode", "flow");
+    auto manager = std::make_unique<TestMetricsManager>(&c);
+    CHECK(manager->flow_sampling());
+
+    SECTION("Every event of a flow gets the same decision")
+    {
+        timespec stamp{0, 0};
+        unsigned int sampled{0};
+        for (uint32_t key = 0; key < 10000; ++key) {
+            auto first = manager->process_flow_event(stamp, key);
+            CHECK(manager->process_flow_event(stamp, key) == first);
+            sampled += first;
+        }
+        CHECK(sampled > 500);
+        CHECK(sampled < 1500);
+    }
+
+    SECTION("Lowering the rate only drops flows")
+    {
+        c.config_set<uint64_t>("deep_sample_rate", 5);
+        auto lower = std::make_unique<TestMetricsManager>(&c);
+        timespec stamp{0, 0};
+        for (uint32_t key = 0; key < 1000; ++key) {
+            if (lower->process_flow_event(stamp, key)) {
+                CHECK(manager->process_flow_event(stamp, key));
+            }
+        }
+    }
+
+    SECTION("Invalid mode")
+    {
+        c.config_set("deep_sample_mode", "sometimes");
+        CHECK_THROWS_WITH(std::make_unique<TestMetricsManager>(&c), "invalid deep_sample_mode 'sometimes', valid modes are: random, flow");
+    }
+}
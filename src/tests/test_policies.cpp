@@ -76,6 +76,33 @@ visor:
                 - "slack.com"
 )";
 
+auto policies_config_reload = R"(
+version: "1.0"
+
+visor:
+  policies:
+    default_view:
+      kind: collection
+      input:
+        tap: anycast
+        input_type: mock
+        config:
+          sample: value
+          bpf: "tcp or udp"
+      handlers:
+        window_config:
+          num_periods: 5
+          deep_sample_rate: 100
+        modules:
+          default_net:
+            type: net
+          special_domain:
+            type: dns
+            filter:
+              only_qname_suffix:
+                - ".ns1.com"
+)";
+
 auto policies_config_merge = R"(
 visor:
   taps:
@@ -564,6 +591,52 @@ visor:
             type: net
 )";
 
+auto policies_config_bad15 = R"(
+version: "1.0"
+
+visor:
+  taps:
+    anycast:
+      input_type: mock
+      config:
+        iface: eth0
+  policies:
+    default_view:
+      config:
+        handler_queue_size: 1
+      kind: collection
+      input:
+        tap: anycast
+        input_type: mock
+      handlers:
+        modules:
+           default_net:
+            type: net
+)";
+
+auto policies_config_bad16 = R"(
+version: "1.0"
+
+visor:
+  taps:
+    anycast:
+      input_type: mock
+      config:
+        iface: eth0
+  policies:
+    default_view:
+      config:
+        cpu_affinity: [0]
+      kind: collection
+      input:
+        tap: anycast
+        input_type: mock
+      handlers:
+        modules:
+           default_net:
+            type: net
+)";
+
 auto policies_config_hseq_bad2 = R"(
 version: "1.0"
 
@@ -1084,6 +1157,18 @@ TEST_CASE("Policies", "[policies]")
         REQUIRE_THROWS_WITH(registry.handler_manager()->set_default_handler_config(config_file["visor"]["global_handler_config"]), "expecting global_handler_config configuration map");
     }
 
+    SECTION("Bad Config: merge_like_handlers with partition_by")
+    {
+        CoreRegistry registry;
+        registry.start(nullptr);
+        YAML::Node config_file = YAML::Load(policies_config_merge);
+        config_file["visor"]["policies"]["default_merge"]["handlers"]["modules"]["default_dns_2"]["config"]["partition_by"] = "vlan";
+
+        REQUIRE_NOTHROW(registry.tap_manager()->load(config_file["visor"]["taps"], true));
+        REQUIRE_THROWS_WITH(registry.policy_manager()->load(config_file["visor"]["policies"]), "policy [default_merge] failed to start: merge_like_handlers is not supported with partition_by, which handler default_merge-anycast_merge-default_dns_2 has");
+        CHECK(!registry.policy_manager()->module_exists("default_merge"));
+    }
+
     SECTION("Bad Config: policy config not a map")
     {
         CoreRegistry registry;
@@ -1094,6 +1179,27 @@ TEST_CASE("Policies", "[policies]")
         REQUIRE_THROWS_WITH(registry.policy_manager()->load(config_file["visor"]["policies"]), "policy configuration is not a map");
     }
 
+    SECTION("Bad Config: invalid handler_queue_size")
+    {
+        CoreRegistry registry;
+        registry.start(nullptr);
+        YAML::Node config_file = YAML::Load(policies_config_bad15);
+
+        REQUIRE_NOTHROW(registry.tap_manager()->load(config_file["visor"]["taps"], true));
+        REQUIRE_THROWS_WITH(registry.policy_manager()->load(config_file["visor"]["policies"]), "invalid handler thread config for policy 'default_view': handler_queue_size must be between 2 and 1048576");
+    }
+
+    SECTION("Bad Config: handler thread on input without support")
+    {
+        CoreRegistry registry;
+        registry.start(nullptr);
+        YAML::Node config_file = YAML::Load(policies_config_bad16);
+
+        REQUIRE_NOTHROW(registry.tap_manager()->load(config_file["visor"]["taps"], true));
+        REQUIRE_THROWS_WITH(registry.policy_manager()->load(config_file["visor"]["policies"]), "input mock does not support handler threads (handler_queue_size, cpu_affinity)");
+        REQUIRE(!registry.policy_manager()->module_exists("default_view"));
+    }
+
     SECTION("Bad Config: invalid handler modules YAML type")
     {
         CoreRegistry registry;
@@ -1316,6 +1422,99 @@ TEST_CASE("Policies", "[policies]")
         CHECK(policy2->input_stream().back()->name() == policy->input_stream().back()->name());
         lock2.unlock();
     }
+
+    SECTION("Good Config, policies with identical handlers share them")
+    {
+        CoreRegistry registry;
+        registry.start(nullptr);
+        YAML::Node config_file = YAML::Load(policies_config);
+        YAML::Node config_file2 = YAML::Load(policies_config_same_input);
+
+        REQUIRE_NOTHROW(registry.tap_manager()->load(config_file["visor"]["taps"], true));
+        REQUIRE_NOTHROW(registry.policy_manager()->load(config_file["visor"]["policies"]));
+        REQUIRE_NOTHROW(registry.policy_manager()->load(config_file2["visor"]["policies"]));
+
+        auto [policy, lock] = registry.policy_manager()->module_get_locked("default_view");
+        auto shared = policy->modules()[0];
+        CHECK(shared->name() == "default_view-anycast-default_net");
+        CHECK(policy->module_name(shared) == "default_view-anycast-default_net");
+        lock.unlock();
+        auto [policy2, lock2] = registry.policy_manager()->module_get_locked("same_input");
+        CHECK(policy2->modules()[0] == shared);
+        CHECK(policy2->module_name(shared) == "same_input-anycast-net");
+        lock2.unlock();
+        CHECK(!registry.handler_manager()->module_exists("same_input-anycast-net"));
+
+        // the handler outlives the policy that created it while another one uses it
+        REQUIRE_NOTHROW(registry.policy_manager()->remove_policy("default_view"));
+        REQUIRE(registry.handler_manager()->module_exists("default_view-anycast-default_net"));
+        CHECK(shared->running());
+        CHECK(!registry.handler_manager()->module_exists("default_view-anycast-default_dns"));
+
+        // loading it again shares the handler once more
+        REQUIRE_NOTHROW(registry.policy_manager()->load(config_file["visor"]["policies"]));
+        auto [new_policy, new_lock] = registry.policy_manager()->module_get_locked("default_view");
+        CHECK(new_policy->modules()[0] == shared);
+        new_lock.unlock();
+
+        REQUIRE_NOTHROW(registry.policy_manager()->remove_policy("same_input"));
+        REQUIRE_NOTHROW(registry.policy_manager()->remove_policy("default_view"));
+        CHECK(!registry.handler_manager()->module_exists("default_view-anycast-default_net"));
+    }
+
+    SECTION("Good Config, reload handlers in place")
+    {
+        CoreRegistry registry;
+        registry.start(nullptr);
+        YAML::Node config_file = YAML::Load(policies_config);
+
+        REQUIRE_NOTHROW(registry.tap_manager()->load(config_file["visor"]["taps"], true));
+        REQUIRE_NOTHROW(registry.policy_manager()->load(config_file["visor"]["policies"]));
+
+        auto [policy, lock] = registry.policy_manager()->module_get_locked("default_view");
+        auto input = policy->input_stream().back();
+        auto input_name = input->name();
+        auto net = policy->modules()[0];
+        auto special_domain = policy->modules()[2];
+        lock.unlock();
+
+        Policy *reloaded{nullptr};
+        REQUIRE_NOTHROW(reloaded = registry.policy_manager()->reload_from_str("default_view", policies_config_reload));
+        CHECK(reloaded == policy);
+        CHECK(input->running());
+        CHECK(reloaded->input_stream().back() == input);
+        REQUIRE(reloaded->modules().size() == 2);
+        // unchanged, so the same instance with its metrics
+        CHECK(reloaded->modules()[0] == net);
+        CHECK(net->running());
+        // changed, so a new instance under the same name
+        CHECK(reloaded->modules()[1] != special_domain);
+        CHECK(reloaded->modules()[1]->running());
+        CHECK(reloaded->module_name(reloaded->modules()[1]) == "default_view-anycast-special_domain");
+        CHECK(!registry.handler_manager()->module_exists("default_view-anycast-default_dns"));
+        CHECK(!registry.handler_manager()->module_exists("default_view-anycast-special_domain"));
+        CHECK(registry.handler_manager()->module_exists("default_view-anycast-special_domain-2"));
+
+        REQUIRE_THROWS_WITH(registry.policy_manager()->reload_from_str("other_view", policies_config_reload), "policy 'default_view' does not match the policy to reload: other_view");
+
+        // a changed input applies the policy again
+        YAML::Node reload_file = YAML::Load(policies_config_reload);
+        reload_file["visor"]["policies"]["default_view"]["input"]["config"]["sample"] = "other";
+        REQUIRE_NOTHROW(reloaded = registry.policy_manager()->reload("default_view", reload_file["visor"]["policies"]));
+        CHECK(reloaded->input_stream().back()->name() != input_name);
+        CHECK(reloaded->modules()[0]->running());
+
+        // one that fails to apply leaves the previous definition in place
+        reload_file["visor"]["policies"]["default_view"]["input"]["config"]["sample"] = "third";
+        reload_file["visor"]["policies"]["default_view"]["handlers"]["modules"]["default_net"]["type"] = "missing";
+        REQUIRE_THROWS(registry.policy_manager()->reload("default_view", reload_file["visor"]["policies"]));
+        auto [restored, restored_lock] = registry.policy_manager()->module_get_locked("default_view");
+        CHECK(restored->definition()["input"]["config"]["sample"].as<std::string>() == "other");
+        REQUIRE(restored->modules().size() == 2);
+        CHECK(restored->modules()[0]->running());
+        restored_lock.unlock();
+        REQUIRE_NOTHROW(registry.policy_manager()->remove_policy("default_view"));
+    }
 }
 
 TEST_CASE("Policies and Metrics", "[policies][metrics]")
@@ -1382,4 +1581,29 @@ TEST_CASE("Policies and Metrics", "[policies][metrics]")
         metrics::v1::ScopeMetrics scope;
         REQUIRE_NOTHROW(policy->opentelemetry_metrics(scope));
     }
-}
\ No newline at end of file
+}
+TEST_CASE("Handler configs that read the same are told apart", "[policies]")
+{
+    // joined without separators these would all read "abc"
+    Config a;
+    a.config_set<std::string>("a", "bc");
+    Config ab;
+    ab.config_set<std::string>("ab", "c");
+    Config list;
+    list.config_set<Configurable::StringList>("a", {"b", "c"});
+    CHECK(a.config_signature() != ab.config_signature());
+    CHECK(a.config_signature() != list.config_signature());
+    CHECK(a.config_hash() != ab.config_hash());
+
+    // a number and a string holding it differ too
+    Config number;
+    number.config_set<uint64_t>("port", 53);
+    Config text;
+    text.config_set<std::string>("port", "53");
+    CHECK(number.config_signature() != text.config_signature());
+
+    Config same;
+    same.config_set<std::string>("a", "bc");
+    CHECK(a.config_signature() == same.config_signature());
+    CHECK(a.config_hash() == same.config_hash());
+}